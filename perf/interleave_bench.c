@@ -0,0 +1,433 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2023-2026 Micron Technology, Inc.  All rights reserved.
+ */
+
+/* interleave_bench.c
+ * Usage: interleave_bench [options] <file> [<file> ...]
+ *
+ * Measures how bandwidth to an interleaved famfs file depends on the strips
+ * (and the allocation buckets the strips live in) that are being accessed.
+ *
+ * The interleave geometry (nstrips, chunk_size, strip device offsets) is read
+ * from 'famfs getmap <file>' output. On mounts where getmap cannot return
+ * the map (e.g. famfs-fuse), pass the geometry with -n and -c instead. A
+ * file that is not interleaved is treated as a single strip.
+ *
+ * File offset -> strip mapping (as in famfs): chunk = off / chunk_size,
+ * strip = chunk % nstrips.
+ *
+ * For each file:
+ *  1) INTERLEAVE_STRIP:  all threads access only the chunks of one strip,
+ *                        for each strip in turn -> bandwidth per strip
+ *  2) INTERLEAVE_BUCKET: all threads access the chunks of the strips that
+ *                        live in one bucket (-b), for each bucket in turn
+ *  3) INTERLEAVE_SCALE:  all threads access strips [0, k) for k = 1, 2, 4,
+ *                        ... nstrips -> aggregate scaling vs. active strips
+ * Running it over files created with different .alloc.cfg settings gives
+ * scaling vs. nstrips and chunk_size; both are printed on every line.
+ *
+ * Options:
+ *   -t <threads>     Worker threads (default 1)
+ *   -d <secs>        Seconds per measurement (default 5)
+ *   -w               Write (store) instead of read
+ *   -n <nstrips>     Override nstrips
+ *   -c <chunk_size>  Override chunk size (accepts K/M/G)
+ *   -b <bucket_size> Bucket size for INTERLEAVE_BUCKET (accepts K/M/G)
+ *   -F <famfs_bin>   famfs cli used for getmap (default: $FAMFS_BIN or famfs)
+ *
+ * Build: gcc -O2 -Wall -Wextra -pthread -o interleave_bench interleave_bench.c
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <time.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define MAX_STRIPS 64
+#define MAX_THREADS 256
+
+struct geometry {
+	size_t nstrips;
+	size_t chunk_size;
+	uint64_t strip_devoff[MAX_STRIPS]; /* 0 if unknown */
+	int have_devoff;
+};
+
+struct run {
+	char *map;
+	size_t filesize;
+	const struct geometry *geo;
+	const size_t *sel;      /* selected strips */
+	size_t nsel;
+	size_t nord;            /* chunk ordinals per pass over sel */
+	int write;
+	double duration;
+	struct timespec start;
+};
+
+struct worker {
+	pthread_t tid;
+	struct run *run;
+	unsigned int id;
+	unsigned int nthreads;
+	unsigned long long bytes;
+	unsigned long sink;
+};
+
+static double elapsed_sec(struct timespec a, struct timespec b)
+{
+	return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+}
+
+static int timespec_now(struct timespec *ts)
+{
+	if (clock_gettime(CLOCK_MONOTONIC, ts) != 0)
+		return -1;
+	return 0;
+}
+
+static size_t parse_size(const char *s)
+{
+	// Accepts "K", "M", "G"
+	char *end = NULL;
+	double val = strtod(s, &end);
+
+	if (end == s)
+		return 0;
+	size_t mult = 1;
+	if (*end) {
+		char c = toupper((unsigned char)*end);
+		if (c == 'K')
+			mult = 1024ULL;
+		else if (c == 'M')
+			mult = 1024ULL * 1024ULL;
+		else if (c == 'G')
+			mult = 1024ULL * 1024ULL * 1024ULL;
+		else
+			return 0;
+	}
+	double bytes_d = val * (double)mult;
+	if (bytes_d <= 0.0)
+		return 0;
+	return (size_t)bytes_d;
+}
+
+/* Parse 'famfs getmap' output. Returns 0 if an interleaved map was found */
+static int getmap_geometry(const char *famfs_bin, const char *path,
+			   struct geometry *geo)
+{
+	char cmd[8192];
+	char line[512];
+	int in_strips = 0;
+	size_t nstrips = 0;
+	size_t strip = 0;
+	FILE *fp;
+
+	snprintf(cmd, sizeof(cmd), "%s getmap '%s' 2>/dev/null",
+		 famfs_bin, path);
+	fp = popen(cmd, "r");
+	if (!fp)
+		return -1;
+
+	while (fgets(line, sizeof(line), fp)) {
+		unsigned long long a, b;
+
+		if (sscanf(line, "Interleave_Param chunk_size: %llu", &a) == 1) {
+			geo->chunk_size = a;
+		} else if (sscanf(line, "Interleaved extent has %llu strips", &a) == 1) {
+			nstrips = a;
+			in_strips = 1;
+		} else if (in_strips && strip < MAX_STRIPS &&
+			   sscanf(line, " %llx %llu", &a, &b) == 2) {
+			geo->strip_devoff[strip++] = a;
+		}
+	}
+	pclose(fp);
+
+	if (!nstrips || !geo->chunk_size)
+		return -1;
+	geo->nstrips = nstrips;
+	geo->have_devoff = (strip == nstrips);
+	return 0;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	struct run *r = w->run;
+	const struct geometry *geo = r->geo;
+	size_t cs = geo->chunk_size;
+	struct timespec now;
+	size_t ord = w->id;
+
+	for (;;) {
+		/* Chunk ordinals are dealt round-robin to the threads */
+		size_t stripe = ord / r->nsel;
+		size_t chunk = stripe * geo->nstrips + r->sel[ord % r->nsel];
+		char *p = r->map + chunk * cs;
+
+		if (r->write) {
+			memset(p, (int)ord, cs);
+		} else {
+			const uint64_t *q = (const uint64_t *)p;
+			uint64_t sum = 0;
+
+			for (size_t i = 0; i < cs / sizeof(*q); i++)
+				sum += q[i];
+			w->sink += sum;
+		}
+		w->bytes += cs;
+
+		ord += w->nthreads;
+		if (ord >= r->nord)
+			ord = w->id % r->nord;
+
+		timespec_now(&now);
+		if (elapsed_sec(r->start, now) >= r->duration)
+			break;
+	}
+	return NULL;
+}
+
+/* Run one measurement over the strips in sel; returns MiB/s */
+static double run_strips(struct run *r, const size_t *sel, size_t nsel,
+			 unsigned int nthreads, double *secs)
+{
+	const struct geometry *geo = r->geo;
+	size_t nstripes = r->filesize / (geo->chunk_size * geo->nstrips);
+	struct worker w[MAX_THREADS];
+	unsigned long long bytes = 0;
+	struct timespec end;
+
+	r->sel = sel;
+	r->nsel = nsel;
+	r->nord = nstripes * nsel;
+	*secs = 0.0;
+	if (r->nord == 0)
+		return 0.0;
+	if (nthreads > r->nord)
+		nthreads = r->nord;
+
+	timespec_now(&r->start);
+	for (unsigned int i = 0; i < nthreads; i++) {
+		memset(&w[i], 0, sizeof(w[i]));
+		w[i].run = r;
+		w[i].id = i;
+		w[i].nthreads = nthreads;
+		if (pthread_create(&w[i].tid, NULL, worker_fn, &w[i]) != 0) {
+			perror("pthread_create");
+			exit(2);
+		}
+	}
+	for (unsigned int i = 0; i < nthreads; i++) {
+		pthread_join(w[i].tid, NULL);
+		bytes += w[i].bytes;
+	}
+	timespec_now(&end);
+
+	*secs = elapsed_sec(r->start, end);
+	return (bytes / 1024.0 / 1024.0) / *secs;
+}
+
+static int bench_file(const char *path, struct geometry *geo,
+		      size_t bucket_size, unsigned int nthreads,
+		      double duration, int write)
+{
+	const char *op = write ? "write" : "read";
+	size_t sel[MAX_STRIPS];
+	struct run r = { 0 };
+	struct stat st;
+	double mbps, secs;
+	int fd;
+
+	fd = open(path, write ? O_RDWR : O_RDONLY);
+	if (fd < 0) {
+		perror("open");
+		fprintf(stderr, "Cannot open %s\n", path);
+		return -1;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		fprintf(stderr, "Cannot use %s (stat failed or empty)\n", path);
+		close(fd);
+		return -1;
+	}
+	if ((size_t)st.st_size < geo->chunk_size * geo->nstrips) {
+		fprintf(stderr, "%s is smaller than one stripe (%zu bytes)\n",
+			path, geo->chunk_size * geo->nstrips);
+		close(fd);
+		return -1;
+	}
+
+	r.filesize = st.st_size;
+	r.map = mmap(NULL, r.filesize, write ? PROT_READ | PROT_WRITE : PROT_READ,
+		     MAP_SHARED, fd, 0);
+	if (r.map == MAP_FAILED) {
+		perror("mmap");
+		close(fd);
+		return -1;
+	}
+	r.geo = geo;
+	r.write = write;
+	r.duration = duration;
+
+	printf("INTERLEAVE_BENCH_BEGIN, file=%s, size_bytes=%zu, nstrips=%zu, "
+	       "chunk_size=%zu, threads=%u, op=%s\n", path, r.filesize,
+	       geo->nstrips, geo->chunk_size, nthreads, op);
+
+	/* 1) Per strip */
+	for (size_t s = 0; s < geo->nstrips; s++) {
+		sel[0] = s;
+		mbps = run_strips(&r, sel, 1, nthreads, &secs);
+		printf("INTERLEAVE_STRIP, nstrips=%zu, chunk_size=%zu, strip=%zu, "
+		       "devoff=0x%llx, threads=%u, op=%s, elapsed=%.3f sec, "
+		       "throughput=%.2f MiB/s\n", geo->nstrips, geo->chunk_size, s,
+		       (unsigned long long)geo->strip_devoff[s], nthreads, op,
+		       secs, mbps);
+	}
+
+	/* 2) Per bucket */
+	if (bucket_size && geo->have_devoff) {
+		uint64_t done[MAX_STRIPS] = { 0 };
+
+		for (size_t s = 0; s < geo->nstrips; s++) {
+			uint64_t bucket = geo->strip_devoff[s] / bucket_size;
+			size_t nsel = 0;
+
+			if (done[s])
+				continue;
+			for (size_t t = s; t < geo->nstrips; t++) {
+				if (geo->strip_devoff[t] / bucket_size == bucket) {
+					sel[nsel++] = t;
+					done[t] = 1;
+				}
+			}
+			mbps = run_strips(&r, sel, nsel, nthreads, &secs);
+			printf("INTERLEAVE_BUCKET, nstrips=%zu, chunk_size=%zu, "
+			       "bucket=%llu, bucket_strips=%zu, threads=%u, op=%s, "
+			       "elapsed=%.3f sec, throughput=%.2f MiB/s\n",
+			       geo->nstrips, geo->chunk_size,
+			       (unsigned long long)bucket, nsel, nthreads, op,
+			       secs, mbps);
+		}
+	}
+
+	/* 3) Scaling vs. number of active strips */
+	for (size_t k = 1; ; k = (k * 2 > geo->nstrips) ? geo->nstrips : k * 2) {
+		for (size_t s = 0; s < k; s++)
+			sel[s] = s;
+		mbps = run_strips(&r, sel, k, nthreads, &secs);
+		printf("INTERLEAVE_SCALE, nstrips=%zu, chunk_size=%zu, "
+		       "active_strips=%zu, threads=%u, op=%s, elapsed=%.3f sec, "
+		       "throughput=%.2f MiB/s\n", geo->nstrips, geo->chunk_size,
+		       k, nthreads, op, secs, mbps);
+		if (k == geo->nstrips)
+			break;
+	}
+
+	printf("INTERLEAVE_BENCH_END, file=%s\n", path);
+	munmap(r.map, r.filesize);
+	close(fd);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-t threads] [-d secs] [-w] [-n nstrips] [-c chunk_size]\n"
+		"          [-b bucket_size] [-F famfs_bin] <file> [<file> ...]\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	const char *famfs_bin = getenv("FAMFS_BIN");
+	size_t nstrips_arg = 0, chunk_arg = 0, bucket_size = 0;
+	unsigned int nthreads = 1;
+	double duration = 5.0;
+	int write = 0;
+	int rc = 0;
+	int c;
+
+	if (!famfs_bin || !*famfs_bin)
+		famfs_bin = "famfs";
+
+	while ((c = getopt(argc, argv, "t:d:wn:c:b:F:h")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 'w':
+			write = 1;
+			break;
+		case 'n':
+			nstrips_arg = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			chunk_arg = parse_size(optarg);
+			break;
+		case 'b':
+			bucket_size = parse_size(optarg);
+			break;
+		case 'F':
+			famfs_bin = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		return -1;
+	}
+	if (nthreads < 1 || nthreads > MAX_THREADS) {
+		fprintf(stderr, "threads must be 1..%d\n", MAX_THREADS);
+		return -1;
+	}
+	if (nstrips_arg > MAX_STRIPS) {
+		fprintf(stderr, "nstrips must be <= %d\n", MAX_STRIPS);
+		return -1;
+	}
+	if (duration < 0.1)
+		duration = 0.1;
+
+	for (; optind < argc; optind++) {
+		const char *path = argv[optind];
+		struct geometry geo = { 0 };
+
+		if (getmap_geometry(famfs_bin, path, &geo) != 0) {
+			/* Not interleaved, or no map available from getmap */
+			geo.nstrips = 1;
+			geo.chunk_size = 2 * 1024 * 1024;
+		}
+		if (nstrips_arg)
+			geo.nstrips = nstrips_arg;
+		if (chunk_arg)
+			geo.chunk_size = chunk_arg;
+		if (geo.nstrips > MAX_STRIPS || geo.chunk_size % sizeof(uint64_t)) {
+			fprintf(stderr, "%s: unsupported geometry nstrips=%zu "
+				"chunk_size=%zu\n", path, geo.nstrips,
+				geo.chunk_size);
+			rc = -1;
+			continue;
+		}
+
+		if (bench_file(path, &geo, bucket_size, nthreads, duration,
+			       write))
+			rc = -1;
+	}
+	return rc;
+}
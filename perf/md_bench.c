@@ -0,0 +1,571 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2023-2026 Micron Technology, Inc.  All rights reserved.
+ */
+
+/* md_bench.c
+ * Usage: md_bench [options] <dir>
+ *
+ * mdtest-style metadata benchmark. Builds a tree under <dir> with
+ * <depth> levels of directories below <dir>, <fanout> subdirectories per
+ * directory and <files> files in every directory, then times these phases
+ * with <threads> threads, reporting ops/s and per-op latency percentiles:
+ *
+ *  MKDIR     - create the directories (level by level)
+ *  CREATE    - create the files
+ *  STAT      - stat every file
+ *  OPEN      - open + close every file
+ *  READDIR   - opendir/readdir/closedir every directory
+ *  READDIRP  - readdir + fstatat of every entry (readdirplus pattern)
+ *  CHURN     - random stat/open of random files for <secs> seconds
+ *
+ * famfs does not support unlink, so there is no removal phase; CHURN is the
+ * steady-state lookup load instead.
+ *
+ * Create modes (-m):
+ *  famfs - directories and files are created by running 'famfs mkdir' and
+ *          'famfs creat' (the real famfs create path); default
+ *  posix - mkdir(2) and open(O_CREAT), for baselines on other filesystems
+ *
+ * Options:
+ *   -t <threads>   Worker threads (default 1)
+ *   -d <depth>     Directory levels below <dir> (default 1)
+ *   -b <fanout>    Subdirectories per directory (default 10)
+ *   -n <files>     Files per directory (default 100)
+ *   -s <size>      File size for famfs creat (default 2M; accepts K/M/G)
+ *   -S <secs>      CHURN duration (default 10)
+ *   -m <mode>      famfs | posix
+ *   -F <famfs_bin> famfs cli (default: $FAMFS_BIN or famfs)
+ *   -x             Skip MKDIR/CREATE and reuse an existing tree
+ *   -D             Drop kernel caches before each phase (needs root)
+ *
+ * Build: gcc -O2 -Wall -Wextra -pthread -o md_bench md_bench.c
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <time.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
+
+extern char **environ;
+
+#define MAX_THREADS 1024
+#define MAX_ITEMS   (16 * 1024 * 1024)
+
+enum phase {
+	PH_MKDIR,
+	PH_CREATE,
+	PH_STAT,
+	PH_OPEN,
+	PH_READDIR,
+	PH_READDIRP,
+	PH_CHURN,
+};
+
+static const char *phase_name[] = {
+	"MKDIR", "CREATE", "STAT", "OPEN", "READDIR", "READDIRP", "CHURN",
+};
+
+struct cfg {
+	const char *root;
+	const char *famfs_bin;
+	unsigned int nthreads;
+	unsigned int depth;
+	unsigned int fanout;
+	unsigned int nfiles;
+	size_t fsize;
+	double churn_secs;
+	int posix;
+	int reuse;
+	int drop_caches;
+};
+
+struct tree {
+	char **dirs;           /* BFS order; dirs[0] is the root */
+	size_t ndirs;
+	size_t *level_start;   /* index of the first dir of each level */
+	unsigned int nlevels;
+};
+
+struct lat {
+	uint64_t *ns;
+	size_t n;
+	size_t cap;
+};
+
+struct worker {
+	pthread_t tid;
+	const struct cfg *cfg;
+	const struct tree *tree;
+	enum phase phase;
+	unsigned int id;
+	size_t first;          /* item range [first, last) */
+	size_t last;
+	struct lat lat;
+	size_t errors;
+	uint64_t rng;
+};
+
+static double elapsed_sec(struct timespec a, struct timespec b)
+{
+	return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t parse_size(const char *s)
+{
+	// Accepts "K", "M", "G"
+	char *end = NULL;
+	double val = strtod(s, &end);
+
+	if (end == s)
+		return 0;
+	size_t mult = 1;
+	if (*end) {
+		char c = toupper((unsigned char)*end);
+		if (c == 'K')
+			mult = 1024ULL;
+		else if (c == 'M')
+			mult = 1024ULL * 1024ULL;
+		else if (c == 'G')
+			mult = 1024ULL * 1024ULL * 1024ULL;
+		else
+			return 0;
+	}
+	double bytes_d = val * (double)mult;
+	if (bytes_d <= 0.0)
+		return 0;
+	return (size_t)bytes_d;
+}
+
+// xorshift64* RNG
+static inline uint64_t rng_next(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 2685821657736338717ULL;
+}
+
+static void lat_add(struct lat *l, uint64_t ns)
+{
+	if (l->n == l->cap) {
+		l->cap = l->cap ? l->cap * 2 : 4096;
+		l->ns = realloc(l->ns, l->cap * sizeof(*l->ns));
+		if (!l->ns) {
+			perror("realloc");
+			exit(2);
+		}
+	}
+	l->ns[l->n++] = ns;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int build_tree(const struct cfg *cfg, struct tree *t)
+{
+	size_t ndirs = 1, level_n = 1;
+
+	for (unsigned int l = 0; l < cfg->depth; l++) {
+		level_n *= cfg->fanout;
+		ndirs += level_n;
+		if (ndirs > MAX_ITEMS || ndirs * cfg->nfiles > MAX_ITEMS) {
+			fprintf(stderr, "Tree too large (> %d items)\n",
+				MAX_ITEMS);
+			return -1;
+		}
+	}
+
+	t->dirs = calloc(ndirs, sizeof(*t->dirs));
+	t->level_start = calloc(cfg->depth + 2, sizeof(*t->level_start));
+	if (!t->dirs || !t->level_start)
+		return -1;
+
+	t->dirs[0] = strdup(cfg->root);
+	t->ndirs = 1;
+	t->nlevels = cfg->depth + 1;
+	t->level_start[0] = 0;
+	t->level_start[1] = 1;
+	for (unsigned int l = 1; l <= cfg->depth; l++) {
+		size_t pfirst = t->level_start[l - 1];
+		size_t plast = t->level_start[l];
+
+		for (size_t p = pfirst; p < plast; p++) {
+			for (unsigned int c = 0; c < cfg->fanout; c++) {
+				if (asprintf(&t->dirs[t->ndirs], "%s/d%u.%u",
+					     t->dirs[p], l, c) < 0)
+					return -1;
+				t->ndirs++;
+			}
+		}
+		t->level_start[l + 1] = t->ndirs;
+	}
+	return 0;
+}
+
+static void file_path(const struct cfg *cfg, const struct tree *t,
+		      size_t item, char *buf, size_t len)
+{
+	snprintf(buf, len, "%s/f.%zu", t->dirs[item / cfg->nfiles],
+		 item % cfg->nfiles);
+}
+
+static int run_cmd(char *const argv[])
+{
+	pid_t pid;
+	int status;
+
+	if (posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ) != 0)
+		return -1;
+	if (waitpid(pid, &status, 0) < 0)
+		return -1;
+	return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+static int do_mkdir(const struct cfg *cfg, const char *path)
+{
+	if (cfg->posix)
+		return mkdir(path, 0755);
+
+	char *argv[] = { (char *)cfg->famfs_bin, "mkdir", (char *)path, NULL };
+
+	return run_cmd(argv);
+}
+
+static int do_create(const struct cfg *cfg, const char *path)
+{
+	if (cfg->posix) {
+		int fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+
+		if (fd < 0)
+			return -1;
+		return close(fd);
+	}
+
+	char size[32];
+	char *argv[] = { (char *)cfg->famfs_bin, "creat", "-s", size,
+			 (char *)path, NULL };
+
+	snprintf(size, sizeof(size), "%zu", cfg->fsize);
+	return run_cmd(argv);
+}
+
+static int do_readdir(const char *path, int plus)
+{
+	struct dirent *de;
+	struct stat st;
+	DIR *dp;
+	int rc = 0;
+
+	dp = opendir(path);
+	if (!dp)
+		return -1;
+	while ((de = readdir(dp)) != NULL) {
+		if (!plus || de->d_name[0] == '.')
+			continue;
+		if (fstatat(dirfd(dp), de->d_name, &st,
+			    AT_SYMLINK_NOFOLLOW) < 0)
+			rc = -1;
+	}
+	closedir(dp);
+	return rc;
+}
+
+static int do_open(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+	return close(fd);
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	const struct cfg *cfg = w->cfg;
+	const struct tree *t = w->tree;
+	size_t nitems = t->ndirs * cfg->nfiles;
+	char path[4096];
+	struct stat st;
+	uint64_t s, e;
+	int rc = 0;
+
+	if (w->phase == PH_CHURN) {
+		uint64_t end = now_ns() + (uint64_t)(cfg->churn_secs * 1e9);
+
+		do {
+			uint64_t r = rng_next(&w->rng);
+
+			file_path(cfg, t, r % nitems, path, sizeof(path));
+			s = now_ns();
+			rc = ((r >> 32) & 1) ? do_open(path) : stat(path, &st);
+			e = now_ns();
+			lat_add(&w->lat, e - s);
+			if (rc)
+				w->errors++;
+		} while (e < end);
+		return NULL;
+	}
+
+	for (size_t i = w->first; i < w->last; i++) {
+		switch (w->phase) {
+		case PH_MKDIR:
+			s = now_ns();
+			rc = do_mkdir(cfg, t->dirs[i]);
+			break;
+		case PH_CREATE:
+			file_path(cfg, t, i, path, sizeof(path));
+			s = now_ns();
+			rc = do_create(cfg, path);
+			break;
+		case PH_STAT:
+			file_path(cfg, t, i, path, sizeof(path));
+			s = now_ns();
+			rc = stat(path, &st);
+			break;
+		case PH_OPEN:
+			file_path(cfg, t, i, path, sizeof(path));
+			s = now_ns();
+			rc = do_open(path);
+			break;
+		case PH_READDIR:
+		case PH_READDIRP:
+			s = now_ns();
+			rc = do_readdir(t->dirs[i], w->phase == PH_READDIRP);
+			break;
+		default:
+			return NULL;
+		}
+		e = now_ns();
+		lat_add(&w->lat, e - s);
+		if (rc)
+			w->errors++;
+	}
+	return NULL;
+}
+
+static void drop_caches(void)
+{
+	int fd;
+
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0 || write(fd, "3\n", 2) != 2)
+		fprintf(stderr, "Unable to drop caches: %s\n", strerror(errno));
+	if (fd >= 0)
+		close(fd);
+}
+
+/* Latencies and errors of the phase being run, merged from all workers */
+static struct lat phase_lat;
+static size_t phase_errors;
+
+static void report(const struct cfg *cfg, enum phase ph, double secs)
+{
+	struct lat *l = &phase_lat;
+
+	if (l->n == 0)
+		return;
+	qsort(l->ns, l->n, sizeof(*l->ns), cmp_u64);
+
+#define PCT(p) (l->ns[(size_t)((l->n - 1) * (p))] / 1000.0)
+	printf("MDBENCH_%s, threads=%u, depth=%u, fanout=%u, files=%u, "
+	       "ops=%zu, errors=%zu, elapsed=%.6f sec, throughput=%.2f ops/s, "
+	       "p50_us=%.1f, p90_us=%.1f, p99_us=%.1f, p999_us=%.1f, "
+	       "max_us=%.1f\n", phase_name[ph], cfg->nthreads, cfg->depth,
+	       cfg->fanout, cfg->nfiles, l->n, phase_errors, secs,
+	       l->n / secs, PCT(0.50), PCT(0.90), PCT(0.99), PCT(0.999),
+	       l->ns[l->n - 1] / 1000.0);
+#undef PCT
+}
+
+/* Run items [first, last) of a phase, split evenly across the threads */
+static void run_items(const struct cfg *cfg, const struct tree *t,
+		      enum phase ph, size_t first, size_t last)
+{
+	static struct worker w[MAX_THREADS];
+	unsigned int nthreads = cfg->nthreads;
+	size_t n = last - first;
+
+	if (ph != PH_CHURN && nthreads > n)
+		nthreads = n ? n : 1;
+
+	for (unsigned int i = 0; i < nthreads; i++) {
+		free(w[i].lat.ns);
+		memset(&w[i], 0, sizeof(w[i]));
+		w[i].cfg = cfg;
+		w[i].tree = t;
+		w[i].phase = ph;
+		w[i].id = i;
+		w[i].first = first + n * i / nthreads;
+		w[i].last = first + n * (i + 1) / nthreads;
+		w[i].rng = now_ns() ^ (0x9E3779B97F4A7C15ULL * (i + 1));
+		if (pthread_create(&w[i].tid, NULL, worker_fn, &w[i]) != 0) {
+			perror("pthread_create");
+			exit(2);
+		}
+	}
+	for (unsigned int i = 0; i < nthreads; i++) {
+		pthread_join(w[i].tid, NULL);
+		for (size_t j = 0; j < w[i].lat.n; j++)
+			lat_add(&phase_lat, w[i].lat.ns[j]);
+		phase_errors += w[i].errors;
+	}
+}
+
+static void run_phase(const struct cfg *cfg, const struct tree *t,
+		      enum phase ph)
+{
+	size_t nitems = t->ndirs * cfg->nfiles;
+	struct timespec s, e;
+
+	if (cfg->drop_caches)
+		drop_caches();
+
+	phase_lat.n = 0;
+	phase_errors = 0;
+	clock_gettime(CLOCK_MONOTONIC, &s);
+	switch (ph) {
+	case PH_MKDIR:
+		/* Parents before children; the root must already exist */
+		for (unsigned int l = 1; l < t->nlevels; l++)
+			run_items(cfg, t, ph, t->level_start[l],
+				  t->level_start[l + 1]);
+		break;
+	case PH_READDIR:
+	case PH_READDIRP:
+		run_items(cfg, t, ph, 0, t->ndirs);
+		break;
+	default:
+		run_items(cfg, t, ph, 0, nitems);
+		break;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &e);
+
+	report(cfg, ph, elapsed_sec(s, e));
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-t threads] [-d depth] [-b fanout] [-n files] [-s size]\n"
+		"          [-S churn_secs] [-m famfs|posix] [-F famfs_bin] [-x] [-D] <dir>\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct cfg cfg = {
+		.nthreads = 1, .depth = 1, .fanout = 10, .nfiles = 100,
+		.fsize = 2 * 1024 * 1024, .churn_secs = 10.0,
+	};
+	struct tree t = { 0 };
+	int c;
+
+	cfg.famfs_bin = getenv("FAMFS_BIN");
+	if (!cfg.famfs_bin || !*cfg.famfs_bin)
+		cfg.famfs_bin = "famfs";
+
+	while ((c = getopt(argc, argv, "t:d:b:n:s:S:m:F:xDh")) != -1) {
+		switch (c) {
+		case 't':
+			cfg.nthreads = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			cfg.depth = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			cfg.fanout = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			cfg.nfiles = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			cfg.fsize = parse_size(optarg);
+			break;
+		case 'S':
+			cfg.churn_secs = atof(optarg);
+			break;
+		case 'm':
+			if (!strcmp(optarg, "posix")) {
+				cfg.posix = 1;
+			} else if (strcmp(optarg, "famfs")) {
+				usage(argv[0]);
+				return -1;
+			}
+			break;
+		case 'F':
+			cfg.famfs_bin = optarg;
+			break;
+		case 'x':
+			cfg.reuse = 1;
+			break;
+		case 'D':
+			cfg.drop_caches = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return -1;
+	}
+	if (cfg.nthreads < 1 || cfg.nthreads > MAX_THREADS || cfg.fanout < 1 ||
+	    cfg.nfiles < 1 || cfg.fsize == 0) {
+		fprintf(stderr, "Invalid arguments\n");
+		return -1;
+	}
+	cfg.root = argv[optind];
+
+	if (build_tree(&cfg, &t))
+		return -1;
+
+	printf("MDBENCH_BEGIN, dir=%s, mode=%s, threads=%u, depth=%u, "
+	       "fanout=%u, files=%u, dirs=%zu, total_files=%zu\n", cfg.root,
+	       cfg.posix ? "posix" : "famfs", cfg.nthreads, cfg.depth,
+	       cfg.fanout, cfg.nfiles, t.ndirs, t.ndirs * cfg.nfiles);
+
+	if (!cfg.reuse) {
+		if (t.nlevels > 1)
+			run_phase(&cfg, &t, PH_MKDIR);
+		run_phase(&cfg, &t, PH_CREATE);
+	}
+	run_phase(&cfg, &t, PH_STAT);
+	run_phase(&cfg, &t, PH_OPEN);
+	run_phase(&cfg, &t, PH_READDIR);
+	run_phase(&cfg, &t, PH_READDIRP);
+	if (cfg.churn_secs > 0)
+		run_phase(&cfg, &t, PH_CHURN);
+
+	printf("MDBENCH_END, dir=%s\n", cfg.root);
+	return 0;
+}
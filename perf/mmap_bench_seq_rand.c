@@ -15,9 +15,24 @@
  *    MMAP_RAND_SECS: duration seconds (double), default 60
  *    MMAP_SEED: uint64 seed (default: time(NULL) ^ addr), for reproducibility
  *
- * Build: gcc -O2 -Wall -Wextra -o mmap_bench mmap_bench.c
+ * Multithreaded sweep (enabled by setting MMAP_THREADS):
+ *    MMAP_THREADS: thread counts to sweep, CSV (e.g. "1,2,4,8,16")
+ *    MMAP_RW_MIX: write percentages to sweep, CSV (default "0,100")
+ *    MMAP_CPUS: cpu list to pin threads to, e.g. "0-15,32-47"
+ *    MMAP_NUMA_NODE: pin threads to the cpus of this node (overrides MMAP_CPUS)
+ *    MMAP_NT=1: non-temporal loads/stores (x86 only; ignored elsewhere)
+ *    MMAP_POPULATE=1: map with MAP_POPULATE instead of demand faulting
+ *    MMAP_CSV / MMAP_JSON: also append results to this file as CSV rows /
+ *        JSON lines
+ *  For each block size, mix and thread count the file is mapped (mmap time
+ *  is reported, since MAP_POPULATE moves the fault cost there), then:
+ *  1) MT_SEQ: each thread covers its own slice of the file once
+ *  2) MT_RAND: each thread does random block ops for MMAP_RAND_SECS
+ *  Each op reads or writes the whole block; the mix picks per op.
+ *
+ * Build: gcc -O2 -Wall -Wextra -pthread -o mmap_bench mmap_bench.c
  */
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -30,6 +45,11 @@
 #include <time.h>
 #include <ctype.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 static double elapsed_sec(struct timespec a, struct timespec b)
 {
@@ -323,6 +343,442 @@ static void bench_rand_read(void *map, size_t filesize, size_t bs,
 	(void)sink;
 }
 
+/*
+ * Multithreaded sweep
+ */
+
+#define MT_MAX_THREADS 1024
+#define MT_MAX_CPUS    4096
+
+enum mt_phase { MT_SEQ, MT_RAND };
+
+struct mt_cfg {
+	size_t filesize;
+	size_t bs;
+	unsigned int nthreads;
+	unsigned int write_pct;
+	int nt;
+	int populate;
+	double duration;
+	uint64_t seed;
+	const int *cpus;
+	int ncpus;
+};
+
+struct mt_thread {
+	pthread_t tid;
+	const struct mt_cfg *cfg;
+	char *map;
+	enum mt_phase phase;
+	unsigned int id;
+	void *buf;
+	uint64_t ops;
+	unsigned long long bytes;
+	double secs;
+	unsigned long sink;
+};
+
+struct mt_out {
+	FILE *csv;
+	FILE *json;
+};
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.1")))
+static unsigned long nt_read(const char *p, size_t len)
+{
+	__m128i acc = _mm_setzero_si128();
+
+	for (size_t i = 0; i < len; i += 16)
+		acc = _mm_add_epi64(acc,
+			_mm_stream_load_si128((__m128i *)(p + i)));
+	return (unsigned long)_mm_cvtsi128_si64(acc);
+}
+
+static void nt_write(char *p, const char *src, size_t len)
+{
+	for (size_t i = 0; i < len; i += 16)
+		_mm_stream_si128((__m128i *)(p + i),
+				 _mm_load_si128((const __m128i *)(src + i)));
+}
+
+static int nt_supported(void)
+{
+	return __builtin_cpu_supports("sse4.1");
+}
+#else
+static unsigned long nt_read(const char *p, size_t len)
+{
+	(void)p;
+	(void)len;
+	return 0;
+}
+
+static void nt_write(char *p, const char *src, size_t len)
+{
+	(void)p;
+	(void)src;
+	(void)len;
+}
+
+static int nt_supported(void)
+{
+	return 0;
+}
+#endif
+
+static inline void mt_do_op(struct mt_thread *t, char *p, int write)
+{
+	const struct mt_cfg *cfg = t->cfg;
+
+	if (write) {
+		if (cfg->nt)
+			nt_write(p, t->buf, cfg->bs);
+		else
+			memcpy(p, t->buf, cfg->bs);
+	} else if (cfg->nt) {
+		t->sink += nt_read(p, cfg->bs);
+	} else {
+		const uint64_t *q = (const uint64_t *)p;
+		uint64_t sum = 0;
+
+		for (size_t i = 0; i < cfg->bs / sizeof(*q); i++)
+			sum += q[i];
+		t->sink += sum;
+	}
+	t->ops++;
+	t->bytes += cfg->bs;
+}
+
+static void *mt_worker(void *arg)
+{
+	struct mt_thread *t = arg;
+	const struct mt_cfg *cfg = t->cfg;
+	uint64_t rng = cfg->seed ^ (0x9E3779B97F4A7C15ULL * (t->id + 1));
+	struct timespec start, now;
+
+	if (cfg->ncpus > 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(cfg->cpus[t->id % cfg->ncpus], &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+			fprintf(stderr, "thread %u: cannot pin to cpu %d\n",
+				t->id, cfg->cpus[t->id % cfg->ncpus]);
+	}
+
+	timespec_now(&start);
+	if (t->phase == MT_SEQ) {
+		size_t nblocks = cfg->filesize / cfg->bs;
+		size_t per = nblocks / cfg->nthreads;
+		size_t first = t->id * per;
+		size_t last = (t->id == cfg->nthreads - 1) ? nblocks : first + per;
+
+		for (size_t i = first; i < last; i++)
+			mt_do_op(t, t->map + i * cfg->bs,
+				 (rng_next(&rng) % 100) < cfg->write_pct);
+		timespec_now(&now);
+	} else {
+		size_t max_index = (cfg->filesize - cfg->bs) / cfg->bs;
+
+		for (;;) {
+			uint64_t r = rng_next(&rng);
+			size_t off = (size_t)(r % (max_index + 1)) * cfg->bs;
+
+			mt_do_op(t, t->map + off,
+				 ((r >> 32) % 100) < cfg->write_pct);
+
+			timespec_now(&now);
+			if (elapsed_sec(start, now) >= cfg->duration)
+				break;
+		}
+	}
+#if defined(__x86_64__)
+	if (cfg->nt)
+		_mm_sfence();
+#endif
+	t->secs = elapsed_sec(start, now);
+	return NULL;
+}
+
+static void mt_report(const struct mt_out *out, const char *phase,
+		      const struct mt_cfg *cfg, double map_secs,
+		      const struct mt_thread *t)
+{
+	unsigned long long bytes = 0, ops = 0;
+	double secs = 0.0, min_mbps = 0.0, max_mbps = 0.0;
+
+	for (unsigned int i = 0; i < cfg->nthreads; i++) {
+		double mbps = (t[i].bytes / 1024.0 / 1024.0) / t[i].secs;
+
+		bytes += t[i].bytes;
+		ops += t[i].ops;
+		if (t[i].secs > secs)
+			secs = t[i].secs;
+		if (i == 0 || mbps < min_mbps)
+			min_mbps = mbps;
+		if (i == 0 || mbps > max_mbps)
+			max_mbps = mbps;
+	}
+	double mbps = (bytes / 1024.0 / 1024.0) / secs;
+	double iops = ops / secs;
+
+	printf("MMAP_%s, bs=%zu, threads=%u, write_pct=%u, nt=%d, populate=%d, "
+	       "map_sec=%.6f, ops=%llu, bytes=%llu, elapsed=%.6f sec, "
+	       "throughput=%.2f MiB/s, iops=%.2f, thread_min=%.2f MiB/s, "
+	       "thread_max=%.2f MiB/s\n", phase, cfg->bs, cfg->nthreads,
+	       cfg->write_pct, cfg->nt, cfg->populate, map_secs, ops, bytes,
+	       secs, mbps, iops, min_mbps, max_mbps);
+
+	if (out->csv) {
+		fprintf(out->csv, "%s,%zu,%u,%u,%d,%d,%.6f,%llu,%llu,%.6f,"
+			"%.2f,%.2f,%.2f,%.2f\n", phase, cfg->bs, cfg->nthreads,
+			cfg->write_pct, cfg->nt, cfg->populate, map_secs, ops,
+			bytes, secs, mbps, iops, min_mbps, max_mbps);
+		fflush(out->csv);
+	}
+	if (out->json) {
+		fprintf(out->json, "{\"test\":\"%s\",\"bs\":%zu,\"threads\":%u,"
+			"\"write_pct\":%u,\"nt\":%d,\"populate\":%d,"
+			"\"map_sec\":%.6f,\"ops\":%llu,\"bytes\":%llu,"
+			"\"elapsed_sec\":%.6f,\"mib_per_sec\":%.2f,\"iops\":%.2f,"
+			"\"thread_min_mib_per_sec\":%.2f,"
+			"\"thread_max_mib_per_sec\":%.2f}\n", phase, cfg->bs,
+			cfg->nthreads, cfg->write_pct, cfg->nt, cfg->populate,
+			map_secs, ops, bytes, secs, mbps, iops, min_mbps,
+			max_mbps);
+		fflush(out->json);
+	}
+}
+
+/* Map the file, run one phase with cfg->nthreads threads, unmap */
+static int mt_run(int fd, const struct mt_cfg *cfg, enum mt_phase phase,
+		  const struct mt_out *out)
+{
+	int flags = MAP_SHARED | (cfg->populate ? MAP_POPULATE : 0);
+	struct mt_thread *t;
+	struct timespec s, e;
+	char *map;
+	int rc = 0;
+
+	t = calloc(cfg->nthreads, sizeof(*t));
+	if (!t)
+		return -1;
+
+	timespec_now(&s);
+	map = mmap(NULL, cfg->filesize, PROT_READ | PROT_WRITE, flags, fd, 0);
+	timespec_now(&e);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		free(t);
+		return -1;
+	}
+
+	for (unsigned int i = 0; i < cfg->nthreads; i++) {
+		t[i].cfg = cfg;
+		t[i].map = map;
+		t[i].phase = phase;
+		t[i].id = i;
+		if (posix_memalign(&t[i].buf, 4096, cfg->bs) != 0) {
+			fprintf(stderr, "posix_memalign failed for bs=%zu\n",
+				cfg->bs);
+			exit(2);
+		}
+		memset(t[i].buf, 0xEF, cfg->bs);
+	}
+	for (unsigned int i = 0; i < cfg->nthreads; i++) {
+		if (pthread_create(&t[i].tid, NULL, mt_worker, &t[i]) != 0) {
+			perror("pthread_create");
+			exit(2);
+		}
+	}
+	for (unsigned int i = 0; i < cfg->nthreads; i++)
+		pthread_join(t[i].tid, NULL);
+
+	mt_report(out, (phase == MT_SEQ) ? "MT_SEQ" : "MT_RAND", cfg,
+		  elapsed_sec(s, e), t);
+
+	if (munmap(map, cfg->filesize) != 0) {
+		perror("munmap");
+		rc = -1;
+	}
+	for (unsigned int i = 0; i < cfg->nthreads; i++)
+		free(t[i].buf);
+	free(t);
+	return rc;
+}
+
+/* Parse a cpu list such as "0-3,8,10-11"; returns the number of cpus */
+static int parse_cpulist(const char *s, int *cpus, int max)
+{
+	int n = 0;
+
+	while (*s && n < max) {
+		char *end;
+		long a = strtol(s, &end, 10), b;
+
+		if (end == s)
+			break;
+		b = a;
+		if (*end == '-')
+			b = strtol(end + 1, &end, 10);
+		for (long c = a; c <= b && n < max; c++)
+			cpus[n++] = (int)c;
+		s = end;
+		while (*s == ',' || *s == '\n' || *s == ' ')
+			s++;
+	}
+	return n;
+}
+
+static int numa_node_cpus(int node, int *cpus, int max)
+{
+	char path[128];
+	char line[4096];
+	FILE *fp;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/node/node%d/cpulist", node);
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+	if (!fgets(line, sizeof(line), fp)) {
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	return parse_cpulist(line, cpus, max);
+}
+
+static int get_env_flag(const char *name)
+{
+	const char *s = getenv(name);
+
+	return (s && *s && strcmp(s, "0") != 0);
+}
+
+static int mt_sweep(int fd, const char *path, size_t filesize,
+		    const char *sizes_csv)
+{
+	const char *threads_csv = getenv("MMAP_THREADS");
+	const char *mix_csv = getenv("MMAP_RW_MIX");
+	const char *cpus_str = getenv("MMAP_CPUS");
+	const char *node_str = getenv("MMAP_NUMA_NODE");
+	const char *csv_path = getenv("MMAP_CSV");
+	const char *json_path = getenv("MMAP_JSON");
+	static int cpus[MT_MAX_CPUS];
+	struct mt_out out = { 0 };
+	struct mt_cfg cfg = { 0 };
+	char *sizestr, *tok, *save_bs;
+	int rc = 0;
+
+	if (!mix_csv || !*mix_csv)
+		mix_csv = "0,100";
+
+	cfg.filesize = filesize;
+	cfg.duration = get_rand_secs_default();
+	cfg.seed = get_seed_default((uint64_t)(uintptr_t)&cfg);
+	cfg.populate = get_env_flag("MMAP_POPULATE");
+	cfg.nt = get_env_flag("MMAP_NT");
+	if (cfg.nt && !nt_supported()) {
+		fprintf(stderr, "Non-temporal access not supported; ignoring MMAP_NT\n");
+		cfg.nt = 0;
+	}
+	if (node_str && *node_str)
+		cfg.ncpus = numa_node_cpus(atoi(node_str), cpus, MT_MAX_CPUS);
+	else if (cpus_str && *cpus_str)
+		cfg.ncpus = parse_cpulist(cpus_str, cpus, MT_MAX_CPUS);
+	if (cfg.ncpus < 0)
+		return -1;
+	cfg.cpus = cpus;
+
+	if (csv_path && *csv_path) {
+		int need_hdr;
+
+		out.csv = fopen(csv_path, "a");
+		if (!out.csv) {
+			perror(csv_path);
+			return -1;
+		}
+		need_hdr = (ftell(out.csv) == 0);
+		if (need_hdr)
+			fprintf(out.csv, "test,bs,threads,write_pct,nt,populate,"
+				"map_sec,ops,bytes,elapsed_sec,mib_per_sec,iops,"
+				"thread_min_mib_per_sec,thread_max_mib_per_sec\n");
+	}
+	if (json_path && *json_path) {
+		out.json = fopen(json_path, "a");
+		if (!out.json) {
+			perror(json_path);
+			rc = -1;
+			goto out;
+		}
+	}
+
+	printf("MMAP_MT_BEGIN, file=%s, size_bytes=%zu, sizes_csv=%s, "
+	       "threads_csv=%s, rw_mix=%s, ncpus_pinned=%d, nt=%d, populate=%d, "
+	       "rand_secs=%.3f\n", path, filesize, sizes_csv, threads_csv,
+	       mix_csv, cfg.ncpus, cfg.nt, cfg.populate, cfg.duration);
+
+	sizestr = strdup(sizes_csv);
+	if (!sizestr) {
+		rc = -1;
+		goto out;
+	}
+	for (tok = strtok_r(sizestr, ",", &save_bs); tok;
+	     tok = strtok_r(NULL, ",", &save_bs)) {
+		char *mixstr, *mtok, *save_mix;
+
+		while (*tok == ' ' || *tok == '\t')
+			tok++;
+		cfg.bs = parse_size(tok);
+		if (cfg.bs == 0 || cfg.bs > filesize || cfg.bs % 16) {
+			fprintf(stderr, "Invalid block size token: '%s'\n", tok);
+			continue;
+		}
+
+		mixstr = strdup(mix_csv);
+		for (mtok = strtok_r(mixstr, ",", &save_mix); mtok;
+		     mtok = strtok_r(NULL, ",", &save_mix)) {
+			char *thrstr, *ttok, *save_thr;
+
+			cfg.write_pct = strtoul(mtok, NULL, 0);
+			if (cfg.write_pct > 100)
+				cfg.write_pct = 100;
+
+			thrstr = strdup(threads_csv);
+			for (ttok = strtok_r(thrstr, ",", &save_thr); ttok;
+			     ttok = strtok_r(NULL, ",", &save_thr)) {
+				cfg.nthreads = strtoul(ttok, NULL, 0);
+				if (cfg.nthreads < 1 ||
+				    cfg.nthreads > MT_MAX_THREADS ||
+				    cfg.nthreads > filesize / cfg.bs) {
+					fprintf(stderr,
+						"Invalid thread count: '%s'\n",
+						ttok);
+					continue;
+				}
+				if (mt_run(fd, &cfg, MT_SEQ, &out) ||
+				    mt_run(fd, &cfg, MT_RAND, &out))
+					rc = -1;
+			}
+			free(thrstr);
+		}
+		free(mixstr);
+	}
+	free(sizestr);
+
+	printf("MMAP_MT_END, file=%s\n", path);
+out:
+	if (out.csv)
+		fclose(out.csv);
+	if (out.json)
+		fclose(out.json);
+	return rc;
+}
+
 int main(int argc, char **argv)
 {
 	if (argc < 2) {
@@ -365,6 +821,15 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
+	const char *threads_csv = getenv("MMAP_THREADS");
+
+	if (threads_csv && *threads_csv) {
+		int rc = mt_sweep(fd, path, filesize, csv);
+
+		close(fd);
+		return rc;
+	}
+
 	// Map the file
 	void *map =	mmap(NULL, filesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 	if (map == MAP_FAILED) {
@@ -34,6 +34,27 @@ FAMFS_CREATE_SUBCMD="${FAMFS_CREATE_SUBCMD:-creat}"
 MMAP_SIZE_GB="${MMAP_SIZE_GB:-100}"
 MMAP_IO_SIZES="${MMAP_IO_SIZES:-4K,64K,1M}"
 
+# Multithreaded mmap sweep (see perf/mmap_bench_seq_rand.c for the full set
+# of MMAP_* knobs; MMAP_CPUS, MMAP_NUMA_NODE, MMAP_NT, MMAP_POPULATE are
+# passed through from the environment)
+MMAP_MT_THREADS="${MMAP_MT_THREADS:-1,2,4,8,16}"
+MMAP_MT_RW_MIX="${MMAP_MT_RW_MIX:-0,30,100}"
+MMAP_MT_SECS="${MMAP_MT_SECS:-10}"
+MMAP_MT_CSV="${MMAP_MT_CSV:-$LOG_DIR/mmap_mt_${RUN_ID}.csv}"
+MMAP_MT_JSON="${MMAP_MT_JSON:-$LOG_DIR/mmap_mt_${RUN_ID}.json}"
+
+# interleave_bench settings (nstrips/chunk_size come from 'famfs getmap';
+# set INTERLEAVE_OPTS="-n <nstrips> -c <chunk_size>" where getmap has no map)
+INTERLEAVE_THREADS="${INTERLEAVE_THREADS:-$(nproc)}"
+INTERLEAVE_SECS="${INTERLEAVE_SECS:-5}"
+INTERLEAVE_OPTS="${INTERLEAVE_OPTS:-}"
+
+# md_bench (metadata ops) settings: a wide and a deep tree
+MDBENCH_THREADS="${MDBENCH_THREADS:-8}"
+MDBENCH_WIDE_OPTS="${MDBENCH_WIDE_OPTS:--d 1 -b 100 -n 50}"
+MDBENCH_DEEP_OPTS="${MDBENCH_DEEP_OPTS:--d 16 -b 1 -n 50}"
+MDBENCH_CHURN_SECS="${MDBENCH_CHURN_SECS:-10}"
+
 # control max number of files
 MAX_FILES="${MAX_FILES:-10000}"
 
@@ -63,6 +84,7 @@ echo "FAMFS_BIN: $FAMFS_BIN"
 echo "FAMFS_CREATE_SUBCMD: $FAMFS_CREATE_SUBCMD"
 echo "MMAP_SIZE_GB: $MMAP_SIZE_GB"
 echo "MMAP_IO_SIZES: $MMAP_IO_SIZES"
+echo "INTERLEAVE_THREADS: $INTERLEAVE_THREADS"
 echo "=========================================="
 
 ########################################
@@ -153,10 +175,14 @@ ensure_helpers() {
 
 	[[ -f "${src_dir}/openclose_bench.c" ]] || abort "Missing ${src_dir}/openclose_bench.c"
 	[[ -f "${src_dir}/mmap_bench_seq_rand.c" ]] || abort "Missing ${src_dir}/mmap_bench_seq_rand.c"
+	[[ -f "${src_dir}/interleave_bench.c" ]] || abort "Missing ${src_dir}/interleave_bench.c"
+	[[ -f "${src_dir}/md_bench.c" ]] || abort "Missing ${src_dir}/md_bench.c"
 
 	echo "[BUILD] Compiling helper binaries from ${src_dir}"
 	gcc -O2 -Wall -Wextra -o "${WORK_DIR}/openclose_bench" "${src_dir}/openclose_bench.c"
-	gcc -O2 -Wall -Wextra -o "${WORK_DIR}/mmap_bench" "${src_dir}/mmap_bench_seq_rand.c"
+	gcc -O2 -Wall -Wextra -pthread -o "${WORK_DIR}/mmap_bench" "${src_dir}/mmap_bench_seq_rand.c"
+	gcc -O2 -Wall -Wextra -pthread -o "${WORK_DIR}/interleave_bench" "${src_dir}/interleave_bench.c"
+	gcc -O2 -Wall -Wextra -pthread -o "${WORK_DIR}/md_bench" "${src_dir}/md_bench.c"
 }
 
 ########################################
@@ -255,6 +281,44 @@ test_007_mmap() {
 	measure "MMAP_${MMAP_SIZE_GB}GB" "${WORK_DIR}/mmap_bench" "$MOUNT_DIR/mmap_${MMAP_SIZE_GB}GB.bin" "$MMAP_IO_SIZES"
 }
 
+# Per-strip / per-bucket / strip-scaling bandwidth; reuses the test 007 file
+test_008_interleave() {
+	ensure_mounted
+	echo "[TEST] Interleave placement bandwidth (threads=${INTERLEAVE_THREADS})"
+	measure "INTERLEAVE_${MMAP_SIZE_GB}GB" "${WORK_DIR}/interleave_bench" \
+		-F "$FAMFS_BIN" -t "$INTERLEAVE_THREADS" -d "$INTERLEAVE_SECS" \
+		$INTERLEAVE_OPTS "$MOUNT_DIR/mmap_${MMAP_SIZE_GB}GB.bin"
+}
+
+# Thread-count x read/write-mix sweep; results also go to CSV and JSON files
+# in LOG_DIR for regression tracking. Reuses the test 007 file.
+test_009_mmap_mt() {
+	ensure_mounted
+	echo "[TEST] ${MMAP_SIZE_GB}GB mmap multithreaded sweep (threads=${MMAP_MT_THREADS}, mix=${MMAP_MT_RW_MIX})"
+	measure "MMAP_MT_${MMAP_SIZE_GB}GB" env \
+		MMAP_THREADS="$MMAP_MT_THREADS" MMAP_RW_MIX="$MMAP_MT_RW_MIX" \
+		MMAP_RAND_SECS="$MMAP_MT_SECS" \
+		MMAP_CSV="$MMAP_MT_CSV" MMAP_JSON="$MMAP_MT_JSON" \
+		"${WORK_DIR}/mmap_bench" "$MOUNT_DIR/mmap_${MMAP_SIZE_GB}GB.bin" "$MMAP_IO_SIZES"
+}
+
+# Metadata ops (create/stat/open/readdir/churn) with latency percentiles,
+# over a wide and a deep tree on a fresh file system
+test_010_mdbench() {
+	reformat_and_mount
+	ensure_mounted
+	$SUDO $FAMFS_BIN mkdir "$MOUNT_DIR/md_wide"
+	$SUDO $FAMFS_BIN mkdir "$MOUNT_DIR/md_deep"
+	echo "[TEST] Metadata ops, wide tree (${MDBENCH_WIDE_OPTS})"
+	measure "MDBENCH_WIDE" $SUDO "${WORK_DIR}/md_bench" -F "$FAMFS_BIN" \
+		-t "$MDBENCH_THREADS" -S "$MDBENCH_CHURN_SECS" -D \
+		$MDBENCH_WIDE_OPTS "$MOUNT_DIR/md_wide"
+	echo "[TEST] Metadata ops, deep tree (${MDBENCH_DEEP_OPTS})"
+	measure "MDBENCH_DEEP" $SUDO "${WORK_DIR}/md_bench" -F "$FAMFS_BIN" \
+		-t "$MDBENCH_THREADS" -S "$MDBENCH_CHURN_SECS" -D \
+		$MDBENCH_DEEP_OPTS "$MOUNT_DIR/md_deep"
+}
+
 ########################################
 # Register tests
 ########################################
@@ -265,6 +329,9 @@ register_test "004" "Create 10000 files"               test_004_create_10000_fil
 register_test "005" "Create $MAX_FILES files"          test_005_create_max_files
 register_test "006" "Open/Close first 1000 files"      test_006_openclose_max_files
 register_test "007" "${MMAP_SIZE_GB}GB mmap BW & IOPS" test_007_mmap
+register_test "008" "Interleave strip/bucket BW"       test_008_interleave
+register_test "009" "${MMAP_SIZE_GB}GB mmap MT sweep"    test_009_mmap_mt
+register_test "010" "Metadata ops (md_bench)"          test_010_mdbench
 
 ########################################
 # Main
@@ -276,6 +343,7 @@ run_registered_tests
 echo
 echo "==== DONE (${RUN_ID}) ===="
 echo "Log file at: $LOG_FILE , summary: $SUMMARY_FILE"
+echo "mmap sweep results: $MMAP_MT_CSV $MMAP_MT_JSON"
 sync
 
 sleep 1
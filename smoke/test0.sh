@@ -72,6 +72,14 @@ expect_fail "${CLI[@]}" verify -S 1 -f badfile        -- "verify with bad filena
 expect_good "${CLI[@]}" verify -S 1 -f "$MPT/test1"   -- "verify 1 after creat"
 expect_fail "${CLI[@]}" verify -S 99 -f "$MPT/test1"  -- "verify with wrong seed shoud fail"
 
+# Threaded (range) verify of a file > 64MiB, seed above 32 bits
+expect_good "${CLI[@]}" creat -r -s 100M -S 0x100000007 "$MPT/bigseed" \
+           -- "creat with a 33-bit seed"
+expect_good "${CLI[@]}" verify -t 4 -S 0x100000007 -f "$MPT/bigseed" \
+           -- "threaded verify with a 33-bit seed"
+expect_good "${CLI[@]}" verify -t 1 -S 0x100000007 -f "$MPT/bigseed" \
+           -- "single-threaded verify with a 33-bit seed"
+
 # Create 2 more files
 expect_good "${CLI[@]}" creat -r -s 4096 -S 2 "$MPT/test2" -- "creat test2"
 expect_good "${CLI[@]}" creat -r -s 4096 -S 3 "$MPT/test3" -- "creat test3"
@@ -196,6 +204,10 @@ if [[ "$FAMFS_MODE" == "fuse" ]]; then
         "$(scripts/famfs_shadow.sh /mnt/famfs)/sock" \
         http://localhost/icache_stats \
         -- "icache_stats REST query failed"
+    expect_good sudo curl --unix-socket \
+        "$(scripts/famfs_shadow.sh /mnt/famfs)/sock" \
+        http://localhost/metrics \
+        -- "metrics REST query failed"
 fi
 
 # Unmount and remount
@@ -107,21 +107,95 @@ set_extent_in_bitmap(
  *
  * The two files that are not in the log are the superblock and the log.
  * So these files need to be manually added to the allocation bitmap. This
- * function does that.
+ * function does that, including any segments the log has grown by.
  *
  * @bitmap:    The bitmap
- * @log_len:   Size of the log (superblock size is invariant)
+ * @logp:      The log (superblock size is invariant)
  * @alloc_sum: Amount of space marked as allocated for  the superblock and log
  */
-static inline void
+void
 put_sb_log_into_bitmap(
 	u8 *bitmap,
 	const u64 alloc_unit,
-	u64 log_len,
+	const struct famfs_log *logp,
 	u64 *alloc_sum)
 {
+	const struct famfs_log_seg *seg;
+	u32 i;
+
 	set_extent_in_bitmap(bitmap, alloc_unit, 0,
-			     FAMFS_SUPERBLOCK_SIZE + log_len, alloc_sum);
+			     FAMFS_SUPERBLOCK_SIZE + logp->famfs_log_len,
+			     alloc_sum);
+
+	for (i = 0; i < famfs_log_nsegs(logp); i++) {
+		seg = &famfs_log_packed(logp)->pl_segs[i];
+		if (seg->ls_len != famfs_log_seg_end(logp, i) ||
+		    (seg->ls_offset & (FAMFS_ALLOC_UNIT - 1))) {
+			fprintf(stderr, "%s: invalid log segment %d\n",
+				__func__, i);
+			break;
+		}
+		set_extent_in_bitmap(bitmap, alloc_unit, seg->ls_offset,
+				     seg->ls_len, alloc_sum);
+	}
+}
+
+/**
+ * famfs_bitmap_add_file() - Mark a logged file's extents allocated
+ *
+ * @bitmap:     The bitmap
+ * @alloc_unit: Allocation unit (bytes per bit)
+ * @fm:         File metadata from a (validated) log entry
+ * @alloc_sum:  If non-null, incremented by the newly-allocated bytes
+ *
+ * Return value: the number of allocation units that were already set
+ * (i.e. double allocations)
+ */
+u64
+famfs_bitmap_add_file(
+	u8 *bitmap,
+	const u64 alloc_unit,
+	const struct famfs_log_file_meta *fm,
+	u64 *alloc_sum)
+{
+	const struct famfs_log_fmap *fmap = &fm->fm_fmap;
+	u64 errors = 0;
+	u64 j, k;
+
+	switch (fmap->fmap_ext_type) {
+	case FAMFS_EXT_SIMPLE:
+		/* For each extent in this log entry, mark the bitmap as
+		 * allocated */
+		for (j = 0; j < fmap->fmap_nextents; j++) {
+			u64 ofs = fmap->se[j].se_offset;
+			u64 len = fmap->se[j].se_len;
+
+			assert(!(ofs % alloc_unit));
+			errors += set_extent_in_bitmap(bitmap, alloc_unit,
+						       ofs, len, alloc_sum);
+		}
+		break;
+	case FAMFS_EXT_INTERLEAVE:
+		for (j = 0; j < fmap->fmap_niext; j++) {
+			const struct famfs_interleaved_ext *ie = &fmap->ie[j];
+
+			for (k = 0; k < ie->ie_nstrips; k++) {
+				const struct famfs_simple_extent *se =
+					&ie->ie_strips[k];
+
+				errors += set_extent_in_bitmap(bitmap,
+							       alloc_unit,
+							       se->se_offset,
+							       se->se_len,
+							       alloc_sum);
+			}
+		}
+		break;
+	default:
+		fprintf(stderr, "%s: file %s: bad fmap_ext_type %d\n",
+			__func__, fm->fm_relpath, fmap->fmap_ext_type);
+	}
+	return errors;
 }
 
 /**
@@ -161,8 +235,10 @@ famfs_build_bitmap(const struct famfs_log   *logp,
 					    * collected by logplay */
 	u64 fsize_sum  = 0;
 	u64 alloc_sum = 0;
+	struct famfs_log_iter it;
+	struct famfs_log_entry lebuf;
 	u64 errors = 0;
-	u64 i, j;
+	int rc;
 
 	assert (alloc_unit);
 	assert((alloc_unit & (alloc_unit - 1)) == 0);
@@ -180,84 +256,36 @@ famfs_build_bitmap(const struct famfs_log   *logp,
 	if (!bitmap)
 		return NULL;
 
-	put_sb_log_into_bitmap(bitmap, alloc_unit, logp->famfs_log_len,
-			       &alloc_sum);
+	put_sb_log_into_bitmap(bitmap, alloc_unit, logp, &alloc_sum);
 
-	/* This loop is over all log entries */
-	for (i = 0; i < logp->famfs_log_next_index; i++) {
-		const struct famfs_log_entry *le = &logp->entries[i];
+	/* This loop is over all log entries (and checkpoint records) */
+	famfs_log_iter_init(&it, logp);
+	while ((rc = famfs_log_iter_next(&it, &lebuf)) != 0) {
+		const struct famfs_log_entry *le = &lebuf;
 
 		ls.n_entries++;
 
-		if (famfs_validate_log_entry(le, i)) {
+		if (rc < 0) {
 			ls.bad_entries++;
+			famfs_log_iter_skip(&it);
 			continue;
 		}
 
 		switch (le->famfs_log_entry_type) {
 		case FAMFS_LOG_FILE: {
 			const struct famfs_log_file_meta *fm = &le->famfs_fm;
-			const struct famfs_log_fmap *fmap = &fm->fm_fmap;
-			const struct famfs_log_fmap *ext = &fm->fm_fmap;
-				
+
 			ls.f_logged++;
 			fsize_sum += fm->fm_size;
 
-			switch (fmap->fmap_ext_type) {
-			case FAMFS_EXT_SIMPLE:
-				if (verbose > 1)
-					printf("%s: file=%s size=%lld\n",
-					       __func__,
-					       fm->fm_relpath, fm->fm_size);
-
-				/* For each extent in this log entry,
-				 * mark the bitmap as allocated */
-				for (j = 0; j < fmap->fmap_nextents; j++) {
-					u64 ofs = ext->se[j].se_offset;
-					u64 len = ext->se[j].se_len;
-					int rc;
-
-					assert(!(ofs % alloc_unit));
-
-					rc = set_extent_in_bitmap(bitmap,
-								  alloc_unit,
-								  ofs, len,
-								  &alloc_sum);
-					errors += rc;
-				}
-				break;
-			case FAMFS_EXT_INTERLEAVE: {
-				int nstripes = fmap->fmap_niext;
-				int j;
-				u64 k;
-
-				for (j = 0; j < nstripes; j++) {
-					const struct famfs_interleaved_ext *stripes = &fmap->ie[j];
-
-					for (k = 0; k < stripes[j].ie_nstrips;
-					     k++) {
-						const struct famfs_simple_extent *se =
-							&(stripes[j].ie_strips[k]);
-						u64 ofs = se->se_offset;
-						u64 len = se->se_len;
-						int rc;
-
-						rc = set_extent_in_bitmap(bitmap, alloc_unit,
-									  ofs, len, &alloc_sum);
-						errors += rc;
-					}
-				}
-				break;
-			}
-			default:
-				fprintf(stderr,
-					"%s: entry %lld of %lld: "
-					"bad fmap_ext_type %d\n",
-					__func__, i, logp->famfs_log_next_index,
-					fmap->fmap_ext_type);
-			}
+			if (verbose > 1)
+				printf("%s: file=%s size=%lld\n", __func__,
+				       fm->fm_relpath, fm->fm_size);
+
+			errors += famfs_bitmap_add_file(bitmap, alloc_unit, fm,
+							&alloc_sum);
+			break;
 		}
-		  break;
 		case FAMFS_LOG_MKDIR:
 			ls.d_logged++;
 			/* Ignore directory log entries - no space is used */
@@ -282,7 +310,7 @@ famfs_build_bitmap(const struct famfs_log   *logp,
 		default:
 			fprintf(stderr,
 				"%s: log entry %lld of %lld: bad type (%d)\n",
-				__func__, i, logp->famfs_log_next_index,
+				__func__, it.nread - 1, logp->famfs_log_next_index,
 				le->famfs_log_entry_type);
 			break;
 		}
@@ -456,6 +484,71 @@ out:
 	return rc;
 }
 
+/* Build the allocation bitmap for @lp, if that hasn't been done yet */
+static int
+famfs_locked_log_bitmap(
+	struct famfs_locked_log *lp,
+	int                      verbose)
+{
+	if (lp->bitmap)
+		return 0;
+
+	lp->bitmap = famfs_build_bitmap(lp->logp, lp->alloc_unit,
+					lp->devsize, &lp->nbits,
+					NULL, NULL, NULL, NULL, verbose);
+	if (!lp->bitmap) {
+		fprintf(stderr, "%s: failed to allocate bitmap\n", __func__);
+		return -1;
+	}
+	lp->cur_pos = 0;
+	return 0;
+}
+
+/**
+ * famfs_log_seg_alloc()
+ *
+ * Allocate contiguous space for a log segment. Segments are mapped in 2MiB
+ * pages, so the space is aligned to FAMFS_ALLOC_UNIT even if the allocation
+ * unit is smaller. Nothing is logged: the space belongs to the log once the
+ * segment is linked from the log header (see put_sb_log_into_bitmap()).
+ *
+ * @lp:  locked log struct. Will perform bitmap build if no already done
+ * @len: Size to allocate (a multiple of FAMFS_ALLOC_UNIT)
+ *
+ * Returns the offset, or -ENOMEM if there is no aligned space
+ */
+s64
+famfs_log_seg_alloc(
+	struct famfs_locked_log *lp,
+	u64                      len,
+	int                      verbose)
+{
+	u64 step = MAX(FAMFS_ALLOC_UNIT / lp->alloc_unit, 1);
+	u64 nbits = (len + lp->alloc_unit - 1) / lp->alloc_unit;
+	u64 i, j;
+
+	assert(!(len & (FAMFS_ALLOC_UNIT - 1)));
+
+	if (famfs_locked_log_bitmap(lp, verbose))
+		return -ENOMEM;
+
+	for (i = 0; i + nbits <= lp->nbits; i += step) {
+		for (j = i; j < i + nbits; j++)
+			if (mu_bitmap_test(lp->bitmap, j))
+				break;
+		if (j == i + nbits) {
+			for (j = i; j < i + nbits; j++)
+				mse_bitmap_set32(lp->bitmap, j);
+			return i * lp->alloc_unit;
+		}
+		/* Resume at the first aligned bit past the one that is set */
+		i = (j / step) * step;
+	}
+	fprintf(stderr, "%s: no free %lld byte range for a log segment\n",
+		__func__, len);
+	return -ENOMEM;
+}
+
 /*******************************************************************************
  * Strided allocator stuff
  */
@@ -760,17 +853,9 @@ famfs_file_alloc(
 	struct famfs_log_fmap      **fmap_out,
 	int                          verbose)
 {
-	if (!lp->bitmap) {
-		/* Bitmap is needed and hasn't been built yet */
-		lp->bitmap = famfs_build_bitmap(lp->logp, lp->alloc_unit,
-						lp->devsize, &lp->nbits,
-						NULL, NULL, NULL, NULL, verbose);
-		if (!lp->bitmap) {
-			fprintf(stderr, "%s: failed to allocate bitmap\n", __func__);
-			return -1;
-		}
-		lp->cur_pos = 0;
-	}
+	/* Bitmap is needed and may not have been built yet */
+	if (famfs_locked_log_bitmap(lp, verbose))
+		return -1;
 
 	if ((FAMFS_KABI_VERSION <= 42) && alloc_is_interleaved(lp)) {
 		fprintf(stderr,
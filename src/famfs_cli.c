@@ -32,6 +32,7 @@
 #include "thpool.h"
 #include "famfs_log.h"
 #include "libfcc.h"
+#include "famfs_fused_metrics.h"
 
 /* Long-only option value for --fuse (-f is taken by --force in subcommands
  * that select mode, e.g. fsck). Used to pin the mode for the internal dummy
@@ -1096,6 +1097,234 @@ do_famfs_cli_check(int argc, char *argv[])
 
 /********************************************************************/
 
+void
+famfs_compact_usage(int argc,
+	    char *argv[])
+{
+	char *progname = argv[0];
+	(void)argc;
+
+	printf("\n"
+	       "famfs compact: Compact the metadata log of a famfs file system\n"
+	       "\n"
+	       "Replaces the log entries with a checkpoint that holds one compact record per\n"
+	       "file, directory and daxdev. Clients replay a compacted log faster, and the\n"
+	       "log slots that were in use become free for new files. Clients that are\n"
+	       "following the log notice the compaction and pick it up without remounting.\n"
+	       "\n"
+	       "This must be run on the master node. The checkpoint is stored in free space\n"
+	       "in the log; if there is not enough, compaction fails and nothing changes.\n"
+	       "A compacted log can't be read by famfs versions older than this one.\n"
+	       "\n"
+	       "    %s compact [args] <mount point>\n"
+	       "\n"
+	       "Arguments:\n"
+	       "    -h|-?        - Print this message\n"
+	       "    -v|--verbose - Print a summary of the compaction\n"
+	       "\n", progname);
+}
+
+int
+do_famfs_cli_compact(int argc, char *argv[])
+{
+	char *path = NULL;
+	int verbose = 0;
+	int rc = 0;
+	int c;
+
+	struct option compact_options[] = {
+		/* These options set a */
+		{"verbose",     no_argument,          0,  'v'},
+		{0, 0, 0, 0}
+	};
+
+	/* Note: the "+" at the beginning of the arg string tells getopt_long
+	 * to return -1 when it sees something that is not recognized option
+	 * (e.g. the command that will mux us off to the command handlers
+	 */
+	while ((c = getopt_long(argc, argv, "+h?v",
+				compact_options, &optind)) != EOF) {
+
+		switch (c) {
+
+		case 'h':
+		case '?':
+			famfs_compact_usage(argc, argv);
+			return 0;
+
+		case 'v':
+			verbose++;
+			break;
+		}
+	}
+
+	if (optind > (argc - 1)) {
+		fprintf(stderr, "famfs_compact: Must specify mount point\n");
+		famfs_compact_usage(argc, argv);
+		return EINVAL;
+	}
+
+	path = argv[optind++];
+
+	rc = famfs_compact(path, verbose);
+	return rc;
+}
+
+/********************************************************************/
+
+void
+famfs_growlog_usage(int argc,
+	    char *argv[])
+{
+	char *progname = argv[0];
+	(void)argc;
+
+	printf("\n"
+	       "famfs growlog: Grow the metadata log of a famfs file system\n"
+	       "\n"
+	       "Doubles the space in the log by linking another segment to it. The segment\n"
+	       "is allocated from free space on the device, and is mapped by everything that\n"
+	       "reads the log; clients pick it up without remounting. A log can grow %d\n"
+	       "times, to %d times its size at mkfs time.\n"
+	       "\n"
+	       "This must be run on the master node, and only a packed log can grow\n"
+	       "(mkfs.famfs --packed-log). A grown log can't be read by famfs versions older\n"
+	       "than this one.\n"
+	       "\n"
+	       "    %s growlog [args] <mount point>\n"
+	       "\n"
+	       "Arguments:\n"
+	       "    -h|-?        - Print this message\n"
+	       "    -v|--verbose - Print the new log size\n"
+	       "\n", FAMFS_LOG_MAX_SEGS, 1 << FAMFS_LOG_MAX_SEGS, progname);
+}
+
+int
+do_famfs_cli_growlog(int argc, char *argv[])
+{
+	char *path = NULL;
+	int verbose = 0;
+	int rc = 0;
+	int c;
+
+	struct option growlog_options[] = {
+		/* These options set a */
+		{"verbose",     no_argument,          0,  'v'},
+		{0, 0, 0, 0}
+	};
+
+	/* Note: the "+" at the beginning of the arg string tells getopt_long
+	 * to return -1 when it sees something that is not recognized option
+	 * (e.g. the command that will mux us off to the command handlers
+	 */
+	while ((c = getopt_long(argc, argv, "+h?v",
+				growlog_options, &optind)) != EOF) {
+
+		switch (c) {
+
+		case 'h':
+		case '?':
+			famfs_growlog_usage(argc, argv);
+			return 0;
+
+		case 'v':
+			verbose++;
+			break;
+		}
+	}
+
+	if (optind > (argc - 1)) {
+		fprintf(stderr, "famfs_growlog: Must specify mount point\n");
+		famfs_growlog_usage(argc, argv);
+		return EINVAL;
+	}
+
+	path = argv[optind++];
+
+	rc = famfs_grow_log(path, verbose);
+	return rc;
+}
+
+/********************************************************************/
+
+void
+famfs_master_usage(int argc,
+	    char *argv[])
+{
+	char *progname = argv[0];
+	(void)argc;
+
+	printf("\n"
+	       "famfs master: Run the master metadata service for a famfs file system\n"
+	       "\n"
+	       "Each famfs creat, mkdir or cp sets up a session with the metadata log:\n"
+	       "it validates the superblock, locks and maps the log, and builds the\n"
+	       "allocation bitmap. The master service sets that session up once and keeps\n"
+	       "it, and those commands send their creations to it over a unix socket\n"
+	       "(under %s, or $FAMFS_MASTER_DIR). This speeds up automation that creates\n"
+	       "files one or a few at a time. The commands work the same way whether or\n"
+	       "not the service is running.\n"
+	       "\n"
+	       "The service runs in the foreground until it gets SIGINT or SIGTERM. It\n"
+	       "holds the log lock, so commands that need the log itself (compact,\n"
+	       "growlog, ...) wait for it to exit. This must be run on the master node.\n"
+	       "\n"
+	       "    %s master [args] <mount point>\n"
+	       "\n"
+	       "Arguments:\n"
+	       "    -h|-?        - Print this message\n"
+	       "    -v|--verbose - Print each request\n"
+	       "\n", FAMFS_MASTER_DIR, progname);
+}
+
+int
+do_famfs_cli_master(int argc, char *argv[])
+{
+	char *path = NULL;
+	int verbose = 0;
+	int rc = 0;
+	int c;
+
+	struct option master_options[] = {
+		/* These options set a */
+		{"verbose",     no_argument,          0,  'v'},
+		{0, 0, 0, 0}
+	};
+
+	/* Note: the "+" at the beginning of the arg string tells getopt_long
+	 * to return -1 when it sees something that is not recognized option
+	 * (e.g. the command that will mux us off to the command handlers
+	 */
+	while ((c = getopt_long(argc, argv, "+h?v",
+				master_options, &optind)) != EOF) {
+
+		switch (c) {
+
+		case 'h':
+		case '?':
+			famfs_master_usage(argc, argv);
+			return 0;
+
+		case 'v':
+			verbose++;
+			break;
+		}
+	}
+
+	if (optind > (argc - 1)) {
+		fprintf(stderr, "famfs_master: Must specify mount point\n");
+		famfs_master_usage(argc, argv);
+		return EINVAL;
+	}
+
+	path = argv[optind++];
+
+	rc = famfs_master_serve(path, verbose);
+	return rc;
+}
+
+/********************************************************************/
+
 void
 famfs_getmap_usage(int argc,
 	    char *argv[])
@@ -2028,7 +2257,9 @@ famfs_verify_usage(int argc,
 	       "    -m|--multi <filename>,<seed> - Verify multiple files in parallel\n"
 	       "                                   (specify with multiple instances of this arg)\n"
 	       "                                   (cannot combine with separate args)\n"
-	       "    -t|--threadct <nthreads>     - Thread count in --multi mode\n"
+	       "    -t|--threadct <nthreads>     - Thread count; in --multi mode files are\n"
+	       "                                   verified in parallel, otherwise ranges\n"
+	       "                                   of a single file are (default: ncpus)\n"
 	       "\n", progname);
 }
 
@@ -2053,12 +2284,89 @@ free_multi_verify(struct multi_verify *mv, int multi_count)
 	free(mv);
 }
 
+/* Files are verified in chunks of this size when range threads are used;
+ * must be a multiple of RB_BLOCK_SIZE */
+#define VERIFY_CHUNK_SIZE (64UL * 1024 * 1024)
+
+struct verify_range {
+	char *addr;
+	unsigned int seed;  /* As randomize_buffer() took it */
+	size_t offset;
+	size_t len;
+	s64 rc;      /* -1 if the range verified, else offset of miscompare */
+};
+
+static void
+threaded_verify_range(void *arg)
+{
+	struct verify_range *vr = arg;
+
+	assert(vr);
+	invalidate_processor_cache(vr->addr + vr->offset, vr->len);
+	vr->rc = validate_random_buffer_range(vr->addr + vr->offset, vr->len,
+					      vr->offset, vr->seed);
+}
+
+/**
+ * verify_ranges() - Verify a mapped file in parallel
+ *
+ * @addr:     Address where the file is mapped
+ * @fsize:    Size of the file
+ * @seed:     Seed that the file was randomized with
+ * @threadct: Number of threads
+ *
+ * The file is split into VERIFY_CHUNK_SIZE chunks; each worker invalidates
+ * and validates its own chunk. The file was written by randomize_buffer(),
+ * which takes an unsigned int seed, so @seed is truncated the same way here.
+ *
+ * Returns -1 if the whole file verified, or the lowest miscompare offset
+ */
+static s64
+verify_ranges(char *addr, size_t fsize, s64 seed, int threadct)
+{
+	struct verify_range *vr;
+	threadpool thp;
+	size_t nchunks;
+	s64 rc = -1;
+	size_t i;
+
+	nchunks = (fsize + VERIFY_CHUNK_SIZE - 1) / VERIFY_CHUNK_SIZE;
+	vr = calloc(nchunks, sizeof(*vr));
+	thp = (vr) ? thpool_init(threadct) : NULL;
+	if (!thp) {
+		/* Fall back to verifying the whole file in this thread */
+		free(vr);
+		invalidate_processor_cache(addr, fsize);
+		return validate_random_buffer_range(addr, fsize, 0,
+						    (unsigned int)seed);
+	}
+
+	for (i = 0; i < nchunks; i++) {
+		vr[i].addr = addr;
+		vr[i].seed = (unsigned int)seed;
+		vr[i].offset = i * VERIFY_CHUNK_SIZE;
+		vr[i].len = MIN(VERIFY_CHUNK_SIZE, fsize - vr[i].offset);
+		thpool_add_work(thp, threaded_verify_range, (void *)&vr[i]);
+	}
+	thpool_wait(thp);
+	famfs_thpool_destroy(thp, 100000 /* 100ms */);
+
+	/* Chunks are in file order, so the first failure is the lowest */
+	for (i = 0; i < nchunks; i++) {
+		if (vr[i].rc != -1) {
+			rc = vr[i].rc;
+			break;
+		}
+	}
+	free(vr);
+	return rc;
+}
+
 static int
-verify_one(const char *filename, s64 seed, int quiet)
+verify_one(const char *filename, s64 seed, int quiet, int threadct)
 {
 	size_t fsize;
 	void *addr;
-	char *buf;
 	int fd;
 	s64 rc;
 
@@ -2081,11 +2389,18 @@ verify_one(const char *filename, s64 seed, int quiet)
 	addr = famfs_mmap_whole_file(filename, 0, &fsize);
 	if (!addr) {
 		fprintf(stderr, "%s: randomize mmap failed\n", __func__);
+		close(fd);
 		return 1;
 	}
-	invalidate_processor_cache(addr, fsize);
-	buf = (char *)addr;
-	rc = validate_random_buffer(buf, fsize, seed);
+	if (threadct > 1 && fsize > VERIFY_CHUNK_SIZE)
+		rc = verify_ranges((char *)addr, fsize, seed, threadct);
+	else {
+		invalidate_processor_cache(addr, fsize);
+		rc = validate_random_buffer((char *)addr, fsize, seed);
+	}
+	munmap(addr, fsize);
+	close(fd);
+
 	if (rc == -1) {
 		if (!quiet)
 			printf("Success: verified %ld bytes in file %s\n",
@@ -2105,7 +2420,8 @@ threaded_verify(void *arg)
 	struct multi_verify *mv = arg;
 
 	assert(mv);
-	mv->rc = verify_one(mv->fname, mv->seed, mv->quiet);
+	/* Parallelism is across files here, not within them */
+	mv->rc = verify_one(mv->fname, mv->seed, mv->quiet, 1);
 }
 
 static int
@@ -2252,7 +2568,7 @@ do_famfs_cli_verify(int argc, char *argv[])
 	}
 
 	if (!mv)
-		rc = verify_one(filename, seed, quiet);
+		rc = verify_one(filename, seed, quiet, threadct);
 	else
 		rc = verify_multi(mv, multi_count, threadct, quiet);
 
@@ -2513,6 +2829,163 @@ do_famfs_cli_chkread(int argc, char *argv[])
 
 /********************************************************************/
 
+void
+famfs_trace_usage(int argc,
+	    char *argv[])
+{
+	char *progname = argv[0];
+	(void)argc;
+
+	printf("\n"
+	       "famfs trace: dump the request trace of a fuse-mounted famfs\n"
+	       "\n"
+	       "famfs_fused records every request it handles in a per-thread ring.\n"
+	       "This fetches the rings through the daemon's REST socket and prints\n"
+	       "one line per request, oldest first: time (CLOCK_MONOTONIC seconds),\n"
+	       "thread, cpu, operation, nodeid, duration and result (errno).\n"
+	       "\n"
+	       "    %s trace [args] <mount point>\n"
+	       "\n"
+	       "Arguments:\n"
+	       "    -f           - Follow: keep polling for new requests\n"
+	       "    -i <msec>    - Poll interval for -f (default 1000)\n"
+	       "    -s <usec>    - Only show requests that took at least this long\n"
+	       "    -h|-?        - Print this message\n"
+	       "\n", progname);
+}
+
+/* Print the records in a /trace reply; returns the latest completion time
+ * seen, for the next poll's ?since= */
+static u64
+famfs_trace_decode(const char *buf, size_t len, u64 min_ns, u64 newest)
+{
+	const struct famfs_trace_hdr *hdr = (const void *)buf;
+	const struct famfs_trace_rec *recs;
+	u64 i;
+
+	if (len < sizeof(*hdr) || hdr->magic != FAMFS_TRACE_MAGIC) {
+		fprintf(stderr, "%s: not a famfs trace\n", __func__);
+		return newest;
+	}
+	if (hdr->version != FAMFS_TRACE_VERSION ||
+	    hdr->rec_size != sizeof(*recs) ||
+	    len < sizeof(*hdr) + hdr->nrecs * sizeof(*recs)) {
+		fprintf(stderr, "%s: unsupported trace version %d\n",
+			__func__, hdr->version);
+		return newest;
+	}
+	if (hdr->lost)
+		fprintf(stderr, "%s: %lld records overwritten during dump\n",
+			__func__, hdr->lost);
+
+	recs = (const void *)(buf + sizeof(*hdr));
+	for (i = 0; i < hdr->nrecs; i++) {
+		const struct famfs_trace_rec *r = &recs[i];
+
+		if (r->start_ns + r->dur_ns > newest)
+			newest = r->start_ns + r->dur_ns;
+		if (r->dur_ns < min_ns)
+			continue;
+		printf("%llu.%09llu %7u %3u %-12s 0x%-16llx %10.3f us %d\n",
+		       (unsigned long long)(r->start_ns / 1000000000ULL),
+		       (unsigned long long)(r->start_ns % 1000000000ULL),
+		       r->tid, r->cpu, famfs_metrics_op_name(r->op),
+		       (unsigned long long)r->nodeid,
+		       (double)r->dur_ns / 1000.0, r->result);
+	}
+	fflush(stdout);
+	return newest;
+}
+
+int
+do_famfs_cli_trace(int argc, char *argv[])
+{
+	char shadow[PATH_MAX];
+	char sock_path[PATH_MAX];
+	char url[64];
+	int interval_ms = 1000;
+	u64 min_ns = 0;
+	u64 newest = 0;
+	int follow = 0;
+	char *mpt;
+	int rc;
+	int c;
+
+	struct option trace_options[] = {
+		/* These options set a */
+		{0, 0, 0, 0}
+	};
+
+	/* Note: the "+" at the beginning of the arg string tells getopt_long
+	 * to return -1 when it sees something that is not recognized option
+	 * (e.g. the command that will mux us off to the command handlers
+	 */
+	while ((c = getopt_long(argc, argv, "+fi:s:h?",
+				trace_options, &optind)) != EOF) {
+
+		switch (c) {
+		case 'f':
+			follow = 1;
+			break;
+		case 'i':
+			interval_ms = atoi(optarg);
+			break;
+		case 's':
+			min_ns = strtoull(optarg, NULL, 0) * 1000;
+			break;
+		case 'h':
+		case '?':
+			famfs_trace_usage(argc, argv);
+			return 0;
+		}
+	}
+
+	if (optind > (argc - 1)) {
+		fprintf(stderr, "%s: must specify mount point\n", __func__);
+		famfs_trace_usage(argc, argv);
+		return -1;
+	}
+	mpt = argv[optind++];
+
+	rc = famfs_get_shadow_from_xattr(mpt, shadow, sizeof(shadow));
+	if (rc < 0) {
+		fprintf(stderr, "%s: %s is not a fuse-mounted famfs\n",
+			__func__, mpt);
+		return -1;
+	}
+	rc = snprintf(sock_path, sizeof(sock_path), "%s/sock", shadow);
+	if (rc < 0 || (size_t)rc >= sizeof(sock_path)) {
+		fprintf(stderr, "%s: socket path too long: %s/sock\n",
+			__func__, shadow);
+		return -1;
+	}
+
+	do {
+		char *response = NULL;
+		size_t len = 0;
+		long http_code = 0;
+
+		snprintf(url, sizeof(url), "/trace?since=%llu",
+			 (unsigned long long)newest);
+		rc = famfs_http_get_uds(sock_path, url, &response, &len,
+					&http_code);
+		if (rc) {
+			fprintf(stderr, "%s: trace request failed (%d, http %ld)\n",
+				__func__, rc, http_code);
+			return -1;
+		}
+		newest = famfs_trace_decode(response, len, min_ns, newest);
+		free(response);
+
+		if (follow)
+			usleep(interval_ms * 1000);
+	} while (follow);
+
+	return 0;
+}
+
+/********************************************************************/
+
 
 struct famfs_cli_cmd {
 	char *cmd;
@@ -2528,6 +3001,9 @@ famfs_cli_cmd famfs_cli_cmds[] = {
 	{"mount",   do_famfs_cli_mount,   famfs_mount_usage},
 	{"fsck",    do_famfs_cli_fsck,    famfs_fsck_usage},
 	{"check",   do_famfs_cli_check,   famfs_check_usage},
+	{"compact", do_famfs_cli_compact, famfs_compact_usage},
+	{"growlog", do_famfs_cli_growlog, famfs_growlog_usage},
+	{"master",  do_famfs_cli_master,  famfs_master_usage},
 	{"mkdir",   do_famfs_cli_mkdir,   famfs_mkdir_usage},
 	{"cp",      do_famfs_cli_cp,      famfs_cp_usage},
 	{"creat",   do_famfs_cli_creat,   famfs_creat_usage},
@@ -2538,6 +3014,7 @@ famfs_cli_cmd famfs_cli_cmds[] = {
 	{"getmap",  do_famfs_cli_getmap,  famfs_getmap_usage},
 	{"clone",   do_famfs_cli_clone,   famfs_clone_usage},
 	{"chkread", do_famfs_cli_chkread, famfs_chkread_usage},
+	{"trace",   do_famfs_cli_trace,   famfs_trace_usage},
 
 	{NULL, NULL, NULL}
 };
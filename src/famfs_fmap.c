@@ -195,6 +195,11 @@ out_free:
 		
 }
 
+/*
+ * Serialize a file's fmap into the message format of the fuse GET_FMAP reply.
+ * This is quiet (no printing) - famfs_fused serializes once per inode at
+ * lookup time and replies from the cached message.
+ */
 ssize_t
 famfs_log_file_meta_to_msg(
 	char *msg,
@@ -227,9 +232,6 @@ famfs_log_file_meta_to_msg(
 
 	cursor += sizeof(*flh);
 
-	printf("%s: size=%ld ext_type=%d nextents=%d\n",
-	       __func__, flh->file_size, flh->ext_type, flh->nextents);
-	famfs_emit_file_yaml(fmeta, stdout); /* needs famfs_lib.h */
 	switch (log_fmap->fmap_ext_type) {
 	case FUSE_FAMFS_EXT_SIMPLE: {
 		struct fuse_famfs_simple_ext *se = (struct fuse_famfs_simple_ext *)&msg[cursor];
@@ -268,9 +270,6 @@ famfs_log_file_meta_to_msg(
 			ie[i].ie_chunk_size = log_fmap->ie[i].ie_chunk_size;
 			ie[i].ie_nbytes = fmeta->fm_size;
 
-			printf("%s: ie[%d] nstrips=%d chunk=%d nbytes=%ld\n",
-			       __func__, i, ie[i].ie_nstrips, ie[i].ie_chunk_size,
-			       ie[i].ie_nbytes);
 			se = (struct fmap_simple_ext *)&msg[cursor];
 
 			cursor += ie[i].ie_nstrips * sizeof(*se);
@@ -279,8 +278,6 @@ famfs_log_file_meta_to_msg(
 
 			memset(se, 0, ie[i].ie_nstrips * sizeof(*se));
 
-			printf("%s: interleaved ext %d: strips=%d\n",
-			       __func__, i, ie[i].ie_nstrips);
 			/* Strip extents into msg */
 			for (j = 0; j < ie[i].ie_nstrips; j++) {
 				const struct famfs_simple_extent *strips =
@@ -28,8 +28,12 @@
 #include <sys/param.h> /* MAX() (fuse_i.h provides its own MIN) */
 #include <sys/file.h>
 #include <sys/xattr.h>
+#include <sys/syscall.h>
 #include <systemd/sd-journal.h>
 #include <signal.h>
+#include <sched.h>
+#include <sys/sysinfo.h>
+#include <sys/resource.h>
 
 #include "famfs_lib.h"
 #include "famfs_fmap.h"
@@ -41,6 +45,11 @@
 #include "famfs_fused.h"
 #include "famfs_fused_icache.h"
 #include "famfs_fused_rest.h"
+#include "famfs_fused_logtail.h"
+#include "famfs_fused_metrics.h"
+#include "famfs_fused_memns.h"
+#include "famfs_fused_statfs.h"
+#include "famfs_fused_warmup.h"
 
 #ifdef FAMFS_COVERAGE
 extern void __gcov_dump(void);
@@ -127,7 +136,18 @@ famfs_dump_opts(const struct famfs_ctx *fd)
 	famfs_log(FAMFS_LOG_DEBUG, "    timeout=%f\n", fd->timeout);
 	famfs_log(FAMFS_LOG_DEBUG, "    cache=%d\n", fd->cache);
 	famfs_log(FAMFS_LOG_DEBUG, "    timeout_set=%d\n", fd->timeout_set);
+	famfs_log(FAMFS_LOG_DEBUG, "    negative_timeout=%f (set=%d)\n",
+		  fd->neg_timeout, fd->neg_timeout_set);
 	famfs_log(FAMFS_LOG_DEBUG, "    pass_yaml=%d\n", fd->pass_yaml);
+	famfs_log(FAMFS_LOG_DEBUG, "    uring=%d\n", fd->uring);
+	famfs_log(FAMFS_LOG_DEBUG, "    memns=%d\n", fd->memns);
+	famfs_log(FAMFS_LOG_DEBUG, "    logtail_ms=%d\n", fd->logtail_ms);
+	famfs_log(FAMFS_LOG_DEBUG, "    warmup=%d paths=%s threads=%d\n",
+		  fd->warmup, fd->warmup_paths ? fd->warmup_paths : "(all)",
+		  fd->warmup_threads);
+	famfs_log(FAMFS_LOG_DEBUG, "    icache_max_mb=%d icache_max_fds=%d\n",
+		  fd->icache_max_mb, fd->icache_max_fds);
+	famfs_log(FAMFS_LOG_DEBUG, "    trace_entries=%d\n", fd->trace_entries);
 }
 
 /*
@@ -150,6 +170,14 @@ static const struct fuse_opt famfs_opts[] = {
 	  offsetof(struct famfs_ctx, timeout), 0 },
 	{ "timeout=",
 	  offsetof(struct famfs_ctx, timeout_set), 1 },
+	{ "negative_timeout=%lf",
+	  offsetof(struct famfs_ctx, neg_timeout), 0 },
+	{ "negative_timeout=",
+	  offsetof(struct famfs_ctx, neg_timeout_set), 1 },
+	{ "neg_timeout=%lf",
+	  offsetof(struct famfs_ctx, neg_timeout), 0 },
+	{ "neg_timeout=",
+	  offsetof(struct famfs_ctx, neg_timeout_set), 1 },
 	{ "cache=never",
 	  offsetof(struct famfs_ctx, cache), CACHE_NEVER },
 	{ "cache=auto",
@@ -160,6 +188,28 @@ static const struct fuse_opt famfs_opts[] = {
 	  offsetof(struct famfs_ctx, readdirplus), 1 },
 	{ "no_readdirplus",
 	  offsetof(struct famfs_ctx, readdirplus), 0 },
+	{ "uring",
+	  offsetof(struct famfs_ctx, uring), 1 },
+	{ "no_uring",
+	  offsetof(struct famfs_ctx, uring), 0 },
+	{ "memns",
+	  offsetof(struct famfs_ctx, memns), 1 },
+	{ "logtail",
+	  offsetof(struct famfs_ctx, logtail_ms), FAMFS_LOGTAIL_DEFAULT_MS },
+	{ "logtail=%d",
+	  offsetof(struct famfs_ctx, logtail_ms), 0 },
+	{ "warmup",
+	  offsetof(struct famfs_ctx, warmup), 1 },
+	{ "warmup=%s",
+	  offsetof(struct famfs_ctx, warmup_paths), 0 },
+	{ "warmup_threads=%d",
+	  offsetof(struct famfs_ctx, warmup_threads), 0 },
+	{ "icache_max_mb=%d",
+	  offsetof(struct famfs_ctx, icache_max_mb), 0 },
+	{ "icache_max_fds=%d",
+	  offsetof(struct famfs_ctx, icache_max_fds), 0 },
+	{ "trace=%d",
+	  offsetof(struct famfs_ctx, trace_entries), 0 },
 	{ "debug=%d",
 	  offsetof(struct famfs_ctx, debug), 0 },
 
@@ -189,9 +239,29 @@ static void famfs_fused_help(void)
 "    -o no_flock            Disable flock\n"
 "    -o timeout=1.0         Caching timeout\n"
 "    -o timeout=0/1         Timeout is set\n"
+"    -o negative_timeout=T  Cache lookups of missing names for T seconds\n"
+"                           (default 0; alias neg_timeout=T). A name\n"
+"                           created on this node may stay hidden until\n"
+"                           the log tailer plays it\n"
 "    -o cache=never         Disable cache\n"
 "    -o cache=auto          Auto enable cache\n"
-"    -o cache=always        Cache always\n");
+"    -o cache=always        Cache always\n"
+"    -o uring               Use FUSE-over-io_uring if the kernel and\n"
+"                           libfuse support it (else /dev/fuse)\n"
+"    -o memns               Serve the namespace from memory, built from\n"
+"                           the log (requires daxdev)\n"
+"    -o logtail[=ms]        Follow the log and apply new entries\n"
+"                           (poll interval, default 100ms)\n"
+"    -o warmup[=dir:dir]    Cache all files (or these subtrees) at\n"
+"                           startup\n"
+"    -o warmup_threads=N    Threads for warmup (default 8)\n"
+"    -o icache_max_mb=N     Keep unreferenced inodes cached, evicting\n"
+"                           the least recently used beyond N MiB\n"
+"    -o icache_max_fds=N    Max open directory fds; cold ones are closed\n"
+"                           and reopened on demand (default: half of\n"
+"                           RLIMIT_NOFILE; -1 for no limit)\n"
+"    -o trace=N             Requests kept per thread in the trace ring\n"
+"                           (default 4096; 0 to disable)\n");
 }
 
 static struct famfs_ctx *famfs_ctx_from_req(fuse_req_t req)
@@ -199,6 +269,36 @@ static struct famfs_ctx *famfs_ctx_from_req(fuse_req_t req)
 	return (struct famfs_ctx *) fuse_req_userdata(req);
 }
 
+/*
+ * Count a request against the queue it arrived on. With FUSE-over-io_uring
+ * the kernel has one ring per CPU and a request is handled on its ring's
+ * CPU, so the CPU is the queue; with /dev/fuse it is the CPU of the worker
+ * thread that picked the request up.
+ */
+static inline void
+famfs_req_account(fuse_req_t req)
+{
+	struct famfs_ctx *lo = famfs_ctx_from_req(req);
+	int cpu;
+
+	if (!lo->queue_stats)
+		return;
+
+	cpu = sched_getcpu();
+	if (cpu < 0)
+		cpu = 0;
+	__atomic_add_fetch(&lo->queue_stats[cpu % lo->nqueues].nreq, 1,
+			   __ATOMIC_RELAXED);
+}
+
+/* Reply with an error, and note it for the request trace */
+static inline void
+famfs_reply_err(fuse_req_t req, int err)
+{
+	famfs_req_result = err;
+	fuse_reply_err(req, err);
+}
+
 #if 0
 static bool famfs_debug(fuse_req_t req)
 {
@@ -219,6 +319,25 @@ static void famfs_init(
 		conn->want |= FUSE_CAP_FLOCK_LOCKS;
 	}
 
+	if (lo->uring) {
+#ifdef FUSE_CAP_OVER_IO_URING
+		if (conn->capable_ext & FUSE_CAP_OVER_IO_URING) {
+			conn->want_ext |= FUSE_CAP_OVER_IO_URING;
+			lo->uring_active = 1;
+			famfs_log(FAMFS_LOG_NOTICE,
+				  "%s: using FUSE-over-io_uring\n", __func__);
+		} else {
+			famfs_log(FAMFS_LOG_NOTICE,
+				  "%s: kernel lacks FUSE-over-io_uring; "
+				  "using /dev/fuse\n", __func__);
+		}
+#else
+		famfs_log(FAMFS_LOG_NOTICE,
+			  "%s: libfuse built without io_uring; "
+			  "using /dev/fuse\n", __func__);
+#endif
+	}
+
 	if (conn->capable & FUSE_CAP_PASSTHROUGH)
 		famfs_log(FAMFS_LOG_NOTICE, "%s: Kernel is passthrough-capable\n",
 			 __func__);
@@ -243,6 +362,11 @@ static void famfs_destroy(void *userdata)
 	(void)userdata; /* icache is destroyed in main() after fuse_session_unmount */
 }
 
+#ifdef FUSE_DEV_IOC_DAXDEV_OPEN
+static void famfs_push_daxdevs(fuse_req_t req, struct famfs_ctx *lo,
+			       int maxdev);
+#endif
+
 static void
 famfs_getattr(
 	fuse_req_t req,
@@ -256,25 +380,34 @@ famfs_getattr(
 	int res;
 
 	(void) fi;
+	famfs_req_account(req);
 
 	/*
 	 * Root inode is a special case that is not looked up before getattr.
 	 * All other inodes have been looked up, and therefore already know
 	 * their attrs
 	 */
-	if (nodeid == FUSE_ROOT_ID) {
+	if (nodeid == FUSE_ROOT_ID && !lo->memns) {
 		famfs_log(FAMFS_LOG_NOTICE, "%s: root inode\n", __func__);
 		res = fstatat(inode->fd, "", &buf,
 			      AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW);
 		if (res == -1) {
 			famfs_inode_putref(inode);
-			return (void) fuse_reply_err(req, errno);
+			return (void) famfs_reply_err(req, errno);
 		}
-		inode->attr = buf;
+		famfs_inode_set_attr(inode, &buf);
+	} else {
+		famfs_inode_get_attr(inode, &buf);
 	}
 
-	log_file_mode(__func__, inode->name, &inode->attr, FAMFS_LOG_DEBUG);
-	buf = inode->attr;
+#ifdef FUSE_DEV_IOC_DAXDEV_OPEN
+	/* The first request on a new mount is a GETATTR of the root: register
+	 * the whole daxdev table then, before any file is looked up */
+	if (nodeid == FUSE_ROOT_ID && lo->daxdev)
+		famfs_push_daxdevs(req, lo, -1);
+#endif
+
+	log_file_mode(__func__, inode->name, &buf, FAMFS_LOG_DEBUG);
 	famfs_inode_putref(inode);
 	fuse_reply_attr(req, &buf, lo->timeout);
 }
@@ -294,6 +427,8 @@ famfs_setattr(
 	int errs = 0;
 	(void)fi;
 
+	famfs_req_account(req);
+
 	/*
 	 * Setattr makes ephemeral changes to famfs. The authority is the
 	 * metadata log.
@@ -305,8 +440,9 @@ famfs_setattr(
 	 * because the the copy in the icache will be used.
 	 */
 
-	buf = inode->attr; /* grab a copy from the icached inode */
-	log_file_mode(__func__, inode->name, &inode->attr, FAMFS_LOG_NOTICE);
+	/* grab a copy from the icached inode */
+	famfs_inode_get_attr(inode, &buf);
+	log_file_mode(__func__, inode->name, &buf, FAMFS_LOG_NOTICE);
 
 	/* Update the attr */
 	if (valid & FUSE_SET_ATTR_MODE)
@@ -325,12 +461,11 @@ famfs_setattr(
 
 	if (errs) {
 		famfs_log(FAMFS_LOG_DEBUG, "%s: ENOTSUP\n", __func__);
-		fuse_reply_err(req, EINVAL);
+		famfs_reply_err(req, EINVAL);
 	} else {
-		inode->attr = buf; /* replace with changed attr */
+		famfs_inode_set_attr(inode, &buf); /* replace with changed attr */
 		inode->pinned = 1;
-		log_file_mode("after:", inode->name, &inode->attr,
-			      FAMFS_LOG_NOTICE);
+		log_file_mode("after:", inode->name, &buf, FAMFS_LOG_NOTICE);
 		fuse_reply_attr(req, &buf, lo->timeout);
 	}
 	famfs_inode_putref(inode);
@@ -338,14 +473,78 @@ famfs_setattr(
 
 #define FMAP_MSG_MAX 4096
 
+/* Highest daxdev index referenced by a file's fmap (-1 if none) */
+static int
+famfs_fmeta_max_devindex(const struct famfs_log_file_meta *fmeta)
+{
+	const struct famfs_log_fmap *fmap = &fmeta->fm_fmap;
+	int maxdev = -1;
+	u32 i, j;
+
+	switch (fmap->fmap_ext_type) {
+	case FAMFS_EXT_SIMPLE:
+		for (i = 0; i < fmap->fmap_nextents; i++)
+			maxdev = MAX(maxdev, (int)fmap->se[i].se_devindex);
+		break;
+	case FAMFS_EXT_INTERLEAVE:
+		for (i = 0; i < fmap->fmap_niext; i++)
+			for (j = 0; j < fmap->ie[i].ie_nstrips; j++)
+				maxdev = MAX(maxdev,
+					     (int)fmap->ie[i].ie_strips[j].se_devindex);
+		break;
+	default:
+		break;
+	}
+	return maxdev;
+}
+
+/**
+ * famfs_fmap_alloc() - build the compact fmap for a file
+ *
+ * The GET_FMAP reply is serialized once per inode, at lookup time, and
+ * famfs_get_fmap() replies from it as-is. The fmeta is not needed after this.
+ *
+ * Returns an fmap allocated from the icache pools, holding one ref (drop it
+ * with famfs_fmap_free()), or NULL on failure
+ */
+struct famfs_fmap *
+famfs_fmap_alloc(
+	struct famfs_icache *icache,
+	const struct famfs_log_file_meta *fmeta)
+{
+	char buf[FMAP_MSG_MAX];
+	struct famfs_fmap *fmap;
+	ssize_t fmap_size;
+
+	memset(buf, 0, sizeof(buf));
+	/* XXX: FUSE_FAMFS_FILE_REG - mark sb and log correctly */
+	fmap_size = famfs_log_file_meta_to_msg(buf, sizeof(buf),
+					       FUSE_FAMFS_FILE_REG, fmeta);
+	if (fmap_size <= 0) {
+		famfs_log(FAMFS_LOG_ERR,
+			  "%s: %ld error putting fmap in message\n",
+			  __func__, fmap_size);
+		return NULL;
+	}
+
+	fmap = famfs_icache_mem_alloc(icache, sizeof(*fmap) + fmap_size);
+	if (!fmap)
+		return NULL;
+	fmap->size = fmap_size;
+	fmap->refcount = 1;
+	fmap->max_devindex = famfs_fmeta_max_devindex(fmeta);
+	memcpy(fmap->msg, buf, fmap_size);
+	return fmap;
+}
+
 static int
 famfs_check_inode(
 	struct famfs_inode *inode,
-	struct famfs_log_file_meta *fmeta,
+	struct famfs_fmap *fmap,
 	struct fuse_entry_param *e)
 {
 	(void)inode;
-	(void)fmeta;
+	(void)fmap;
 	(void)e;
 	/* e->attr is struct stat */
 
@@ -422,6 +621,39 @@ famfs_push_one_daxdev(fuse_req_t req, struct famfs_ctx *lo, int devindex)
 	return 0;
 }
 
+/*
+ * Once every device is registered - the common case, from the first request
+ * on - this is a single atomic load. The mutex is only taken when there is
+ * something to push; daxdev_max_pushed is published with a release store
+ * after the push succeeds, so a lookup that sees it never gets ahead of the
+ * kernel's registration.
+ *
+ * Whatever index is asked for, the whole daxdev table is pushed along with
+ * it, so a multi-device mount registers all its devices on the first push
+ * rather than one contended push at a time as files on each device are
+ * looked up.
+ */
+static void
+famfs_push_daxdevs(fuse_req_t req, struct famfs_ctx *lo, int maxdev)
+{
+	int pushed;
+
+	maxdev = MAX(maxdev, lo->max_daxdevs - 1);
+	if (__atomic_load_n(&lo->daxdev_max_pushed, __ATOMIC_ACQUIRE) >= maxdev)
+		return;
+
+	pthread_mutex_lock(&lo->daxdev_push_mutex);
+	pushed = lo->daxdev_max_pushed;
+	while (pushed < maxdev) {
+		if (famfs_push_one_daxdev(req, lo, pushed + 1) != 0)
+			break; /* can't densely push the next index; retry later */
+		pushed++;
+		__atomic_store_n(&lo->daxdev_max_pushed, pushed,
+				 __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&lo->daxdev_push_mutex);
+}
+
 /*
  * famfs_push_fmap_daxdevs() - ensure every daxdev an fmap references is
  * registered with the kernel. Called at lookup time, where the file's fmap is
@@ -438,54 +670,124 @@ famfs_push_one_daxdev(fuse_req_t req, struct famfs_ctx *lo, int devindex)
  */
 static void
 famfs_push_fmap_daxdevs(fuse_req_t req, struct famfs_ctx *lo,
-			const struct famfs_log_file_meta *fmeta)
+			const struct famfs_fmap *fmap)
 {
-	const struct famfs_log_fmap *fmap = &fmeta->fm_fmap;
-	int maxdev = -1;
-	u32 i, j;
+	famfs_push_daxdevs(req, lo, fmap->max_devindex);
+}
+#endif /* FUSE_DEV_IOC_DAXDEV_OPEN */
 
-	switch (fmap->fmap_ext_type) {
-	case FAMFS_EXT_SIMPLE:
-		for (i = 0; i < fmap->fmap_nextents; i++)
-			maxdev = MAX(maxdev, (int)fmap->se[i].se_devindex);
-		break;
-	case FAMFS_EXT_INTERLEAVE:
-		for (i = 0; i < fmap->fmap_niext; i++)
-			for (j = 0; j < fmap->ie[i].ie_nstrips; j++)
-				maxdev = MAX(maxdev,
-					     (int)fmap->ie[i].ie_strips[j].se_devindex);
-		break;
-	default:
-		return;
+/**
+ * famfs_shadow_file_load() - load a regular file's metadata from its shadow
+ *
+ * @req:          fuse request (for the daxdev push); NULL if there is none,
+ *                in which case the push is left to the kernel's LOOKUP
+ * @lo:           famfs context
+ * @fd:           the shadow yaml file, open for reading
+ * @attr:         in: stat of the shadow file; out: the famfs file attributes
+ * @fmap_out:     the file's compact fmap (free with famfs_fmap_free()), or
+ *                NULL if it could not be built
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+famfs_shadow_file_load(
+	fuse_req_t req,
+	struct famfs_ctx *lo,
+	int fd,
+	struct stat *attr,
+	struct famfs_fmap **fmap_out)
+{
+	struct famfs_log_file_meta fmeta;
+	struct stat shadow_st = *attr;
+	ssize_t yaml_size;
+	void *yaml_buf;
+	int rc;
+
+	(void)req;
+
+	memset(&fmeta, 0, sizeof(fmeta));
+	yaml_buf = famfs_read_fd_to_buf(fd, FAMFS_YAML_MAX, &yaml_size);
+	if (!yaml_buf) {
+		famfs_log(FAMFS_LOG_ERR, "failed to read to yaml_buf\n");
+		return -1;
 	}
 
-	pthread_mutex_lock(&lo->daxdev_push_mutex);
-	while (lo->daxdev_max_pushed < maxdev) {
-		if (famfs_push_one_daxdev(req, lo,
-					  lo->daxdev_max_pushed + 1) != 0)
-			break; /* can't densely push the next index; retry later */
-		lo->daxdev_max_pushed++;
+	/* Famfs gets the stat struct from the shadow yaml */
+	rc = famfs_shadow_to_stat(yaml_buf, yaml_size, &shadow_st, attr,
+				  &fmeta, 0);
+	free(yaml_buf);
+	if (rc)
+		return -1;
+
+	/* If this fails, GET_FMAP will fail for the file */
+	*fmap_out = famfs_fmap_alloc(&lo->icache, &fmeta);
+
+#ifdef FUSE_DEV_IOC_DAXDEV_OPEN
+	/*
+	 * Push-mode daxdev registration: register every daxdev this
+	 * file's fmap references with the kernel now, before it can be
+	 * opened or mapped. Failures are logged, not fatal - the lookup
+	 * still succeeds and a later lookup retries.
+	 */
+	if (lo->daxdev && req)
+		famfs_push_daxdevs(req, lo, famfs_fmeta_max_devindex(&fmeta));
+#endif
+
+	return 0;
+}
+
+/**
+ * famfs_find_cached_file() - find a cached file whose fmap is current
+ *
+ * @shadow_st:  stat of the file's shadow yaml
+ * @maxdev_out: the highest daxdev index the fmap references, read under the
+ *              mutex since inode->fmap can be replaced once it is dropped
+ *
+ * If the file is cached and its shadow yaml hasn't changed since fmap was
+ * read from it, return the inode with a ref held; the caller can skip the
+ * yaml read and parse. Otherwise return NULL.
+ */
+static struct famfs_inode *
+famfs_find_cached_file(
+	struct famfs_ctx *lo,
+	const struct stat *shadow_st,
+	int *maxdev_out)
+{
+	struct famfs_inode *inode;
+
+	pthread_mutex_lock(&lo->icache.mutex);
+	inode = famfs_icache_find_get_from_ino_locked(&lo->icache,
+						      shadow_st->st_ino);
+	if (inode && (inode->ftype != FAMFS_FREG || !inode->fmap ||
+		      inode->shadow_ctim.tv_sec != shadow_st->st_ctim.tv_sec ||
+		      inode->shadow_ctim.tv_nsec != shadow_st->st_ctim.tv_nsec)) {
+		famfs_inode_putref_locked(inode, 1);
+		inode = NULL;
 	}
-	pthread_mutex_unlock(&lo->daxdev_push_mutex);
+	if (inode)
+		*maxdev_out = inode->fmap->max_devindex;
+	pthread_mutex_unlock(&lo->icache.mutex);
+	return inode;
 }
-#endif /* FUSE_DEV_IOC_DAXDEV_OPEN */
 
 static int
 famfs_do_lookup(
 	fuse_req_t req,
 	fuse_ino_t parent,
 	const char *name,
-	struct fuse_entry_param *e,
-	struct famfs_log_file_meta **fmeta_out)
+	struct fuse_entry_param *e)
 {
 	enum famfs_fuse_ftype ftype = FAMFS_FINVALID;
-	struct famfs_log_file_meta *fmeta = NULL;
 	struct famfs_ctx *lo = famfs_ctx_from_req(req);
 	struct famfs_inode *parent_inode = famfs_get_inode_from_nodeid(&lo->icache,
 								       parent);
 	struct famfs_inode *inode = NULL;
+	struct famfs_fmap *fmap = NULL;
 	struct stat st;
-	int parentfd;
+	int negcache = famfs_negcache_enabled(lo);
+	uint64_t neg_gen = 0;
+	int parentfd = -1;
+	int maxdev;
 	int saverr;
 	int newfd = -1;
 	int res;
@@ -501,10 +803,27 @@ famfs_do_lookup(
 	e->attr_timeout = lo->timeout;
 	e->entry_timeout = lo->timeout;
 
+	/* A name this directory recently didn't have, with no log entries
+	 * played since, still doesn't exist: skip the openat. The generation
+	 * is sampled first, so a miss recorded below can't outlive a log
+	 * entry that creates the name concurrently */
+	if (negcache && parent_inode) {
+		int hit;
+
+		neg_gen = famfs_icache_neg_gen(&lo->icache);
+		pthread_mutex_lock(&lo->icache.mutex);
+		hit = famfs_negcache_find_locked(parent_inode, name, neg_gen);
+		if (hit)
+			famfs_inode_putref_locked(parent_inode, 1);
+		pthread_mutex_unlock(&lo->icache.mutex);
+		if (hit)
+			return ENOENT;
+	}
+
 	/* Note: this accesses the parent inode in our icache without looking
 	 * it up. 'parent' is a pointer directly to the famfs_inode.
 	 */
-	parentfd = parent_inode->fd;
+	parentfd = famfs_inode_fd_get(parent_inode);
 
 	famfs_log(FAMFS_LOG_DEBUG, "%s: name=%s (%s)\n", __func__, name,
 	       (parentfd < 0) ? "ERROR bad parentfd" : "good parentfd");
@@ -513,9 +832,15 @@ famfs_do_lookup(
 
 	newfd = openat(parentfd, name, O_PATH | O_NOFOLLOW, O_RDONLY);
 	if (newfd == -1) {
-		if (errno != ENOENT)
+		if (errno != ENOENT) {
 			famfs_log(FAMFS_LOG_ERR, "%s: open failed errno=%d\n",
 				  __func__, errno);
+		} else if (negcache) {
+			pthread_mutex_lock(&lo->icache.mutex);
+			famfs_negcache_add_locked(parent_inode, name, neg_gen);
+			pthread_mutex_unlock(&lo->icache.mutex);
+			errno = ENOENT;
+		}
 		goto out_err;
 	}
 
@@ -531,12 +856,24 @@ famfs_do_lookup(
 			 "               : inode=%d is a directory\n",
 			 e->attr.st_ino);
 	} else if (S_ISREG(st.st_mode)) {
-		void *yaml_buf = NULL;
-		ssize_t yaml_size;
-		ino_t ino = st.st_ino; /* Inode number from file, not yaml */
-
 		ftype = FAMFS_FREG;
 
+		/* Cached with current metadata (e.g. by -o warmup): the
+		 * find ref becomes the lookup ref */
+		inode = famfs_find_cached_file(lo, &st, &maxdev);
+		if (inode) {
+			close(newfd);
+			famfs_inode_get_attr(inode, &e->attr);
+			e->ino = (uintptr_t)inode;
+#ifdef FUSE_DEV_IOC_DAXDEV_OPEN
+			if (lo->daxdev)
+				famfs_push_daxdevs(req, lo, maxdev);
+#endif
+			famfs_inode_fd_put(parent_inode);
+			famfs_inode_putref(parent_inode);
+			return 0;
+		}
+
 		/* Now that we know it's a regular file, we must
 		 * close and re-open without O_PATH to get to the
 		 * shadow yaml */
@@ -546,42 +883,13 @@ famfs_do_lookup(
 			goto out_err;
 		}
 
-		fmeta = calloc(1, sizeof(*fmeta));
-		if (!fmeta)
-			goto out_err;
-
-		yaml_buf = famfs_read_fd_to_buf(newfd, FAMFS_YAML_MAX,
-						&yaml_size);
-		if (!yaml_buf) {
-			famfs_log(FAMFS_LOG_ERR,
-				  "failed to read to yaml_buf\n");
-			goto out_err;
-		}
+		res = famfs_shadow_file_load(req, lo, newfd, &e->attr, &fmap);
 
 		/* Don't keep regular files open - only directories */
 		close(newfd);
 		newfd = -1;
-
-		/* Famfs gets the stat struct from the shadow yaml */
-		res = famfs_shadow_to_stat(yaml_buf, yaml_size, &st,
-					   &e->attr, fmeta, 0);
 		if (res)
 			goto out_err;
-		st.st_ino = ino;
-
-#ifdef FUSE_DEV_IOC_DAXDEV_OPEN
-		/*
-		 * Push-mode daxdev registration: register every daxdev this
-		 * file's fmap references with the kernel now, before it can be
-		 * opened or mapped. Failures are logged, not fatal - the lookup
-		 * still succeeds and a later lookup retries.
-		 */
-		if (lo->daxdev)
-			famfs_push_fmap_daxdevs(req, lo, fmeta);
-#endif
-
-		if (yaml_buf)
-			free(yaml_buf);
 
 	} else {
 		famfs_log(FAMFS_LOG_DEBUG,
@@ -618,7 +926,7 @@ famfs_do_lookup(
 					name,
 					e->attr.st_ino /* inode number */,
 					e->attr.st_dev,
-					fmeta,         /* valid only for files */
+					fmap,          /* valid only for files */
 					&e->attr,
 					ftype,
 					parent_inode);
@@ -627,6 +935,8 @@ famfs_do_lookup(
 				pthread_mutex_unlock(&lo->icache.mutex);
 				goto out_err;
 			}
+			inode->shadow_ctim = st.st_ctim;
+			fmap = NULL;
 			famfs_log(FAMFS_LOG_DEBUG,
 				  "               : Caching inode %d\n",
 				  e->attr.st_ino);
@@ -641,35 +951,38 @@ found_inode:
 			  "s: inode=%d already cached\n", inode->ino);
 
 		/* Use cached attrs (preserves chown/chmod changes) */
-		e->attr = inode->attr;
+		famfs_inode_get_attr(inode, &e->attr);
 
 		close(newfd);
 		newfd = -1;
-		rc = famfs_check_inode(inode, fmeta, e);
+		rc = famfs_check_inode(inode, fmap, e);
+
+		/* GET_FMAP takes its ref on inode->fmap under the mutex, so
+		 * the old fmap lives until its reply is sent */
+		pthread_mutex_lock(&lo->icache.mutex);
 		if (rc) {
 			/* Recover by replacing the stale metadata... */
-			if (inode->fmeta) {
-				free(inode->fmeta);
-				inode->fmeta = NULL;
-			}
+			famfs_fmap_free(&lo->icache, inode->fmap);
+			inode->fmap = NULL;
 		}
-		if (inode->ftype == FAMFS_FREG && !inode->fmeta) {
+		if (inode->ftype == FAMFS_FREG && !inode->fmap) {
 			famfs_log(FAMFS_LOG_ERR,
-				 "%s: null fmeta for ino=%ld; populating\n",
+				 "%s: null fmap for ino=%ld; populating\n",
 				 __func__, e->attr.st_ino);
-			inode->fmeta = fmeta;
-		} else {
-			/* XXX: should we verify that fmeta matches inode? */
-			free(fmeta);
-			fmeta = NULL;
+			inode->fmap = fmap;
+			inode->shadow_ctim = st.st_ctim;
+			fmap = NULL;
 		}
+		pthread_mutex_unlock(&lo->icache.mutex);
+
+		/* XXX: should we verify that fmap matches inode? */
+		famfs_fmap_free(&lo->icache, fmap);
+		fmap = NULL;
 	}
 
 	/* The address of the famfs_inode is a valid "nodeid" because it is
 	 * unique */
 	e->ino = (uintptr_t) inode;
-	if (fmeta_out)
-		*fmeta_out = inode->fmeta;
 
 	/* Note that the "nodeid" is used in-kernel, as fi->nodeid. It is the
 	 * "key" used for looking up the famfs_inode. The inode number
@@ -685,39 +998,102 @@ found_inode:
 	 */
 	dump_inode(__func__, inode, FAMFS_LOG_NOTICE);
 
-	/* TODO: a vectorized famfs_inode_putref would be nice */
-	if (parent_inode)
-		famfs_inode_putref(parent_inode);
+	/* Drop the parent's fd pin and both refs under one lock */
+	pthread_mutex_lock(&lo->icache.mutex);
+	if (parent_inode) {
+		famfs_inode_fd_put_locked(parent_inode);
+		famfs_inode_putref_locked(parent_inode, 1);
+	}
 	if (inode)
-		famfs_inode_putref(inode);
+		famfs_inode_putref_locked(inode, 1);
+	pthread_mutex_unlock(&lo->icache.mutex);
 
 	return 0;
 
 out_err:
+	saverr = errno;
+	if (parentfd >= 0)
+		famfs_inode_fd_put(parent_inode);
 	if (parent_inode)
 		famfs_inode_putref(parent_inode);
-	saverr = errno;
 	if (newfd != -1)
 		close(newfd);
-	if (fmeta)
-		free(fmeta);
+	famfs_fmap_free(&lo->icache, fmap);
 
 	return saverr;
 }
 
+/**
+ * famfs_memns_do_lookup() - lookup in the in-memory namespace
+ *
+ * Same contract as famfs_do_lookup(): on success e->ino holds one lookup ref.
+ */
+static int
+famfs_memns_do_lookup(
+	fuse_req_t req,
+	fuse_ino_t parent,
+	const char *name,
+	struct fuse_entry_param *e)
+{
+	struct famfs_ctx *lo = famfs_ctx_from_req(req);
+	struct famfs_inode *dir, *inode = NULL;
+
+	memset(e, 0, sizeof(*e));
+	e->attr_timeout = lo->timeout;
+	e->entry_timeout = lo->timeout;
+
+	pthread_mutex_lock(&lo->icache.mutex);
+	dir = famfs_get_inode_from_nodeid_locked(&lo->icache, parent);
+	if (dir) {
+		inode = famfs_dir_index_find_locked(dir, name);
+		famfs_inode_getref_locked(inode); /* The lookup ref */
+		famfs_inode_putref_locked(dir, 1);
+	}
+	if (inode)
+		famfs_inode_get_attr(inode, &e->attr);
+	pthread_mutex_unlock(&lo->icache.mutex);
+
+	if (!inode)
+		return ENOENT;
+	e->ino = (uintptr_t)inode;
+
+#ifdef FUSE_DEV_IOC_DAXDEV_OPEN
+	/* Namespace inodes never go away, so fmap is stable */
+	if (lo->daxdev && inode->fmap)
+		famfs_push_fmap_daxdevs(req, lo, inode->fmap);
+#endif
+	return 0;
+}
+
 static void
 famfs_lookup(
 	fuse_req_t req,
 	fuse_ino_t parent,
 	const char *name)
 {
-	struct famfs_log_file_meta *fmeta = NULL;
+	struct famfs_ctx *lo = famfs_ctx_from_req(req);
 	struct fuse_entry_param e;
 	int err;
 
-	err = famfs_do_lookup(req, parent, name, &e, &fmeta);
+	famfs_req_account(req);
+
+	if (lo->memns)
+		err = famfs_memns_do_lookup(req, parent, name, &e);
+	else
+		err = famfs_do_lookup(req, parent, name, &e);
+
+	/* Let the kernel cache the miss too (a negative dentry): the log
+	 * tailer invalidates the name when a log entry creates it */
+	if (err == ENOENT && famfs_neg_timeout(lo) > 0) {
+		memset(&e, 0, sizeof(e));
+		e.entry_timeout = famfs_neg_timeout(lo);
+		famfs_req_result = ENOENT;
+		fuse_reply_entry(req, &e);
+		return;
+	}
+
 	if (err)
-		fuse_reply_err(req, err);
+		famfs_reply_err(req, err);
 	else
 		fuse_reply_entry(req, &e);
 }
@@ -729,18 +1105,12 @@ famfs_get_fmap(
 	size_t size)
 {
 	struct famfs_ctx *lo = famfs_ctx_from_req(req);
-	ssize_t fmap_bufsize = FMAP_MSG_MAX;
 	struct famfs_inode *inode = NULL;
-	char *fmap_message = NULL;
-	ssize_t fmap_size;
+	struct famfs_fmap *fmap;
 	int err = 0;
 	(void)size;
 
-	fmap_message = calloc(1, fmap_bufsize);
-	if (!fmap_message) {
-		err = ENOMEM;
-		goto out_err;
-	}
+	famfs_req_account(req);
 
 	/* The nodeid is the address of the famfs_inode. Retrieving it
 	 * this way validates that there is indeed an inode at that address.
@@ -754,32 +1124,23 @@ famfs_get_fmap(
 		goto out_err;
 	}
 
-	if (!inode->fmeta) {
+	/* The message was serialized when the inode was looked up. A
+	 * lookup may replace it concurrently, so reply from a ref */
+	pthread_mutex_lock(&lo->icache.mutex);
+	fmap = famfs_fmap_get(inode->fmap);
+	pthread_mutex_unlock(&lo->icache.mutex);
+	if (!fmap) {
 		famfs_log(FAMFS_LOG_ERR, "%s: no fmap on inode\n", __func__);
 		err = ENOENT;
 		goto out_err;
 	}
 
-	/* XXX: FUSE_FAMFS_FILE_REG - mark sb and log correctly */
-	fmap_size = famfs_log_file_meta_to_msg(fmap_message, fmap_bufsize,
-					       FUSE_FAMFS_FILE_REG,
-					       inode->fmeta);
-	if (fmap_size <= 0) {
-		/* Send reply without fmap */
-		famfs_log(FAMFS_LOG_ERR,
-			  "%s: %ld error putting fmap in message\n",
-			 __func__, fmap_size);
-		err = EINVAL;
-		goto out_err;
-	}
-
-	err = fuse_reply_buf(req, fmap_message, fmap_size /* FMAP_MSG_MAX */);
+	err = fuse_reply_buf(req, (const char *)fmap->msg, fmap->size);
 	if (err)
 		famfs_log(FAMFS_LOG_ERR, "%s: fuse_reply_buf returned err %d\n",
 			 __func__, err);
 
-	free(fmap_message);
-
+	famfs_fmap_free(&lo->icache, fmap);
 	famfs_inode_putref(inode);
 	return;
 
@@ -787,10 +1148,7 @@ out_err:
 	if (inode)
 		famfs_inode_putref(inode);
 
-	if (fmap_message)
-		free(fmap_message);
-
-	fuse_reply_err(req, err);
+	famfs_reply_err(req, err);
 }
 
 static void
@@ -802,6 +1160,8 @@ famfs_get_daxdev(
 	struct fuse_daxdev_out daxdev;
 	int err = 0;
 
+	famfs_req_account(req);
+
 	famfs_log(FAMFS_LOG_NOTICE, "%s: daxdev_index=%d\n",
 		 __func__, daxdev_index);
 	memset(&daxdev, 0, sizeof(daxdev));
@@ -831,24 +1191,7 @@ famfs_get_daxdev(
 	return;
 
 out_err:
-	fuse_reply_err(req, err);
-}
-
-static void
-famfs_forget_one(
-	fuse_req_t req,
-	fuse_ino_t nodeid,
-	uint64_t nlookup)
-{
-	struct famfs_ctx *lo = famfs_ctx_from_req(req);
-	struct famfs_inode *inode = famfs_get_inode_from_nodeid(&lo->icache,
-							    nodeid);
-
-	famfs_log(FAMFS_LOG_DEBUG, "%s: ino=%lld refcount=%lld count=%lld\n",
-		  __func__, inode->ino, inode->refcount, nlookup);
-
-	/* +1 because we got a ref when we looked it up here */
-	famfs_icache_unref_inode(&lo->icache, inode, nlookup + 1);
+	famfs_reply_err(req, err);
 }
 
 static void
@@ -857,30 +1200,56 @@ famfs_forget(
 	fuse_ino_t nodeid,
 	uint64_t nlookup)
 {
-	famfs_log(FAMFS_LOG_DEBUG, "%s:\n", __func__);
-	famfs_forget_one(req, nodeid, nlookup);
+	struct famfs_ctx *lo = famfs_ctx_from_req(req);
+	struct fuse_forget_data forget = {
+		.ino = nodeid,
+		.nlookup = nlookup,
+	};
+
+	famfs_req_account(req);
+	famfs_log(FAMFS_LOG_DEBUG, "%s: nodeid=%lx nlookup=%lld\n",
+		  __func__, nodeid, nlookup);
+	famfs_icache_forget_batch(&lo->icache, &forget, 1);
 	fuse_reply_none(req);
 }
 
+/*
+ * After a large find or du the kernel sends forgets in batches of thousands;
+ * the whole batch is applied under one hold of the icache mutex
+ */
 static void
 famfs_forget_multi(
 	fuse_req_t req,
 	size_t count,
 	struct fuse_forget_data *forgets)
 {
-	size_t i;
+	struct famfs_ctx *lo = famfs_ctx_from_req(req);
 
-	famfs_log(FAMFS_LOG_DEBUG, "%s:\n", __func__);
+	famfs_req_account(req);
+
+	famfs_log(FAMFS_LOG_DEBUG, "%s: count=%ld\n", __func__, count);
 
-	for (i = 0; i < count; i++)
-		famfs_forget_one(req, forgets[i].ino, forgets[i].nlookup);
+	famfs_icache_forget_batch(&lo->icache, forgets, count);
 	fuse_reply_none(req);
 }
 
+struct famfs_rdp_ent;
+
 struct famfs_dirp {
 	DIR *dp;
 	struct dirent *entry;
 	off_t offset;
+
+	/* readdirplus reads the directory fd directly (see
+	 * famfs_do_readdirplus()); these flag when the other path has moved
+	 * the shared file position out from under the DIR stream or the
+	 * dents buffer */
+	int dp_stale;
+	int dents_stale;
+	char *dents;		/* getdents64 buffer (FAMFS_DENTS_BUFSIZE) */
+	size_t dents_len;
+	size_t dents_pos;
+	struct famfs_rdp_ent *ents;
 };
 
 static struct famfs_dirp *
@@ -900,7 +1269,10 @@ famfs_opendir(
 	struct famfs_inode *inode = famfs_get_inode_from_nodeid(&lo->icache,
 								nodeid);
 	struct famfs_dirp *d;
-	int fd;
+	int fd = -1;
+	int dfd;
+
+	famfs_req_account(req);
 
 	famfs_log(FAMFS_LOG_DEBUG, "%s: inode=%ld (%jx)\n",
 		 __func__, nodeid, nodeid);
@@ -909,7 +1281,20 @@ famfs_opendir(
 	if (d == NULL)
 		goto out_err;
 
-	fd = openat(inode->fd, ".", O_RDONLY);
+	/* memns directories have no fd; readdir walks the dir index */
+	if (lo->memns) {
+		if (!inode->dindex) {
+			error = ENOTDIR;
+			goto out_err;
+		}
+		goto out;
+	}
+
+	dfd = famfs_inode_fd_get(inode);
+	if (dfd == -1)
+		goto out_errno;
+	fd = openat(dfd, ".", O_RDONLY);
+	famfs_inode_fd_put(inode);
 	if (fd == -1)
 		goto out_errno;
 
@@ -920,9 +1305,11 @@ famfs_opendir(
 	d->offset = 0;
 	d->entry = NULL;
 
+out:
 	fi->fh = (uintptr_t) d;
 	if (lo->cache == CACHE_ALWAYS)
 		fi->cache_readdir = 1;
+	famfs_metrics_gauge_add(FAMFS_GAUGE_OPEN_DIRS, 1);
 	fuse_reply_open(req, fi);
 	famfs_inode_putref(inode);
 	return;
@@ -936,7 +1323,7 @@ out_err:
 			close(fd);
 		free(d);
 	}
-	fuse_reply_err(req, error);
+	famfs_reply_err(req, error);
 }
 
 static int
@@ -973,11 +1360,13 @@ famfs_do_readdir(
 	}
 	p = buf;
 
-	if (offset != d->offset) {
+	if (offset != d->offset || d->dp_stale) {
 		seekdir(d->dp, offset);
 		d->entry = NULL;
 		d->offset = offset;
+		d->dp_stale = 0;
 	}
+	d->dents_stale = 1;
 	while (1) {
 		size_t entsize;
 		off_t nextoff;
@@ -1006,8 +1395,7 @@ famfs_do_readdir(
 					.attr.st_mode = d->entry->d_type << 12,
 				};
 			} else {
-				err = famfs_do_lookup(req, nodeid,
-						      name, &e, NULL);
+				err = famfs_do_lookup(req, nodeid, name, &e);
 				if (err)
 					goto error;
 				entry_ino = e.ino;
@@ -1024,8 +1412,16 @@ famfs_do_readdir(
 						    &st, nextoff);
 		}
 		if (entsize > rem) {
-			if (entry_ino != 0)
-				famfs_forget_one(req, entry_ino, 1);
+			if (entry_ino != 0) {
+				struct fuse_forget_data forget = {
+					.ino = entry_ino,
+					.nlookup = 1,
+				};
+
+				famfs_icache_forget_batch(
+					&famfs_ctx_from_req(req)->icache,
+					&forget, 1);
+			}
 			break;
 		}
 
@@ -1045,23 +1441,498 @@ error:
      * return what we've collected until that point.
      */
     if (err && rem == size)
-	    fuse_reply_err(req, err);
+	    famfs_reply_err(req, err);
     else
 	    fuse_reply_buf(req, buf, size - rem);
     free(buf);
 }
 
-static void
-famfs_readdir(
-	fuse_req_t req,
-	fuse_ino_t nodeid,
+/*
+ * readdirplus fast path
+ *
+ * Rather than a full famfs_do_lookup() per entry, the entries from each
+ * getdents64() buffer are resolved as a batch:
+ *
+ * 1. Size up the entries that will fit in the reply
+ * 2. One pass under the icache mutex picks up the inodes that are already
+ *    cached. Directories need no I/O at all; a file costs one fstatat() to
+ *    check that its fmap is current, as in lookup
+ * 3. The misses are loaded from the shadow tree with no lock held: one
+ *    openat() + fstat() per entry, plus the yaml read for files
+ * 4. One more pass under the mutex inserts the new inodes (or adopts an
+ *    inode that a concurrent lookup cached in the meantime)
+ *
+ * Each entry returned holds one lookup ref, as with famfs_do_lookup().
+ */
+#define FAMFS_DENTS_BUFSIZE (64 * 1024)
+
+struct famfs_linux_dirent64 {
+	u64            d_ino;
+	s64            d_off;
+	unsigned short d_reclen;
+	unsigned char  d_type;
+	char           d_name[];
+};
+
+/* The smallest dirent64 record is 24 bytes (header + 1 char name, padded) */
+#define FAMFS_DENTS_MAX (FAMFS_DENTS_BUFSIZE / 24)
+
+struct famfs_rdp_ent {
+	struct famfs_linux_dirent64 *de;
+	struct famfs_inode *inode;	/* Holds the lookup ref once resolved */
+	enum famfs_fuse_ftype ftype;	/* FAMFS_FINVALID: no inode for entry */
+	struct stat attr;
+	struct timespec shadow_ctim;
+	int fd;				/* Dirs only: O_PATH fd for the inode */
+	int maxdev;			/* Cached files: fmap max_devindex */
+	struct famfs_fmap *fmap;
+};
+
+/**
+ * famfs_rdp_load_one() - load a directory entry that missed the icache
+ *
+ * Returns 0 on success, -1 if the entry can't be (or should not be) cached
+ */
+static int
+famfs_rdp_load_one(
+	fuse_req_t req,
+	struct famfs_ctx *lo,
+	int parentfd,
+	struct famfs_rdp_ent *ent)
+{
+	const char *name = ent->de->d_name;
+	unsigned char type = ent->de->d_type;
+	struct stat st;
+	int fd;
+	int rc;
+
+	if (type == DT_UNKNOWN) {
+		if (fstatat(parentfd, name, &st, AT_SYMLINK_NOFOLLOW))
+			return -1;
+		type = IFTODT(st.st_mode);
+	}
+
+	switch (type) {
+	case DT_DIR:
+		fd = openat(parentfd, name, O_PATH | O_NOFOLLOW);
+		if (fd < 0)
+			return -1;
+		if (fstatat(fd, "", &ent->attr,
+			    AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW)) {
+			close(fd);
+			return -1;
+		}
+		ent->fd = fd;
+		ent->ftype = FAMFS_FDIR;
+		return 0;
+
+	case DT_REG:
+		fd = openat(parentfd, name, O_RDONLY | O_NOFOLLOW);
+		if (fd < 0)
+			return -1;
+		rc = fstat(fd, &ent->attr);
+		ent->shadow_ctim = ent->attr.st_ctim;
+		if (!rc)
+			rc = famfs_shadow_file_load(req, lo, fd, &ent->attr,
+						    &ent->fmap);
+		close(fd);
+		if (rc)
+			return -1;
+		ent->ftype = FAMFS_FREG;
+		return 0;
+
+	default:
+		/* Neither file nor dir: famfs_do_lookup() would fail it too */
+		return -1;
+	}
+}
+
+/**
+ * famfs_rdp_insert_locked() - cache a loaded entry, or adopt a cached inode
+ *
+ * Caller holds the icache mutex. On success ent->inode holds one ref, and
+ * whatever the inode took over from @ent has been cleared from @ent.
+ */
+static void
+famfs_rdp_insert_locked(
+	struct famfs_ctx *lo,
+	struct famfs_inode *parent_inode,
+	struct famfs_rdp_ent *ent)
+{
+	struct famfs_inode *inode;
+
+	inode = famfs_icache_find_get_from_ino_locked(&lo->icache,
+						      ent->attr.st_ino);
+	if (inode) {
+		/* Cached since pass 2, cached without fmap, or cached with
+		 * an fmap older than its shadow yaml */
+		if (inode->ftype == FAMFS_FREG && ent->fmap &&
+		    (!inode->fmap ||
+		     inode->shadow_ctim.tv_sec != ent->shadow_ctim.tv_sec ||
+		     inode->shadow_ctim.tv_nsec != ent->shadow_ctim.tv_nsec)) {
+			if (!inode->fmap)
+				famfs_log(FAMFS_LOG_ERR,
+					  "%s: null fmap for ino=%ld; populating\n",
+					  __func__, ent->attr.st_ino);
+			famfs_fmap_free(&lo->icache, inode->fmap);
+			inode->fmap = ent->fmap;
+			inode->shadow_ctim = ent->shadow_ctim;
+			ent->fmap = NULL;
+		}
+		ent->inode = inode;
+		return;
+	}
+
+	inode = famfs_inode_alloc(&lo->icache, ent->fd, ent->de->d_name,
+				  ent->attr.st_ino, ent->attr.st_dev,
+				  ent->fmap, &ent->attr, ent->ftype,
+				  parent_inode);
+	if (!inode) {
+		ent->ftype = FAMFS_FINVALID;
+		return;
+	}
+	inode->shadow_ctim = ent->shadow_ctim;
+	ent->fd = -1;
+	ent->fmap = NULL;
+
+	famfs_icache_insert_locked(&lo->icache, inode);
+	/* Insert leaves 2 refs; keep one as the lookup ref */
+	famfs_inode_putref_locked(inode, 1);
+	ent->inode = inode;
+}
+
+static void
+famfs_do_readdirplus(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
 	size_t size,
 	off_t offset,
 	struct fuse_file_info *fi)
 {
+	struct famfs_ctx *lo = famfs_ctx_from_req(req);
+	struct famfs_dirp *d = famfs_dirp(fi);
+	struct famfs_inode *parent_inode = NULL;
+	size_t rem = size;
+	int parentfd = -1;
+	char *buf;
+	char *p;
+	int err = 0;
+
+	famfs_log(FAMFS_LOG_DEBUG, "%s: nodeid=%lx size=%ld ofs=%ld\n",
+		  __func__, nodeid, size, offset);
+
+	if (!d->dents) {
+		d->dents = malloc(FAMFS_DENTS_BUFSIZE);
+		d->ents = calloc(FAMFS_DENTS_MAX, sizeof(*d->ents));
+		if (!d->dents || !d->ents) {
+			free(d->dents);
+			free(d->ents);
+			d->dents = NULL;
+			d->ents = NULL;
+			famfs_reply_err(req, ENOMEM);
+			return;
+		}
+	}
+
+	buf = calloc(1, size);
+	if (!buf) {
+		famfs_reply_err(req, ENOMEM);
+		return;
+	}
+	p = buf;
+
+	parent_inode = famfs_get_inode_from_nodeid(&lo->icache, nodeid);
+	if (parent_inode)
+		parentfd = famfs_inode_fd_get(parent_inode);
+	if (parentfd < 0) {
+		err = EINVAL;
+		goto out;
+	}
+
+	if (offset != d->offset || d->dents_stale) {
+		if (lseek(dirfd(d->dp), offset, SEEK_SET) < 0) {
+			err = errno;
+			goto out;
+		}
+		d->dents_len = d->dents_pos = 0;
+		d->offset = offset;
+		d->dents_stale = 0;
+	}
+	d->dp_stale = 1;
+
+	while (rem > 0) {
+		struct famfs_rdp_ent *ents = d->ents;
+		size_t budget = rem;
+		size_t pos;
+		size_t nents = 0;
+		size_t i;
+
+		if (d->dents_pos >= d->dents_len) {
+			ssize_t n = syscall(SYS_getdents64, dirfd(d->dp),
+					    d->dents, FAMFS_DENTS_BUFSIZE);
+
+			if (n < 0) {
+				err = errno;
+				break;
+			}
+			if (n == 0)
+				break; /* End of stream */
+			d->dents_len = n;
+			d->dents_pos = 0;
+		}
+
+		/* 1. The entries that fit in the reply */
+		for (pos = d->dents_pos; pos < d->dents_len; ) {
+			struct famfs_linux_dirent64 *de =
+				(struct famfs_linux_dirent64 *)(d->dents + pos);
+			size_t entsize = fuse_add_direntry_plus(req, NULL, 0,
+							       de->d_name,
+							       NULL, 0);
+			if (entsize > budget)
+				break;
+			budget -= entsize;
+			ents[nents++] = (struct famfs_rdp_ent) {
+				.de = de,
+				.ftype = FAMFS_FINVALID,
+				.fd = -1,
+				.maxdev = -1,
+			};
+			pos += de->d_reclen;
+		}
+		if (nents == 0)
+			break; /* Reply buffer is full */
+
+		/* 2. Inodes that are already cached */
+		pthread_mutex_lock(&lo->icache.mutex);
+		for (i = 0; i < nents; i++) {
+			struct famfs_inode *inode;
+
+			if (is_dot_or_dotdot(ents[i].de->d_name))
+				continue;
+			inode = famfs_icache_find_get_from_ino_locked(
+				&lo->icache, ents[i].de->d_ino);
+			if (inode && inode->ftype == FAMFS_FREG &&
+			    !inode->fmap) {
+				/* Needs repair; treat as a miss */
+				famfs_inode_putref_locked(inode, 1);
+				inode = NULL;
+			}
+			if (inode && inode->ftype == FAMFS_FREG) {
+				ents[i].shadow_ctim = inode->shadow_ctim;
+				ents[i].maxdev = inode->fmap->max_devindex;
+			}
+			ents[i].inode = inode;
+		}
+		pthread_mutex_unlock(&lo->icache.mutex);
+
+		/* A cached file is only current if its shadow yaml hasn't
+		 * changed since its fmap was read - the check lookup makes
+		 * in famfs_find_cached_file(). A stale one is a miss */
+		for (i = 0; i < nents; i++) {
+			struct famfs_inode *inode = ents[i].inode;
+			struct stat st;
+
+			if (!inode || inode->ftype != FAMFS_FREG)
+				continue;
+			if (fstatat(parentfd, ents[i].de->d_name, &st,
+				    AT_SYMLINK_NOFOLLOW) ||
+			    st.st_ino != inode->ino ||
+			    st.st_ctim.tv_sec != ents[i].shadow_ctim.tv_sec ||
+			    st.st_ctim.tv_nsec != ents[i].shadow_ctim.tv_nsec) {
+				famfs_inode_putref(inode);
+				ents[i].inode = NULL;
+				continue;
+			}
+#ifdef FUSE_DEV_IOC_DAXDEV_OPEN
+			/* As lookup does for a cached file */
+			if (lo->daxdev)
+				famfs_push_daxdevs(req, lo, ents[i].maxdev);
+#endif
+		}
+
+		/* 3. Load the misses from the shadow tree */
+		for (i = 0; i < nents; i++) {
+			if (ents[i].inode ||
+			    is_dot_or_dotdot(ents[i].de->d_name))
+				continue;
+			if (famfs_rdp_load_one(req, lo, parentfd, &ents[i]))
+				ents[i].ftype = FAMFS_FINVALID;
+		}
+
+		/* 4. Cache the misses */
+		pthread_mutex_lock(&lo->icache.mutex);
+		for (i = 0; i < nents; i++) {
+			if (!ents[i].inode && ents[i].ftype != FAMFS_FINVALID)
+				famfs_rdp_insert_locked(lo, parent_inode,
+							&ents[i]);
+		}
+		pthread_mutex_unlock(&lo->icache.mutex);
+
+		/* Emit the entries; each one is already known to fit */
+		for (i = 0; i < nents; i++) {
+			struct famfs_linux_dirent64 *de = ents[i].de;
+			struct fuse_entry_param e = {
+				.attr_timeout = lo->timeout,
+				.entry_timeout = lo->timeout,
+			};
+			size_t entsize;
+
+			if (ents[i].fd >= 0)
+				close(ents[i].fd);
+			famfs_fmap_free(&lo->icache, ents[i].fmap);
+
+			if (ents[i].inode) {
+				/* Cached attrs (preserves chown/chmod) */
+				e.ino = (uintptr_t)ents[i].inode;
+				famfs_inode_get_attr(ents[i].inode, &e.attr);
+			} else {
+				/* Dot entries, and anything we can't cache:
+				 * no lookup ref, like readdir */
+				e.attr.st_ino = de->d_ino;
+				e.attr.st_mode = de->d_type << 12;
+			}
+
+			entsize = fuse_add_direntry_plus(req, p, rem,
+							 de->d_name, &e,
+							 de->d_off);
+			p += entsize;
+			rem -= entsize;
+			d->offset = de->d_off;
+		}
+		d->dents_pos = pos;
+	}
+
+out:
+	if (parentfd >= 0)
+		famfs_inode_fd_put(parent_inode);
+	if (parent_inode)
+		famfs_inode_putref(parent_inode);
+
+	/* As in famfs_do_readdir(): entries already in the buffer carry
+	 * lookup refs, so an error can only be returned if there are none */
+	if (err && rem == size)
+		famfs_reply_err(req, err);
+	else
+		fuse_reply_buf(req, buf, size - rem);
+	free(buf);
+}
+
+/**
+ * famfs_memns_readdir() - READDIR / READDIRPLUS from the in-memory namespace
+ *
+ * Offset 0 is ".", 1 is "..", and 2 + n is the directory's nth child in
+ * creation order; since names are never removed, offsets stay valid across
+ * calls. With @plus, every child returned gets a lookup ref.
+ */
+static void
+famfs_memns_readdir(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	size_t size,
+	off_t offset,
+	int plus)
+{
+	struct famfs_ctx *lo = famfs_ctx_from_req(req);
+	struct famfs_inode *dir;
+	size_t rem = size;
+	int maxdev = -1;
+	char *buf;
+	char *p;
+	off_t off;
+
+	buf = calloc(1, size);
+	if (!buf) {
+		famfs_reply_err(req, ENOMEM);
+		return;
+	}
+	p = buf;
+
+	pthread_mutex_lock(&lo->icache.mutex);
+	dir = famfs_get_inode_from_nodeid_locked(&lo->icache, nodeid);
+	if (!dir || !dir->dindex) {
+		if (dir)
+			famfs_inode_putref_locked(dir, 1);
+		pthread_mutex_unlock(&lo->icache.mutex);
+		free(buf);
+		famfs_reply_err(req, ENOTDIR);
+		return;
+	}
+
+	for (off = offset; ; off++) {
+		struct famfs_inode *child = NULL;
+		struct fuse_entry_param e = {
+			.attr_timeout = lo->timeout,
+			.entry_timeout = lo->timeout,
+		};
+		const char *name;
+		size_t entsize;
+
+		if (off < 2) {
+			name = (off == 0) ? "." : "..";
+			e.attr.st_ino = (off == 0 || !dir->parent)
+				? dir->ino : dir->parent->ino;
+			e.attr.st_mode = S_IFDIR;
+		} else if ((size_t)(off - 2) < dir->dindex->nchildren) {
+			child = dir->dindex->children[off - 2];
+			name = child->name;
+			famfs_inode_get_attr(child, &e.attr);
+		} else {
+			break; /* End of directory */
+		}
+
+		if (plus) {
+			if (child)
+				e.ino = (uintptr_t)child;
+			entsize = fuse_add_direntry_plus(req, p, rem, name,
+							 &e, off + 1);
+		} else {
+			entsize = fuse_add_direntry(req, p, rem, name,
+						    &e.attr, off + 1);
+		}
+		if (entsize > rem)
+			break;
+
+		if (plus && child) {
+			famfs_inode_getref_locked(child); /* The lookup ref */
+#ifdef FUSE_DEV_IOC_DAXDEV_OPEN
+			if (child->fmap)
+				maxdev = MAX(maxdev, child->fmap->max_devindex);
+#endif
+		}
+		p += entsize;
+		rem -= entsize;
+	}
+
+	famfs_inode_putref_locked(dir, 1);
+	pthread_mutex_unlock(&lo->icache.mutex);
+
+#ifdef FUSE_DEV_IOC_DAXDEV_OPEN
+	/* Files returned by readdirplus can be opened without a LOOKUP */
+	if (lo->daxdev && maxdev >= 0)
+		famfs_push_daxdevs(req, lo, maxdev);
+#else
+	(void)maxdev;
+#endif
+
+	fuse_reply_buf(req, buf, size - rem);
+	free(buf);
+}
+
+static void
+famfs_readdir(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	size_t size,
+	off_t offset,
+	struct fuse_file_info *fi)
+{
+	famfs_req_account(req);
 	famfs_log(FAMFS_LOG_DEBUG, "%s: nodeid=%lx size=%ld offset=%ld\n",
 		  __func__, nodeid, size, offset);
-	famfs_do_readdir(req, nodeid, size, offset, fi, 0);
+	if (famfs_ctx_from_req(req)->memns)
+		famfs_memns_readdir(req, nodeid, size, offset, 0);
+	else
+		famfs_do_readdir(req, nodeid, size, offset, fi, 0);
 }
 
 static void famfs_readdirplus(
@@ -1071,9 +1942,13 @@ static void famfs_readdirplus(
 	off_t offset,
 	struct fuse_file_info *fi)
 {
-	famfs_log(FAMFS_LOG_ERR, "%s: nodeid=%lx size=%ld offset=%ld\n",
+	famfs_req_account(req);
+	famfs_log(FAMFS_LOG_DEBUG, "%s: nodeid=%lx size=%ld offset=%ld\n",
 		  __func__, nodeid, size, offset);
-	famfs_do_readdir(req, nodeid, size, offset, fi, 1);
+	if (famfs_ctx_from_req(req)->memns)
+		famfs_memns_readdir(req, nodeid, size, offset, 1);
+	else
+		famfs_do_readdirplus(req, nodeid, size, offset, fi);
 }
 
 static void
@@ -1084,9 +1959,15 @@ famfs_releasedir(
 {
 	struct famfs_dirp *d = famfs_dirp(fi);
 	(void) nodeid;
-	closedir(d->dp);
+
+	famfs_req_account(req);
+	if (d->dp)
+		closedir(d->dp);
+	free(d->dents);
+	free(d->ents);
 	free(d);
-	fuse_reply_err(req, 0);
+	famfs_metrics_gauge_add(FAMFS_GAUGE_OPEN_DIRS, -1);
+	famfs_reply_err(req, 0);
 }
 
 static void
@@ -1102,8 +1983,10 @@ famfs_create(
 	(void)mode;
 	(void)fi;
 
+	famfs_req_account(req);
+
 	famfs_log(FAMFS_LOG_DEBUG, "%s: ENOTSUP\n", __func__);
-	fuse_reply_err(req, ENOTSUP);
+	famfs_reply_err(req, ENOTSUP);
 }
 
 static void
@@ -1116,6 +1999,8 @@ famfs_open(
 	struct famfs_inode *inode = famfs_get_inode_from_nodeid(&lo->icache,
 								nodeid);
 
+	famfs_req_account(req);
+
 	famfs_log(FAMFS_LOG_DEBUG, "%s: nodeid=%lx\n", __func__, nodeid);
 
 	famfs_inode_getref(inode->icache, inode);
@@ -1136,6 +2021,7 @@ famfs_open(
 	   To make parallel_direct_writes valid, need set fi->direct_io
 	   in current function. */
 	fi->parallel_direct_writes = 1;
+	famfs_metrics_gauge_add(FAMFS_GAUGE_OPEN_FILES, 1);
 
 	/*
 	 * We got a ref on the inode above, and it will stay on the inode until
@@ -1145,6 +2031,19 @@ famfs_open(
 	fuse_reply_open(req, fi);
 }
 
+/* Reply to flock requests that were granted after waiting */
+static void
+famfs_flock_reply_granted(struct famfs_flock_waiter *granted)
+{
+	while (granted) {
+		struct famfs_flock_waiter *next = granted->next;
+
+		fuse_reply_err((fuse_req_t)granted->cookie, 0);
+		free(granted);
+		granted = next;
+	}
+}
+
 static void
 famfs_release(
 	fuse_req_t req,
@@ -1154,23 +2053,27 @@ famfs_release(
 	struct famfs_ctx *lo = famfs_ctx_from_req(req);
 	struct famfs_inode *inode = famfs_get_inode_from_nodeid(&lo->icache,
 								nodeid);
-	(void) fi;
+	struct famfs_flock_waiter *granted = NULL;
+
+	famfs_req_account(req);
 
 	famfs_log(FAMFS_LOG_DEBUG, "%s: nodeid=%lx\n", __func__, nodeid);
 
-	fuse_reply_err(req, 0);
+	famfs_metrics_gauge_add(FAMFS_GAUGE_OPEN_FILES, -1);
+	famfs_reply_err(req, 0);
 
-	if (inode->flock_held) {
-		famfs_icache_unflock(inode);
-		famfs_log(FAMFS_LOG_NOTICE,
+	pthread_mutex_lock(&lo->icache.mutex);
+	if (fi->flock_release &&
+	    famfs_flock_release_locked(inode, fi->lock_owner, &granted))
+		famfs_log(FAMFS_LOG_DEBUG,
 			  "%s: ino=%lld name=%s released flock\n",
 			  __func__, inode->ino, inode->name);
-	}
-	pthread_mutex_lock(&lo->icache.mutex);
 	/* Release 2 refs: one for from the get in this function,
 	 * and one for the open that this closes */
 	famfs_inode_putref_locked(inode, 2);
 	pthread_mutex_unlock(&lo->icache.mutex);
+
+	famfs_flock_reply_granted(granted);
 }
 
 static void
@@ -1184,12 +2087,25 @@ famfs_statfs(
 	struct famfs_inode *inode = famfs_get_inode_from_nodeid(&lo->icache,
 								nodeid);
 
+	famfs_req_account(req);
+
 	famfs_log(FAMFS_LOG_DEBUG, "%s: nodeid=%lx\n", __func__, nodeid);
 
-	res = fstatvfs(inode->fd, &stbuf);
+	/* Famfs capacity from the log; the shadow fs if that's unavailable */
+	if (famfs_fs_stats_statvfs(&stbuf) == 0) {
+		famfs_inode_putref(inode);
+		fuse_reply_statfs(req, &stbuf);
+		return;
+	}
+
+	res = famfs_inode_fd_get(inode);
+	if (res >= 0) {
+		res = fstatvfs(res, &stbuf);
+		famfs_inode_fd_put(inode);
+	}
 	famfs_inode_putref(inode);
 	if (res == -1)
-		fuse_reply_err(req, errno);
+		famfs_reply_err(req, errno);
 	else
 		fuse_reply_statfs(req, &stbuf);
 }
@@ -1208,18 +2124,19 @@ famfs_getxattr(
 	size_t shadow_len;
 
 	(void)nodeid;
+	famfs_req_account(req);
 
 	famfs_log(FAMFS_LOG_DEBUG, "%s: nodeid=%lx name=%s size=%zu\n",
 		  __func__, nodeid, name, size);
 
 	/* Only support the shadow xattr for now */
 	if (strcmp(name, FAMFS_XATTR_SHADOW) != 0) {
-		fuse_reply_err(req, ENODATA);
+		famfs_reply_err(req, ENODATA);
 		return;
 	}
 
 	if (!shadow_path) {
-		fuse_reply_err(req, ENODATA);
+		famfs_reply_err(req, ENODATA);
 		return;
 	}
 
@@ -1230,13 +2147,41 @@ famfs_getxattr(
 		fuse_reply_xattr(req, shadow_len);
 	} else if (size < shadow_len) {
 		/* Buffer too small */
-		fuse_reply_err(req, ERANGE);
+		famfs_reply_err(req, ERANGE);
 	} else {
 		/* Return the value */
 		fuse_reply_buf(req, shadow_path, shadow_len);
 	}
 }
 
+/*
+ * The kernel interrupted a waiting flock (e.g. a signal). Called by libfuse
+ * with the request lock held, so we never hold the icache mutex while
+ * calling into libfuse for a request that may be waiting.
+ */
+static void
+famfs_flock_interrupt(fuse_req_t req, void *data)
+{
+	struct famfs_inode *inode = data;
+	struct famfs_icache *icache = inode->icache;
+	struct famfs_flock_waiter *granted = NULL;
+	int cancelled;
+
+	pthread_mutex_lock(&icache->mutex);
+	cancelled = famfs_flock_cancel_locked(inode, req, &granted);
+	pthread_mutex_unlock(&icache->mutex);
+
+	if (cancelled)
+		fuse_reply_err(req, EINTR);
+	famfs_flock_reply_granted(granted);
+}
+
+/*
+ * Flock is per inode: requests on different files never wait on each other.
+ * A request that has to wait is queued on the inode and no daemon thread
+ * waits with it; it is answered when a release grants it (or when the
+ * kernel interrupts it).
+ */
 static void
 famfs_flock(
 	fuse_req_t req,
@@ -1244,56 +2189,231 @@ famfs_flock(
 	struct fuse_file_info *fi,
 	int op)
 {
-	(void) fi;
-	int rc = 0;
 	struct famfs_ctx *lo = famfs_ctx_from_req(req);
 	struct famfs_inode *inode = famfs_get_inode_from_nodeid(&lo->icache,
 								nodeid);
+	struct famfs_flock_waiter *granted = NULL;
+	int nonblock = op & LOCK_NB;
+	int rc = 0;
 
-	famfs_log(FAMFS_LOG_NOTICE, "%s: nodeid=%lx op=%d\n",
-		 __func__, nodeid, op);
+	famfs_req_account(req);
+
+	famfs_log(FAMFS_LOG_DEBUG, "%s: nodeid=%lx op=%d owner=%llx\n",
+		 __func__, nodeid, op, (unsigned long long)fi->lock_owner);
+
+	if (!inode) {
+		famfs_reply_err(req, EBADF);
+		return;
+	}
 
-	switch (op) {
+	switch (op & ~LOCK_NB) {
 	case LOCK_EX:
-		if (inode->flock_held) {
-			famfs_log(FAMFS_LOG_ERR,
-				  "%s: nodeid=%lx op=%d LOCK_EX already held\n",
-				  __func__, nodeid, op);
-			rc = EINVAL;
-			goto err_out;
-		}
-		famfs_icache_flock(inode);
+	case LOCK_SH:
+		/* Must be registered before the request can be queued: once
+		 * it's queued, a release may reply to it at any time */
+		if (!nonblock)
+			fuse_req_interrupt_func(req, famfs_flock_interrupt,
+						inode);
+		pthread_mutex_lock(&lo->icache.mutex);
+		rc = famfs_flock_acquire_locked(inode, fi->lock_owner,
+						(op & ~LOCK_NB) == LOCK_EX,
+						nonblock, req, &granted);
 		break;
 	case LOCK_UN:
-		if (!inode->flock_held) {
-			famfs_log(FAMFS_LOG_ERR,
-				  "%s: nodeid=%lx op=%d LOCK_UN but not held\n",
-				  __func__, nodeid, op);
-			rc = EINVAL;
-			goto err_out;
-		}
-		famfs_icache_unflock(inode);
+		/* As with flock(2), unlocking a lock that isn't held is ok */
+		pthread_mutex_lock(&lo->icache.mutex);
+		famfs_flock_release_locked(inode, fi->lock_owner, &granted);
 		break;
-	case LOCK_SH:
-		famfs_log(FAMFS_LOG_ERR,
-			  "%s: nodeid=%lx op=%d LOCK_SH not supported\n",
-			  __func__, nodeid, op);
+	default:
 		rc = EINVAL;
-		goto err_out;
+		pthread_mutex_lock(&lo->icache.mutex);
 		break;
 	}
+	/* The open file holds a ref for as long as the request can wait */
+	famfs_inode_putref_locked(inode, 1);
+	pthread_mutex_unlock(&lo->icache.mutex);
+
+	famfs_flock_reply_granted(granted);
+	if (rc != EINPROGRESS)
+		famfs_reply_err(req, rc); /* if rc=0, this is a successful reply */
+}
+
+/*
+ * Request metrics and trace: each handler is called through a wrapper that
+ * times it and records it in the thread's trace ring (see
+ * famfs_fused_metrics.c). The time covers the handler and the reply it
+ * sends; a FLOCK that has to wait returns before it is granted, so its wait
+ * shows up in /flock_stats rather than here. The traced result is the errno
+ * the handler passed to famfs_reply_err(), or 0.
+ */
+#define FAMFS_TIMED(op, nodeid, call)				\
+	do {							\
+		u64 __t0 = famfs_metrics_now();			\
+								\
+		famfs_req_result = 0;				\
+		call;						\
+		famfs_metrics_account(op, __t0, nodeid);	\
+	} while (0)
+
+static void
+famfs_lookup_timed(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	FAMFS_TIMED(FAMFS_OP_LOOKUP, parent, famfs_lookup(req, parent, name));
+}
+
+static void
+famfs_forget_timed(fuse_req_t req, fuse_ino_t nodeid, uint64_t nlookup)
+{
+	FAMFS_TIMED(FAMFS_OP_FORGET, nodeid, famfs_forget(req, nodeid, nlookup));
+}
+
+static void
+famfs_forget_multi_timed(
+	fuse_req_t req,
+	size_t count,
+	struct fuse_forget_data *forgets)
+{
+	FAMFS_TIMED(FAMFS_OP_FORGET_MULTI, 0,
+		    famfs_forget_multi(req, count, forgets));
+}
+
+static void
+famfs_getattr_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	struct fuse_file_info *fi)
+{
+	FAMFS_TIMED(FAMFS_OP_GETATTR, nodeid, famfs_getattr(req, nodeid, fi));
+}
+
+static void
+famfs_setattr_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	struct stat *attr,
+	int valid,
+	struct fuse_file_info *fi)
+{
+	FAMFS_TIMED(FAMFS_OP_SETATTR, nodeid,
+		    famfs_setattr(req, nodeid, attr, valid, fi));
+}
+
+static void
+famfs_open_timed(fuse_req_t req, fuse_ino_t nodeid, struct fuse_file_info *fi)
+{
+	FAMFS_TIMED(FAMFS_OP_OPEN, nodeid, famfs_open(req, nodeid, fi));
+}
+
+static void
+famfs_release_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	struct fuse_file_info *fi)
+{
+	FAMFS_TIMED(FAMFS_OP_RELEASE, nodeid, famfs_release(req, nodeid, fi));
+}
 
-err_out:
-	fuse_reply_err(req, rc); /* if rc=0, this is a successful reply */
+static void
+famfs_opendir_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	struct fuse_file_info *fi)
+{
+	FAMFS_TIMED(FAMFS_OP_OPENDIR, nodeid, famfs_opendir(req, nodeid, fi));
+}
+
+static void
+famfs_readdir_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	size_t size,
+	off_t offset,
+	struct fuse_file_info *fi)
+{
+	FAMFS_TIMED(FAMFS_OP_READDIR, nodeid,
+		    famfs_readdir(req, nodeid, size, offset, fi));
+}
+
+static void
+famfs_readdirplus_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	size_t size,
+	off_t offset,
+	struct fuse_file_info *fi)
+{
+	FAMFS_TIMED(FAMFS_OP_READDIRPLUS, nodeid,
+		    famfs_readdirplus(req, nodeid, size, offset, fi));
+}
+
+static void
+famfs_releasedir_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	struct fuse_file_info *fi)
+{
+	FAMFS_TIMED(FAMFS_OP_RELEASEDIR, nodeid,
+		    famfs_releasedir(req, nodeid, fi));
+}
+
+static void
+famfs_statfs_timed(fuse_req_t req, fuse_ino_t nodeid)
+{
+	FAMFS_TIMED(FAMFS_OP_STATFS, nodeid, famfs_statfs(req, nodeid));
+}
+
+static void
+famfs_getxattr_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	const char *name,
+	size_t size)
+{
+	FAMFS_TIMED(FAMFS_OP_GETXATTR, nodeid,
+		    famfs_getxattr(req, nodeid, name, size));
+}
+
+static void
+famfs_create_timed(
+	fuse_req_t req,
+	fuse_ino_t parent,
+	const char *name,
+	mode_t mode,
+	struct fuse_file_info *fi)
+{
+	FAMFS_TIMED(FAMFS_OP_CREATE, parent,
+		    famfs_create(req, parent, name, mode, fi));
+}
+
+static void
+famfs_flock_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	struct fuse_file_info *fi,
+	int op)
+{
+	FAMFS_TIMED(FAMFS_OP_FLOCK, nodeid, famfs_flock(req, nodeid, fi, op));
+}
+
+static void
+famfs_get_fmap_timed(fuse_req_t req, fuse_ino_t nodeid, size_t size)
+{
+	FAMFS_TIMED(FAMFS_OP_GET_FMAP, nodeid, famfs_get_fmap(req, nodeid, size));
+}
+
+static void
+famfs_get_daxdev_timed(fuse_req_t req, int daxdev_index)
+{
+	FAMFS_TIMED(FAMFS_OP_GET_DAXDEV, 0, famfs_get_daxdev(req, daxdev_index));
 }
 
 static const struct fuse_lowlevel_ops famfs_oper = {
 	.init		= famfs_init,
 	.destroy	= famfs_destroy,
-	.lookup		= famfs_lookup,
-	.forget		= famfs_forget,
-	.getattr	= famfs_getattr,
-	.setattr	= famfs_setattr,
+	.lookup		= famfs_lookup_timed,
+	.forget		= famfs_forget_timed,
+	.getattr	= famfs_getattr_timed,
+	.setattr	= famfs_setattr_timed,
 	/* .readlink */
 	/* .mknod */
 	/* .mkdir */
@@ -1302,39 +2422,39 @@ static const struct fuse_lowlevel_ops famfs_oper = {
 	/* .symlink */
 	/* .rename */
 	/* .link */
-	.open		= famfs_open,
+	.open		= famfs_open_timed,
 	/* .read */
 	/* .write */
 	/* .flush */
-	.release	= famfs_release,
+	.release	= famfs_release_timed,
 	/* .fsync */
-	.opendir	= famfs_opendir,
-	.readdir	= famfs_readdir,
-	.releasedir	= famfs_releasedir,
+	.opendir	= famfs_opendir_timed,
+	.readdir	= famfs_readdir_timed,
+	.releasedir	= famfs_releasedir_timed,
 	/* .fsyncdir */
-	.statfs		= famfs_statfs,
+	.statfs		= famfs_statfs_timed,
 	/* .setxattr */
-	.getxattr	= famfs_getxattr,
+	.getxattr	= famfs_getxattr_timed,
 	/* .listxattr */
 	/* .removexattr */
 	/* .access */
-	.create		= famfs_create,
+	.create		= famfs_create_timed,
 	/* .getlk */
 	/* .setlk */
 	/* .ioctl */
 	/* .poll */
 	/* .write_buf */
 	/* .retrieve_reply */
-	.forget_multi	= famfs_forget_multi,
-	.flock		= famfs_flock,
+	.forget_multi	= famfs_forget_multi_timed,
+	.flock		= famfs_flock_timed,
 	/* .fallocate */
-	.readdirplus	= famfs_readdirplus,
+	.readdirplus	= famfs_readdirplus_timed,
 #ifdef HAVE_COPY_FILE_RANGE
 	/* .copy_file_range */
 #endif
 	/* .lseek */
-	.get_fmap       = famfs_get_fmap,
-	.get_daxdev     = famfs_get_daxdev,
+	.get_fmap       = famfs_get_fmap_timed,
+	.get_daxdev     = famfs_get_daxdev_timed,
 };
 
 void jg_print_fuse_opts(struct fuse_cmdline_opts *opts)
@@ -1369,6 +2489,25 @@ fused_syslog(
 
 #define PROGNAME "famfs_fused"
 
+/*
+ * Directory fd budget for the icache. By default directories may use half
+ * of the fd limit, leaving the rest for the fuse channel(s), the REST server
+ * and shadow files being read.
+ */
+static u64
+famfs_icache_fd_budget(int max_fds)
+{
+	struct rlimit rl;
+
+	if (max_fds < 0)
+		return 0; /* No limit */
+	if (max_fds > 0)
+		return max_fds;
+	if (getrlimit(RLIMIT_NOFILE, &rl) || rl.rlim_cur == RLIM_INFINITY)
+		return 0;
+	return rl.rlim_cur / 2;
+}
+
 #define MAX_DAXDEVS 1
 
 /*
@@ -1395,6 +2534,7 @@ int main(int argc, char *argv[])
 	lo->xattr = 0;
 	lo->cache = CACHE_NORMAL;
 	lo->pass_yaml = 0;
+	lo->trace_entries = FAMFS_TRACE_DEFAULT_ENTRIES;
 #ifdef FUSE_DEV_IOC_DAXDEV_OPEN
 	pthread_mutex_init(&lo->daxdev_push_mutex, NULL);
 	lo->daxdev_max_pushed = -1;
@@ -1457,6 +2597,8 @@ int main(int argc, char *argv[])
 			calloc(MAX_DAXDEVS, sizeof(*lo->daxdev_table));
 		strncpy(lo->daxdev_table[0].dd_daxdev,
 			lo->daxdev, FAMFS_DEVNAME_LEN - 1);
+		/* Rows populated; the daxdev push registers all of them */
+		lo->max_daxdevs = 1;
 	}
 
 	if (!lo->source) {
@@ -1496,6 +2638,12 @@ int main(int argc, char *argv[])
 		ret = 1;
 		goto err_out1;
 	}
+	if (lo->neg_timeout_set && lo->neg_timeout < 0) {
+		famfs_log(FAMFS_LOG_ERR, "negative_timeout is negative (%lf)\n",
+			 lo->neg_timeout);
+		ret = 1;
+		goto err_out1;
+	}
 	if (lo->debug)
 		printf("timeout=%f\n", lo->timeout);
 
@@ -1506,6 +2654,55 @@ int main(int argc, char *argv[])
 		goto err_out1;
 	}
 
+	/*
+	 * With memns the shadow path is still used to find the REST socket
+	 * (and is reported via the shadow xattr), but the namespace itself
+	 * is built from the log on the daxdev.
+	 */
+	if (lo->memns) {
+		if (!lo->daxdev) {
+			famfs_log(FAMFS_LOG_ERR, "%s: memns requires -o daxdev\n",
+				  PROGNAME);
+			ret = 1;
+			goto err_out1;
+		}
+		if (famfs_memns_build(&lo->icache, lo->daxdev)) {
+			ret = 1;
+			goto err_out1;
+		}
+	}
+
+	famfs_icache_set_limits(&lo->icache,
+				(u64)MAX(lo->icache_max_mb, 0) << 20,
+				famfs_icache_fd_budget(lo->icache_max_fds));
+
+	famfs_trace_init(lo->trace_entries);
+
+	/* Without this, STATFS reports the shadow file system */
+	if (lo->daxdev && famfs_fs_stats_init(lo->daxdev))
+		famfs_log(FAMFS_LOG_WARNING,
+			  "%s: statfs will report the shadow file system\n",
+			  PROGNAME);
+
+	lo->nqueues = get_nprocs_conf();
+	if (lo->nqueues < 1)
+		lo->nqueues = 1;
+	lo->queue_stats = aligned_alloc(sizeof(*lo->queue_stats),
+					lo->nqueues * sizeof(*lo->queue_stats));
+	if (lo->queue_stats)
+		memset(lo->queue_stats, 0,
+		       lo->nqueues * sizeof(*lo->queue_stats));
+
+#ifdef FUSE_CAP_OVER_IO_URING
+	/* Ask libfuse to set up the rings; famfs_init() then asks the kernel,
+	 * and libfuse stays on /dev/fuse if the kernel says no */
+	if (lo->uring && fuse_opt_add_arg(&args, "-oio_uring") != 0) {
+		famfs_log(FAMFS_LOG_ERR, "%s: failed to add io_uring opt\n",
+			  PROGNAME);
+		lo->uring = 0;
+	}
+#endif
+
 	/*
 	 * this creates the fuse session
 	 */
@@ -1526,6 +2723,13 @@ int main(int argc, char *argv[])
 	fuse_daemonize(opts.foreground);
 
 	famfs_diag_server_start(shadow_root);
+	if (famfs_warmup_start(lo))
+		famfs_log(FAMFS_LOG_ERR, "%s: icache warmup not started\n",
+			  PROGNAME);
+	if (famfs_logtail_start(lo, se, shadow_root))
+		famfs_log(FAMFS_LOG_ERR,
+			  "%s: log tailer not started; new files will appear "
+			  "after logplay\n", PROGNAME);
 
 	/* Block until ctrl+c or fusermount -u */
 	if (opts.singlethread)
@@ -1542,6 +2746,8 @@ int main(int argc, char *argv[])
 	famfs_log(FAMFS_LOG_NOTICE, "%s: umount %s\n", PROGNAME,
 		  opts.mountpoint);
 	famfs_diag_server_stop();
+	famfs_logtail_stop();
+	famfs_warmup_stop();
 
 	fuse_session_unmount(se);
 
@@ -1559,8 +2765,11 @@ err_out1:
 
 	if (lo->daxdev_table)
 		free(lo->daxdev_table);
+	free(lo->queue_stats);
+	famfs_fs_stats_destroy();
 
 	free(lo->source);
+	free(lo->warmup_paths);
 
 #ifdef FAMFS_COVERAGE
 	__gcov_dump();
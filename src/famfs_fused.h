@@ -16,6 +16,11 @@ enum {
 	CACHE_ALWAYS,
 };
 
+/* Per-queue request count; one cache line each, as queues are per-CPU */
+struct famfs_queue_stat {
+	uint64_t nreq;
+} __attribute__((aligned(64)));
+
 struct famfs_ctx {
 	int debug;
 	int flock;
@@ -27,19 +32,64 @@ struct famfs_ctx {
 	double timeout;
 	int cache;
 	int timeout_set;
+	double neg_timeout;   /* entry timeout for lookups of missing names */
+	int neg_timeout_set;
 	int pass_yaml; /* pass the shadow yaml through */
 	int readdirplus;
+	int memns;       /* in-memory namespace; no shadow tree lookups */
+	int uring;       /* FUSE-over-io_uring requested */
+	int uring_active; /* ...and negotiated with the kernel */
+	int nqueues;
+	struct famfs_queue_stat *queue_stats;
+	int logtail_ms;  /* log tailer poll interval; 0 = no tailer */
+	int logtail_active; /* tailer is running; see famfs_negcache_enabled() */
+	int warmup;      /* pre-populate the icache at startup */
+	char *warmup_paths; /* ...only these subtrees (':'-separated) */
+	int warmup_threads;
+	int icache_max_mb;  /* retain unreferenced inodes within this budget */
+	int icache_max_fds; /* open directory fds; 0 = half of RLIMIT_NOFILE */
+	int trace_entries;  /* trace ring records per thread; 0 = no trace */
 	struct famfs_icache icache;
 
 	/*
 	 * Push-mode daxdev registration (one consumer of the daxdev table).
 	 * Daxdevs are pushed to the kernel densely in index order, so the
 	 * pushed state is just the highest index pushed so far (-1 = none) -
-	 * the fuse analog of the kernel's GET_MAX_DAXDEV. daxdev_push_mutex
-	 * serializes the check-and-push against concurrent lookups.
+	 * the fuse analog of the kernel's GET_MAX_DAXDEV. It is read without
+	 * the lock (atomic acquire load) so already-pushed lookups never touch
+	 * daxdev_push_mutex; the mutex only serializes actual pushes, which
+	 * publish the new index with a release store.
 	 */
 	pthread_mutex_t daxdev_push_mutex;
 	int             daxdev_max_pushed;
 };
 
+/* Entry timeout for a negative lookup reply; 0 = reply ENOENT instead.
+ * Opt-in: a local create writes its shadow file and opens the new name
+ * through the mount right away, without waiting for the log tailer to
+ * invalidate a cached miss */
+static inline double
+famfs_neg_timeout(struct famfs_ctx *lo)
+{
+	return lo->neg_timeout_set ? lo->neg_timeout : 0.0;
+}
+
+/*
+ * The daemon caches misses only if negative lookups are cached at all, and
+ * only while the log tailer is running: without it, names appear when some
+ * other process plays the log, and nothing would tell us (or the kernel) to
+ * drop the cached misses.
+ */
+static inline int
+famfs_negcache_enabled(struct famfs_ctx *lo)
+{
+	return famfs_neg_timeout(lo) > 0 &&
+		__atomic_load_n(&lo->logtail_active, __ATOMIC_ACQUIRE);
+}
+
+struct famfs_fmap *famfs_fmap_alloc(struct famfs_icache *icache,
+				    const struct famfs_log_file_meta *fmeta);
+int famfs_shadow_file_load(fuse_req_t req, struct famfs_ctx *lo, int fd,
+			   struct stat *attr, struct famfs_fmap **fmap_out);
+
 #endif /* FAMFS_FUSED_H */
@@ -9,6 +9,243 @@
 #include <fuse_lowlevel.h>
 #include "famfs_fused_icache.h"
 #include "famfs_fused.h"
+#include "famfs_lib_internal.h"
+
+/*
+ * Memory pools
+ *
+ * With millions of cached inodes, per-object malloc overhead adds up, and
+ * lookup and forget would each make several trips into malloc. Instead,
+ * inodes come from a slab of fixed-size objects, and names and fmaps from a
+ * set of power-of-2 size class slabs (anything bigger than the largest class
+ * falls back to malloc). Freed objects go back on their slab's free list for
+ * reuse, so a steady-state icache doesn't call malloc or free at all.
+ */
+
+#define FAMFS_SLAB_CHUNK_SIZE (64 * 1024)
+#define FAMFS_SLAB_CHUNK_HDR  16  /* Keeps objects 16-byte aligned */
+
+static void
+famfs_slab_init(struct famfs_slab *slab, size_t objsize)
+{
+	memset(slab, 0, sizeof(*slab));
+	slab->objsize = (objsize + 15) & ~(size_t)15;
+}
+
+/* Caller holds the pool mutex */
+static void *
+famfs_slab_alloc(struct famfs_slab *slab)
+{
+	void *obj;
+
+	if (!slab->free) {
+		size_t nobj = (FAMFS_SLAB_CHUNK_SIZE - FAMFS_SLAB_CHUNK_HDR) /
+			slab->objsize;
+		char *chunk = malloc(FAMFS_SLAB_CHUNK_SIZE);
+		size_t i;
+
+		if (!chunk)
+			return NULL;
+		*(void **)chunk = slab->chunks;
+		slab->chunks = chunk;
+		slab->nchunks++;
+
+		/* Thread the new objects onto the free list, lowest first */
+		for (i = nobj; i > 0; i--) {
+			obj = chunk + FAMFS_SLAB_CHUNK_HDR +
+				(i - 1) * slab->objsize;
+			*(void **)obj = slab->free;
+			slab->free = obj;
+		}
+	}
+
+	obj = slab->free;
+	slab->free = *(void **)obj;
+	slab->in_use++;
+	return obj;
+}
+
+/* Caller holds the pool mutex */
+static void
+famfs_slab_free(struct famfs_slab *slab, void *obj)
+{
+	*(void **)obj = slab->free;
+	slab->free = obj;
+	slab->in_use--;
+}
+
+static void
+famfs_slab_destroy(struct famfs_slab *slab)
+{
+	while (slab->chunks) {
+		void *chunk = slab->chunks;
+
+		slab->chunks = *(void **)chunk;
+		free(chunk);
+	}
+	slab->free = NULL;
+	slab->nchunks = 0;
+}
+
+static int
+famfs_mem_class(size_t size)
+{
+	int class = 0;
+
+	while (size > ((size_t)1 << (FAMFS_MEM_MIN_SHIFT + class)))
+		class++;
+	return (class < FAMFS_MEM_NCLASSES) ? class : -1;
+}
+
+static void
+famfs_icache_pools_init(struct famfs_icache *icache)
+{
+	int i;
+
+	pthread_mutex_init(&icache->pool_mutex, NULL);
+	famfs_slab_init(&icache->inode_slab, sizeof(struct famfs_inode));
+	for (i = 0; i < FAMFS_MEM_NCLASSES; i++)
+		famfs_slab_init(&icache->mem_slab[i],
+				(size_t)1 << (FAMFS_MEM_MIN_SHIFT + i));
+}
+
+/* Every object must have been freed */
+static void
+famfs_icache_pools_destroy(struct famfs_icache *icache)
+{
+	int i;
+
+	pthread_mutex_lock(&icache->pool_mutex);
+	famfs_slab_destroy(&icache->inode_slab);
+	for (i = 0; i < FAMFS_MEM_NCLASSES; i++)
+		famfs_slab_destroy(&icache->mem_slab[i]);
+	pthread_mutex_unlock(&icache->pool_mutex);
+}
+
+/**
+ * famfs_icache_mem_alloc() - allocate a name or fmap from the icache pools
+ *
+ * The memory is not zeroed. It must be freed with famfs_icache_mem_free(),
+ * with the same size.
+ */
+void *
+famfs_icache_mem_alloc(struct famfs_icache *icache, size_t size)
+{
+	int class = famfs_mem_class(size);
+	void *p;
+
+	if (class < 0) {
+		p = malloc(size);
+		if (p) {
+			pthread_mutex_lock(&icache->pool_mutex);
+			icache->mem_large++;
+			icache->mem_large_bytes += size;
+			pthread_mutex_unlock(&icache->pool_mutex);
+		}
+		return p;
+	}
+
+	pthread_mutex_lock(&icache->pool_mutex);
+	p = famfs_slab_alloc(&icache->mem_slab[class]);
+	pthread_mutex_unlock(&icache->pool_mutex);
+	return p;
+}
+
+void
+famfs_icache_mem_free(struct famfs_icache *icache, void *p, size_t size)
+{
+	int class = famfs_mem_class(size);
+
+	if (!p)
+		return;
+
+	pthread_mutex_lock(&icache->pool_mutex);
+	if (class < 0) {
+		icache->mem_large--;
+		icache->mem_large_bytes -= size;
+		free(p);
+	} else {
+		famfs_slab_free(&icache->mem_slab[class], p);
+	}
+	pthread_mutex_unlock(&icache->pool_mutex);
+}
+
+static char *
+famfs_icache_strdup(struct famfs_icache *icache, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *p = famfs_icache_mem_alloc(icache, len);
+
+	if (p)
+		memcpy(p, s, len);
+	return p;
+}
+
+static void
+famfs_icache_strfree(struct famfs_icache *icache, char *s)
+{
+	if (s)
+		famfs_icache_mem_free(icache, s, strlen(s) + 1);
+}
+
+struct famfs_fmap *
+famfs_fmap_get(struct famfs_fmap *fmap)
+{
+	if (fmap)
+		__atomic_add_fetch(&fmap->refcount, 1, __ATOMIC_RELAXED);
+	return fmap;
+}
+
+/* Drop a ref; the fmap is freed with the last one */
+void
+famfs_fmap_free(struct famfs_icache *icache, struct famfs_fmap *fmap)
+{
+	if (fmap && __atomic_sub_fetch(&fmap->refcount, 1,
+				       __ATOMIC_ACQ_REL) == 0)
+		famfs_icache_mem_free(icache, fmap,
+				      sizeof(*fmap) + fmap->size);
+}
+
+/* Bytes of objects allocated from the pools */
+static uint64_t
+famfs_icache_pool_bytes(struct famfs_icache *icache)
+{
+	uint64_t bytes;
+	int i;
+
+	pthread_mutex_lock(&icache->pool_mutex);
+	bytes = icache->inode_slab.in_use * icache->inode_slab.objsize +
+		icache->mem_large_bytes;
+	for (i = 0; i < FAMFS_MEM_NCLASSES; i++)
+		bytes += icache->mem_slab[i].in_use *
+			icache->mem_slab[i].objsize;
+	pthread_mutex_unlock(&icache->pool_mutex);
+	return bytes;
+}
+
+/**
+ * famfs_icache_pool_stats() - snapshot of the icache pool usage
+ */
+void
+famfs_icache_pool_stats(
+	struct famfs_icache *icache,
+	struct famfs_pool_stats *ps)
+{
+	int i;
+
+	memset(ps, 0, sizeof(*ps));
+	ps->bytes = famfs_icache_pool_bytes(icache);
+	pthread_mutex_lock(&icache->pool_mutex);
+	ps->inodes = icache->inode_slab.in_use;
+	ps->inode_bytes = icache->inode_slab.nchunks * FAMFS_SLAB_CHUNK_SIZE;
+	for (i = 0; i < FAMFS_MEM_NCLASSES; i++) {
+		ps->mem_allocs += icache->mem_slab[i].in_use;
+		ps->mem_bytes += icache->mem_slab[i].nchunks *
+			FAMFS_SLAB_CHUNK_SIZE;
+	}
+	ps->mem_large = icache->mem_large;
+	pthread_mutex_unlock(&icache->pool_mutex);
+}
 
 int famfs_icache_init(
 	void *owner,
@@ -17,7 +254,7 @@ int famfs_icache_init(
 {
 	memset(icache, 0, sizeof(*icache));
 	pthread_mutex_init(&icache->mutex, NULL);
-	pthread_mutex_init(&icache->flock_mutex, NULL);
+	famfs_icache_pools_init(icache);
 	icache->owner = owner;
 	
 	/* Root inode setup */
@@ -25,7 +262,7 @@ int famfs_icache_init(
 	icache->root.flags = FAMFS_ROOTDIR;
 	icache->root.ftype = FAMFS_FDIR;
 	icache->root.ino = FUSE_ROOT_ID;
-	icache->root.name = strdup(".");
+	icache->root.name = famfs_icache_strdup(icache, ".");
 	icache->root.icache = icache;
 	icache->root.refcount = 2;
 	icache->root.fd = -1;
@@ -59,10 +296,18 @@ void famfs_icache_destroy(struct famfs_icache *icache)
 	/* Clean up root inode resources */
 	if (icache->root.fd >= 0)
 		close(icache->root.fd);
-	if (icache->root.name)
-		free(icache->root.name);
+	famfs_icache_strfree(icache, icache->root.name);
+	icache->root.name = NULL;
+	famfs_dir_index_free(icache->root.dindex);
+	icache->root.dindex = NULL;
+	famfs_negcache_free(icache, icache->root.negcache);
+	icache->root.negcache = NULL;
+	free(icache->ino_hash);
+	icache->ino_hash = NULL;
+	icache->ino_hash_size = 0;
 
 	pthread_mutex_unlock(&icache->mutex);
+	famfs_icache_pools_destroy(icache);
 	/*
 	 * Don't destroy mutexes - process is exiting anyway,
 	 * and this avoids a theoretical race between mutex_lock and
@@ -70,25 +315,270 @@ void famfs_icache_destroy(struct famfs_icache *icache)
 	 */
 }
 
-void famfs_icache_flock(struct famfs_inode *inode)
+/*
+ * Flock
+ */
+
+static void
+famfs_flock_free(struct famfs_flock *fl)
 {
-	struct famfs_icache *icache = inode->icache;
+	struct famfs_flock_holder *h;
+	struct famfs_flock_waiter *w;
+
+	if (!fl)
+		return;
+	while ((h = fl->holders)) {
+		fl->holders = h->next;
+		free(h);
+	}
+	while ((w = fl->waiters)) {
+		fl->waiters = w->next;
+		free(w);
+	}
+	free(fl);
+}
+
+/* Free the inode's flock state once nobody holds or waits for the lock */
+static void
+famfs_flock_put_locked(struct famfs_inode *inode)
+{
+	struct famfs_flock *fl = inode->flock;
 
-	pthread_mutex_lock(&icache->flock_mutex);
-	inode->flock_held = 1;
+	if (fl && !fl->holders && !fl->waiters) {
+		famfs_flock_free(fl);
+		inode->flock = NULL;
+	}
 }
 
-void famfs_icache_unflock(struct famfs_inode *inode)
+static int
+famfs_flock_add_holder(struct famfs_flock *fl, uint64_t owner, int exclusive)
 {
-	struct famfs_icache *icache = inode->icache;
+	struct famfs_flock_holder *h;
 
-	if (!inode->flock_held) {
-		famfs_log(FAMFS_LOG_ERR, "%s: ino %d name %s flock not held\n",
-			  __func__, inode->ino, inode->name);
-		return;
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return ENOMEM;
+	h->owner = owner;
+	h->next = fl->holders;
+	fl->holders = h;
+	fl->exclusive = exclusive;
+	return 0;
+}
+
+/* Returns 1 if @owner held the lock (and no longer does) */
+static int
+famfs_flock_del_holder(struct famfs_flock *fl, uint64_t owner)
+{
+	struct famfs_flock_holder **pp, *h;
+
+	for (pp = &fl->holders; (h = *pp); pp = &h->next) {
+		if (h->owner == owner) {
+			*pp = h->next;
+			free(h);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static uint64_t
+famfs_flock_ns_since(const struct timespec *t)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t->tv_sec) * 1000000000ULL +
+		now.tv_nsec - t->tv_nsec;
+}
+
+/*
+ * Grant waiters from the head of the queue for as long as they are
+ * compatible with the holders: one exclusive waiter, or a run of shared
+ * waiters. Granted waiters are appended to @granted.
+ */
+static void
+famfs_flock_grant_locked(
+	struct famfs_inode *inode,
+	struct famfs_flock_waiter **granted)
+{
+	struct famfs_flock_stats *st = &inode->icache->flock_stats;
+	struct famfs_flock *fl = inode->flock;
+	struct famfs_flock_waiter *w;
+
+	while ((w = fl->waiters)) {
+		uint64_t ns;
+
+		if (fl->holders && (w->exclusive || fl->exclusive))
+			break;
+		if (famfs_flock_add_holder(fl, w->owner, w->exclusive))
+			break; /* Retried at the next release */
+
+		fl->waiters = w->next;
+		if (!fl->waiters)
+			fl->waiters_tail = &fl->waiters;
+
+		ns = famfs_flock_ns_since(&w->queued);
+		st->waiting--;
+		st->acquired++;
+		st->wait_ns += ns;
+		if (ns > st->max_wait_ns)
+			st->max_wait_ns = ns;
+
+		while (*granted)
+			granted = &(*granted)->next;
+		w->next = NULL;
+		*granted = w;
+	}
+}
+
+/**
+ * famfs_flock_acquire_locked() - take a shared or exclusive flock
+ *
+ * @inode:     the inode
+ * @owner:     lock owner
+ * @exclusive: LOCK_EX if nonzero, else LOCK_SH
+ * @nonblock:  LOCK_NB: fail rather than wait
+ * @cookie:    identifies the request if it has to wait
+ * @granted:   waiters granted as a side effect (if @owner converts a lock it
+ *             already held) are appended here; the caller must reply to and
+ *             free them
+ *
+ * A request waits behind earlier waiters even if it is compatible with the
+ * holders, so a stream of shared lockers can't starve an exclusive one.
+ *
+ * Returns 0 if the lock was granted, EWOULDBLOCK if @nonblock and it is not
+ * available, EINPROGRESS if the request was queued (it is returned through
+ * @granted by a later release), or ENOMEM
+ */
+int
+famfs_flock_acquire_locked(
+	struct famfs_inode *inode,
+	uint64_t owner,
+	int exclusive,
+	int nonblock,
+	void *cookie,
+	struct famfs_flock_waiter **granted)
+{
+	struct famfs_flock_stats *st = &inode->icache->flock_stats;
+	struct famfs_flock_waiter *w;
+	struct famfs_flock *fl;
+	int rc;
+
+	if (!inode->flock) {
+		inode->flock = calloc(1, sizeof(*inode->flock));
+		if (!inode->flock)
+			return ENOMEM;
+		inode->flock->waiters_tail = &inode->flock->waiters;
+	}
+	fl = inode->flock;
+
+	/* Conversion: as with flock(2), the old lock is dropped first (and
+	 * it's a no-op if the mode is unchanged) */
+	if (fl->holders && fl->exclusive == !!exclusive) {
+		struct famfs_flock_holder *h;
+
+		for (h = fl->holders; h; h = h->next)
+			if (h->owner == owner)
+				return 0;
+	}
+	if (famfs_flock_del_holder(fl, owner))
+		famfs_flock_grant_locked(inode, granted);
+
+	if (!fl->waiters && (!fl->holders || (!exclusive && !fl->exclusive))) {
+		rc = famfs_flock_add_holder(fl, owner, !!exclusive);
+		if (rc)
+			goto out;
+		st->acquired++;
+		return 0;
+	}
+
+	if (nonblock) {
+		st->wouldblock++;
+		rc = EWOULDBLOCK;
+		goto out;
+	}
+
+	w = calloc(1, sizeof(*w));
+	if (!w) {
+		rc = ENOMEM;
+		goto out;
 	}
-	inode->flock_held = 0;
-	pthread_mutex_unlock(&icache->flock_mutex);
+	w->cookie = cookie;
+	w->owner = owner;
+	w->exclusive = !!exclusive;
+	clock_gettime(CLOCK_MONOTONIC, &w->queued);
+	*fl->waiters_tail = w;
+	fl->waiters_tail = &w->next;
+	st->contended++;
+	st->waiting++;
+	return EINPROGRESS;
+
+out:
+	famfs_flock_put_locked(inode);
+	return rc;
+}
+
+/**
+ * famfs_flock_release_locked() - drop @owner's flock on @inode
+ *
+ * Waiters that can now be granted are appended to @granted; the caller must
+ * reply to and free them.
+ *
+ * Returns 1 if @owner held the lock, 0 if it did not
+ */
+int
+famfs_flock_release_locked(
+	struct famfs_inode *inode,
+	uint64_t owner,
+	struct famfs_flock_waiter **granted)
+{
+	int held;
+
+	if (!inode->flock)
+		return 0;
+
+	held = famfs_flock_del_holder(inode->flock, owner);
+	if (held)
+		famfs_flock_grant_locked(inode, granted);
+	famfs_flock_put_locked(inode);
+	return held;
+}
+
+/**
+ * famfs_flock_cancel_locked() - remove a waiting request from the queue
+ *
+ * Waiters that were queued behind it and can now be granted are appended to
+ * @granted, as for famfs_flock_release_locked().
+ *
+ * Returns 1 if the request identified by @cookie was waiting (the caller
+ * must reply to it), 0 if it was not (it may have been granted already)
+ */
+int
+famfs_flock_cancel_locked(
+	struct famfs_inode *inode,
+	void *cookie,
+	struct famfs_flock_waiter **granted)
+{
+	struct famfs_flock_waiter **pp, *w;
+	struct famfs_flock *fl = inode->flock;
+
+	if (!fl)
+		return 0;
+
+	for (pp = &fl->waiters; (w = *pp); pp = &w->next) {
+		if (w->cookie != cookie)
+			continue;
+		*pp = w->next;
+		if (fl->waiters_tail == &w->next)
+			fl->waiters_tail = pp;
+		free(w);
+		inode->icache->flock_stats.waiting--;
+		inode->icache->flock_stats.interrupted++;
+		famfs_flock_grant_locked(inode, granted);
+		famfs_flock_put_locked(inode);
+		return 1;
+	}
+	return 0;
 }
 
 void dump_inode(const char *caller, struct famfs_inode *inode, int loglevel)
@@ -104,9 +594,9 @@ void dump_inode(const char *caller, struct famfs_inode *inode, int loglevel)
 		  (inode->parent) ? inode->parent->ino : 0,
 		  inode->pinned,
 		  inode->name);
-	if (inode->ftype == FAMFS_FDIR && inode->fmeta)
-		famfs_log(FAMFS_LOG_ERR, "%s: dir inode has fmeta %p\n",
-			  __func__, inode->fmeta);
+	if (inode->ftype == FAMFS_FDIR && inode->fmap)
+		famfs_log(FAMFS_LOG_ERR, "%s: dir inode has fmap %p\n",
+			  __func__, inode->fmap);
 }
 
 void dump_icache(struct famfs_icache *icache, int loglevel)
@@ -127,6 +617,344 @@ void dump_icache(struct famfs_icache *icache, int loglevel)
 	famfs_log(loglevel, "   %ld inodes cached\n", nino);
 }
 
+/*
+ * Directory index (memns)
+ */
+
+#define FAMFS_DIR_INDEX_MIN_BUCKETS 16
+
+static uint64_t
+famfs_dir_index_hash(const char *name)
+{
+	uint64_t h = 0xcbf29ce484222325ULL; /* FNV-1a */
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+struct famfs_dir_index *
+famfs_dir_index_alloc(void)
+{
+	struct famfs_dir_index *di = calloc(1, sizeof(*di));
+
+	if (!di)
+		return NULL;
+
+	di->nbuckets = FAMFS_DIR_INDEX_MIN_BUCKETS;
+	di->buckets = calloc(di->nbuckets, sizeof(*di->buckets));
+	if (!di->buckets) {
+		free(di);
+		return NULL;
+	}
+	return di;
+}
+
+/* Frees the index only; the children are icache inodes */
+void
+famfs_dir_index_free(struct famfs_dir_index *di)
+{
+	if (!di)
+		return;
+	free(di->children);
+	free(di->buckets);
+	free(di);
+}
+
+/* Double the bucket count once the load factor reaches 1 */
+static int
+famfs_dir_index_grow(struct famfs_dir_index *di)
+{
+	size_t nbuckets = di->nbuckets * 2;
+	struct famfs_inode **buckets;
+	size_t i;
+
+	buckets = calloc(nbuckets, sizeof(*buckets));
+	if (!buckets)
+		return -1;
+
+	for (i = 0; i < di->nchildren; i++) {
+		struct famfs_inode *child = di->children[i];
+		size_t b = famfs_dir_index_hash(child->name) & (nbuckets - 1);
+
+		child->dir_hnext = buckets[b];
+		buckets[b] = child;
+	}
+	free(di->buckets);
+	di->buckets = buckets;
+	di->nbuckets = nbuckets;
+	return 0;
+}
+
+/**
+ * famfs_dir_index_find_locked()
+ *
+ * Find a child of @dir by name. Does not take a ref on the child.
+ * Caller holds the icache mutex.
+ */
+struct famfs_inode *
+famfs_dir_index_find_locked(struct famfs_inode *dir, const char *name)
+{
+	struct famfs_dir_index *di = dir->dindex;
+	struct famfs_inode *p;
+
+	if (!di)
+		return NULL;
+
+	p = di->buckets[famfs_dir_index_hash(name) & (di->nbuckets - 1)];
+	for (; p; p = p->dir_hnext)
+		if (strcmp(p->name, name) == 0)
+			return p;
+	return NULL;
+}
+
+/**
+ * famfs_dir_index_add_locked()
+ *
+ * Add @child to @dir's index. The caller has checked that the name is not
+ * already present. Caller holds the icache mutex.
+ *
+ * Returns 0 on success, -1 on allocation failure
+ */
+int
+famfs_dir_index_add_locked(
+	struct famfs_inode *dir,
+	struct famfs_inode *child)
+{
+	struct famfs_dir_index *di = dir->dindex;
+	size_t b;
+
+	FAMFS_ASSERT(__func__, di);
+
+	if (di->nchildren == di->children_cap) {
+		size_t cap = di->children_cap ? di->children_cap * 2 : 16;
+		struct famfs_inode **children;
+
+		children = realloc(di->children, cap * sizeof(*children));
+		if (!children)
+			return -1;
+		di->children = children;
+		di->children_cap = cap;
+	}
+	if (di->nchildren >= di->nbuckets && famfs_dir_index_grow(di))
+		return -1;
+
+	di->children[di->nchildren++] = child;
+	b = famfs_dir_index_hash(child->name) & (di->nbuckets - 1);
+	child->dir_hnext = di->buckets[b];
+	di->buckets[b] = child;
+	return 0;
+}
+
+/*
+ * Negative lookup cache
+ */
+
+static void
+famfs_negcache_clear(struct famfs_icache *icache, struct famfs_negcache *nc)
+{
+	int i;
+
+	for (i = 0; i < FAMFS_NEGCACHE_SLOTS; i++) {
+		famfs_icache_strfree(icache, nc->slots[i].name);
+		nc->slots[i].name = NULL;
+	}
+	nc->count = 0;
+}
+
+void
+famfs_negcache_free(struct famfs_icache *icache, struct famfs_negcache *nc)
+{
+	if (!nc)
+		return;
+	famfs_negcache_clear(icache, nc);
+	famfs_icache_mem_free(icache, nc, sizeof(*nc));
+}
+
+/**
+ * famfs_negcache_find_locked()
+ *
+ * @gen is the negative cache generation the caller sampled before it would
+ * have searched the shadow directory. Caller holds the icache mutex.
+ *
+ * Returns 1 if @name is known not to exist in @dir, else 0
+ */
+int
+famfs_negcache_find_locked(
+	struct famfs_inode *dir,
+	const char *name,
+	uint64_t gen)
+{
+	struct famfs_negcache *nc = dir->negcache;
+	uint64_t h;
+	int slot;
+
+	if (!nc || nc->gen != gen || !nc->count)
+		return 0;
+
+	h = famfs_dir_index_hash(name);
+	slot = h & (FAMFS_NEGCACHE_SLOTS - 1);
+	if (!nc->slots[slot].name || nc->slots[slot].hash != h ||
+	    strcmp(nc->slots[slot].name, name) != 0)
+		return 0;
+
+	dir->icache->neg_hits++;
+	return 1;
+}
+
+/**
+ * famfs_negcache_add_locked()
+ *
+ * Record that @name was not found in @dir. @gen is the generation sampled
+ * before the search: if it has been superseded, the name may exist by now
+ * and is not added. Failure to allocate just leaves the name uncached.
+ * Caller holds the icache mutex.
+ */
+void
+famfs_negcache_add_locked(
+	struct famfs_inode *dir,
+	const char *name,
+	uint64_t gen)
+{
+	struct famfs_icache *icache = dir->icache;
+	struct famfs_negcache *nc = dir->negcache;
+	uint64_t h = famfs_dir_index_hash(name);
+	int slot = h & (FAMFS_NEGCACHE_SLOTS - 1);
+	char *p;
+
+	if (dir->ftype != FAMFS_FDIR || gen != famfs_icache_neg_gen(icache))
+		return;
+
+	if (!nc) {
+		nc = famfs_icache_mem_alloc(icache, sizeof(*nc));
+		if (!nc)
+			return;
+		memset(nc, 0, sizeof(*nc));
+		nc->gen = gen;
+		dir->negcache = nc;
+	} else if (nc->gen != gen) {
+		famfs_negcache_clear(icache, nc);
+		nc->gen = gen;
+	}
+
+	p = famfs_icache_strdup(icache, name);
+	if (!p)
+		return;
+	if (nc->slots[slot].name)
+		famfs_icache_strfree(icache, nc->slots[slot].name);
+	else
+		nc->count++;
+	nc->slots[slot].hash = h;
+	nc->slots[slot].name = p;
+	icache->neg_adds++;
+}
+
+/**
+ * famfs_icache_shadow_logplay_entry()
+ *
+ * Play a log entry into the shadow tree for the log tailer. A FILE or MKDIR
+ * entry that creates its shadow file invalidates the negcache; one whose
+ * shadow file was already there changes nothing a lookup could have seen.
+ *
+ * Returns famfs_shadow_logplay_entry()'s result
+ */
+int
+famfs_icache_shadow_logplay_entry(
+	struct famfs_icache *icache,
+	const char *shadow_root,
+	const struct famfs_log_entry *le)
+{
+	int rc;
+
+	rc = famfs_shadow_logplay_entry(shadow_root, le, NULL, 0, 0, 0);
+	if (rc > 0 && (le->famfs_log_entry_type == FAMFS_LOG_FILE ||
+		       le->famfs_log_entry_type == FAMFS_LOG_MKDIR))
+		famfs_icache_neg_invalidate(icache);
+	return rc;
+}
+
+/*
+ * Inode number hash
+ */
+
+#define FAMFS_INO_HASH_MIN 64
+
+static inline size_t
+famfs_ino_hash(uint64_t ino, size_t size)
+{
+	uint64_t h = ino * 0x9E3779B97F4A7C15ULL;
+
+	return (h ^ (h >> 32)) & (size - 1);
+}
+
+/* Grow (or create) the ino hash so it has at least one bucket per inode */
+static void
+famfs_ino_hash_grow_locked(struct famfs_icache *icache)
+{
+	size_t newsize = icache->ino_hash_size ? icache->ino_hash_size * 2
+					       : FAMFS_INO_HASH_MIN;
+	struct famfs_inode **newhash;
+	struct famfs_inode *p;
+	size_t i;
+
+	newhash = calloc(newsize, sizeof(*newhash));
+	if (!newhash)
+		return; /* Keep the old table; chains just get longer */
+
+	for (i = 0; i < icache->ino_hash_size; i++) {
+		while ((p = icache->ino_hash[i])) {
+			size_t b = famfs_ino_hash(p->ino, newsize);
+
+			icache->ino_hash[i] = p->ino_hnext;
+			p->ino_hnext = newhash[b];
+			newhash[b] = p;
+		}
+	}
+	free(icache->ino_hash);
+	icache->ino_hash = newhash;
+	icache->ino_hash_size = newsize;
+}
+
+static void
+famfs_ino_hash_add_locked(
+	struct famfs_icache *icache,
+	struct famfs_inode *inode)
+{
+	size_t b;
+
+	if (icache->count >= icache->ino_hash_size)
+		famfs_ino_hash_grow_locked(icache);
+	if (!icache->ino_hash)
+		return;
+
+	b = famfs_ino_hash(inode->ino, icache->ino_hash_size);
+	inode->ino_hnext = icache->ino_hash[b];
+	icache->ino_hash[b] = inode;
+}
+
+static void
+famfs_ino_hash_del_locked(
+	struct famfs_icache *icache,
+	struct famfs_inode *inode)
+{
+	struct famfs_inode **pp;
+
+	if (!icache->ino_hash)
+		return;
+
+	pp = &icache->ino_hash[famfs_ino_hash(inode->ino,
+					      icache->ino_hash_size)];
+	for (; *pp; pp = &(*pp)->ino_hnext) {
+		if (*pp == inode) {
+			*pp = inode->ino_hnext;
+			inode->ino_hnext = NULL;
+			return;
+		}
+	}
+}
+
 /*
  * Move to new: famfs_icache.c
  */
@@ -138,16 +966,27 @@ famfs_inode_alloc(
 	const char *name,
 	ino_t inode_num,
 	dev_t dev,
-	struct famfs_log_file_meta *fmeta,
+	struct famfs_fmap *fmap,
 	struct stat *attrp,
 	enum famfs_fuse_ftype ftype,
 	struct famfs_inode *parent)
 {
 	struct famfs_inode *inode;
 
-	inode = calloc(1, sizeof(*inode));
+	pthread_mutex_lock(&icache->pool_mutex);
+	inode = famfs_slab_alloc(&icache->inode_slab);
+	pthread_mutex_unlock(&icache->pool_mutex);
 	if (!inode)
 		return NULL;
+	memset(inode, 0, sizeof(*inode));
+
+	inode->name = famfs_icache_strdup(icache, name);
+	if (!inode->name) {
+		pthread_mutex_lock(&icache->pool_mutex);
+		famfs_slab_free(&icache->inode_slab, inode);
+		pthread_mutex_unlock(&icache->pool_mutex);
+		return NULL;
+	}
 
 	inode->icache = (void *)icache;
 	inode->refcount = 1;
@@ -155,10 +994,9 @@ famfs_inode_alloc(
 	inode->fd = fd;
 	inode->ino = inode_num;
 	inode->dev = dev;
-	inode->fmeta = fmeta;
-	inode->attr = *attrp;
+	inode->fmap = fmap;
+	famfs_inode_set_attr(inode, attrp);
 	inode->ftype = ftype;
-	inode->name = strdup(name);
 	inode->parent = parent;
 
 	/* Ref will be put on parent when the inode is inserted into icache */
@@ -166,6 +1004,312 @@ famfs_inode_alloc(
 	return inode;
 }
 
+/**
+ * famfs_inode_get_attr() - the inode's attributes as a struct stat
+ */
+void
+famfs_inode_get_attr(const struct famfs_inode *inode, struct stat *st)
+{
+	const struct famfs_iattr *a = &inode->attr;
+
+	memset(st, 0, sizeof(*st));
+	st->st_ino = inode->ino;
+	st->st_dev = inode->dev;
+	st->st_mode = a->mode;
+	st->st_nlink = a->nlink;
+	st->st_uid = a->uid;
+	st->st_gid = a->gid;
+	st->st_size = a->size;
+	st->st_blksize = a->blksize;
+	st->st_blocks = a->blocks;
+	st->st_atim.tv_sec = a->atime;
+	st->st_atim.tv_nsec = a->atime_nsec;
+	st->st_mtim.tv_sec = a->mtime;
+	st->st_mtim.tv_nsec = a->mtime_nsec;
+	st->st_ctim.tv_sec = a->ctime;
+	st->st_ctim.tv_nsec = a->ctime_nsec;
+}
+
+/**
+ * famfs_inode_set_attr() - set the inode's attributes from a struct stat
+ *
+ * st_ino and st_dev are not stored; they belong to the inode
+ */
+void
+famfs_inode_set_attr(struct famfs_inode *inode, const struct stat *st)
+{
+	struct famfs_iattr *a = &inode->attr;
+
+	a->mode = st->st_mode;
+	a->nlink = st->st_nlink;
+	a->uid = st->st_uid;
+	a->gid = st->st_gid;
+	a->size = st->st_size;
+	a->blksize = st->st_blksize;
+	a->blocks = st->st_blocks;
+	a->atime = st->st_atim.tv_sec;
+	a->atime_nsec = st->st_atim.tv_nsec;
+	a->mtime = st->st_mtim.tv_sec;
+	a->mtime_nsec = st->st_mtim.tv_nsec;
+	a->ctime = st->st_ctim.tv_sec;
+	a->ctime_nsec = st->st_ctim.tv_nsec;
+}
+
+/*
+ * Budget and LRU
+ *
+ * The kernel holds a ref on every inode it has looked up, and those can't go
+ * away until it forgets them. What the daemon controls is everything else:
+ *
+ * - With a memory budget (max_bytes), inodes whose last ref is dropped are
+ *   retained on an LRU instead of being freed, so a later lookup (or a
+ *   warm-up) finds them cached. When the pools hold more than max_bytes,
+ *   retained inodes are freed from the cold end. Without a budget, an
+ *   unreferenced inode is freed at once, as before.
+ * - Each directory inode holds an O_PATH fd into the shadow tree. With an fd
+ *   budget (max_fds), the fds of the coldest directories are closed, and
+ *   reopened from the parent's fd when they are next needed. Users of a
+ *   directory fd must bracket it with famfs_inode_fd_get()/_put(), which keep
+ *   it from being closed underneath them.
+ *
+ * Pinned inodes (mutated attrs) and memns inodes (held by the namespace) are
+ * never retained or evicted. The LRUs are protected by the icache mutex.
+ */
+
+/**
+ * famfs_icache_set_limits() - set the icache memory and fd budgets
+ *
+ * @max_bytes: pool bytes above which retained inodes are evicted; 0 to free
+ *             unreferenced inodes immediately (no retention)
+ * @max_fds:   open directory fds above which cold ones are closed; 0 for no
+ *             limit
+ */
+void
+famfs_icache_set_limits(
+	struct famfs_icache *icache,
+	uint64_t max_bytes,
+	uint64_t max_fds)
+{
+	pthread_mutex_lock(&icache->mutex);
+	icache->max_bytes = icache->memns ? 0 : max_bytes;
+	icache->max_fds = max_fds;
+	pthread_mutex_unlock(&icache->mutex);
+}
+
+static void
+famfs_lru_add_locked(struct famfs_icache *icache, struct famfs_inode *inode)
+{
+	inode->lru_prev = NULL;
+	inode->lru_next = icache->lru_head;
+	if (icache->lru_head)
+		icache->lru_head->lru_prev = inode;
+	else
+		icache->lru_tail = inode;
+	icache->lru_head = inode;
+	inode->flags |= FAMFS_ON_LRU;
+	icache->lru_count++;
+}
+
+static void
+famfs_lru_del_locked(struct famfs_icache *icache, struct famfs_inode *inode)
+{
+	if (!(inode->flags & FAMFS_ON_LRU))
+		return;
+	if (inode->lru_prev)
+		inode->lru_prev->lru_next = inode->lru_next;
+	else
+		icache->lru_head = inode->lru_next;
+	if (inode->lru_next)
+		inode->lru_next->lru_prev = inode->lru_prev;
+	else
+		icache->lru_tail = inode->lru_prev;
+	inode->lru_next = inode->lru_prev = NULL;
+	inode->flags &= ~FAMFS_ON_LRU;
+	icache->lru_count--;
+}
+
+static void
+famfs_fdlru_add_locked(struct famfs_icache *icache, struct famfs_inode *inode)
+{
+	inode->fdlru_prev = NULL;
+	inode->fdlru_next = icache->fdlru_head;
+	if (icache->fdlru_head)
+		icache->fdlru_head->fdlru_prev = inode;
+	else
+		icache->fdlru_tail = inode;
+	icache->fdlru_head = inode;
+	inode->flags |= FAMFS_ON_FDLRU;
+	icache->nfds++;
+}
+
+static void
+famfs_fdlru_del_locked(struct famfs_icache *icache, struct famfs_inode *inode)
+{
+	if (!(inode->flags & FAMFS_ON_FDLRU))
+		return;
+	if (inode->fdlru_prev)
+		inode->fdlru_prev->fdlru_next = inode->fdlru_next;
+	else
+		icache->fdlru_head = inode->fdlru_next;
+	if (inode->fdlru_next)
+		inode->fdlru_next->fdlru_prev = inode->fdlru_prev;
+	else
+		icache->fdlru_tail = inode->fdlru_prev;
+	inode->fdlru_next = inode->fdlru_prev = NULL;
+	inode->flags &= ~FAMFS_ON_FDLRU;
+	icache->nfds--;
+}
+
+/* Close the fds of the coldest directories that nobody is using */
+static void
+famfs_icache_trim_fds_locked(struct famfs_icache *icache)
+{
+	struct famfs_inode *inode = icache->fdlru_tail;
+
+	if (!icache->max_fds)
+		return;
+
+	while (inode && icache->nfds > icache->max_fds) {
+		struct famfs_inode *prev = inode->fdlru_prev;
+
+		if (!inode->fd_users) {
+			famfs_fdlru_del_locked(icache, inode);
+			close(inode->fd);
+			inode->fd = -1;
+			icache->fd_closes++;
+		}
+		inode = prev;
+	}
+}
+
+/* Directory inodes whose fd is managed by the fd LRU */
+static int
+famfs_inode_fd_managed(struct famfs_inode *inode)
+{
+	return inode->ftype == FAMFS_FDIR &&
+		inode != &inode->icache->root && !inode->icache->memns;
+}
+
+/*
+ * Reopen a directory whose fd was closed for the budget. This is done under
+ * the icache mutex; it's an openat() on the local shadow tree, and only
+ * happens once the fd budget has been exceeded.
+ */
+static int
+famfs_inode_reopen_locked(struct famfs_inode *inode)
+{
+	struct famfs_icache *icache = inode->icache;
+	struct stat st;
+	int pfd, fd;
+
+	if (!inode->parent) {
+		errno = ESTALE;
+		goto err;
+	}
+	pfd = famfs_inode_fd_get_locked(inode->parent);
+	if (pfd < 0)
+		goto err;
+	fd = openat(pfd, inode->name, O_PATH | O_NOFOLLOW);
+	famfs_inode_fd_put_locked(inode->parent);
+	if (fd < 0)
+		goto err;
+
+	/* The shadow tree is not supposed to change under us, but check */
+	if (fstat(fd, &st) || st.st_ino != inode->ino) {
+		close(fd);
+		errno = ESTALE;
+		goto err;
+	}
+
+	inode->fd = fd;
+	famfs_fdlru_add_locked(icache, inode);
+	icache->fd_reopens++;
+	return 0;
+
+err:
+	famfs_log(FAMFS_LOG_ERR, "%s: failed to reopen %s: %s\n",
+		  __func__, inode->name, strerror(errno));
+	icache->fd_reopen_errors++;
+	return -1;
+}
+
+/**
+ * famfs_inode_fd_get_locked() - get an inode's shadow fd for use
+ *
+ * A directory's fd may have been closed for the fd budget; if so, it is
+ * reopened. The fd stays open until the matching famfs_inode_fd_put().
+ *
+ * Returns the fd, or -1 (with errno set) if the inode has no fd - in which
+ * case there is nothing to put
+ */
+int
+famfs_inode_fd_get_locked(struct famfs_inode *inode)
+{
+	struct famfs_icache *icache = inode->icache;
+
+	if (!famfs_inode_fd_managed(inode)) {
+		if (inode->fd < 0)
+			errno = EBADF;
+		return inode->fd;
+	}
+
+	if (inode->fd < 0 && famfs_inode_reopen_locked(inode))
+		return -1;
+
+	inode->fd_users++;
+	famfs_fdlru_del_locked(icache, inode);
+	famfs_fdlru_add_locked(icache, inode);
+	famfs_icache_trim_fds_locked(icache);
+	return inode->fd;
+}
+
+int
+famfs_inode_fd_get(struct famfs_inode *inode)
+{
+	struct famfs_icache *icache = inode->icache;
+	int fd;
+
+	pthread_mutex_lock(&icache->mutex);
+	fd = famfs_inode_fd_get_locked(inode);
+	pthread_mutex_unlock(&icache->mutex);
+	return fd;
+}
+
+void
+famfs_inode_fd_put_locked(struct famfs_inode *inode)
+{
+	if (!famfs_inode_fd_managed(inode))
+		return;
+	FAMFS_ASSERT(__func__, inode->fd_users > 0);
+	inode->fd_users--;
+}
+
+void
+famfs_inode_fd_put(struct famfs_inode *inode)
+{
+	struct famfs_icache *icache = inode->icache;
+
+	pthread_mutex_lock(&icache->mutex);
+	famfs_inode_fd_put_locked(inode);
+	pthread_mutex_unlock(&icache->mutex);
+}
+
+/* Take a found inode's ref; a retained inode comes off the LRU */
+static struct famfs_inode *
+famfs_icache_get_cached_locked(
+	struct famfs_icache *icache,
+	struct famfs_inode *inode)
+{
+	FAMFS_ASSERT(__func__, inode->refcount > 0 || inode->pinned ||
+		     (inode->flags & FAMFS_ON_LRU));
+	if (inode->flags & FAMFS_ON_LRU) {
+		famfs_lru_del_locked(icache, inode);
+		icache->lru_hits++;
+	}
+	inode->refcount++;
+	return inode;
+}
+
 /**
  * famfs_find_inode_locked(): find a cached famfs_inode
  *
@@ -175,7 +1319,6 @@ struct famfs_inode *
 famfs_icache_find_get_from_ino_locked(
 	struct famfs_icache *icache, uint64_t ino)
 {
-	/* TODO: replace this lookup mechanism with Bernd's wbtree lookup code */
 	struct famfs_inode *p;
 	struct famfs_inode *inode = NULL;
 
@@ -186,16 +1329,29 @@ famfs_icache_find_get_from_ino_locked(
 	}
 
 	icache->search_count++;
+	if (icache->ino_hash) {
+		p = icache->ino_hash[famfs_ino_hash(ino,
+						    icache->ino_hash_size)];
+		for (; p; p = p->ino_hnext) {
+			icache->nodes_scanned++;
+			if (p->ino == ino) {
+				inode = famfs_icache_get_cached_locked(icache,
+								       p);
+				break;
+			}
+		}
+		goto out;
+	}
+
 	for (p = icache->root.next; p != &icache->root; p = p->next) {
 		/* Nodeid is the address of the entry we're looking for */
 		icache->nodes_scanned++;
 		if (p->ino == ino) {
-			FAMFS_ASSERT(__func__, p->refcount > 0 || p->pinned);
-			inode = p;
-			inode->refcount++;
+			inode = famfs_icache_get_cached_locked(icache, p);
 			break;
 		}
 	}
+out:
 	if (!inode)
 		icache->search_fail_ct++;
 
@@ -245,22 +1401,78 @@ famfs_icache_insert_locked(
 	inode->icache = icache;
 	famfs_inode_getref_locked(inode->parent);
 
+	famfs_ino_hash_add_locked(icache, inode);
 	icache->count++;
+
+	if (inode->fd >= 0 && famfs_inode_fd_managed(inode)) {
+		famfs_fdlru_add_locked(icache, inode);
+		famfs_icache_trim_fds_locked(icache);
+	}
 }
 
 void
 famfs_inode_free(struct famfs_inode *inode)
 {
+	struct famfs_icache *icache = inode->icache;
+
 	if (inode->ino == FUSE_ROOT_ID)
 		return;
 
+	if (inode->flags & FAMFS_ON_FDLRU)
+		famfs_fdlru_del_locked(icache, inode);
 	if (inode->fd > 0)
 		close(inode->fd);
-	if (inode->fmeta)
-		free(inode->fmeta);
-	if (inode->name)
-		free(inode->name);
-	free(inode);
+	famfs_fmap_free(icache, inode->fmap);
+	famfs_icache_strfree(icache, inode->name);
+	famfs_dir_index_free(inode->dindex);
+	famfs_negcache_free(icache, inode->negcache);
+	famfs_flock_free(inode->flock);
+
+	pthread_mutex_lock(&icache->pool_mutex);
+	famfs_slab_free(&icache->inode_slab, inode);
+	pthread_mutex_unlock(&icache->pool_mutex);
+}
+
+/* Take an unreferenced inode out of the icache and free it */
+static void
+famfs_inode_evict_locked(struct famfs_inode *inode)
+{
+	struct famfs_icache *icache = inode->icache;
+	struct famfs_inode *prev, *next;
+
+	prev = inode->prev;
+	next = inode->next;
+	next->prev = prev;
+	prev->next = next;
+	famfs_ino_hash_del_locked(icache, inode);
+	icache->count--;
+
+	if (inode->parent)
+		famfs_inode_putref_locked(inode->parent, 1);
+
+	inode->parent = 0;
+	famfs_inode_free(inode);
+}
+
+/* Free retained inodes, coldest first, until the pools are within budget.
+ * Evicting an inode can drop its parent's last ref, which retains the parent
+ * on the LRU; it may then be evicted by the same loop */
+static void
+famfs_icache_trim_locked(struct famfs_icache *icache)
+{
+	if (icache->trimming)
+		return;
+
+	icache->trimming = 1;
+	while (icache->lru_tail &&
+	       famfs_icache_pool_bytes(icache) > icache->max_bytes) {
+		struct famfs_inode *inode = icache->lru_tail;
+
+		famfs_lru_del_locked(icache, inode);
+		famfs_inode_evict_locked(inode);
+		icache->evictions++;
+	}
+	icache->trimming = 0;
 }
 
 void famfs_inode_putref_locked(struct famfs_inode *inode, uint64_t count)
@@ -270,20 +1482,14 @@ void famfs_inode_putref_locked(struct famfs_inode *inode, uint64_t count)
 	inode->refcount -= count;
 
 	if (!inode->refcount && !inode->pinned && inode->ino != FUSE_ROOT_ID) {
-		struct famfs_inode *prev, *next;
-
-		prev = inode->prev;
-		next = inode->next;
-		next->prev = prev;
-		prev->next = next;
-		inode->icache->count--;
-		inode->icache = NULL;
+		struct famfs_icache *icache = inode->icache;
 
-		if (inode->parent)
-			famfs_inode_putref_locked(inode->parent, 1);
-
-		inode->parent = 0;
-		famfs_inode_free(inode);
+		if (!icache->max_bytes) {
+			famfs_inode_evict_locked(inode);
+			return;
+		}
+		famfs_lru_add_locked(icache, inode);
+		famfs_icache_trim_locked(icache);
 	}
 };
 
@@ -316,6 +1522,77 @@ famfs_icache_unref_inode(
 	pthread_mutex_unlock(&icache->mutex);
 }
 
+/* Forget entries applied per hold of the icache mutex; bounds how long a
+ * large batch can keep LOOKUPs waiting */
+#define FAMFS_FORGET_CHUNK 1024
+
+/**
+ * famfs_icache_forget_batch() - drop the kernel's lookup refs on many inodes
+ *
+ * @icache:  the icache
+ * @forgets: nodeids and the number of lookups the kernel is forgetting
+ * @count:   entries in @forgets
+ *
+ * The batch is applied FAMFS_FORGET_CHUNK entries per hold of the icache
+ * mutex, rather than taking it once or twice per entry. Inodes whose last ref
+ * goes away are freed (or retained on the LRU) as they are reached, and so
+ * are the parents they held; with a memory budget, the LRU is trimmed once
+ * per chunk rather than after each entry.
+ *
+ * Returns the number of entries applied; entries whose nodeid is not a live
+ * inode in this icache are skipped
+ */
+size_t
+famfs_icache_forget_batch(
+	struct famfs_icache *icache,
+	const struct fuse_forget_data *forgets,
+	size_t count)
+{
+	size_t i = 0, applied = 0;
+
+	pthread_mutex_lock(&icache->mutex);
+	icache->forget_batches++;
+	while (i < count) {
+		size_t end = (count - i > FAMFS_FORGET_CHUNK) ?
+			i + FAMFS_FORGET_CHUNK : count;
+
+		icache->trimming = 1;
+		for (; i < end; i++) {
+			struct famfs_inode *inode;
+
+			if (forgets[i].ino == FUSE_ROOT_ID)
+				inode = &icache->root;
+			else
+				inode = (struct famfs_inode *)(uintptr_t)
+					forgets[i].ino;
+
+			if (inode->icache != icache || inode->refcount < 1) {
+				famfs_log(FAMFS_LOG_ERR,
+					  "%s: bad nodeid 0x%llx\n", __func__,
+					  (unsigned long long)forgets[i].ino);
+				continue;
+			}
+			FAMFS_ASSERT(__func__,
+				     inode->refcount >= forgets[i].nlookup);
+			famfs_inode_putref_locked(inode, forgets[i].nlookup);
+			applied++;
+		}
+		icache->trimming = 0;
+		if (icache->max_bytes)
+			famfs_icache_trim_locked(icache);
+
+		if (i < count) {
+			/* Let waiting LOOKUPs in between chunks */
+			pthread_mutex_unlock(&icache->mutex);
+			pthread_mutex_lock(&icache->mutex);
+		}
+	}
+	icache->forgets += applied;
+	pthread_mutex_unlock(&icache->mutex);
+
+	return applied;
+}
+
 struct famfs_inode *
 famfs_get_inode_from_nodeid_locked(
 	struct famfs_icache *icache,
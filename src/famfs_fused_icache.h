@@ -18,6 +18,7 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <pthread.h>
+#include <time.h>
 #include <sys/file.h>
 #include <sys/xattr.h>
 #include <systemd/sd-journal.h>
@@ -34,26 +35,176 @@ enum famfs_fuse_ftype {
 
 /* flags */
 
-#define FAMFS_ROOTDIR 1
+#define FAMFS_ROOTDIR  1
+#define FAMFS_ON_LRU   2  /* On the icache LRU (unreferenced, retained) */
+#define FAMFS_ON_FDLRU 4  /* Directory fd is open and on the fd LRU */
 
 struct famfs_icache;
+struct famfs_inode;
+
+/*
+ * Per-directory child index, used by the in-memory namespace (-o memns),
+ * where directories have no shadow directory to openat() into. Children are
+ * kept in creation order - famfs never removes names, so an index into
+ * children[] is a stable readdir offset - and are hashed by name for lookup.
+ * Protected by the icache mutex.
+ */
+struct famfs_dir_index {
+	struct famfs_inode **children;     /* creation order */
+	size_t nchildren;
+	size_t children_cap;
+	struct famfs_inode **buckets;      /* chained via inode->dir_hnext */
+	size_t nbuckets;                   /* power of 2 */
+};
+
+/*
+ * Per-directory negative lookup cache: names recently looked up in the
+ * shadow directory and not found. Entries are only valid at the generation
+ * they were added in (see famfs_icache_neg_invalidate()); a newer generation
+ * empties the cache on the next add. Direct-mapped by name hash, so a
+ * colliding add replaces the older name. Protected by the icache mutex.
+ */
+#define FAMFS_NEGCACHE_SLOTS 64
+
+struct famfs_negcache {
+	uint64_t gen;
+	uint32_t count;
+	struct {
+		uint64_t hash;
+		char *name;                /* from the icache pools */
+	} slots[FAMFS_NEGCACHE_SLOTS];
+};
+
+/*
+ * Per-inode flock state, allocated on first use and freed when the last
+ * holder and waiter are gone. Holders are identified by lock owner (the
+ * kernel's id for the open file). Waiters are queued in arrival order with
+ * an opaque cookie (the fuse request); when a waiter is granted it is handed
+ * back to the caller, which replies outside the icache mutex. Protected by
+ * the icache mutex.
+ */
+struct famfs_flock_holder {
+	struct famfs_flock_holder *next;
+	uint64_t owner;
+};
+
+struct famfs_flock_waiter {
+	struct famfs_flock_waiter *next;
+	void *cookie;
+	uint64_t owner;
+	int exclusive;
+	struct timespec queued;
+};
+
+struct famfs_flock {
+	int exclusive;                       /* holders hold it exclusively */
+	struct famfs_flock_holder *holders;
+	struct famfs_flock_waiter *waiters;  /* FIFO */
+	struct famfs_flock_waiter **waiters_tail;
+};
+
+struct famfs_flock_stats {
+	uint64_t acquired;     /* Locks granted */
+	uint64_t contended;    /* Requests that had to wait */
+	uint64_t wouldblock;   /* LOCK_NB requests refused */
+	uint64_t interrupted;  /* Waits cancelled by the kernel */
+	uint64_t waiting;      /* Requests waiting now */
+	uint64_t wait_ns;      /* Total time granted waiters waited */
+	uint64_t max_wait_ns;
+};
+
+/*
+ * Inode attributes: the parts of struct stat that famfs inodes use, in about
+ * half the space. st_ino and st_dev come from the inode itself; see
+ * famfs_inode_get_attr().
+ */
+struct famfs_iattr {
+	uint64_t size;
+	uint64_t blocks;
+	int64_t atime;
+	int64_t mtime;
+	int64_t ctime;
+	uint32_t atime_nsec;
+	uint32_t mtime_nsec;
+	uint32_t ctime_nsec;
+	uint32_t mode;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t nlink;
+	uint32_t blksize;
+};
+
+/*
+ * Compact file map: the GET_FMAP reply for a file, serialized once when it is
+ * looked up, plus what the daemon itself needs to know about the fmap. It is
+ * sized to the file's extents, rather than the fixed extent arrays of a
+ * struct famfs_log_file_meta. Allocated from the icache pools.
+ *
+ * An fmap is refcounted so GET_FMAP can reply from it while lookup replaces
+ * inode->fmap: take a ref under the icache mutex with famfs_fmap_get(), and
+ * drop it with famfs_fmap_free().
+ */
+struct famfs_fmap {
+	uint32_t size;         /* bytes in msg[] */
+	int32_t max_devindex;  /* highest daxdev index referenced (-1: none) */
+	uint32_t refcount;     /* atomic */
+	uint8_t msg[];         /* GET_FMAP reply */
+};
 
 struct famfs_inode {
 	struct famfs_inode *next;          /* protected by lo->mutex */
 	struct famfs_inode *prev;          /* protected by lo->mutex */
 	int fd;                            /* fd must be closed if > 0 */
+	int flags;
 	ino_t ino;
 	dev_t dev;
-	int flags;
 	uint64_t refcount;                 /* protected by lo->mutex */
 	struct famfs_icache *icache;
-	struct famfs_log_file_meta *fmeta; /* fmeta must be freed */
-	struct stat attr;
+	struct famfs_fmap *fmap;           /* files only; must be freed */
+	struct timespec shadow_ctim;       /* ctime of the shadow yaml that
+					    * fmap was read from */
+	struct famfs_iattr attr;           /* see famfs_inode_get_attr() */
 	int pinned;      /* We pin in the cache if attrs have been mutated */
 	enum famfs_fuse_ftype ftype;
 	struct famfs_inode *parent;        /* parent ref must be dropped */
 	char *name;                        /* name must be freed */
-	int flock_held;
+	struct famfs_flock *flock;         /* NULL if not locked; must be
+					    * freed */
+	struct famfs_dir_index *dindex;    /* memns dirs only; must be freed */
+	struct famfs_negcache *negcache;   /* dirs only; must be freed */
+	struct famfs_inode *dir_hnext;     /* parent dindex hash chain */
+	struct famfs_inode *ino_hnext;     /* icache ino hash chain */
+	struct famfs_inode *lru_next;      /* icache LRU, if FAMFS_ON_LRU */
+	struct famfs_inode *lru_prev;
+	struct famfs_inode *fdlru_next;    /* fd LRU, if FAMFS_ON_FDLRU */
+	struct famfs_inode *fdlru_prev;
+	int fd_users;                      /* see famfs_inode_fd_get() */
+};
+
+/*
+ * Fixed-size object allocator for the icache pools. Objects are carved from
+ * chunks that are only released when the icache is destroyed; free objects
+ * are chained through their first word.
+ */
+struct famfs_slab {
+	size_t objsize;
+	void *free;
+	void *chunks;            /* chained through their first word */
+	uint64_t nchunks;
+	uint64_t in_use;
+};
+
+/* Size classes for names and fmaps: 16, 32, ... 4096 bytes */
+#define FAMFS_MEM_MIN_SHIFT 4
+#define FAMFS_MEM_NCLASSES  9
+
+struct famfs_pool_stats {
+	uint64_t bytes;          /* Bytes of objects allocated, all pools */
+	uint64_t inodes;         /* Inodes allocated */
+	uint64_t inode_bytes;    /* Bytes of inode chunks */
+	uint64_t mem_allocs;     /* Names and fmaps allocated */
+	uint64_t mem_bytes;      /* Bytes of name/fmap chunks */
+	uint64_t mem_large;      /* Allocations too big for a size class */
 };
 
 struct famfs_icache {
@@ -62,13 +213,74 @@ struct famfs_icache {
 	uint64_t count;
 	char *shadow_root;
 	void *owner;
-	pthread_mutex_t flock_mutex; /* only one flock per file system!! */
+	struct famfs_flock_stats flock_stats;
 
 	uint64_t search_count;   /* How many times did we find_get an inode */
 	uint64_t nodes_scanned;  /* how many nodes scanned in find_get ops */
 	uint64_t search_fail_ct; /* How many searches failed */
+
+	/* Inodes hashed by ino, for find_get_from_ino. If the table can't be
+	 * allocated, searches fall back to scanning the list */
+	struct famfs_inode **ino_hash;
+	size_t ino_hash_size;    /* power of 2 */
+
+	int memns;               /* namespace is in memory (no shadow tree) */
+	ino_t next_ino;          /* memns: next inode number to assign */
+
+	/* Inodes, names and fmaps are allocated from these pools, which have
+	 * their own mutex: fmaps are built outside the icache mutex. When
+	 * both are held, the icache mutex is taken first */
+	pthread_mutex_t pool_mutex;
+	struct famfs_slab inode_slab;
+	struct famfs_slab mem_slab[FAMFS_MEM_NCLASSES];
+	uint64_t mem_large;
+	uint64_t mem_large_bytes;
+
+	/* Budget: see famfs_icache_set_limits() */
+	uint64_t max_bytes;
+	uint64_t max_fds;
+	struct famfs_inode *lru_head;    /* Unreferenced inodes, MRU first */
+	struct famfs_inode *lru_tail;
+	uint64_t lru_count;
+	struct famfs_inode *fdlru_head;  /* Directories with open fds, MRU
+					  * first */
+	struct famfs_inode *fdlru_tail;
+	uint64_t nfds;
+	int trimming;
+
+	uint64_t lru_hits;       /* Retained inodes referenced again */
+	uint64_t evictions;      /* Retained inodes freed for the budget */
+	uint64_t fd_closes;      /* Directory fds closed for the budget */
+	uint64_t fd_reopens;     /* ...and reopened on demand */
+	uint64_t fd_reopen_errors;
+
+	uint64_t forget_batches; /* famfs_icache_forget_batch() calls */
+	uint64_t forgets;        /* ...and the entries in them */
+
+	/* Negative lookup cache generation; bumped without the mutex when
+	 * names may have appeared in the shadow tree */
+	uint64_t neg_gen;
+	uint64_t neg_hits;       /* Lookups answered from a negcache */
+	uint64_t neg_adds;       /* Names added to a negcache */
 };
 
+/*
+ * Invalidate every directory's negative lookup cache. Call after the name
+ * exists in the shadow tree; lookups sample the generation before they
+ * search the shadow directory.
+ */
+static inline void
+famfs_icache_neg_invalidate(struct famfs_icache *icache)
+{
+	__atomic_add_fetch(&icache->neg_gen, 1, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t
+famfs_icache_neg_gen(struct famfs_icache *icache)
+{
+	return __atomic_load_n(&icache->neg_gen, __ATOMIC_ACQUIRE);
+}
+
 static inline uint64_t
 famfs_icache_count(struct famfs_icache *icache)
 {
@@ -80,17 +292,31 @@ int famfs_icache_init(
 	struct famfs_icache *icache,
 	const char *shadow_root);
 void famfs_icache_destroy(struct famfs_icache *icache);
+void famfs_icache_set_limits(struct famfs_icache *icache,
+			     uint64_t max_bytes, uint64_t max_fds);
 struct famfs_inode *famfs_inode_alloc(
 	struct famfs_icache *icache, int fd,
 	const char *name, ino_t inode_num, dev_t dev,
-	struct famfs_log_file_meta *fmeta, struct stat *attrp,
+	struct famfs_fmap *fmap, struct stat *attrp,
 	enum famfs_fuse_ftype ftype, struct famfs_inode *parent);
+void famfs_inode_get_attr(const struct famfs_inode *inode, struct stat *st);
+void famfs_inode_set_attr(struct famfs_inode *inode, const struct stat *st);
+
+void *famfs_icache_mem_alloc(struct famfs_icache *icache, size_t size);
+void famfs_icache_mem_free(struct famfs_icache *icache, void *p, size_t size);
+struct famfs_fmap *famfs_fmap_get(struct famfs_fmap *fmap);
+void famfs_fmap_free(struct famfs_icache *icache, struct famfs_fmap *fmap);
+void famfs_icache_pool_stats(struct famfs_icache *icache,
+			     struct famfs_pool_stats *ps);
 
 void famfs_icache_insert_locked(struct famfs_icache *icache,
 				struct famfs_inode *inode);
 void
 famfs_icache_unref_inode(struct famfs_icache *icache, struct famfs_inode *inode,
 			 uint64_t n);
+size_t famfs_icache_forget_batch(struct famfs_icache *icache,
+				 const struct fuse_forget_data *forgets,
+				 size_t count);
 void dump_inode(const char *caller, struct famfs_inode *inode, int loglevel);
 void dump_icache(struct famfs_icache *icache, int loglevel);
 
@@ -123,7 +349,34 @@ static inline void famfs_inode_getref(
 void famfs_inode_putref_locked(struct famfs_inode *inode, uint64_t count);
 void famfs_inode_putref(struct famfs_inode *inode);
 
-void famfs_icache_flock(struct famfs_inode *inode);
-void famfs_icache_unflock(struct famfs_inode *inode);
+int famfs_inode_fd_get_locked(struct famfs_inode *inode);
+int famfs_inode_fd_get(struct famfs_inode *inode);
+void famfs_inode_fd_put_locked(struct famfs_inode *inode);
+void famfs_inode_fd_put(struct famfs_inode *inode);
+
+struct famfs_dir_index *famfs_dir_index_alloc(void);
+void famfs_dir_index_free(struct famfs_dir_index *di);
+int famfs_dir_index_add_locked(struct famfs_inode *dir,
+			       struct famfs_inode *child);
+struct famfs_inode *famfs_dir_index_find_locked(struct famfs_inode *dir,
+						const char *name);
+
+void famfs_negcache_free(struct famfs_icache *icache,
+			 struct famfs_negcache *nc);
+int famfs_negcache_find_locked(struct famfs_inode *dir, const char *name,
+			       uint64_t gen);
+void famfs_negcache_add_locked(struct famfs_inode *dir, const char *name,
+			       uint64_t gen);
+int famfs_icache_shadow_logplay_entry(struct famfs_icache *icache,
+				      const char *shadow_root,
+				      const struct famfs_log_entry *le);
+
+int famfs_flock_acquire_locked(struct famfs_inode *inode, uint64_t owner,
+			       int exclusive, int nonblock, void *cookie,
+			       struct famfs_flock_waiter **granted);
+int famfs_flock_release_locked(struct famfs_inode *inode, uint64_t owner,
+			       struct famfs_flock_waiter **granted);
+int famfs_flock_cancel_locked(struct famfs_inode *inode, void *cookie,
+			      struct famfs_flock_waiter **granted);
 
 #endif /* FAMFS_FUSED_ICACHE */
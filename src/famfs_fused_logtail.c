@@ -0,0 +1,404 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2026 Micron Technology, Inc.  All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#define FUSE_USE_VERSION FUSE_MAKE_VERSION(3, 12)
+
+#include <fuse_lowlevel.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "famfs_lib.h"
+#include "famfs_lib_internal.h"
+#include "famfs_log.h"
+#include "libfcc.h"
+#include "famfs_fused.h"
+#include "famfs_fused_icache.h"
+#include "famfs_fused_logtail.h"
+#include "famfs_fused_memns.h"
+
+/*
+ * Log tailer
+ *
+ * Without the tailer, a file created on another node shows up on a fuse
+ * client only after something runs 'famfs logplay' to write its shadow yaml,
+ * and even then only once the kernel looks it up again. The tailer follows
+ * the log directly: it maps the log read-only from the daxdev, polls
+ * famfs_log_next_index, plays each new entry into the shadow tree, and tells
+ * the kernel to drop its (possibly negative) dentry for the new name. The
+ * next access does a fresh LOOKUP, which builds the icache inode and fmap
+ * from the shadow yaml - so inode refcounts stay driven by kernel lookups.
+ *
+ * The tailer starts from log index 0: entries already played at mount time
+ * find their shadow files in place, create nothing and notify nobody. When
+ * the log is compacted (famfs compact) the tailer starts over; again, only
+ * entries it has not seen before create anything. Names created on this
+ * node are not the tailer's business: negative lookups are only cached when
+ * asked for (-o negative_timeout), since a local create opens its new name
+ * right away.
+ *
+ * With -o memns there is no shadow tree; new entries go straight into the
+ * in-memory namespace (see famfs_fused_memns.c) instead.
+ *
+ * The tailer maps the log from the daxdev, so it takes on segments the log
+ * grows by as it reaches them (famfs_log_iter_next()). When it does, it
+ * writes the shadow meta files for them (.meta/.log.<n>), since readers
+ * that map the log through the mount need those.
+ */
+
+/* Polls an unreadable entry is retried for before it is skipped: next_index
+ * may be visible before the entry it covers, but not for this long */
+#define FAMFS_LOGTAIL_RETRIES 10
+
+struct famfs_logtail {
+	struct famfs_ctx *lo;
+	struct fuse_session *se;
+	char *shadow_root;
+	struct famfs_superblock *sb;
+	struct famfs_log *logp;
+	int poll_ms;
+	struct famfs_log_iter it;
+	int retries;        /* Polls the next entry has been unreadable for */
+	u64 mapped_len;     /* Log length when segment meta files were made */
+	u64 applied;        /* Entries played (counting replays) */
+	u64 restarts;       /* Replays from the start after a compaction */
+
+	u64 created;        /* Files/dirs created by the tailer */
+	u64 errors;         /* Entries that could not be played */
+	u64 notify_errors;  /* Kernel notifications that failed */
+};
+
+static struct famfs_logtail lt;
+static pthread_t logtail_thread;
+static volatile int logtail_shutdown_requested;
+static int logtail_running;
+
+/* Must not hold the icache mutex here: the kernel may be waiting on the
+ * parent's i_rwsem for a LOOKUP that needs it */
+static void
+famfs_logtail_inval(fuse_ino_t parent_nodeid, const char *name)
+{
+	int rc;
+
+	rc = fuse_lowlevel_notify_inval_entry(lt.se, parent_nodeid, name,
+					      strlen(name));
+	if (rc && rc != -ENOENT) {
+		famfs_log(FAMFS_LOG_WARNING,
+			  "%s: inval_entry(%s) failed: %d\n",
+			  __func__, name, rc);
+		lt.notify_errors++;
+	}
+
+	/* With cache=always the parent's readdir results are cached too */
+	rc = fuse_lowlevel_notify_inval_inode(lt.se, parent_nodeid, 0, 0);
+	if (rc && rc != -ENOENT)
+		lt.notify_errors++;
+}
+
+static fuse_ino_t
+famfs_logtail_nodeid(struct famfs_inode *inode)
+{
+	return (inode == &lt.lo->icache.root) ? FUSE_ROOT_ID
+					       : (uintptr_t)inode;
+}
+
+/**
+ * famfs_logtail_notify() - invalidate the kernel dentry for a new log entry
+ *
+ * If the parent directory is not in the icache, the kernel has never looked
+ * it up, so it cannot hold a dentry for the new name and there is nothing
+ * to invalidate.
+ *
+ * Returns 0, or -1 if the shadow path of the parent does not fit in PATH_MAX
+ */
+static int
+famfs_logtail_notify(const char *relpath)
+{
+	struct famfs_inode *parent = NULL;
+	fuse_ino_t parent_nodeid;
+	char path[PATH_MAX];
+	const char *name;
+	struct stat st;
+	char *slash;
+	int rc;
+
+	strncpy(path, relpath, sizeof(path) - 1);
+	path[sizeof(path) - 1] = '\0';
+
+	slash = strrchr(path, '/');
+	if (!slash) {
+		parent_nodeid = FUSE_ROOT_ID;
+		name = path;
+	} else {
+		char shadow_parent[PATH_MAX];
+
+		*slash = '\0';
+		name = slash + 1;
+		rc = snprintf(shadow_parent, sizeof(shadow_parent), "%s/%s",
+			      lt.shadow_root, path);
+		if (rc < 0 || (size_t)rc >= sizeof(shadow_parent)) {
+			famfs_log(FAMFS_LOG_ERR, "%s: path too long: %s/%s\n",
+				  __func__, lt.shadow_root, path);
+			return -1;
+		}
+		if (stat(shadow_parent, &st))
+			return 0;
+
+		parent = famfs_icache_find_get_from_ino(&lt.lo->icache,
+							st.st_ino);
+		if (!parent)
+			return 0;
+		parent_nodeid = (uintptr_t)parent;
+	}
+
+	famfs_logtail_inval(parent_nodeid, name);
+
+	if (parent)
+		famfs_inode_putref(parent);
+	return 0;
+}
+
+/* Make the meta files for log segments the tailer has mapped since it last
+ * looked */
+static void
+famfs_logtail_segs(void)
+{
+	u64 len = famfs_log_mapped_len(lt.logp);
+	enum famfs_system_role role;
+	char relpath[32];
+	u32 i;
+
+	if (len == lt.mapped_len || lt.lo->memns)
+		return;
+	lt.mapped_len = len;
+
+	role = __famfs_get_role_and_logstats(lt.sb, NULL, NULL);
+	if (__famfs_mkmeta_log_segs(lt.shadow_root, lt.logp, role,
+				    1 /* shadow */, 0) <= 0)
+		return;
+
+	famfs_icache_neg_invalidate(&lt.lo->icache);
+	for (i = 1; i <= famfs_log_nsegs(lt.logp); i++) {
+		snprintf(relpath, sizeof(relpath), ".meta/.log.%d", i);
+		famfs_logtail_notify(relpath);
+	}
+}
+
+static void
+famfs_logtail_poll(void)
+{
+	struct famfs_log *logp = lt.logp;
+	struct famfs_log_entry le;
+	u64 next;
+	int rc;
+
+	/* Only the cache line that holds next_index is invalidated here; each
+	 * new entry is invalidated as it is consumed */
+	invalidate_processor_cache(&logp->famfs_log_next_index,
+				   sizeof(logp->famfs_log_next_index));
+	next = logp->famfs_log_next_index;
+	if (next > logp->famfs_log_last_index + 1)
+		return;
+
+	famfs_logtail_segs();
+
+	if (famfs_log_iter_stale(&lt.it)) {
+		famfs_log(FAMFS_LOG_NOTICE,
+			  "%s: log was compacted; replaying it\n", __func__);
+		famfs_log_iter_init(&lt.it, logp);
+		lt.retries = 0;
+		lt.restarts++;
+	}
+
+	while (!logtail_shutdown_requested) {
+		struct famfs_inode *parent = NULL;
+		const char *relpath;
+		const char *name;
+
+		famfs_log_iter_invalidate(&lt.it);
+		rc = famfs_log_iter_next(&lt.it, &le);
+		if (rc == 0)
+			break;
+
+		/* next_index may be visible before the entry it covers;
+		 * leave it for the next poll. An entry that stays bad is
+		 * corrupt: count it and step over it, rather than stop */
+		if (rc < 0) {
+			if (++lt.retries < FAMFS_LOGTAIL_RETRIES)
+				return;
+			famfs_log(FAMFS_LOG_ERR,
+				  "%s: skipping bad log entry after %lld "
+				  "(index %lld)\n", __func__, lt.it.nread,
+				  lt.it.index);
+			famfs_log_iter_skip(&lt.it);
+			lt.retries = 0;
+			lt.errors++;
+			continue;
+		}
+		lt.retries = 0;
+
+		if (lt.lo->memns) {
+			pthread_mutex_lock(&lt.lo->icache.mutex);
+			rc = famfs_memns_apply_entry_locked(&lt.lo->icache,
+							    &le, &parent);
+			pthread_mutex_unlock(&lt.lo->icache.mutex);
+		} else {
+			/* Invalidates the negcache even if the shadow file
+			 * was already there */
+			rc = famfs_icache_shadow_logplay_entry(&lt.lo->icache,
+							       lt.shadow_root,
+							       &le);
+		}
+		lt.applied++;
+		if (rc < 0) {
+			lt.errors++;
+			continue;
+		}
+		/* Only a name the tailer just created needs telling about */
+		if (rc == 0)
+			continue;
+		if (le.famfs_log_entry_type != FAMFS_LOG_FILE &&
+		    le.famfs_log_entry_type != FAMFS_LOG_MKDIR)
+			continue;
+
+		lt.created++;
+		/* Before the kernel is told: a lookup it triggers must not
+		 * be answered from a negative cache */
+		if (lt.lo->memns)
+			famfs_icache_neg_invalidate(&lt.lo->icache);
+		relpath = (le.famfs_log_entry_type == FAMFS_LOG_FILE)
+			? (const char *)le.famfs_fm.fm_relpath
+			: (const char *)le.famfs_md.md_relpath;
+		famfs_log(FAMFS_LOG_DEBUG, "%s: played log entry %lld (%s)\n",
+			  __func__, lt.it.nread - 1, relpath);
+
+		if (!lt.lo->memns) {
+			if (famfs_logtail_notify(relpath))
+				lt.errors++;
+			continue;
+		}
+		if (!parent)
+			continue;
+
+		/* memns: the parent is known; the new name is the last
+		 * path component */
+		name = strrchr(relpath, '/');
+		name = name ? name + 1 : relpath;
+		famfs_logtail_inval(famfs_logtail_nodeid(parent), name);
+		famfs_inode_putref(parent);
+	}
+}
+
+static void *
+famfs_logtail_thread(void *arg)
+{
+	(void)arg;
+
+	while (!logtail_shutdown_requested) {
+		famfs_logtail_poll();
+		usleep(lt.poll_ms * 1000);
+	}
+	return NULL;
+}
+
+/**
+ * famfs_logtail_start() - start following the log (if -o logtail is set)
+ *
+ * Must be called after fuse_daemonize(), since the thread does not survive
+ * the fork. Failure is not fatal to the mount: files still appear once the
+ * log is played by other means.
+ *
+ * Returns 0 on success or if the tailer is disabled, -1 on failure
+ */
+int
+famfs_logtail_start(
+	struct famfs_ctx *lo,
+	struct fuse_session *se,
+	const char *shadow_root)
+{
+	int rc;
+
+	if (lo->logtail_ms <= 0)
+		return 0;
+
+	if (!lo->daxdev) {
+		famfs_log(FAMFS_LOG_ERR, "%s: logtail requires -o daxdev\n",
+			  __func__);
+		return -1;
+	}
+
+	rc = famfs_mmap_log_raw_ro(lo->daxdev, &lt.sb, &lt.logp);
+	if (rc) {
+		famfs_log(FAMFS_LOG_ERR, "%s: failed to map log from %s\n",
+			  __func__, lo->daxdev);
+		return -1;
+	}
+	if (famfs_validate_log_header(lt.logp)) {
+		famfs_log(FAMFS_LOG_ERR, "%s: invalid log header on %s\n",
+			  __func__, lo->daxdev);
+		goto err_unmap;
+	}
+
+	lt.shadow_root = strdup(shadow_root);
+	if (!lt.shadow_root)
+		goto err_unmap;
+	lt.lo = lo;
+	lt.se = se;
+	lt.poll_ms = lo->logtail_ms;
+	lt.applied = 0;
+	famfs_log_iter_init(&lt.it, lt.logp);
+
+	logtail_shutdown_requested = 0;
+	rc = pthread_create(&logtail_thread, NULL, famfs_logtail_thread, NULL);
+	if (rc) {
+		famfs_log(FAMFS_LOG_ERR, "%s: pthread_create failed: %d\n",
+			  __func__, rc);
+		free(lt.shadow_root);
+		lt.shadow_root = NULL;
+		goto err_unmap;
+	}
+	logtail_running = 1;
+	__atomic_store_n(&lo->logtail_active, 1, __ATOMIC_RELEASE);
+
+	famfs_log(FAMFS_LOG_NOTICE, "%s: following log on %s every %d ms\n",
+		  __func__, lo->daxdev, lt.poll_ms);
+	return 0;
+
+err_unmap:
+	famfs_unmap_log(lt.logp);
+	munmap(lt.sb, FAMFS_SUPERBLOCK_SIZE);
+	lt.logp = NULL;
+	lt.sb = NULL;
+	return -1;
+}
+
+void
+famfs_logtail_stop(void)
+{
+	if (!logtail_running)
+		return;
+
+	__atomic_store_n(&lt.lo->logtail_active, 0, __ATOMIC_RELEASE);
+	logtail_shutdown_requested = 1;
+	pthread_join(logtail_thread, NULL);
+	logtail_running = 0;
+
+	famfs_log(FAMFS_LOG_NOTICE,
+		  "%s: applied=%lld created=%lld errors=%lld "
+		  "notify_errors=%lld restarts=%lld\n", __func__, lt.applied,
+		  lt.created, lt.errors, lt.notify_errors, lt.restarts);
+
+	famfs_unmap_log(lt.logp);
+	munmap(lt.sb, FAMFS_SUPERBLOCK_SIZE);
+	free(lt.shadow_root);
+	memset(&lt, 0, sizeof(lt));
+}
@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) 2026 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef _H_FAMFS_LOGTAIL
+#define _H_FAMFS_LOGTAIL
+
+#include <fuse_lowlevel.h>
+#include "famfs_fused.h"
+
+#define FAMFS_LOGTAIL_DEFAULT_MS 100
+
+int famfs_logtail_start(struct famfs_ctx *lo, struct fuse_session *se,
+			const char *shadow_root);
+void famfs_logtail_stop(void);
+
+#endif /* _H_FAMFS_LOGTAIL */
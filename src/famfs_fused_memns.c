@@ -0,0 +1,315 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2026 Micron Technology, Inc.  All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#define FUSE_USE_VERSION FUSE_MAKE_VERSION(3, 12)
+
+#include <fuse_lowlevel.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "famfs_lib.h"
+#include "famfs_lib_internal.h"
+#include "famfs_log.h"
+#include "famfs_fused.h"
+#include "famfs_fused_icache.h"
+#include "famfs_fused_memns.h"
+
+/*
+ * In-memory namespace (-o memns)
+ *
+ * Normally famfs_fused serves LOOKUP and READDIR from a shadow tree of yaml
+ * files on local disk or tmpfs, and every directory the kernel has looked up
+ * holds an open fd into it. In memns mode the log is instead played straight
+ * into the icache at mount time: every file and directory in the log becomes
+ * a famfs_inode that stays cached for the life of the mount (the namespace
+ * holds one ref on each), and every directory gets a famfs_dir_index to find
+ * its children by name. LOOKUP, READDIR(PLUS), GETATTR and GET_FMAP are then
+ * answered from memory, with no shadow I/O and no directory fds.
+ *
+ * Inode numbers are assigned in log order after FUSE_ROOT_ID, so they are
+ * stable for a given log.
+ */
+
+static void
+famfs_memns_init_attr(
+	struct famfs_icache *icache,
+	struct stat *st,
+	mode_t mode,
+	uid_t uid,
+	gid_t gid,
+	off_t size)
+{
+	time_t now = time(NULL);
+
+	memset(st, 0, sizeof(*st));
+	st->st_ino = icache->next_ino++;
+	st->st_mode = mode;
+	st->st_nlink = S_ISDIR(mode) ? 2 : 1;
+	st->st_uid = uid;
+	st->st_gid = gid;
+	st->st_size = size;
+	st->st_blksize = 4096;
+	st->st_blocks = (size + 511) / 512;
+	st->st_atime = st->st_mtime = st->st_ctime = now;
+}
+
+/**
+ * famfs_memns_resolve_parent_locked()
+ *
+ * Walk @relpath from the root, and return the directory that holds its last
+ * component (whose name is copied to @name). Every directory along the way
+ * must already exist - as in a shadow logplay, where a file can't be created
+ * before its parent directory.
+ */
+static struct famfs_inode *
+famfs_memns_resolve_parent_locked(
+	struct famfs_icache *icache,
+	const char *relpath,
+	char *name)
+{
+	struct famfs_inode *dir = &icache->root;
+	char path[FAMFS_MAX_PATHLEN];
+	char *component = NULL;
+	char *saveptr = NULL;
+	char *tok;
+
+	strncpy(path, relpath, sizeof(path) - 1);
+	path[sizeof(path) - 1] = '\0';
+
+	for (tok = strtok_r(path, "/", &saveptr); tok;
+	     tok = strtok_r(NULL, "/", &saveptr)) {
+		if (strcmp(tok, ".") == 0)
+			continue;
+		if (strcmp(tok, "..") == 0)
+			return NULL;
+		if (component) {
+			dir = famfs_dir_index_find_locked(dir, component);
+			if (!dir || dir->ftype != FAMFS_FDIR)
+				return NULL;
+		}
+		component = tok;
+	}
+	if (!component || strlen(component) > NAME_MAX)
+		return NULL;
+
+	strcpy(name, component);
+	return dir;
+}
+
+static struct famfs_inode *
+famfs_memns_add_locked(
+	struct famfs_icache *icache,
+	struct famfs_inode *parent,
+	const char *name,
+	struct stat *attr,
+	enum famfs_fuse_ftype ftype,
+	const struct famfs_log_file_meta *fmeta)
+{
+	struct famfs_inode *inode;
+
+	inode = famfs_inode_alloc(icache, -1, name, attr->st_ino, 0, NULL,
+				  attr, ftype, parent);
+	if (!inode)
+		return NULL;
+
+	if (ftype == FAMFS_FDIR) {
+		inode->dindex = famfs_dir_index_alloc();
+		if (!inode->dindex)
+			goto err_free;
+	} else {
+		/* If this fails, GET_FMAP will fail for the file */
+		inode->fmap = famfs_fmap_alloc(icache, fmeta);
+	}
+
+	if (famfs_dir_index_add_locked(parent, inode))
+		goto err_free;
+
+	/* Insert leaves 2 refs; the one we keep belongs to the namespace,
+	 * so kernel forgets never take the inode out of the cache */
+	famfs_icache_insert_locked(icache, inode);
+	famfs_inode_putref_locked(inode, 1);
+	return inode;
+
+err_free:
+	famfs_inode_free(inode);
+	return NULL;
+}
+
+/**
+ * famfs_memns_apply_entry_locked() - play one log entry into the namespace
+ *
+ * Caller holds the icache mutex, and has validated the entry.
+ *
+ * @icache:  the icache
+ * @le:      log entry
+ * @parentp: if non-NULL and an inode was created, its parent is returned
+ *           here with a ref held (so the caller can notify the kernel)
+ *
+ * Returns 1 if a file or directory was created, 0 if the name already
+ * existed (or the entry type doesn't create a name), -1 on error
+ */
+int
+famfs_memns_apply_entry_locked(
+	struct famfs_icache *icache,
+	const struct famfs_log_entry *le,
+	struct famfs_inode **parentp)
+{
+	const struct famfs_log_file_meta *fmeta = NULL;
+	struct famfs_inode *parent, *existing;
+	enum famfs_fuse_ftype ftype;
+	char name[NAME_MAX + 1];
+	const char *relpath;
+	struct stat attr;
+
+	switch (le->famfs_log_entry_type) {
+	case FAMFS_LOG_FILE:
+		relpath = le->famfs_fm.fm_relpath;
+		ftype = FAMFS_FREG;
+		break;
+	case FAMFS_LOG_MKDIR:
+		relpath = (const char *)le->famfs_md.md_relpath;
+		ftype = FAMFS_FDIR;
+		break;
+	default:
+		return 0;
+	}
+
+	if (relpath[0] == '/') {
+		famfs_log(FAMFS_LOG_ERR,
+			  "%s: ignoring log entry; path is not relative\n",
+			  __func__);
+		return -1;
+	}
+
+	parent = famfs_memns_resolve_parent_locked(icache, relpath, name);
+	if (!parent) {
+		famfs_log(FAMFS_LOG_ERR, "%s: no parent directory for %s\n",
+			  __func__, relpath);
+		return -1;
+	}
+
+	existing = famfs_dir_index_find_locked(parent, name);
+	if (existing) {
+		if (existing->ftype == ftype)
+			return 0; /* Normal for log replay */
+		famfs_log(FAMFS_LOG_ERR, "%s: %s exists with another type\n",
+			  __func__, relpath);
+		return -1;
+	}
+
+	if (ftype == FAMFS_FREG) {
+		fmeta = &le->famfs_fm;
+		famfs_memns_init_attr(icache, &attr, S_IFREG | fmeta->fm_mode,
+				      fmeta->fm_uid, fmeta->fm_gid,
+				      fmeta->fm_size);
+	} else {
+		const struct famfs_log_mkdir *md = &le->famfs_md;
+
+		famfs_memns_init_attr(icache, &attr, S_IFDIR | md->md_mode,
+				      md->md_uid, md->md_gid, 0);
+	}
+
+	if (!famfs_memns_add_locked(icache, parent, name, &attr, ftype,
+				    fmeta))
+		return -1;
+
+	if (parentp) {
+		famfs_inode_getref_locked(parent);
+		*parentp = parent;
+	}
+	return 1;
+}
+
+/**
+ * famfs_memns_build() - build the in-memory namespace from the log
+ *
+ * Called once at mount time, before the fuse session starts.
+ *
+ * @icache: initialized icache
+ * @daxdev: dax device holding the superblock and log
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+famfs_memns_build(struct famfs_icache *icache, const char *daxdev)
+{
+	struct famfs_superblock *sb;
+	struct famfs_log *logp;
+	struct stat root_attr;
+	u64 nfiles = 0, ndirs = 0, nerrs = 0;
+	struct famfs_log_entry le;
+	struct famfs_log_iter it;
+	int rc = 0;
+	int lrc;
+
+	if (famfs_mmap_log_raw_ro(daxdev, &sb, &logp)) {
+		famfs_log(FAMFS_LOG_ERR, "%s: failed to map log from %s\n",
+			  __func__, daxdev);
+		return -1;
+	}
+	if (famfs_validate_log_header(logp)) {
+		famfs_log(FAMFS_LOG_ERR, "%s: invalid log header on %s\n",
+			  __func__, daxdev);
+		rc = -1;
+		goto out;
+	}
+
+	pthread_mutex_lock(&icache->mutex);
+
+	icache->memns = 1;
+	icache->next_ino = FUSE_ROOT_ID + 1;
+	icache->root.dindex = famfs_dir_index_alloc();
+	if (!icache->root.dindex) {
+		pthread_mutex_unlock(&icache->mutex);
+		rc = -1;
+		goto out;
+	}
+	famfs_memns_init_attr(icache, &root_attr, S_IFDIR | 0755,
+			      getuid(), getgid(), 0);
+	famfs_inode_set_attr(&icache->root, &root_attr);
+	icache->next_ino = FUSE_ROOT_ID + 1;
+
+	famfs_log_iter_init(&it, logp);
+	while ((lrc = famfs_log_iter_next(&it, &le)) != 0) {
+		if (lrc < 0) {
+			famfs_log(FAMFS_LOG_ERR,
+				  "%s: invalid log entry at index %lld\n",
+				  __func__, it.nread);
+			rc = -1;
+			break;
+		}
+
+		switch (famfs_memns_apply_entry_locked(icache, &le, NULL)) {
+		case 1:
+			if (le.famfs_log_entry_type == FAMFS_LOG_FILE)
+				nfiles++;
+			else
+				ndirs++;
+			break;
+		case -1:
+			nerrs++;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&icache->mutex);
+
+	famfs_log(FAMFS_LOG_NOTICE,
+		  "%s: %lld log entries: %lld files, %lld dirs, %lld errors\n",
+		  __func__, it.nread, nfiles, ndirs, nerrs);
+out:
+	famfs_unmap_log(logp);
+	munmap(sb, FAMFS_SUPERBLOCK_SIZE);
+	return rc;
+}
@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) 2026 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef _H_FAMFS_MEMNS
+#define _H_FAMFS_MEMNS
+
+#include "famfs_fused_icache.h"
+
+int famfs_memns_build(struct famfs_icache *icache, const char *daxdev);
+int famfs_memns_apply_entry_locked(struct famfs_icache *icache,
+				   const struct famfs_log_entry *le,
+				   struct famfs_inode **parentp);
+
+#endif /* _H_FAMFS_MEMNS */
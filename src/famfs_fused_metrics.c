@@ -0,0 +1,427 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2026 Micron Technology, Inc.  All rights reserved.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "famfs_lib.h"
+#include "famfs_fused_metrics.h"
+
+/*
+ * Per-operation request metrics
+ *
+ * Every fuse operation handler is timed (see the wrappers at the ops table in
+ * famfs_fused.c), and the count, total latency and a latency histogram are
+ * kept per operation. Requests are handled on many threads at once, so each
+ * thread accumulates into its own block of counters - there is no shared
+ * cache line and no atomic read-modify-write on the request path. A reader
+ * (the REST server) sums the blocks of all threads.
+ *
+ * Blocks are never freed while the daemon runs: a thread that exits (e.g.
+ * an idle fuse worker) gives its block back, and the next new thread takes
+ * it over with its counts intact, so totals never go backwards.
+ *
+ * Trace ring: each block also holds a ring of the last N requests the
+ * thread handled (op, nodeid, start time, duration and result), so latency
+ * can be debugged on a live system without debug logging, which formats and
+ * syslogs every op. A record is written in place and then published by
+ * advancing the ring head with a release store; the writer never waits.
+ * The reader copies the ring and then rereads the head to discard any
+ * record the writer may have overwritten in the meantime.
+ */
+
+struct famfs_op_metrics {
+	u64 count;
+	u64 sum_ns;
+	u64 buckets[FAMFS_METRICS_NBUCKETS];
+};
+
+struct famfs_thread_metrics {
+	struct famfs_thread_metrics *next;
+	int in_use;                     /* Protected by metrics_mutex */
+	struct famfs_op_metrics ops[FAMFS_OP_NR];
+	s64 gauges[FAMFS_GAUGE_NR];
+
+	pid_t tid;                      /* Of the thread that owns the block */
+	u64 trace_head;                 /* Records written, ever */
+	struct famfs_trace_rec *trace;  /* trace_entries records */
+} __attribute__((aligned(64)));
+
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct famfs_thread_metrics *metrics_list;
+static pthread_key_t metrics_key;
+static pthread_once_t metrics_once = PTHREAD_ONCE_INIT;
+static __thread struct famfs_thread_metrics *metrics_self;
+static u64 trace_entries;               /* Power of 2; 0 = no trace */
+
+__thread int famfs_req_result;
+
+/* Thread exit: hand the block to the next thread that needs one */
+static void
+famfs_metrics_thread_exit(void *arg)
+{
+	struct famfs_thread_metrics *tm = arg;
+
+	pthread_mutex_lock(&metrics_mutex);
+	tm->in_use = 0;
+	pthread_mutex_unlock(&metrics_mutex);
+}
+
+static void
+famfs_metrics_key_init(void)
+{
+	pthread_key_create(&metrics_key, famfs_metrics_thread_exit);
+}
+
+/* Slow path: first metric on this thread */
+static struct famfs_thread_metrics *
+famfs_metrics_self_init(void)
+{
+	struct famfs_thread_metrics *tm;
+
+	pthread_once(&metrics_once, famfs_metrics_key_init);
+
+	pthread_mutex_lock(&metrics_mutex);
+	for (tm = metrics_list; tm; tm = tm->next)
+		if (!tm->in_use)
+			break;
+	if (!tm) {
+		tm = aligned_alloc(__alignof__(*tm), sizeof(*tm));
+		if (!tm) {
+			pthread_mutex_unlock(&metrics_mutex);
+			return NULL;
+		}
+		memset(tm, 0, sizeof(*tm));
+		if (trace_entries) {
+			/* Without a ring the block still counts */
+			tm->trace = calloc(trace_entries, sizeof(*tm->trace));
+		}
+		tm->next = metrics_list;
+		metrics_list = tm;
+	}
+	tm->in_use = 1;
+	tm->tid = gettid();
+	pthread_mutex_unlock(&metrics_mutex);
+
+	pthread_setspecific(metrics_key, tm);
+	metrics_self = tm;
+	return tm;
+}
+
+static inline struct famfs_thread_metrics *
+famfs_metrics_self(void)
+{
+	if (metrics_self)
+		return metrics_self;
+	return famfs_metrics_self_init();
+}
+
+/*
+ * Only the owning thread writes its counters, so a plain add is enough; the
+ * relaxed atomic store just keeps a concurrent reader from seeing a torn
+ * value.
+ */
+static inline void
+famfs_metrics_inc(u64 *ctr, u64 n)
+{
+	__atomic_store_n(ctr, *ctr + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * famfs_metrics_bucket() - histogram bucket for a latency
+ *
+ * @ns: latency in nanoseconds
+ *
+ * Returns the index of the smallest bucket whose bound is >= @ns
+ */
+int
+famfs_metrics_bucket(u64 ns)
+{
+	int b;
+
+	if (ns <= (1ULL << FAMFS_METRICS_MIN_SHIFT))
+		return 0;
+
+	/* ceil(log2(ns)) */
+	b = 64 - __builtin_clzll(ns - 1) - FAMFS_METRICS_MIN_SHIFT;
+	return (b < FAMFS_METRICS_NBUCKETS - 1) ? b : FAMFS_METRICS_NBUCKETS - 1;
+}
+
+static inline void
+famfs_trace_record(
+	struct famfs_thread_metrics *tm,
+	enum famfs_metrics_op op,
+	u64 start_ns,
+	u64 ns,
+	u64 nodeid)
+{
+	u64 head = tm->trace_head;
+	struct famfs_trace_rec *rec = &tm->trace[head & (trace_entries - 1)];
+	int cpu = sched_getcpu();
+
+	rec->start_ns = start_ns;
+	rec->nodeid = nodeid;
+	rec->dur_ns = (ns > UINT32_MAX) ? UINT32_MAX : (u32)ns;
+	rec->result = famfs_req_result;
+	rec->op = op;
+	rec->cpu = (cpu < 0) ? 0 : cpu;
+	rec->tid = tm->tid;
+	__atomic_store_n(&tm->trace_head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * famfs_metrics_account() - count and trace a completed request
+ *
+ * @op:       the operation
+ * @start_ns: famfs_metrics_now() when the handler was entered
+ * @nodeid:   the inode the request was for (0 if none)
+ *
+ * The result traced is famfs_req_result, which the caller clears before the
+ * handler runs.
+ */
+void
+famfs_metrics_account(enum famfs_metrics_op op, u64 start_ns, u64 nodeid)
+{
+	struct famfs_thread_metrics *tm = famfs_metrics_self();
+	struct famfs_op_metrics *om;
+	u64 ns = famfs_metrics_now() - start_ns;
+
+	if (!tm)
+		return;
+
+	om = &tm->ops[op];
+	famfs_metrics_inc(&om->count, 1);
+	famfs_metrics_inc(&om->sum_ns, ns);
+	famfs_metrics_inc(&om->buckets[famfs_metrics_bucket(ns)], 1);
+
+	if (tm->trace)
+		famfs_trace_record(tm, op, start_ns, ns, nodeid);
+}
+
+void
+famfs_metrics_gauge_add(enum famfs_metrics_gauge gauge, s64 delta)
+{
+	struct famfs_thread_metrics *tm = famfs_metrics_self();
+
+	if (!tm)
+		return;
+	__atomic_store_n(&tm->gauges[gauge], tm->gauges[gauge] + delta,
+			 __ATOMIC_RELAXED);
+}
+
+/*
+ * A gauge may be incremented on one thread and decremented on another, so
+ * only the sum over all threads is meaningful
+ */
+s64
+famfs_metrics_gauge_read(enum famfs_metrics_gauge gauge)
+{
+	struct famfs_thread_metrics *tm;
+	s64 sum = 0;
+
+	pthread_mutex_lock(&metrics_mutex);
+	for (tm = metrics_list; tm; tm = tm->next)
+		sum += __atomic_load_n(&tm->gauges[gauge], __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&metrics_mutex);
+
+	return sum;
+}
+
+/* Caller holds metrics_mutex */
+static void
+famfs_metrics_sum_locked(enum famfs_metrics_op op, struct famfs_op_metrics *sum)
+{
+	struct famfs_thread_metrics *tm;
+	int i;
+
+	memset(sum, 0, sizeof(*sum));
+	for (tm = metrics_list; tm; tm = tm->next) {
+		struct famfs_op_metrics *om = &tm->ops[op];
+
+		sum->count += __atomic_load_n(&om->count, __ATOMIC_RELAXED);
+		sum->sum_ns += __atomic_load_n(&om->sum_ns, __ATOMIC_RELAXED);
+		for (i = 0; i < FAMFS_METRICS_NBUCKETS; i++)
+			sum->buckets[i] += __atomic_load_n(&om->buckets[i],
+							   __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * famfs_metrics_print() - write the request metrics in Prometheus text format
+ *
+ * The counters are read without stopping the request threads, so a request
+ * that completes during the dump may show up in its count but not yet in its
+ * histogram; _count is taken from the histogram so that each histogram is
+ * self-consistent.
+ */
+void
+famfs_metrics_print(FILE *f)
+{
+	struct famfs_op_metrics sum;
+	int op, i;
+
+	fprintf(f,
+		"# HELP famfs_fused_request_duration_seconds "
+		"Time spent in the fuse operation handler\n"
+		"# TYPE famfs_fused_request_duration_seconds histogram\n");
+
+	pthread_mutex_lock(&metrics_mutex);
+	for (op = 0; op < FAMFS_OP_NR; op++) {
+		const char *name = famfs_metrics_op_name(op);
+		u64 cum = 0;
+
+		famfs_metrics_sum_locked(op, &sum);
+		for (i = 0; i < FAMFS_METRICS_NBUCKETS - 1; i++) {
+			cum += sum.buckets[i];
+			fprintf(f,
+				"famfs_fused_request_duration_seconds_bucket"
+				"{op=\"%s\",le=\"%.9g\"} %llu\n", name,
+				(double)(1ULL << (FAMFS_METRICS_MIN_SHIFT + i))
+				/ 1e9, (unsigned long long)cum);
+		}
+		cum += sum.buckets[FAMFS_METRICS_NBUCKETS - 1];
+		fprintf(f,
+			"famfs_fused_request_duration_seconds_bucket"
+			"{op=\"%s\",le=\"+Inf\"} %llu\n"
+			"famfs_fused_request_duration_seconds_sum{op=\"%s\"} %.9f\n"
+			"famfs_fused_request_duration_seconds_count{op=\"%s\"} %llu\n",
+			name, (unsigned long long)cum,
+			name, (double)sum.sum_ns / 1e9,
+			name, (unsigned long long)cum);
+	}
+	pthread_mutex_unlock(&metrics_mutex);
+}
+
+/**
+ * famfs_trace_init() - size the per-thread trace rings
+ *
+ * @nentries: records per thread, rounded up to a power of 2; 0 disables
+ *
+ * Must be called before the first request is handled
+ */
+void
+famfs_trace_init(int nentries)
+{
+	u64 n = 1;
+
+	if (nentries <= 0) {
+		trace_entries = 0;
+		return;
+	}
+	while (n < (u64)nentries)
+		n <<= 1;
+	trace_entries = n;
+}
+
+static int
+famfs_trace_rec_cmp(const void *a, const void *b)
+{
+	const struct famfs_trace_rec *ra = a;
+	const struct famfs_trace_rec *rb = b;
+
+	if (ra->start_ns != rb->start_ns)
+		return (ra->start_ns < rb->start_ns) ? -1 : 1;
+	return 0;
+}
+
+/**
+ * famfs_trace_snapshot() - copy out the trace rings of all threads
+ *
+ * @since_ns: only requests that completed after this time (0 for all); a
+ *            client that follows the trace passes the latest completion time
+ *            (start_ns + dur_ns) it has seen. Records are published in
+ *            completion order, so a long request is not missed because it
+ *            started before shorter ones on other threads.
+ * @buf_out:  a struct famfs_trace_hdr followed by the records, oldest first;
+ *            caller must free()
+ * @len_out:  length of @buf_out
+ *
+ * Returns 0 on success, -1 if the trace is disabled or out of memory
+ */
+int
+famfs_trace_snapshot(u64 since_ns, void **buf_out, size_t *len_out)
+{
+	struct famfs_thread_metrics *tm;
+	struct famfs_trace_rec *recs;
+	struct famfs_trace_hdr *hdr;
+	u64 nblocks = 0, nrecs = 0, lost = 0;
+	char *buf;
+
+	if (!trace_entries)
+		return -1;
+
+	/* Blocks are only ever added, so the size computed here holds for
+	 * the copy below as long as the mutex is held throughout */
+	pthread_mutex_lock(&metrics_mutex);
+	for (tm = metrics_list; tm; tm = tm->next)
+		nblocks++;
+
+	buf = malloc(sizeof(*hdr) + nblocks * trace_entries * sizeof(*recs));
+	if (!buf) {
+		pthread_mutex_unlock(&metrics_mutex);
+		return -1;
+	}
+	hdr = (struct famfs_trace_hdr *)buf;
+	recs = (struct famfs_trace_rec *)(buf + sizeof(*hdr));
+
+	for (tm = metrics_list; tm; tm = tm->next) {
+		u64 head, first, i, n;
+
+		if (!tm->trace)
+			continue;
+
+		head = __atomic_load_n(&tm->trace_head, __ATOMIC_ACQUIRE);
+		first = (head > trace_entries) ? head - trace_entries : 0;
+		n = 0;
+		for (i = first; i < head; i++)
+			recs[nrecs + n++] = tm->trace[i & (trace_entries - 1)];
+
+		/* Records the writer reached while we copied (including the
+		 * one it may be writing now) are suspect; drop them */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		i = __atomic_load_n(&tm->trace_head, __ATOMIC_ACQUIRE);
+		if (i + 1 > first + trace_entries) {
+			u64 bad = i + 1 - trace_entries - first;
+
+			bad = (bad < n) ? bad : n;
+			memmove(&recs[nrecs], &recs[nrecs + bad],
+				(n - bad) * sizeof(*recs));
+			n -= bad;
+			lost += bad;
+		}
+
+		/* Keep only what the client has not seen */
+		for (i = 0; i < n; i++) {
+			struct famfs_trace_rec *r = &recs[nrecs + i];
+
+			if (r->start_ns + r->dur_ns > since_ns)
+				break;
+		}
+		memmove(&recs[nrecs], &recs[nrecs + i], (n - i) * sizeof(*recs));
+		nrecs += n - i;
+	}
+	pthread_mutex_unlock(&metrics_mutex);
+
+	qsort(recs, nrecs, sizeof(*recs), famfs_trace_rec_cmp);
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = FAMFS_TRACE_MAGIC;
+	hdr->version = FAMFS_TRACE_VERSION;
+	hdr->rec_size = sizeof(*recs);
+	hdr->nrecs = nrecs;
+	hdr->now_ns = famfs_metrics_now();
+	hdr->lost = lost;
+
+	*buf_out = buf;
+	*len_out = sizeof(*hdr) + nrecs * sizeof(*recs);
+	return 0;
+}
@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) 2026 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef _H_FAMFS_FUSED_METRICS
+#define _H_FAMFS_FUSED_METRICS
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "famfs_lib.h"
+
+/* Fuse operations that are timed; one histogram each */
+enum famfs_metrics_op {
+	FAMFS_OP_LOOKUP,
+	FAMFS_OP_FORGET,
+	FAMFS_OP_FORGET_MULTI,
+	FAMFS_OP_GETATTR,
+	FAMFS_OP_SETATTR,
+	FAMFS_OP_OPEN,
+	FAMFS_OP_RELEASE,
+	FAMFS_OP_OPENDIR,
+	FAMFS_OP_READDIR,
+	FAMFS_OP_READDIRPLUS,
+	FAMFS_OP_RELEASEDIR,
+	FAMFS_OP_STATFS,
+	FAMFS_OP_GETXATTR,
+	FAMFS_OP_CREATE,
+	FAMFS_OP_FLOCK,
+	FAMFS_OP_GET_FMAP,
+	FAMFS_OP_GET_DAXDEV,
+	FAMFS_OP_NR,
+};
+
+static inline const char *
+famfs_metrics_op_name(int op)
+{
+	static const char * const names[FAMFS_OP_NR] = {
+		[FAMFS_OP_LOOKUP]       = "lookup",
+		[FAMFS_OP_FORGET]       = "forget",
+		[FAMFS_OP_FORGET_MULTI] = "forget_multi",
+		[FAMFS_OP_GETATTR]      = "getattr",
+		[FAMFS_OP_SETATTR]      = "setattr",
+		[FAMFS_OP_OPEN]         = "open",
+		[FAMFS_OP_RELEASE]      = "release",
+		[FAMFS_OP_OPENDIR]      = "opendir",
+		[FAMFS_OP_READDIR]      = "readdir",
+		[FAMFS_OP_READDIRPLUS]  = "readdirplus",
+		[FAMFS_OP_RELEASEDIR]   = "releasedir",
+		[FAMFS_OP_STATFS]       = "statfs",
+		[FAMFS_OP_GETXATTR]     = "getxattr",
+		[FAMFS_OP_CREATE]       = "create",
+		[FAMFS_OP_FLOCK]        = "flock",
+		[FAMFS_OP_GET_FMAP]     = "get_fmap",
+		[FAMFS_OP_GET_DAXDEV]   = "get_daxdev",
+	};
+
+	return (op >= 0 && op < FAMFS_OP_NR) ? names[op] : "unknown";
+}
+
+/* Up/down counts; the current value is the sum over all threads */
+enum famfs_metrics_gauge {
+	FAMFS_GAUGE_OPEN_FILES,
+	FAMFS_GAUGE_OPEN_DIRS,
+	FAMFS_GAUGE_NR,
+};
+
+/*
+ * Latency buckets are powers of two: bucket i counts requests that took at
+ * most 2^(FAMFS_METRICS_MIN_SHIFT + i) ns (1 us ... ~1 s); the last bucket
+ * is everything slower.
+ */
+#define FAMFS_METRICS_MIN_SHIFT 10
+#define FAMFS_METRICS_NBUCKETS  22
+
+/*
+ * Trace ring
+ *
+ * Each request thread also records every request it handles in a ring of
+ * fixed-size binary records. The REST server's /trace target returns a
+ * snapshot of all rings as a struct famfs_trace_hdr followed by the records,
+ * oldest first; 'famfs trace' decodes it. These structs are that wire format.
+ */
+#define FAMFS_TRACE_MAGIC           0x43525446 /* "FTRC" */
+#define FAMFS_TRACE_VERSION         1
+#define FAMFS_TRACE_DEFAULT_ENTRIES 4096       /* Per thread */
+
+struct famfs_trace_hdr {
+	u32 magic;
+	u16 version;
+	u16 rec_size;       /* sizeof(struct famfs_trace_rec) */
+	u64 nrecs;
+	u64 now_ns;         /* CLOCK_MONOTONIC when the snapshot was taken */
+	u64 lost;           /* Records overwritten while being copied */
+};
+
+struct famfs_trace_rec {
+	u64 start_ns;       /* CLOCK_MONOTONIC */
+	u64 nodeid;
+	u32 dur_ns;         /* Saturates at ~4.3 s */
+	int32_t result;     /* errno replied, or 0 */
+	u16 op;             /* enum famfs_metrics_op */
+	u16 cpu;
+	u32 tid;
+};
+
+/* Result of the request being handled on this thread (see famfs_reply_err) */
+extern __thread int famfs_req_result;
+
+static inline u64
+famfs_metrics_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void famfs_metrics_account(enum famfs_metrics_op op, u64 start_ns,
+			   u64 nodeid);
+void famfs_metrics_gauge_add(enum famfs_metrics_gauge gauge, s64 delta);
+s64 famfs_metrics_gauge_read(enum famfs_metrics_gauge gauge);
+int famfs_metrics_bucket(u64 ns);
+void famfs_metrics_print(FILE *f);
+void famfs_trace_init(int nentries);
+int famfs_trace_snapshot(u64 since_ns, void **buf_out, size_t *len_out);
+
+#endif /* _H_FAMFS_FUSED_METRICS */
@@ -21,12 +21,126 @@
 
 #include "famfs_log.h"
 #include "famfs_fused.h"
+#include "famfs_fused_metrics.h"
+#include "famfs_fused_statfs.h"
+#include "famfs_fused_warmup.h"
 
 static pthread_t diag_thread;
 static volatile int diag_shutdown_requested = 0;
 static int diag_server_running = 0;
 static char *sock_path = NULL;
 
+/* Print one gauge or counter in Prometheus text format */
+static void
+famfs_metrics_print_one(
+	FILE *f,
+	const char *name,
+	const char *type,
+	const char *help,
+	unsigned long long val)
+{
+	fprintf(f, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n",
+		name, help, name, type, name, val);
+}
+
+/*
+ * /metrics: the per-operation histograms, then the icache, flock and queue
+ * counters that are also served (as yaml) by the other targets
+ */
+static int
+famfs_metrics_reply(struct mg_connection *c)
+{
+	extern struct famfs_ctx famfs_context;
+	struct famfs_ctx *lo = &famfs_context;
+	struct famfs_icache *icache = &lo->icache;
+	u64 count, lru_count, nfds, lru_hits, evictions, log_files, log_dirs;
+	struct famfs_flock_stats fs;
+	struct famfs_pool_stats ps;
+	char *body = NULL;
+	size_t len = 0;
+	FILE *f;
+	int i;
+
+	f = open_memstream(&body, &len);
+	if (!f)
+		return -1;
+
+	famfs_metrics_print(f);
+
+	pthread_mutex_lock(&icache->mutex);
+	count = icache->count;
+	lru_count = icache->lru_count;
+	nfds = icache->nfds;
+	lru_hits = icache->lru_hits;
+	evictions = icache->evictions;
+	fs = icache->flock_stats;
+	pthread_mutex_unlock(&icache->mutex);
+	famfs_icache_pool_stats(icache, &ps);
+
+	famfs_metrics_print_one(f, "famfs_fused_icache_inodes", "gauge",
+				"Inodes in the icache", count);
+	famfs_metrics_print_one(f, "famfs_fused_icache_lru_inodes", "gauge",
+				"Unreferenced inodes retained on the LRU",
+				lru_count);
+	famfs_metrics_print_one(f, "famfs_fused_icache_dir_fds", "gauge",
+				"Open directory fds", nfds);
+	famfs_metrics_print_one(f, "famfs_fused_icache_pool_bytes", "gauge",
+				"Bytes held by the icache pools", ps.bytes);
+	famfs_metrics_print_one(f, "famfs_fused_icache_lru_hits_total",
+				"counter", "Lookups that found an LRU inode",
+				lru_hits);
+	famfs_metrics_print_one(f, "famfs_fused_icache_evictions_total",
+				"counter", "Inodes evicted from the LRU",
+				evictions);
+	famfs_metrics_print_one(f, "famfs_fused_open_files", "gauge",
+				"Open file handles",
+				famfs_metrics_gauge_read(FAMFS_GAUGE_OPEN_FILES));
+	famfs_metrics_print_one(f, "famfs_fused_open_dirs", "gauge",
+				"Open directory handles",
+				famfs_metrics_gauge_read(FAMFS_GAUGE_OPEN_DIRS));
+	famfs_metrics_print_one(f, "famfs_fused_flock_acquired_total",
+				"counter", "Flocks granted", fs.acquired);
+	famfs_metrics_print_one(f, "famfs_fused_flock_contended_total",
+				"counter", "Flocks that had to wait",
+				fs.contended);
+	fprintf(f, "# HELP famfs_fused_flock_wait_seconds_total "
+		"Time spent waiting for flocks\n"
+		"# TYPE famfs_fused_flock_wait_seconds_total counter\n"
+		"famfs_fused_flock_wait_seconds_total %.9f\n",
+		(double)fs.wait_ns / 1e9);
+
+	if (famfs_fs_stats_counts(&log_files, &log_dirs) == 0) {
+		famfs_metrics_print_one(f, "famfs_fused_log_files", "gauge",
+					"Files in the famfs log", log_files);
+		famfs_metrics_print_one(f, "famfs_fused_log_dirs", "gauge",
+					"Directories in the famfs log",
+					log_dirs);
+	}
+
+	if (lo->queue_stats) {
+		fprintf(f, "# HELP famfs_fused_queue_requests_total "
+			"Requests per queue\n"
+			"# TYPE famfs_fused_queue_requests_total counter\n");
+		for (i = 0; i < lo->nqueues; i++)
+			fprintf(f, "famfs_fused_queue_requests_total"
+				"{queue=\"%d\"} %llu\n", i,
+				(unsigned long long)__atomic_load_n(
+					&lo->queue_stats[i].nreq,
+					__ATOMIC_RELAXED));
+	}
+
+	if (fclose(f)) {
+		free(body);
+		return -1;
+	}
+
+	mg_http_reply(c, 200,
+		      "Content-Type: text/plain; version=0.0.4\r\n"
+		      "Connection: close\r\n", "%s", body);
+	free(body);
+	return 0;
+}
+
 /*
  * Handle a parsed HTTP request and replies
  *
@@ -36,6 +150,15 @@ static char *sock_path = NULL;
  * * icache_dump - (GET) dump icache into syslog
  * * icache_stats - (GET) return icache stats in yaml format
  * * pid - (GET) Return pid of famfs_fused in yaml format
+ * * queue_stats - (GET) transport and per-queue request counts in yaml
+ * * flock_stats - (GET) flock counts and wait times in yaml
+ * * warmup - (GET) icache warm-up progress in yaml
+ * * ready - (GET) 200 once warm-up is done (or off), 503 while it runs
+ * * inodes - (GET) cached inodes, open files and dirs, and log counts in yaml
+ * * metrics - (GET) request latency histograms and gauges in Prometheus
+ *   text format
+ * * trace[?since=ns] - (GET) the per-thread request trace rings (binary;
+ *   decode with 'famfs trace')
  */
 static void famfs_dispatch_http(
 	struct mg_connection *c, struct mg_http_message *hm)
@@ -106,14 +229,175 @@ static void famfs_dispatch_http(
 	} else if (mg_match(hm->uri, mg_str("/icache_stats"), NULL)) {
 		extern struct famfs_ctx famfs_context;
 		struct famfs_icache *icache = &famfs_context.icache;
+		u64 count, lru_count, nfds, max_bytes, max_fds;
+		u64 lru_hits, evictions, fd_closes, fd_reopens, fd_reopen_errors;
+		u64 forget_batches, forgets, neg_hits, neg_adds;
+		struct famfs_pool_stats ps;
+
+		/* Snapshot under the mutex so the counts are consistent */
+		pthread_mutex_lock(&icache->mutex);
+		count = icache->count;
+		lru_count = icache->lru_count;
+		nfds = icache->nfds;
+		max_bytes = icache->max_bytes;
+		max_fds = icache->max_fds;
+		lru_hits = icache->lru_hits;
+		evictions = icache->evictions;
+		fd_closes = icache->fd_closes;
+		fd_reopens = icache->fd_reopens;
+		fd_reopen_errors = icache->fd_reopen_errors;
+		forget_batches = icache->forget_batches;
+		forgets = icache->forgets;
+		neg_hits = icache->neg_hits;
+		neg_adds = icache->neg_adds;
+		pthread_mutex_unlock(&icache->mutex);
+
+		famfs_icache_pool_stats(icache, &ps);
 		mg_http_reply(c, 200,
 			      "Content-Type: text/yaml\r\nConnection: close\r\n",
 			      "icache_stats:\n"
 			      "  search_count:   %lld\n"
 			      "  nodes_scanned:  %lld\n"
-			      "  search_fail_ct: %lld\n",
+			      "  search_fail_ct: %lld\n"
+			      "  inodes:           %llu\n"
+			      "  lru_inodes:       %llu\n"
+			      "  lru_hits:         %llu\n"
+			      "  evictions:        %llu\n"
+			      "  max_bytes:        %llu\n"
+			      "  dir_fds:          %llu\n"
+			      "  max_fds:          %llu\n"
+			      "  fd_closes:        %llu\n"
+			      "  fd_reopens:       %llu\n"
+			      "  fd_reopen_errors: %llu\n"
+			      "  forget_batches:   %llu\n"
+			      "  forgets:          %llu\n"
+			      "  neg_hits:         %llu\n"
+			      "  neg_adds:         %llu\n"
+			      "  neg_gen:          %llu\n"
+			      "  pool_bytes:       %llu\n"
+			      "  pool_inodes:      %llu\n"
+			      "  pool_inode_bytes: %llu\n"
+			      "  pool_mem_allocs:  %llu\n"
+			      "  pool_mem_bytes:   %llu\n"
+			      "  pool_mem_large:   %llu\n",
 			      icache->search_count, icache->nodes_scanned,
-			      icache->search_fail_ct);
+			      icache->search_fail_ct,
+			      count, lru_count, lru_hits, evictions, max_bytes,
+			      nfds, max_fds, fd_closes, fd_reopens,
+			      fd_reopen_errors, forget_batches, forgets,
+			      neg_hits, neg_adds,
+			      (unsigned long long)famfs_icache_neg_gen(icache),
+			      (unsigned long long)ps.bytes,
+			      (unsigned long long)ps.inodes,
+			      (unsigned long long)ps.inode_bytes,
+			      (unsigned long long)ps.mem_allocs,
+			      (unsigned long long)ps.mem_bytes,
+			      (unsigned long long)ps.mem_large);
+
+	} else if (mg_match(hm->uri, mg_str("/flock_stats"), NULL)) {
+		extern struct famfs_ctx famfs_context;
+		struct famfs_icache *icache = &famfs_context.icache;
+		struct famfs_flock_stats fs;
+
+		/* Snapshot under the mutex so the counts are consistent */
+		pthread_mutex_lock(&icache->mutex);
+		fs = icache->flock_stats;
+		pthread_mutex_unlock(&icache->mutex);
+
+		mg_http_reply(c, 200,
+			      "Content-Type: text/yaml\r\nConnection: close\r\n",
+			      "flock_stats:\n"
+			      "  acquired:    %llu\n"
+			      "  contended:   %llu\n"
+			      "  wouldblock:  %llu\n"
+			      "  interrupted: %llu\n"
+			      "  waiting:     %llu\n"
+			      "  wait_ns:     %llu\n"
+			      "  max_wait_ns: %llu\n",
+			      (unsigned long long)fs.acquired,
+			      (unsigned long long)fs.contended,
+			      (unsigned long long)fs.wouldblock,
+			      (unsigned long long)fs.interrupted,
+			      (unsigned long long)fs.waiting,
+			      (unsigned long long)fs.wait_ns,
+			      (unsigned long long)fs.max_wait_ns);
+
+	} else if (mg_match(hm->uri, mg_str("/queue_stats"), NULL)) {
+		extern struct famfs_ctx famfs_context;
+		struct famfs_ctx *lo = &famfs_context;
+		char *body, *p;
+		size_t len;
+		int i;
+
+		/* One line per queue; queues that never saw a request are
+		 * skipped */
+		len = 128 + (size_t)lo->nqueues * 64;
+		body = calloc(1, len);
+		if (!body) {
+			mg_http_reply(c, 500, "Connection: close\r\n",
+				      "Out of memory\n");
+			goto out;
+		}
+		p = body;
+		p += snprintf(p, len - (p - body),
+			      "queue_stats:\n"
+			      "  transport: %s\n"
+			      "  nqueues: %d\n"
+			      "  queues:\n",
+			      lo->uring_active ? "io_uring" : "dev_fuse",
+			      lo->nqueues);
+		for (i = 0; lo->queue_stats && i < lo->nqueues; i++) {
+			uint64_t n = __atomic_load_n(&lo->queue_stats[i].nreq,
+						     __ATOMIC_RELAXED);
+			if (!n)
+				continue;
+			p += snprintf(p, len - (p - body),
+				      "    - { queue: %d, requests: %llu }\n",
+				      i, (unsigned long long)n);
+		}
+		mg_http_reply(c, 200,
+			      "Content-Type: text/yaml\r\nConnection: close\r\n",
+			      "%s", body);
+		free(body);
+
+	} else if (mg_match(hm->uri, mg_str("/warmup"), NULL)) {
+		static const char * const state_str[] = {
+			[FAMFS_WARMUP_OFF] = "off",
+			[FAMFS_WARMUP_RUNNING] = "running",
+			[FAMFS_WARMUP_DONE] = "done",
+		};
+		struct famfs_warmup_stats ws;
+		u64 log_files = 0, log_dirs = 0;
+
+		famfs_warmup_get_stats(&ws);
+		/* The log counts give a client something to measure progress
+		 * against (for a whole-tree warm-up) */
+		famfs_fs_stats_counts(&log_files, &log_dirs);
+		mg_http_reply(c, 200,
+			      "Content-Type: text/yaml\r\nConnection: close\r\n",
+			      "warmup:\n"
+			      "  state:      %s\n"
+			      "  threads:    %d\n"
+			      "  dirs:       %lld\n"
+			      "  files:      %lld\n"
+			      "  cached:     %lld\n"
+			      "  errors:     %lld\n"
+			      "  elapsed_ms: %lld\n"
+			      "  log_files:  %lld\n"
+			      "  log_dirs:   %lld\n",
+			      state_str[ws.state], ws.nthreads, ws.dirs,
+			      ws.files, ws.cached, ws.errors, ws.elapsed_ms,
+			      log_files, log_dirs);
+
+	} else if (mg_match(hm->uri, mg_str("/ready"), NULL)) {
+		struct famfs_warmup_stats ws;
+		char *meta = "Content-Type: text/plain\r\nConnection: close\r\n";
+
+		famfs_warmup_get_stats(&ws);
+		if (ws.state == FAMFS_WARMUP_RUNNING)
+			mg_http_reply(c, 503, meta, "warming\n");
+		else
+			mg_http_reply(c, 200, meta, "ready\n");
 
 	} else if (mg_match(hm->uri, mg_str("/pid"), NULL)) {
 		pid_t pid = getpid();
@@ -123,16 +407,65 @@ static void famfs_dispatch_http(
 			pid);
 
 	} else if (mg_match(hm->uri, mg_str("/inodes"), NULL)) {
-		/* Dummy target */
+		extern struct famfs_ctx famfs_context;
+		struct famfs_icache *icache = &famfs_context.icache;
+		u64 count, lru_count, log_files = 0, log_dirs = 0;
+
+		pthread_mutex_lock(&icache->mutex);
+		count = icache->count;
+		lru_count = icache->lru_count;
+		pthread_mutex_unlock(&icache->mutex);
+
+		/* The log counts are what could be cached (0 without
+		 * -o daxdev) */
+		famfs_fs_stats_counts(&log_files, &log_dirs);
 		mg_http_reply(c, 200,
 			"Content-Type: text/yaml\r\nConnection: close\r\n",
-			"inodes:\n  total: 1500\n  open: 12\n  deleted: 7\n");
+			"inodes:\n"
+			"  cached:     %llu\n"
+			"  referenced: %llu\n"
+			"  lru:        %llu\n"
+			"  open_files: %lld\n"
+			"  open_dirs:  %lld\n"
+			"  log_files:  %llu\n"
+			"  log_dirs:   %llu\n",
+			count, count - lru_count, lru_count,
+			(long long)famfs_metrics_gauge_read(FAMFS_GAUGE_OPEN_FILES),
+			(long long)famfs_metrics_gauge_read(FAMFS_GAUGE_OPEN_DIRS),
+			log_files, log_dirs);
+
+	} else if (mg_match(hm->uri, mg_str("/trace"), NULL)) {
+		char since[32] = {0};
+		void *buf;
+		size_t len;
+
+		/* A client that follows the trace asks only for records newer
+		 * than the last one it has */
+		mg_http_get_var(&hm->query, "since", since, sizeof(since));
+		if (famfs_trace_snapshot(strtoull(since, NULL, 0), &buf, &len)) {
+			mg_http_reply(c, 503, "Connection: close\r\n",
+				      "Trace disabled or out of memory\n");
+			goto out;
+		}
+		/* Binary body: mg_http_reply() is printf-based */
+		mg_printf(c, "HTTP/1.1 200 OK\r\n"
+			  "Content-Type: application/octet-stream\r\n"
+			  "Content-Length: %lu\r\n"
+			  "Connection: close\r\n\r\n", (unsigned long)len);
+		mg_send(c, buf, len);
+		free(buf);
+
+	} else if (mg_match(hm->uri, mg_str("/metrics"), NULL)) {
+		if (famfs_metrics_reply(c))
+			mg_http_reply(c, 500, "Connection: close\r\n",
+				      "Out of memory\n");
 
 	} else {
 		char *meta = "Content-Type: text/plain\r\nConnection: close\r\n";
 		mg_http_reply(c, 404, meta, "Not Found\n");
 	}
 
+out:
 	/* Ensure the socket closes after we flush the reply
 	 * (avoid endless MG_EV_READ spam) */
 	c->is_draining = 1;
@@ -0,0 +1,253 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2026 Micron Technology, Inc.  All rights reserved.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/statvfs.h>
+
+#include "famfs_lib.h"
+#include "famfs_lib_internal.h"
+#include "famfs_log.h"
+#include "libfcc.h"
+#include "bitmap.h"
+#include "famfs_fused_statfs.h"
+
+/*
+ * Filesystem capacity for STATFS
+ *
+ * The capacity of a famfs file system is the daxdev, and its usage is the
+ * set of extents in the log (plus the superblock and the log itself). At
+ * mount time we build the allocation bitmap once, the same way fsck does,
+ * and keep it along with the log mapping. Since the log is append-only, a
+ * STATFS only has to fold in the entries appended since the previous one:
+ * the cost is one cache line invalidate when nothing changed (two, for a
+ * packed log), and proportional to the new entries otherwise. After a
+ * compaction (which renumbers the log) the bitmap is rebuilt from the
+ * checkpoint, and likewise after the log grows a segment, which takes up
+ * space that no log entry accounts for.
+ *
+ * Inodes are log entries: every file or directory consumes one, so the
+ * inode count is the files and directories plus the log slots that remain,
+ * and the free count is the slots that remain (for a packed log, the
+ * number of the largest entries that still fit).
+ */
+
+struct famfs_fs_stats {
+	pthread_mutex_t mutex;
+	struct famfs_superblock *sb;
+	struct famfs_log *logp;
+	u8 *bitmap;
+	u64 nbits;
+	u64 alloc_unit;
+	struct famfs_log_iter it; /* Entries it has returned are in the bitmap */
+	u32 nsegs;          /* Log segments in the bitmap */
+
+	u64 alloc_sum;      /* Bytes allocated, incl. superblock and log */
+	u64 fsize_sum;      /* Sum of file sizes */
+	u64 nfiles;
+	u64 ndirs;
+	u64 alloc_errors;   /* Double allocations seen */
+};
+
+static struct famfs_fs_stats fss = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Start over with just the superblock and log allocated.
+ * Caller holds fss.mutex */
+static void
+famfs_fs_stats_reset_locked(void)
+{
+	memset(fss.bitmap, 0, mu_bitmap_size(fss.nbits) + 1);
+	fss.alloc_sum = 0;
+	fss.fsize_sum = 0;
+	fss.nfiles = 0;
+	fss.ndirs = 0;
+	fss.alloc_errors = 0;
+	fss.nsegs = famfs_log_nsegs(fss.logp);
+	put_sb_log_into_bitmap(fss.bitmap, fss.alloc_unit, fss.logp,
+			       &fss.alloc_sum);
+	famfs_log_iter_init(&fss.it, fss.logp);
+}
+
+/* Caller holds fss.mutex */
+static void
+famfs_fs_stats_catch_up_locked(void)
+{
+	struct famfs_log *logp = fss.logp;
+	struct famfs_log_entry le;
+	u64 next;
+	int rc;
+
+	invalidate_processor_cache(&logp->famfs_log_next_index,
+				   sizeof(logp->famfs_log_next_index));
+	next = logp->famfs_log_next_index;
+	if (next > logp->famfs_log_last_index + 1)
+		return;
+
+	if (famfs_log_is_packed(logp))
+		invalidate_processor_cache(famfs_log_packed(logp),
+					   sizeof(struct famfs_log_packed));
+	if (famfs_log_iter_stale(&fss.it) ||
+	    famfs_log_nsegs(logp) != fss.nsegs)
+		famfs_fs_stats_reset_locked();
+
+	for (;;) {
+		famfs_log_iter_invalidate(&fss.it);
+		rc = famfs_log_iter_next(&fss.it, &le);
+
+		/* next_index may be visible before the entry it covers;
+		 * pick it up on the next call */
+		if (rc <= 0)
+			return;
+
+		switch (le.famfs_log_entry_type) {
+		case FAMFS_LOG_FILE:
+			fss.nfiles++;
+			fss.fsize_sum += le.famfs_fm.fm_size;
+			fss.alloc_errors += famfs_bitmap_add_file(fss.bitmap,
+								  fss.alloc_unit,
+								  &le.famfs_fm,
+								  &fss.alloc_sum);
+			break;
+		case FAMFS_LOG_MKDIR:
+			fss.ndirs++;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/**
+ * famfs_fs_stats_init() - build the allocation state from the log
+ *
+ * @daxdev: dax device holding the superblock and log
+ *
+ * Returns 0 on success, -1 on failure (STATFS then falls back to the shadow
+ * file system)
+ */
+int
+famfs_fs_stats_init(const char *daxdev)
+{
+	if (famfs_mmap_log_raw_ro(daxdev, &fss.sb, &fss.logp)) {
+		famfs_log(FAMFS_LOG_ERR, "%s: failed to map log from %s\n",
+			  __func__, daxdev);
+		return -1;
+	}
+	if (famfs_validate_log_header(fss.logp)) {
+		famfs_log(FAMFS_LOG_ERR, "%s: invalid log header on %s\n",
+			  __func__, daxdev);
+		goto err_unmap;
+	}
+
+	pthread_mutex_lock(&fss.mutex);
+	fss.alloc_unit = fss.sb->ts_alloc_unit;
+	fss.nbits = (fss.sb->ts_daxdev.dd_size + fss.alloc_unit - 1) /
+		fss.alloc_unit;
+	/* Note: mu_bitmap_foreach accesses 1 bit past the end */
+	fss.bitmap = calloc(1, mu_bitmap_size(fss.nbits) + 1);
+	if (!fss.bitmap) {
+		pthread_mutex_unlock(&fss.mutex);
+		goto err_unmap;
+	}
+	famfs_fs_stats_reset_locked();
+	famfs_fs_stats_catch_up_locked();
+	pthread_mutex_unlock(&fss.mutex);
+
+	famfs_log(FAMFS_LOG_NOTICE,
+		  "%s: %lld of %lld bytes allocated; %lld files, %lld dirs\n",
+		  __func__, fss.alloc_sum, fss.nbits * fss.alloc_unit,
+		  fss.nfiles, fss.ndirs);
+	if (fss.alloc_errors)
+		famfs_log(FAMFS_LOG_WARNING,
+			  "%s: %lld allocation collisions in log\n",
+			  __func__, fss.alloc_errors);
+	return 0;
+
+err_unmap:
+	famfs_unmap_log(fss.logp);
+	munmap(fss.sb, FAMFS_SUPERBLOCK_SIZE);
+	fss.logp = NULL;
+	fss.sb = NULL;
+	return -1;
+}
+
+void
+famfs_fs_stats_destroy(void)
+{
+	pthread_mutex_lock(&fss.mutex);
+	if (fss.logp) {
+		famfs_unmap_log(fss.logp);
+		munmap(fss.sb, FAMFS_SUPERBLOCK_SIZE);
+	}
+	free(fss.bitmap);
+	fss.logp = NULL;
+	fss.sb = NULL;
+	fss.bitmap = NULL;
+	pthread_mutex_unlock(&fss.mutex);
+}
+
+/**
+ * famfs_fs_stats_statvfs() - fill in a statvfs for the famfs file system
+ *
+ * Returns 0 on success, -1 if famfs_fs_stats_init() was not successful
+ */
+int
+famfs_fs_stats_statvfs(struct statvfs *st)
+{
+	u64 used_units;
+
+	pthread_mutex_lock(&fss.mutex);
+	if (!fss.bitmap) {
+		pthread_mutex_unlock(&fss.mutex);
+		return -1;
+	}
+
+	famfs_fs_stats_catch_up_locked();
+
+	memset(st, 0, sizeof(*st));
+	used_units = fss.alloc_sum / fss.alloc_unit;
+
+	st->f_bsize = fss.alloc_unit;
+	st->f_frsize = fss.alloc_unit;
+	st->f_blocks = fss.nbits;
+	st->f_bfree = (used_units < fss.nbits) ? fss.nbits - used_units : 0;
+	st->f_bavail = st->f_bfree;
+	st->f_ffree = log_slots_available(fss.logp);
+	st->f_files = fss.nfiles + fss.ndirs + st->f_ffree;
+	st->f_favail = st->f_ffree;
+	st->f_namemax = NAME_MAX;
+	pthread_mutex_unlock(&fss.mutex);
+
+	return 0;
+}
+
+/**
+ * famfs_fs_stats_counts() - number of files and directories in the log
+ *
+ * Returns 0 on success, -1 if famfs_fs_stats_init() was not successful
+ */
+int
+famfs_fs_stats_counts(u64 *nfiles, u64 *ndirs)
+{
+	pthread_mutex_lock(&fss.mutex);
+	if (!fss.bitmap) {
+		pthread_mutex_unlock(&fss.mutex);
+		return -1;
+	}
+	famfs_fs_stats_catch_up_locked();
+	*nfiles = fss.nfiles;
+	*ndirs = fss.ndirs;
+	pthread_mutex_unlock(&fss.mutex);
+	return 0;
+}
@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) 2026 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef _H_FAMFS_FUSED_STATFS
+#define _H_FAMFS_FUSED_STATFS
+
+#include <sys/statvfs.h>
+#include "famfs_lib.h"
+
+int famfs_fs_stats_init(const char *daxdev);
+void famfs_fs_stats_destroy(void);
+int famfs_fs_stats_statvfs(struct statvfs *st);
+int famfs_fs_stats_counts(u64 *nfiles, u64 *ndirs);
+
+#endif /* _H_FAMFS_FUSED_STATFS */
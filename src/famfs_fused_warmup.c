@@ -0,0 +1,487 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2026 Micron Technology, Inc.  All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#define FUSE_USE_VERSION FUSE_MAKE_VERSION(3, 12)
+
+#include <fuse_lowlevel.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "famfs_lib.h"
+#include "famfs_log.h"
+#include "famfs_fused.h"
+#include "famfs_fused_icache.h"
+#include "famfs_fused_warmup.h"
+
+/*
+ * Icache warm-up (-o warmup[=subtree:subtree...])
+ *
+ * The first LOOKUP of each file on a fresh mount opens the shadow yaml,
+ * parses it, builds the GET_FMAP reply and inserts the inode. With warm-up,
+ * a pool of threads walks the shadow tree (or the listed subtrees) at
+ * startup and does that work ahead of time; each inode it caches holds a
+ * warm-up ref, so it stays cached after the kernel forgets it. (With an
+ * icache memory budget there is no warm-up ref: unreferenced inodes are
+ * retained on the icache LRU anyway, and warm-up must not pin more than
+ * the budget allows.) A LOOKUP
+ * that finds the file cached with current metadata then costs an openat()
+ * and fstat() of the shadow file and no yaml parse.
+ *
+ * The mount is usable while warm-up runs: LOOKUPs that get there first
+ * cache the inode themselves, and warm-up counts it as already cached.
+ * Directories are the unit of work - a worker scans one directory, loads
+ * its entries, and queues its subdirectories for any worker to pick up.
+ *
+ * Progress and readiness are reported through the REST server.
+ */
+
+struct famfs_warmup_dir {
+	struct famfs_warmup_dir *next;
+	struct famfs_inode *inode;  /* A ref is held while queued/scanned */
+};
+
+struct famfs_warmup {
+	struct famfs_ctx *lo;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct famfs_warmup_dir *queue;  /* Protected by mutex */
+	int busy;                        /* Workers scanning a directory */
+	int running;                     /* Workers not yet exited */
+	pthread_t *threads;
+	int nthreads;
+	volatile int shutdown;
+
+	int state;                       /* enum famfs_warmup_state */
+	struct timespec start;
+	struct timespec end;
+
+	u64 dirs;
+	u64 files;
+	u64 cached;
+	u64 errors;
+};
+
+static struct famfs_warmup wu = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+#define WU_INC(field) __atomic_add_fetch(&wu.field, 1, __ATOMIC_RELAXED)
+#define WU_GET(field) __atomic_load_n(&wu.field, __ATOMIC_RELAXED)
+
+static u64
+famfs_warmup_ms(const struct timespec *a, const struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1000 +
+		(b->tv_nsec - a->tv_nsec) / 1000000;
+}
+
+/* Takes over the caller's ref on @dir */
+static void
+famfs_warmup_enqueue(struct famfs_inode *dir)
+{
+	struct famfs_warmup_dir *wd;
+
+	wd = calloc(1, sizeof(*wd));
+	if (!wd) {
+		WU_INC(errors);
+		famfs_inode_putref(dir);
+		return;
+	}
+	wd->inode = dir;
+
+	pthread_mutex_lock(&wu.mutex);
+	wd->next = wu.queue;
+	wu.queue = wd;
+	pthread_cond_signal(&wu.cond);
+	pthread_mutex_unlock(&wu.mutex);
+}
+
+static struct famfs_inode *
+famfs_warmup_load(struct famfs_inode *parent, int pfd, const char *name)
+{
+	struct famfs_ctx *lo = wu.lo;
+	struct famfs_inode *inode;
+	enum famfs_fuse_ftype ftype;
+	struct timespec shadow_ctim = { 0 };
+	struct famfs_fmap *fmap = NULL;
+	struct stat st;
+	int fd = -1;
+	int rc;
+
+	if (fstatat(pfd, name, &st, AT_SYMLINK_NOFOLLOW))
+		goto err;
+
+	inode = famfs_icache_find_get_from_ino(&lo->icache, st.st_ino);
+	if (inode)
+		goto cached;
+
+	switch (st.st_mode & S_IFMT) {
+	case S_IFDIR:
+		fd = openat(pfd, name, O_PATH | O_NOFOLLOW);
+		if (fd < 0)
+			goto err;
+		ftype = FAMFS_FDIR;
+		break;
+
+	case S_IFREG:
+		fd = openat(pfd, name, O_RDONLY | O_NOFOLLOW);
+		if (fd < 0)
+			goto err;
+		rc = fstat(fd, &st);
+		shadow_ctim = st.st_ctim;
+		if (!rc)
+			rc = famfs_shadow_file_load(NULL, lo, fd, &st, &fmap);
+		close(fd);
+		fd = -1;
+		if (rc)
+			goto err;
+		ftype = FAMFS_FREG;
+		break;
+
+	default:
+		/* Not part of the famfs namespace; LOOKUP would fail it too */
+		return NULL;
+	}
+
+	pthread_mutex_lock(&lo->icache.mutex);
+	inode = famfs_icache_find_get_from_ino_locked(&lo->icache, st.st_ino);
+	if (inode) {
+		/* A LOOKUP cached it while we were loading */
+		pthread_mutex_unlock(&lo->icache.mutex);
+		goto cached;
+	}
+	inode = famfs_inode_alloc(&lo->icache, fd, name, st.st_ino, st.st_dev,
+				  fmap, &st, ftype, parent);
+	if (!inode) {
+		pthread_mutex_unlock(&lo->icache.mutex);
+		goto err;
+	}
+	if (ftype == FAMFS_FREG)
+		inode->shadow_ctim = shadow_ctim;
+	fd = -1;
+	fmap = NULL;
+
+	/* Insert leaves 2 refs: one is the warm-up ref, which keeps the
+	 * inode cached (unless there is a memory budget); for a directory
+	 * the other is returned for the scan */
+	famfs_icache_insert_locked(&lo->icache, inode);
+	if (lo->icache.max_bytes)
+		famfs_inode_putref_locked(inode, 1);
+	if (ftype == FAMFS_FREG) {
+		famfs_inode_putref_locked(inode, 1);
+		inode = NULL;
+		WU_INC(files);
+	}
+	pthread_mutex_unlock(&lo->icache.mutex);
+	return inode;
+
+cached:
+	WU_INC(cached);
+	famfs_fmap_free(&lo->icache, fmap);
+	if (fd >= 0)
+		close(fd);
+	if (inode->ftype == FAMFS_FDIR)
+		return inode;
+	famfs_inode_putref(inode);
+	return NULL;
+
+err:
+	famfs_log(FAMFS_LOG_DEBUG, "%s: %s/%s: %s\n", __func__,
+		  parent->name, name, strerror(errno));
+	WU_INC(errors);
+	famfs_fmap_free(&lo->icache, fmap);
+	if (fd >= 0)
+		close(fd);
+	return NULL;
+}
+
+/**
+ * famfs_warmup_one() - cache one shadow tree entry
+ *
+ * Returns the inode with a ref held if the entry is a directory (so it can
+ * be scanned), else NULL
+ */
+static struct famfs_inode *
+famfs_warmup_one(struct famfs_inode *parent, const char *name)
+{
+	struct famfs_inode *inode;
+	int pfd;
+
+	pfd = famfs_inode_fd_get(parent);
+	if (pfd < 0) {
+		WU_INC(errors);
+		return NULL;
+	}
+	inode = famfs_warmup_load(parent, pfd, name);
+	famfs_inode_fd_put(parent);
+	return inode;
+}
+
+static void
+famfs_warmup_scan(struct famfs_inode *dir)
+{
+	struct dirent *de;
+	DIR *dp;
+	int dfd, fd;
+
+	/* Directory inode fds are O_PATH; readdir needs a real open */
+	dfd = famfs_inode_fd_get(dir);
+	if (dfd < 0) {
+		WU_INC(errors);
+		return;
+	}
+	fd = openat(dfd, ".", O_RDONLY | O_DIRECTORY);
+	famfs_inode_fd_put(dir);
+	if (fd < 0) {
+		WU_INC(errors);
+		return;
+	}
+	dp = fdopendir(fd);
+	if (!dp) {
+		close(fd);
+		WU_INC(errors);
+		return;
+	}
+
+	while (!wu.shutdown && (de = readdir(dp))) {
+		struct famfs_inode *child;
+
+		if (strcmp(de->d_name, ".") == 0 ||
+		    strcmp(de->d_name, "..") == 0)
+			continue;
+
+		child = famfs_warmup_one(dir, de->d_name);
+		if (child)
+			famfs_warmup_enqueue(child);
+	}
+	closedir(dp);
+	WU_INC(dirs);
+}
+
+static void *
+famfs_warmup_thread(void *arg)
+{
+	(void)arg;
+
+	for (;;) {
+		struct famfs_warmup_dir *wd;
+
+		pthread_mutex_lock(&wu.mutex);
+		while (!wu.queue && wu.busy && !wu.shutdown)
+			pthread_cond_wait(&wu.cond, &wu.mutex);
+		if (!wu.queue || wu.shutdown) {
+			/* Nothing queued and nobody scanning: the walk is
+			 * over (or we are shutting down) */
+			pthread_cond_broadcast(&wu.cond);
+			break;
+		}
+		wd = wu.queue;
+		wu.queue = wd->next;
+		wu.busy++;
+		pthread_mutex_unlock(&wu.mutex);
+
+		famfs_warmup_scan(wd->inode);
+		famfs_inode_putref(wd->inode);
+		free(wd);
+
+		pthread_mutex_lock(&wu.mutex);
+		wu.busy--;
+		if (!wu.busy && !wu.queue)
+			pthread_cond_broadcast(&wu.cond);
+		pthread_mutex_unlock(&wu.mutex);
+	}
+
+	/* Still holding the mutex */
+	if (--wu.running == 0 && !wu.shutdown) {
+		clock_gettime(CLOCK_MONOTONIC, &wu.end);
+		__atomic_store_n(&wu.state, FAMFS_WARMUP_DONE,
+				 __ATOMIC_RELEASE);
+		famfs_log(FAMFS_LOG_NOTICE,
+			  "%s: done in %lld ms: %lld dirs, %lld files, "
+			  "%lld already cached, %lld errors\n", __func__,
+			  famfs_warmup_ms(&wu.start, &wu.end), wu.dirs,
+			  wu.files, wu.cached, wu.errors);
+	}
+	pthread_mutex_unlock(&wu.mutex);
+	return NULL;
+}
+
+/**
+ * famfs_warmup_queue_subtree() - cache the path to a subtree and queue it
+ *
+ * @relpath: path relative to the mount point; "" or "/" is the whole tree
+ */
+static void
+famfs_warmup_queue_subtree(const char *relpath)
+{
+	struct famfs_inode *dir;
+	char path[PATH_MAX];
+	char *saveptr = NULL;
+	char *tok;
+
+	dir = famfs_get_inode_from_nodeid(&wu.lo->icache, FUSE_ROOT_ID);
+	if (!dir)
+		return;
+
+	strncpy(path, relpath, sizeof(path) - 1);
+	path[sizeof(path) - 1] = '\0';
+
+	for (tok = strtok_r(path, "/", &saveptr); tok;
+	     tok = strtok_r(NULL, "/", &saveptr)) {
+		struct famfs_inode *child;
+
+		child = famfs_warmup_one(dir, tok);
+		famfs_inode_putref(dir);
+		if (!child) {
+			famfs_log(FAMFS_LOG_WARNING,
+				  "%s: %s is not a directory; skipping\n",
+				  __func__, relpath);
+			return;
+		}
+		dir = child;
+	}
+	famfs_warmup_enqueue(dir);
+}
+
+/**
+ * famfs_warmup_start() - start warming the icache (if -o warmup is set)
+ *
+ * Must be called after fuse_daemonize(), since the threads do not survive
+ * the fork.
+ *
+ * Returns 0 on success or if warm-up is disabled, -1 on failure
+ */
+int
+famfs_warmup_start(struct famfs_ctx *lo)
+{
+	char *paths, *saveptr = NULL, *tok;
+	int i, rc;
+
+	if (!lo->warmup && !lo->warmup_paths)
+		return 0;
+
+	wu.lo = lo;
+	clock_gettime(CLOCK_MONOTONIC, &wu.start);
+
+	if (lo->memns) {
+		/* The namespace is already in memory */
+		wu.end = wu.start;
+		wu.state = FAMFS_WARMUP_DONE;
+		return 0;
+	}
+
+	wu.nthreads = lo->warmup_threads;
+	if (wu.nthreads < 1)
+		wu.nthreads = FAMFS_WARMUP_DEFAULT_THREADS;
+	if (wu.nthreads > FAMFS_WARMUP_MAX_THREADS)
+		wu.nthreads = FAMFS_WARMUP_MAX_THREADS;
+
+	wu.threads = calloc(wu.nthreads, sizeof(*wu.threads));
+	if (!wu.threads)
+		return -1;
+
+	wu.shutdown = 0;
+	wu.state = FAMFS_WARMUP_RUNNING;
+
+	if (!lo->warmup_paths) {
+		famfs_warmup_queue_subtree("");
+	} else {
+		paths = strdup(lo->warmup_paths);
+		if (!paths)
+			goto err_free;
+		for (tok = strtok_r(paths, ":", &saveptr); tok;
+		     tok = strtok_r(NULL, ":", &saveptr))
+			famfs_warmup_queue_subtree(tok);
+		free(paths);
+	}
+
+	pthread_mutex_lock(&wu.mutex);
+	for (i = 0; i < wu.nthreads; i++) {
+		rc = pthread_create(&wu.threads[i], NULL, famfs_warmup_thread,
+				    NULL);
+		if (rc) {
+			famfs_log(FAMFS_LOG_ERR,
+				  "%s: pthread_create failed: %d\n",
+				  __func__, rc);
+			break;
+		}
+		wu.running++;
+	}
+	wu.nthreads = i;
+	pthread_mutex_unlock(&wu.mutex);
+
+	if (!wu.nthreads)
+		goto err_free;
+
+	famfs_log(FAMFS_LOG_NOTICE, "%s: warming %s with %d threads\n",
+		  __func__, lo->warmup_paths ? lo->warmup_paths : "all files",
+		  wu.nthreads);
+	return 0;
+
+err_free:
+	famfs_warmup_stop();
+	return -1;
+}
+
+void
+famfs_warmup_stop(void)
+{
+	struct famfs_warmup_dir *wd;
+	int i;
+
+	pthread_mutex_lock(&wu.mutex);
+	wu.shutdown = 1;
+	pthread_cond_broadcast(&wu.cond);
+	pthread_mutex_unlock(&wu.mutex);
+
+	for (i = 0; i < wu.nthreads; i++)
+		pthread_join(wu.threads[i], NULL);
+	free(wu.threads);
+	wu.threads = NULL;
+	wu.nthreads = 0;
+
+	/* Directories still queued when we stopped early */
+	while ((wd = wu.queue)) {
+		wu.queue = wd->next;
+		famfs_inode_putref(wd->inode);
+		free(wd);
+	}
+	if (wu.state == FAMFS_WARMUP_RUNNING)
+		wu.state = FAMFS_WARMUP_OFF;
+}
+
+void
+famfs_warmup_get_stats(struct famfs_warmup_stats *ws)
+{
+	struct timespec now;
+
+	memset(ws, 0, sizeof(*ws));
+	ws->state = __atomic_load_n(&wu.state, __ATOMIC_ACQUIRE);
+	if (ws->state == FAMFS_WARMUP_OFF)
+		return;
+
+	ws->nthreads = wu.nthreads;
+	ws->dirs = WU_GET(dirs);
+	ws->files = WU_GET(files);
+	ws->cached = WU_GET(cached);
+	ws->errors = WU_GET(errors);
+	if (ws->state == FAMFS_WARMUP_DONE) {
+		ws->elapsed_ms = famfs_warmup_ms(&wu.start, &wu.end);
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ws->elapsed_ms = famfs_warmup_ms(&wu.start, &now);
+	}
+}
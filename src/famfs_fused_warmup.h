@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) 2026 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef _H_FAMFS_WARMUP
+#define _H_FAMFS_WARMUP
+
+#include "famfs_fused.h"
+
+#define FAMFS_WARMUP_DEFAULT_THREADS 8
+#define FAMFS_WARMUP_MAX_THREADS     64
+
+enum famfs_warmup_state {
+	FAMFS_WARMUP_OFF,
+	FAMFS_WARMUP_RUNNING,
+	FAMFS_WARMUP_DONE,
+};
+
+struct famfs_warmup_stats {
+	int state;          /* enum famfs_warmup_state */
+	int nthreads;
+	u64 dirs;           /* Directories scanned */
+	u64 files;          /* Files loaded and cached */
+	u64 cached;         /* Entries that were already cached */
+	u64 errors;
+	u64 elapsed_ms;
+};
+
+int famfs_warmup_start(struct famfs_ctx *lo);
+void famfs_warmup_stop(void);
+void famfs_warmup_get_stats(struct famfs_warmup_stats *ws);
+
+#endif /* _H_FAMFS_WARMUP */
@@ -85,8 +85,6 @@ static int open_superblock_file_read_only(const char *path, size_t  *sizep,
 					  char *mpt_out);
 static char *famfs_relpath_from_fullpath(const char *mpt, char *fullpath);
 static void famfs_kill_superblock(struct famfs_superblock *sb);
-static struct famfs_log *famfs_map_log_by_path(
-	const char *path, int read_only, bool check_log, enum lock_opt lockopt);
 
 /* famfs v2 stuff (dual standalone / fuse) */
 
@@ -677,6 +675,7 @@ famfs_fsck_scan(
 	int                            nbuckets,
 	int                            verbose)
 {
+	const struct famfs_log_checkpoint *ck;
 	size_t effective_log_size;
 	struct famfs_log_stats ls;
 	u64 alloc_sum, fsize_sum;
@@ -687,6 +686,7 @@ famfs_fsck_scan(
 	u8 *bitmap;
 	u64 nbits;
 	int role;
+	u32 i;
 
 	assert(sb);
 	assert(logp);
@@ -694,8 +694,16 @@ famfs_fsck_scan(
 	alloc_unit = sb->ts_alloc_unit;
 	assert(alloc_unit == 4096 || alloc_unit == 0x200000);
 	dev_capacity = sb->ts_daxdev.dd_size;
-	effective_log_size = sizeof(*logp) +
-		(logp->famfs_log_next_index * sizeof(struct famfs_log_entry));
+	ck = famfs_log_get_checkpoint(logp);
+	if (famfs_log_is_packed(logp))
+		effective_log_size = sizeof(*logp) +
+			sizeof(struct famfs_log_packed) +
+			famfs_log_packed(logp)->pl_next_offset;
+	else
+		effective_log_size = sizeof(*logp) +
+			(logp->famfs_log_next_index *
+			 sizeof(struct famfs_log_entry));
+	effective_log_size += ck ? ck->ck_len : 0;
 
 	/*
 	 * Print superblock info
@@ -723,10 +731,26 @@ famfs_fsck_scan(
 	 * print log info
 	 */
 	printf("\nLog stats:\n");
-	printf("  # of log entries in use: %lld of %lld\n",
-	       logp->famfs_log_next_index, logp->famfs_log_last_index + 1);
+	if (famfs_log_is_packed(logp))
+		printf("  # of log entries in use: %lld (packed: %lld of %lld "
+		       "bytes)\n", logp->famfs_log_next_index,
+		       famfs_log_packed(logp)->pl_next_offset,
+		       famfs_log_entry_limit(logp));
+	else
+		printf("  # of log entries in use: %lld of %lld\n",
+		       logp->famfs_log_next_index,
+		       famfs_log_entry_limit(logp));
+	if (ck)
+		printf("  Checkpoint:               %lld records, %lld bytes "
+		       "at offset %lld\n", ck->ck_nrecs, ck->ck_len,
+		       ck->ck_offset);
 	printf("  Log size in use:          %ld\n", effective_log_size);
-	printf("  Log size (total bytes)    %lld\n", logp->famfs_log_len);
+	printf("  Log size (total bytes)    %lld\n",
+	       famfs_log_seg_end(logp, famfs_log_nsegs(logp)));
+	for (i = 0; i < famfs_log_nsegs(logp); i++)
+		printf("  Log segment %d:            %lld bytes at offset "
+		       "%lld\n", i, famfs_log_packed(logp)->pl_segs[i].ls_len,
+		       famfs_log_packed(logp)->pl_segs[i].ls_offset);
 
 	/*
 	 * Build the log bitmap to scan for errors
@@ -773,8 +797,11 @@ famfs_fsck_scan(
 
 	/* Log stats */
 	printf("Famfs log:\n");
-	printf("  %lld of %lld entries used\n",
-	       ls.n_entries, logp->famfs_log_last_index + 1);
+	if (famfs_log_is_packed(logp))
+		printf("  %lld entries used (packed)\n", ls.n_entries);
+	else
+		printf("  %lld of %lld entries used\n",
+		       ls.n_entries, logp->famfs_log_last_index + 1);
 	printf("  %lld bad log entries detected\n", ls.bad_entries);
 	printf("  %lld files\n", ls.f_logged);
 	printf("  %lld directories\n\n", ls.d_logged);
@@ -813,9 +840,14 @@ famfs_fsck_scan(
 
 		printf("  last_log_index:    %lld\n",
 		       logp->famfs_log_last_index);
-		total_log_size = sizeof(struct famfs_log)
-			+ (sizeof(struct famfs_log_entry) *
-			   logp->famfs_log_last_index);
+		if (famfs_log_is_packed(logp))
+			total_log_size = sizeof(struct famfs_log)
+				+ sizeof(struct famfs_log_packed)
+				+ famfs_log_entry_limit(logp);
+		else
+			total_log_size = sizeof(struct famfs_log)
+				+ (sizeof(struct famfs_log_entry) *
+				   logp->famfs_log_last_index);
 		printf("  usable log size:   %ld\n", total_log_size);
 		printf("  sizeof(struct famfs_log_file_meta): %ld\n",
 		       sizeof(struct famfs_log_file_meta));
@@ -824,6 +856,369 @@ famfs_fsck_scan(
 	return errors;
 }
 
+/*
+ * Log mappings
+ *
+ * A grown log is mapped as one run of address space: the primary log, then
+ * each extension segment right after the last (see struct famfs_log_packed).
+ * Room for every segment is reserved up front, so a mapping can take on
+ * segments that are linked after it was made. Each log mapped here is
+ * remembered along with the segments it covers and where they come from;
+ * readers must not look past famfs_log_mapped_len().
+ */
+struct famfs_log_mapping {
+	struct famfs_log_mapping *next;
+	const struct famfs_log *logp;
+	size_t  window;         /* Address space reserved at logp */
+	u32     nsegs;          /* Extension segments mapped */
+	int     prot;
+	int     raw;            /* @path is the daxdev, else the mount point */
+	char    path[PATH_MAX];
+};
+
+static struct famfs_log_mapping *famfs_log_mappings;
+static pthread_mutex_t famfs_log_mappings_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Caller holds famfs_log_mappings_mutex */
+static struct famfs_log_mapping *
+famfs_log_mapping_find(const struct famfs_log *logp)
+{
+	struct famfs_log_mapping *m;
+
+	for (m = famfs_log_mappings; m; m = m->next)
+		if (m->logp == logp)
+			return m;
+	return NULL;
+}
+
+/*
+ * Map segment @i of the log at m->logp, as linked from its header.
+ * Caller holds famfs_log_mappings_mutex.
+ */
+static int
+famfs_log_map_seg(struct famfs_log_mapping *m, u32 i)
+{
+	const struct famfs_log *logp = m->logp;
+	const struct famfs_log_seg *seg = &famfs_log_packed(logp)->pl_segs[i];
+	int openmode = (m->prot & PROT_WRITE) ? O_RDWR : O_RDONLY;
+	/* Segment i is as long as everything before it */
+	u64 len = famfs_log_seg_end(logp, i);
+	u8 *dest = (u8 *)logp + len;
+	char path[PATH_MAX];
+	struct stat st;
+	u64 offset = 0;
+	void *addr;
+	int fd;
+	int rc;
+
+	if (seg->ls_len != len || !seg->ls_offset ||
+	    (seg->ls_offset & (FAMFS_ALLOC_UNIT - 1))) {
+		fprintf(stderr, "%s: invalid log segment %d (%lld at %lld)\n",
+			__func__, i, seg->ls_len, seg->ls_offset);
+		return -EINVAL;
+	}
+
+	if (m->raw) {
+		strncpy(path, m->path, PATH_MAX - 1);
+		path[PATH_MAX - 1] = '\0';
+		offset = seg->ls_offset;
+	} else {
+		rc = snprintf(path, sizeof(path), "%s/%s.%d",
+			      m->path, LOG_FILE_RELPATH, i + 1);
+		if (rc < 0 || (size_t)rc >= sizeof(path)) {
+			fprintf(stderr, "%s: path too long for log segment %d\n",
+				__func__, i);
+			return -ENAMETOOLONG;
+		}
+	}
+	fd = open(path, openmode, 0);
+	if (fd < 0) {
+		fprintf(stderr, "%s: failed to open %s for log segment %d\n",
+			__func__, path, i);
+		return -errno;
+	}
+	if (!m->raw && (fstat(fd, &st) || (u64)st.st_size != len)) {
+		fprintf(stderr, "%s: %s is not the size of log segment %d\n",
+			__func__, path, i);
+		close(fd);
+		return -EINVAL;
+	}
+
+	addr = mmap(dest, len, m->prot, MAP_SHARED | MAP_FIXED, fd, offset);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		fprintf(stderr, "%s: failed to mmap log segment %d from %s\n",
+			__func__, i, path);
+		/* A failed MAP_FIXED may have dropped the reservation */
+		mmap(dest, len, PROT_NONE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+		     -1, 0);
+		return -1;
+	}
+	invalidate_processor_cache(dest, len);
+	return 0;
+}
+
+/**
+ * famfs_log_follow_chain()
+ *
+ * Map any extension segments that were linked to the log after it was
+ * mapped. A log that was not mapped by famfs_log_map() (e.g. one that was
+ * read into a buffer) only ever covers the primary log.
+ *
+ * @logp: a log mapped by famfs_log_map()
+ *
+ * Returns the number of segments now mapped
+ */
+u32
+famfs_log_follow_chain(const struct famfs_log *logp)
+{
+	struct famfs_log_mapping *m;
+	u32 nsegs, i;
+
+	if (!famfs_log_is_packed(logp))
+		return 0;
+
+	pthread_mutex_lock(&famfs_log_mappings_mutex);
+	m = famfs_log_mapping_find(logp);
+	if (!m) {
+		pthread_mutex_unlock(&famfs_log_mappings_mutex);
+		return 0;
+	}
+	invalidate_processor_cache(famfs_log_packed(logp),
+				   sizeof(struct famfs_log_packed));
+	nsegs = famfs_log_nsegs(logp);
+	for (i = m->nsegs; i < nsegs; i++) {
+		if (famfs_log_map_seg(m, i))
+			break;
+		m->nsegs = i + 1;
+	}
+	nsegs = m->nsegs;
+	pthread_mutex_unlock(&famfs_log_mappings_mutex);
+	return nsegs;
+}
+
+/**
+ * famfs_log_mapped_len()
+ *
+ * Bytes of the log at @logp that can be read: the primary log and the
+ * segments that are mapped
+ */
+u64
+famfs_log_mapped_len(const struct famfs_log *logp)
+{
+	struct famfs_log_mapping *m;
+	u32 nsegs = 0;
+
+	pthread_mutex_lock(&famfs_log_mappings_mutex);
+	m = famfs_log_mapping_find(logp);
+	if (m)
+		nsegs = m->nsegs;
+	pthread_mutex_unlock(&famfs_log_mappings_mutex);
+	return famfs_log_seg_end(logp, nsegs);
+}
+
+/*
+ * famfs_log_map()
+ *
+ * Map the log (@len bytes of @fd at @offset) into address space with room
+ * for all of its segments, aligned for devdax, then map the segments that
+ * are linked. @path is where the segments come from: the daxdev if @raw,
+ * else the mount point (whose .meta/.log.<n> files map them).
+ *
+ * Returns the log, or NULL on failure; unmap it with famfs_unmap_log()
+ */
+static struct famfs_log *
+famfs_log_map(
+	int         fd,
+	u64         offset,
+	u64         len,
+	int         prot,
+	int         raw,
+	const char *path)
+{
+	size_t window = (size_t)len << FAMFS_LOG_MAX_SEGS;
+	size_t slop = FAMFS_ALLOC_UNIT;
+	struct famfs_log_mapping *m;
+	u8 *addr, *base;
+	void *logp;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+
+	addr = mmap(0, window + slop, PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (addr == MAP_FAILED) {
+		free(m);
+		return NULL;
+	}
+	base = (u8 *)(((uintptr_t)addr + slop - 1) & ~(uintptr_t)(slop - 1));
+	if (base > addr)
+		munmap(addr, base - addr);
+	if (addr + slop > base)
+		munmap(base + window, addr + slop - base);
+
+	logp = mmap(base, len, prot, MAP_SHARED | MAP_FIXED, fd, offset);
+	if (logp == MAP_FAILED) {
+		munmap(base, window);
+		free(m);
+		return NULL;
+	}
+
+	m->logp = logp;
+	m->window = window;
+	m->prot = prot;
+	m->raw = raw;
+	strncpy(m->path, path, PATH_MAX - 1);
+	pthread_mutex_lock(&famfs_log_mappings_mutex);
+	m->next = famfs_log_mappings;
+	famfs_log_mappings = m;
+	pthread_mutex_unlock(&famfs_log_mappings_mutex);
+
+	invalidate_processor_cache(logp, len);
+
+	/* (mkfs maps a log that has no valid header yet) */
+	if (famfs_log_is_packed(logp) &&
+	    ((struct famfs_log *)logp)->famfs_log_len == len &&
+	    ((struct famfs_log *)logp)->famfs_log_crc ==
+	    famfs_gen_log_header_crc(logp))
+		famfs_log_follow_chain(logp);
+	return logp;
+}
+
+/**
+ * famfs_log_read()
+ *
+ * The posix-read counterpart of famfs_log_map(), for readers that don't mmap
+ * the log: read the primary log (@len bytes of @fd), then each segment it has
+ * grown by from its meta file under the mount point @mpt, into a buffer laid
+ * out like a mapping. The buffer is a snapshot; there is no chain to follow
+ * after this.
+ *
+ * Returns the log, or NULL on failure; free it with famfs_unmap_log()
+ */
+static struct famfs_log *
+famfs_log_read(
+	int         fd,
+	u64         len,
+	const char *mpt,
+	int         verbose)
+{
+	size_t window = (size_t)len << FAMFS_LOG_MAX_SEGS;
+	const struct famfs_log_seg *seg;
+	struct famfs_log_mapping *m;
+	struct famfs_log *logp;
+	char path[PATH_MAX];
+	struct stat st;
+	u32 nsegs = 0;
+	u64 seglen;
+	int sfd;
+	u32 i;
+	int rc;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+	logp = mmap(0, window, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (logp == MAP_FAILED) {
+		free(m);
+		return NULL;
+	}
+
+	rc = famfs_file_read(fd, (char *)logp, len, __func__, "log file",
+			     verbose);
+	if (rc)
+		goto err_out;
+
+	if (famfs_log_is_packed(logp) && logp->famfs_log_len == len &&
+	    logp->famfs_log_crc == famfs_gen_log_header_crc(logp))
+		nsegs = famfs_log_nsegs(logp);
+
+	for (i = 0; i < nsegs; i++) {
+		seg = &famfs_log_packed(logp)->pl_segs[i];
+		seglen = famfs_log_seg_end(logp, i);
+		if (seg->ls_len != seglen) {
+			fprintf(stderr, "%s: invalid log segment %d (%lld "
+				"at %lld)\n", __func__, i, seg->ls_len,
+				seg->ls_offset);
+			goto err_out;
+		}
+		rc = snprintf(path, sizeof(path), "%s/%s.%d", mpt,
+			      LOG_FILE_RELPATH, i + 1);
+		if (rc < 0 || (size_t)rc >= sizeof(path)) {
+			fprintf(stderr, "%s: path too long for log segment "
+				"%d\n", __func__, i);
+			goto err_out;
+		}
+		sfd = open(path, O_RDONLY, 0);
+		if (sfd < 0) {
+			fprintf(stderr, "%s: failed to open %s for log "
+				"segment %d\n", __func__, path, i);
+			goto err_out;
+		}
+		if (fstat(sfd, &st) || (u64)st.st_size != seglen) {
+			fprintf(stderr, "%s: %s is not the size of log "
+				"segment %d\n", __func__, path, i);
+			close(sfd);
+			goto err_out;
+		}
+		rc = famfs_file_read(sfd, (char *)logp + seglen, seglen,
+				     __func__, "log segment", verbose);
+		close(sfd);
+		if (rc)
+			goto err_out;
+	}
+
+	m->logp = logp;
+	m->window = window;
+	m->nsegs = nsegs;
+	m->prot = PROT_READ;
+	strncpy(m->path, mpt, PATH_MAX - 1);
+	pthread_mutex_lock(&famfs_log_mappings_mutex);
+	m->next = famfs_log_mappings;
+	famfs_log_mappings = m;
+	pthread_mutex_unlock(&famfs_log_mappings_mutex);
+	return logp;
+
+err_out:
+	munmap(logp, window);
+	free(m);
+	return NULL;
+}
+
+/**
+ * famfs_unmap_log()
+ *
+ * Unmap a log, with any segments that are mapped. Logs that were not mapped
+ * by famfs_log_map() are unmapped at their famfs_log_len.
+ */
+void
+famfs_unmap_log(struct famfs_log *logp)
+{
+	struct famfs_log_mapping **mp, *m = NULL;
+	size_t len;
+
+	pthread_mutex_lock(&famfs_log_mappings_mutex);
+	for (mp = &famfs_log_mappings; *mp; mp = &(*mp)->next) {
+		if ((*mp)->logp == logp) {
+			m = *mp;
+			*mp = m->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&famfs_log_mappings_mutex);
+
+	if (m) {
+		len = m->window;
+		free(m);
+	} else {
+		len = logp->famfs_log_len;
+	}
+	munmap(logp, len);
+}
+
 /**
  * famfs_mmap_superblock_and_log_raw()
  *
@@ -839,6 +1234,8 @@ famfs_fsck_scan(
  *   valid superblock
  * * If log_size>0 (and is a multiple of 2MiB), we attempt to map log_size
  *   from offset FAMFS_LOG_OFFSET into the device.
+ * Segments that the log has grown by are mapped after it; unmap the log
+ * with famfs_unmap_log().
  *
  * The superblock is not validated - UNLESS we need to get the log size from it,
  * in which case we must validate the superblock.
@@ -913,7 +1310,6 @@ famfs_mmap_superblock_and_log_raw(
 	 *   we only map the log if there is a valid superblock
 	 */
 	if (logp) {
-		void *addr;
 		u64 lsize = log_size;
 
 		/* Special case: if the log_size arg==0, we figure out the
@@ -930,15 +1326,14 @@ famfs_mmap_superblock_and_log_raw(
 			lsize = sb->ts_log_len;
 		}
 
-		/* Map log */
-		addr = mmap(0, lsize, mapmode, MAP_SHARED, fd, FAMFS_LOG_OFFSET);
-		if (addr == MAP_FAILED) {
+		/* Map log (and any segments it has grown by) */
+		*logp = famfs_log_map(fd, FAMFS_LOG_OFFSET, lsize, mapmode,
+				      1 /* raw */, devname);
+		if (!*logp) {
 			fprintf(stderr, "Failed to mmap log from %s\n", devname);
 			rc = -1;
 			goto err_out;
 		}
-		*logp = (struct famfs_log *)addr;
-		invalidate_processor_cache(*logp, lsize);
 	}
 
 out:
@@ -954,6 +1349,42 @@ err_out:
 	return rc;
 }
 
+/**
+ * famfs_mmap_log_raw_ro()
+ *
+ * Map the superblock and log of a raw dax device read-only. Unlike
+ * famfs_mmap_superblock_and_log_raw(), this fails if there is no valid
+ * superblock (and therefore no log size). The log is mapped with length
+ * (*logp)->famfs_log_len, plus any segments it has grown by; unmap it with
+ * famfs_unmap_log().
+ *
+ * @devname: dax device name
+ * @sbp:     superblock is returned here
+ * @logp:    log is returned here
+ */
+int
+famfs_mmap_log_raw_ro(
+	const char *devname,
+	struct famfs_superblock **sbp,
+	struct famfs_log **logp)
+{
+	int rc;
+
+	*logp = NULL;
+	rc = famfs_mmap_superblock_and_log_raw(devname, sbp, logp, 0, 1);
+	if (rc)
+		return rc;
+
+	if (!*logp) {
+		fprintf(stderr, "%s: no valid superblock on %s\n",
+			__func__, devname);
+		munmap(*sbp, FAMFS_SUPERBLOCK_SIZE);
+		*sbp = NULL;
+		return -EINVAL;
+	}
+	return 0;
+}
+
 int
 famfs_check_super(
 	const struct famfs_superblock *sb,
@@ -983,6 +1414,18 @@ famfs_check_super(
 		return -1;
 	}
 
+	if (sb->ts_omf_ver_major > FAMFS_OMF_VER_MAJOR ||
+	    (sb->ts_omf_ver_major == FAMFS_OMF_VER_MAJOR &&
+	     sb->ts_omf_ver_minor > FAMFS_OMF_VER_MINOR)) {
+		fprintf(stderr, "%s: superblock OMF version=%d.%d (supported "
+			"up to %d.%d).\n"
+			"\tThis famfs_lib cannot read the log of your "
+			"famfs instance\n", __func__, sb->ts_omf_ver_major,
+			sb->ts_omf_ver_minor, FAMFS_OMF_VER_MAJOR,
+			FAMFS_OMF_VER_MINOR);
+		return 1; /* rc=1: SB may be valid, but is the wrong version */
+	}
+
 	if (sb->ts_alloc_unit != 4096 && sb->ts_alloc_unit != 0x200000) {
 		fprintf(stderr, "%s: invalid alloc unit in superblock: %lld\n",
 			__func__, sb->ts_alloc_unit);
@@ -1281,14 +1724,14 @@ __famfs_mkmeta_superblock(
 	return 0;
 }
 
-/**
- * __famfs_mkmeta_log()
- *
- * Create a famfs metadata log meta file
+/*
+ * Create the meta file .meta/<name> for log space at @log_offset: the log,
+ * or one of its segments
  */
-int
-__famfs_mkmeta_log(
+static int
+famfs_mkmeta_logfile(
 	const char *mpt,
+	const char *name,
 	u64 log_offset,
 	u64 log_size,
 	enum famfs_system_role role,
@@ -1303,8 +1746,6 @@ __famfs_mkmeta_log(
 	int logfd;
 	int rc;
 
-	assert(log_offset == 0x200000);
-
 	strncat(dirpath, mpt,     PATH_MAX - 1);
 	strncat(dirpath, "/",     PATH_MAX - 1);
 	strncat(dirpath, ".meta", PATH_MAX - 1);
@@ -1318,8 +1759,12 @@ __famfs_mkmeta_log(
 	}
 
 	/* Prepare full path for log file */
-	strncpy(log_file, dirpath, PATH_MAX - 1);
-	strncat(log_file, "/.log", PATH_MAX - 1);
+	rc = snprintf(log_file, sizeof(log_file), "%s/%s", dirpath, name);
+	if (rc < 0 || (size_t)rc >= sizeof(log_file)) {
+		fprintf(stderr, "%s: path too long: %s/%s\n",
+			__func__, dirpath, name);
+		return -ENAMETOOLONG;
+	}
 
 	/* Check if log file already exists, and cleanup if bad */
 	rc = stat(log_file, &st);
@@ -1374,7 +1819,17 @@ __famfs_mkmeta_log(
 			return -1;
 		}
 
-		if (file_has_v1_map(logfd)) {
+		if (mock_kmod) {
+			/* Nothing behind the file; it holds the log */
+			rc = ftruncate(logfd, log_size);
+			if (rc) {
+				fprintf(stderr,
+					"%s: failed to size log file %s\n",
+					__func__, log_file);
+				close(logfd);
+				return -1;
+			}
+		} else if (file_has_v1_map(logfd)) {
 			fprintf(stderr,
 				"%s: found valid log file; doing nothing\n",
 				__func__);
@@ -1398,6 +1853,138 @@ __famfs_mkmeta_log(
 	return 0;
 }
 
+/**
+ * __famfs_mkmeta_log()
+ *
+ * Create a famfs metadata log meta file
+ */
+int
+__famfs_mkmeta_log(
+	const char *mpt,
+	u64 log_offset,
+	u64 log_size,
+	enum famfs_system_role role,
+	int shadow,
+	int verbose)
+{
+	assert(log_offset == 0x200000);
+
+	return famfs_mkmeta_logfile(mpt, ".log", log_offset, log_size, role,
+				    shadow, verbose);
+}
+
+/**
+ * __famfs_mkmeta_log_segs()
+ *
+ * Create the meta files for the segments a log has grown by
+ * (.meta/.log.1 etc.; see struct famfs_log_packed) that don't exist yet.
+ *
+ * @mpt:    Where the meta files go (the shadow root, if @shadow)
+ * @logp:   The log; only its header is used
+ *
+ * Returns the number of meta files created, or a negative errno
+ */
+int
+__famfs_mkmeta_log_segs(
+	const char *mpt,
+	const struct famfs_log *logp,
+	enum famfs_system_role role,
+	int shadow,
+	int verbose)
+{
+	const struct famfs_log_seg *seg;
+	char log_file[PATH_MAX];
+	char name[NAME_MAX];
+	struct stat st;
+	int created = 0;
+	u32 i;
+	int rc;
+
+	for (i = 0; i < famfs_log_nsegs(logp); i++) {
+		seg = &famfs_log_packed(logp)->pl_segs[i];
+		snprintf(name, sizeof(name), ".log.%d", i + 1);
+		rc = snprintf(log_file, sizeof(log_file), "%s/.meta/%s",
+			      mpt, name);
+		if (rc < 0 || (size_t)rc >= sizeof(log_file)) {
+			fprintf(stderr, "%s: path too long: %s/.meta/%s\n",
+				__func__, mpt, name);
+			return -ENAMETOOLONG;
+		}
+		if (stat(log_file, &st) == 0)
+			continue;
+
+		rc = famfs_mkmeta_logfile(mpt, name, seg->ls_offset,
+					  seg->ls_len, role, shadow, verbose);
+		if (rc)
+			return rc;
+		created++;
+	}
+	return created;
+}
+
+/**
+ * famfs_mkmeta_log_segs()
+ *
+ * Create any missing log segment meta files in a mounted famfs (in the
+ * shadow tree, if it is a fuse mount), from the log header.
+ *
+ * @mpt: mount point
+ *
+ * Returns the number of meta files created, or a negative errno
+ */
+int
+famfs_mkmeta_log_segs(
+	const char *mpt,
+	enum famfs_system_role role,
+	int verbose)
+{
+	char log_file[PATH_MAX];
+	char shadow[PATH_MAX];
+	char *shadow_root = NULL;
+	struct famfs_log *logp;
+	size_t log_size;
+	int rc;
+
+	rc = snprintf(log_file, sizeof(log_file), "%s/%s", mpt,
+		      LOG_FILE_RELPATH);
+	if (rc < 0 || (size_t)rc >= sizeof(log_file)) {
+		fprintf(stderr, "%s: path too long: %s/%s\n",
+			__func__, mpt, LOG_FILE_RELPATH);
+		return -ENAMETOOLONG;
+	}
+	rc = 0;
+	logp = famfs_mmap_whole_file(log_file, 1 /* read only */, &log_size);
+	if (!logp)
+		return -ENOENT;
+	invalidate_processor_cache(logp, sizeof(*logp) +
+				   sizeof(struct famfs_log_packed));
+
+	/* No segments (or no usable header) means nothing to do */
+	if (log_size != logp->famfs_log_len ||
+	    logp->famfs_log_crc != famfs_gen_log_header_crc(logp) ||
+	    !famfs_log_nsegs(logp))
+		goto out;
+
+	if (file_is_famfs(log_file) == FAMFS_FUSE) {
+		if (famfs_path_is_mount_pt(mpt, NULL, shadow))
+			shadow_root = famfs_get_shadow_root(shadow, verbose);
+		if (!shadow_root) {
+			fprintf(stderr, "%s: failed to get shadow path\n",
+				__func__);
+			rc = -1;
+			goto out;
+		}
+		rc = __famfs_mkmeta_log_segs(shadow_root, logp, role,
+					     1 /* shadow */, verbose);
+	} else {
+		rc = __famfs_mkmeta_log_segs(mpt, logp, role, 0, verbose);
+	}
+out:
+	free(shadow_root);
+	munmap(logp, log_size);
+	return rc;
+}
+
 /**
  * famfs_mkmeta()
  *
@@ -1486,11 +2073,20 @@ famfs_mkmeta_standalone(
 		goto out;
 	}
 
-out:
-	if (sb)
-		munmap(sb, FAMFS_SUPERBLOCK_SIZE);
-	if (mpt)
-		free(mpt);
+	/* ...and for any segments the log has grown by */
+	rc = famfs_mkmeta_log_segs(mpt, role, verbose);
+	if (rc < 0) {
+		fprintf(stderr, "%s: failed to create log segment meta files\n",
+			__func__);
+		goto out;
+	}
+	rc = 0;
+
+out:
+	if (sb)
+		munmap(sb, FAMFS_SUPERBLOCK_SIZE);
+	if (mpt)
+		free(mpt);
 	return rc;
 }
 
@@ -1597,7 +2193,9 @@ famfs_print_log_stats(
 static inline int
 famfs_log_full(const struct famfs_log *logp)
 {
-	return (logp->famfs_log_next_index > logp->famfs_log_last_index);
+	if (famfs_log_is_packed(logp))
+		return (log_slots_available(logp) == 0);
+	return (logp->famfs_log_next_index >= famfs_log_entry_limit(logp));
 }
 
 static inline int
@@ -1619,7 +2217,8 @@ famfs_validate_log_header(const struct famfs_log *logp)
 {
 	unsigned long crc = famfs_gen_log_header_crc(logp);
 
-	if (logp->famfs_log_magic != FAMFS_LOG_MAGIC) {
+	if (logp->famfs_log_magic != FAMFS_LOG_MAGIC &&
+	    logp->famfs_log_magic != FAMFS_LOG_MAGIC_PACKED) {
 		fprintf(stderr, "%s: bad magic number in log header\n",
 			__func__);
 		return -1;
@@ -1668,6 +2267,542 @@ retry_once:
 	return errors;
 }
 
+/*
+ * Log iterator
+ *
+ * Every reader of the log walks it with a famfs_log_iter, which hides
+ * whether the log has been compacted: the records of a checkpoint come out
+ * as the log entries they replaced, followed by the entries logged since.
+ */
+
+static u32
+famfs_ckpt_crc(const u8 *buf, u64 len)
+{
+	return crc32(crc32(0L, Z_NULL, 0), buf, len);
+}
+
+/* Bytes needed to record @le in a checkpoint (0 if it has no record) */
+static size_t
+famfs_log_rec_size(const struct famfs_log_entry *le)
+{
+	const struct famfs_log_fmap *fmap = &le->famfs_fm.fm_fmap;
+	size_t len = sizeof(struct famfs_log_rec);
+
+	switch (le->famfs_log_entry_type) {
+	case FAMFS_LOG_FILE:
+		if (fmap->fmap_ext_type == FAMFS_EXT_INTERLEAVE)
+			len += sizeof(u64) + (fmap->fmap_niext ?
+				fmap->ie[0].ie_nstrips : 0) *
+				sizeof(struct famfs_simple_extent);
+		else
+			len += fmap->fmap_nextents *
+				sizeof(struct famfs_simple_extent);
+		len += strnlen(le->famfs_fm.fm_relpath, FAMFS_MAX_PATHLEN);
+		break;
+	case FAMFS_LOG_MKDIR:
+		len += strnlen((const char *)le->famfs_md.md_relpath,
+			       FAMFS_MAX_PATHLEN);
+		break;
+	case FAMFS_LOG_ADD_DAXDEV:
+		len += sizeof(uuid_le);
+		break;
+	case FAMFS_LOG_CHECKPOINT:
+		len += sizeof(struct famfs_log_checkpoint);
+		break;
+	default:
+		return 0;
+	}
+	return (len + FAMFS_LOG_REC_ALIGN - 1) & ~(size_t)(FAMFS_LOG_REC_ALIGN - 1);
+}
+
+/* Encode @le at @buf, which has famfs_log_rec_size(le) zeroed bytes */
+static void
+famfs_log_rec_encode(const struct famfs_log_entry *le, u8 *buf)
+{
+	struct famfs_log_rec *lr = (struct famfs_log_rec *)buf;
+	u8 *p = buf + sizeof(*lr);
+
+	lr->lr_len = famfs_log_rec_size(le);
+	lr->lr_type = le->famfs_log_entry_type;
+
+	switch (le->famfs_log_entry_type) {
+	case FAMFS_LOG_FILE: {
+		const struct famfs_log_file_meta *fm = &le->famfs_fm;
+		const struct famfs_log_fmap *fmap = &fm->fm_fmap;
+		const struct famfs_simple_extent *se = fmap->se;
+		u64 chunk = 0;
+
+		lr->lr_ext_type = fmap->fmap_ext_type;
+		lr->lr_nextents = fmap->fmap_nextents;
+		if (fmap->fmap_ext_type == FAMFS_EXT_INTERLEAVE) {
+			lr->lr_nextents = 0;
+			if (fmap->fmap_niext) {
+				chunk = fmap->ie[0].ie_chunk_size;
+				lr->lr_nextents = fmap->ie[0].ie_nstrips;
+				se = fmap->ie[0].ie_strips;
+			}
+			memcpy(p, &chunk, sizeof(chunk));
+			p += sizeof(chunk);
+		}
+		memcpy(p, se, lr->lr_nextents * sizeof(*se));
+		p += lr->lr_nextents * sizeof(*se);
+
+		lr->lr_pathlen = strnlen(fm->fm_relpath, FAMFS_MAX_PATHLEN);
+		memcpy(p, fm->fm_relpath, lr->lr_pathlen);
+		lr->lr_flags = fm->fm_flags;
+		lr->lr_uid = fm->fm_uid;
+		lr->lr_gid = fm->fm_gid;
+		lr->lr_mode = fm->fm_mode;
+		lr->lr_size = fm->fm_size;
+		break;
+	}
+	case FAMFS_LOG_MKDIR: {
+		const struct famfs_log_mkdir *md = &le->famfs_md;
+
+		lr->lr_pathlen = strnlen((const char *)md->md_relpath,
+					 FAMFS_MAX_PATHLEN);
+		memcpy(p, md->md_relpath, lr->lr_pathlen);
+		lr->lr_uid = md->md_uid;
+		lr->lr_gid = md->md_gid;
+		lr->lr_mode = md->md_mode;
+		break;
+	}
+	case FAMFS_LOG_ADD_DAXDEV: {
+		const struct famfs_log_add_daxdev *dd = &le->famfs_dd;
+
+		lr->lr_pathlen = sizeof(dd->dd_uuid);
+		memcpy(p, &dd->dd_uuid, sizeof(dd->dd_uuid));
+		lr->lr_flags = dd->dd_index;
+		lr->lr_size = dd->dd_size;
+		break;
+	}
+	case FAMFS_LOG_CHECKPOINT:
+		memcpy(p, &le->famfs_ck, sizeof(le->famfs_ck));
+		break;
+	}
+}
+
+/*
+ * Expand the checkpoint record at @p into @le.
+ *
+ * Returns the record length, or -1 if it is malformed
+ */
+static int
+famfs_log_rec_decode(
+	const u8 *p,
+	const u8 *end,
+	struct famfs_log_entry *le)
+{
+	const struct famfs_log_rec *lr = (const struct famfs_log_rec *)p;
+	const u8 *q = p + sizeof(*lr);
+	size_t need = sizeof(*lr);
+
+	if ((size_t)(end - p) < sizeof(*lr) || lr->lr_len < sizeof(*lr) ||
+	    lr->lr_len > (size_t)(end - p) || lr->lr_len % FAMFS_LOG_REC_ALIGN)
+		return -1;
+
+	memset(le, 0, sizeof(*le));
+	le->famfs_log_entry_type = lr->lr_type;
+
+	switch (lr->lr_type) {
+	case FAMFS_LOG_FILE: {
+		struct famfs_log_file_meta *fm = &le->famfs_fm;
+		struct famfs_log_fmap *fmap = &fm->fm_fmap;
+		struct famfs_simple_extent *se = fmap->se;
+		int interleave = (lr->lr_ext_type == FAMFS_EXT_INTERLEAVE);
+
+		need += (interleave ? sizeof(u64) : 0) + lr->lr_pathlen +
+			lr->lr_nextents * sizeof(*se);
+		if (need > lr->lr_len || lr->lr_pathlen >= FAMFS_MAX_PATHLEN ||
+		    lr->lr_nextents > FAMFS_MAX_SIMPLE_EXTENTS)
+			return -1;
+
+		fmap->fmap_ext_type = lr->lr_ext_type;
+		if (interleave) {
+			memcpy(&fmap->ie[0].ie_chunk_size, q, sizeof(u64));
+			q += sizeof(u64);
+			fmap->fmap_niext = 1;
+			fmap->ie[0].ie_nstrips = lr->lr_nextents;
+			se = fmap->ie[0].ie_strips;
+		} else {
+			fmap->fmap_nextents = lr->lr_nextents;
+		}
+		memcpy(se, q, lr->lr_nextents * sizeof(*se));
+		q += lr->lr_nextents * sizeof(*se);
+		memcpy(fm->fm_relpath, q, lr->lr_pathlen);
+
+		fm->fm_flags = lr->lr_flags;
+		fm->fm_uid = lr->lr_uid;
+		fm->fm_gid = lr->lr_gid;
+		fm->fm_mode = lr->lr_mode;
+		fm->fm_size = lr->lr_size;
+		break;
+	}
+	case FAMFS_LOG_MKDIR: {
+		struct famfs_log_mkdir *md = &le->famfs_md;
+
+		need += lr->lr_pathlen;
+		if (need > lr->lr_len || lr->lr_pathlen >= FAMFS_MAX_PATHLEN)
+			return -1;
+		memcpy(md->md_relpath, q, lr->lr_pathlen);
+		md->md_uid = lr->lr_uid;
+		md->md_gid = lr->lr_gid;
+		md->md_mode = lr->lr_mode;
+		break;
+	}
+	case FAMFS_LOG_ADD_DAXDEV: {
+		struct famfs_log_add_daxdev *dd = &le->famfs_dd;
+
+		need += sizeof(dd->dd_uuid);
+		if (need > lr->lr_len || lr->lr_pathlen != sizeof(dd->dd_uuid))
+			return -1;
+		memcpy(&dd->dd_uuid, q, sizeof(dd->dd_uuid));
+		dd->dd_index = lr->lr_flags;
+		dd->dd_size = lr->lr_size;
+		break;
+	}
+	case FAMFS_LOG_CHECKPOINT:
+		need += sizeof(le->famfs_ck);
+		if (need > lr->lr_len)
+			return -1;
+		memcpy(&le->famfs_ck, q, sizeof(le->famfs_ck));
+		break;
+	default:
+		return -1;
+	}
+	return lr->lr_len;
+}
+
+/* Bytes of a packed log entry for @le */
+static size_t
+famfs_log_prec_size(const struct famfs_log_entry *le)
+{
+	return offsetof(struct famfs_log_prec, pr_rec) + famfs_log_rec_size(le);
+}
+
+static u32
+famfs_log_prec_crc(const struct famfs_log_prec *pr)
+{
+	u32 crc = crc32(0L, Z_NULL, 0);
+
+	crc = crc32(crc, (const unsigned char *)&pr->pr_seqnum,
+		    sizeof(pr->pr_seqnum));
+	return crc32(crc, (const unsigned char *)&pr->pr_rec,
+		     pr->pr_rec.lr_len);
+}
+
+/*
+ * Check the packed entry at @pr, which must end by @end.
+ *
+ * Returns its length, or -1 if it is not a valid entry
+ */
+static int
+famfs_log_prec_check(const struct famfs_log_prec *pr, const u8 *end)
+{
+	size_t avail = end - (const u8 *)pr;
+	size_t len;
+
+	if ((const u8 *)pr > end || avail < sizeof(*pr))
+		return -1;
+	len = offsetof(struct famfs_log_prec, pr_rec) + pr->pr_rec.lr_len;
+	if (pr->pr_rec.lr_len < sizeof(pr->pr_rec) || len > avail)
+		return -1;
+	if (famfs_log_prec_crc(pr) != pr->pr_crc)
+		return -1;
+	return len;
+}
+
+/* Encode @le (with its seqnum) as a packed entry at @buf, which has
+ * famfs_log_prec_size(le) zeroed bytes */
+static void
+famfs_log_prec_encode(const struct famfs_log_entry *le, u8 *buf)
+{
+	struct famfs_log_prec *pr = (struct famfs_log_prec *)buf;
+
+	pr->pr_seqnum = le->famfs_log_entry_seqnum;
+	famfs_log_rec_encode(le, (u8 *)&pr->pr_rec);
+	pr->pr_crc = famfs_log_prec_crc(pr);
+}
+
+/* The end of the space for packed log entries that is mapped */
+static const u8 *
+famfs_log_packed_end(const struct famfs_log *logp)
+{
+	return (const u8 *)logp + famfs_log_mapped_len(logp);
+}
+
+void
+famfs_log_iter_init(struct famfs_log_iter *it, const struct famfs_log *logp)
+{
+	memset(it, 0, sizeof(*it));
+	it->logp = logp;
+	it->len = famfs_log_mapped_len(logp);
+	if (famfs_log_is_packed(logp))
+		it->pos = famfs_log_packed(logp)->pl_entries;
+}
+
+/* Take on log segments that were linked since @it last looked. Returns
+ * nonzero if more of the log can be read now. */
+static int
+famfs_log_iter_extend(struct famfs_log_iter *it)
+{
+	u64 len;
+
+	if (!famfs_log_is_packed(it->logp))
+		return 0;
+	famfs_log_follow_chain(it->logp);
+	len = famfs_log_mapped_len(it->logp);
+	if (len <= it->len)
+		return 0;
+	it->len = len;
+	return 1;
+}
+
+/* Check the snapshot region of the checkpoint at the start of the log */
+static int
+famfs_log_iter_load_ckpt(struct famfs_log_iter *it)
+{
+	const u8 *base = (const u8 *)it->logp;
+	const struct famfs_log_checkpoint *ck = &it->ck;
+	u64 first = offsetof(struct famfs_log, entries) +
+		sizeof(struct famfs_log_entry);
+	int retries = 1;
+
+	while (ck->ck_len > it->len || ck->ck_offset > it->len - ck->ck_len) {
+		if (!famfs_log_iter_extend(it)) {
+			fprintf(stderr, "%s: checkpoint region out of bounds\n",
+				__func__);
+			return -1;
+		}
+	}
+	if (ck->ck_offset < first) {
+		fprintf(stderr, "%s: checkpoint region out of bounds\n",
+			__func__);
+		return -1;
+	}
+
+	/* As with log entries: a stale cache line can make it look bad */
+	while (famfs_ckpt_crc(base + ck->ck_offset, ck->ck_len) != ck->ck_crc) {
+		if (!retries--) {
+			fprintf(stderr, "%s: bad checkpoint crc\n", __func__);
+			return -1;
+		}
+		invalidate_processor_cache(base + ck->ck_offset, ck->ck_len);
+	}
+
+	it->ck_pos = base + ck->ck_offset;
+	it->ck_end = it->ck_pos + ck->ck_len;
+	it->ck_pending = 0;
+	return 0;
+}
+
+/*
+ * Read the packed entry at it->pos into @le.
+ *
+ * Returns its length, or -1 if it is invalid
+ */
+static int
+famfs_log_iter_read_packed(
+	struct famfs_log_iter *it,
+	struct famfs_log_entry *le)
+{
+	const struct famfs_log *logp = it->logp;
+	const struct famfs_log_prec *pr = (const struct famfs_log_prec *)it->pos;
+	const u8 *end = (const u8 *)logp + it->len;
+	int retries = 1;
+	int len;
+
+	/* Same as famfs_validate_log_entry(): retry once past a stale
+	 * cache line */
+	while ((len = famfs_log_prec_check(pr, end)) < 0) {
+		/* It may run into a segment that was linked since */
+		if (famfs_log_iter_extend(it)) {
+			end = (const u8 *)logp + it->len;
+			continue;
+		}
+		if (!retries--) {
+			if (famfs_log_seg_end(logp, famfs_log_nsegs(logp)) >
+			    it->len)
+				fprintf(stderr,
+					"%s: log entry %lld is in a log "
+					"segment that is not mapped\n",
+					__func__, it->index);
+			else
+				fprintf(stderr,
+					"%s: bad packed log entry at index "
+					"%lld\n", __func__, it->index);
+			return -1;
+		}
+		invalidate_processor_cache(pr, MIN(FAMFS_LOG_PREC_MAX,
+						   (size_t)(end - it->pos)));
+	}
+	if (famfs_log_rec_decode((const u8 *)&pr->pr_rec, it->pos + len,
+				 le) < 0) {
+		fprintf(stderr, "%s: bad packed log entry at index %lld\n",
+			__func__, it->index);
+		return -1;
+	}
+	le->famfs_log_entry_seqnum = pr->pr_seqnum;
+	return len;
+}
+
+/**
+ * famfs_log_iter_next()
+ *
+ * @it: iterator
+ * @le: the next entry is copied out here (validated)
+ *
+ * Returns 1 if an entry was returned, 0 at the end of the log, or -1 if the
+ * next entry (or the checkpoint) is invalid. The iterator does not move past
+ * an invalid entry, since it may just not be visible yet; the caller can
+ * retry later, or step over it with famfs_log_iter_skip().
+ */
+int
+famfs_log_iter_next(struct famfs_log_iter *it, struct famfs_log_entry *le)
+{
+	const struct famfs_log *logp = it->logp;
+	int packed = famfs_log_is_packed(logp);
+	int len = 0;
+
+again:
+	if (it->ck_pending && famfs_log_iter_load_ckpt(it))
+		return -1;
+
+	if (it->ck_pos) {
+		if (it->ck_pos < it->ck_end) {
+			len = famfs_log_rec_decode(it->ck_pos, it->ck_end, le);
+			if (len < 0 ||
+			    le->famfs_log_entry_type == FAMFS_LOG_CHECKPOINT) {
+				fprintf(stderr,
+					"%s: bad checkpoint record %lld\n",
+					__func__, it->nread);
+				return -1;
+			}
+			le->famfs_log_entry_seqnum = it->seq_base;
+			it->ck_pos += len;
+			it->nread++;
+			return 1;
+		}
+		it->ck_pos = NULL;
+	}
+
+	if (it->index >= logp->famfs_log_next_index || (packed && !it->pos))
+		return 0;
+
+	if (packed) {
+		len = famfs_log_iter_read_packed(it, le);
+		if (len < 0)
+			return -1;
+	} else {
+		*le = logp->entries[it->index];
+	}
+
+	/* The one entry whose seqnum is not implied by its index */
+	if (it->index == 0 &&
+	    le->famfs_log_entry_type == FAMFS_LOG_CHECKPOINT) {
+		if (!packed &&
+		    famfs_validate_log_entry(le, le->famfs_log_entry_seqnum))
+			return -1;
+		it->seq_base = le->famfs_log_entry_seqnum;
+		it->ck = le->famfs_ck;
+		it->have_ck = 1;
+		it->ck_pending = 1;
+		it->index = 1;
+		if (packed)
+			it->pos += len;
+		goto again;
+	}
+
+	if (packed) {
+		/* The seqnum is covered by the entry's crc */
+		if (le->famfs_log_entry_seqnum != it->seq_base + it->index) {
+			fprintf(stderr, "%s: bad seqnum; expect %lld found %lld\n",
+				__func__, it->seq_base + it->index,
+				le->famfs_log_entry_seqnum);
+			return -1;
+		}
+		it->pos += len;
+	} else if (famfs_validate_log_entry(le, it->seq_base + it->index)) {
+		return -1;
+	}
+	it->index++;
+
+	/* A compaction in progress appends its checkpoint before moving it
+	 * to the front (see __famfs_log_compact()); what it stands for has
+	 * already been read */
+	if (le->famfs_log_entry_type == FAMFS_LOG_CHECKPOINT)
+		goto again;
+	it->nread++;
+	return 1;
+}
+
+/* Step over whatever famfs_log_iter_next() failed on */
+void
+famfs_log_iter_skip(struct famfs_log_iter *it)
+{
+	if (it->ck_pending)
+		it->ck_pending = 0;    /* the whole checkpoint */
+	else if (it->ck_pos)
+		it->ck_pos = NULL;     /* the rest of the checkpoint */
+	else if (it->pos)
+		it->pos = NULL;        /* the length of a bad packed entry can't
+					* be trusted, so that is the end */
+	else
+		it->index++;
+}
+
+/**
+ * famfs_log_iter_invalidate()
+ *
+ * For readers that follow a live log: invalidate the processor cache for
+ * the next entry, before famfs_log_iter_next(). (Checkpoint records are
+ * checked against the checkpoint crc instead.)
+ */
+void
+famfs_log_iter_invalidate(const struct famfs_log_iter *it)
+{
+	const struct famfs_log *logp = it->logp;
+	const u8 *end;
+
+	if (it->ck_pos || it->index >= logp->famfs_log_next_index)
+		return;
+	if (!famfs_log_is_packed(logp)) {
+		invalidate_processor_cache(&logp->entries[it->index],
+					   sizeof(logp->entries[0]));
+		return;
+	}
+	if (!it->pos)
+		return;
+	end = (const u8 *)logp + it->len;
+	if (it->pos < end)
+		invalidate_processor_cache(it->pos,
+					   MIN(FAMFS_LOG_PREC_MAX,
+					       (size_t)(end - it->pos)));
+}
+
+/**
+ * famfs_log_iter_stale()
+ *
+ * For readers that follow a live log: returns nonzero if the log has been
+ * compacted since @it started, in which case the reader should start over
+ * with a new iterator. The caller has invalidated famfs_log_next_index.
+ */
+int
+famfs_log_iter_stale(const struct famfs_log_iter *it)
+{
+	const struct famfs_log *logp = it->logp;
+	const u64 *seqnum = &logp->entries[0].famfs_log_entry_seqnum;
+
+	if (!it->index)
+		return 0;
+	if (famfs_log_is_packed(logp))
+		seqnum = &((const struct famfs_log_prec *)
+			   famfs_log_packed(logp)->pl_entries)->pr_seqnum;
+	invalidate_processor_cache(seqnum, sizeof(*seqnum));
+	return (*seqnum != it->seq_base ||
+		logp->famfs_log_next_index < it->index);
+}
+
 /**
  * __famfs_logplay()
  *
@@ -1700,9 +2835,11 @@ __famfs_logplay(
 {
 
 	struct famfs_log_stats ls = { 0 };
+	struct famfs_log_entry le;
+	struct famfs_log_iter it;
 	char *shadow_root = NULL;
 	int bad_entries = 0;
-	u64 i, j;
+	u64 j;
 	int rc;
 
 	if (role == FAMFS_NOSUPER) {
@@ -1736,20 +2873,26 @@ __famfs_logplay(
 		printf("%s: log contains %lld entries\n",
 		       __func__, logp->famfs_log_next_index);
 
-	for (i = 0; i < logp->famfs_log_next_index; i++) {
-		struct famfs_log_entry le = logp->entries[i];
-
-		if (famfs_validate_log_entry(&le, i)) {
+	famfs_log_iter_init(&it, logp);
+	while ((rc = famfs_log_iter_next(&it, &le)) != 0) {
+		if (rc < 0) {
 			fprintf(stderr,
 				"%s: Error: invalid log entry at index "
 				"%lld of %lld\n",
-				__func__, i, logp->famfs_log_next_index);
+				__func__, it.index, logp->famfs_log_next_index);
 			bad_entries = 1;
 			return -1;
 		}
 		ls.n_entries++;
 
-		famfs_dump_logentry(&le, i, __func__, verbose);
+		famfs_dump_logentry(&le, it.nread - 1, __func__, verbose);
+
+		if (shadow) {
+			famfs_shadow_logplay_entry(shadow_root, &le, &ls,
+						   dry_run, shadowtest,
+						   verbose);
+			continue;
+		}
 
 		switch (le.famfs_log_entry_type) {
 		case FAMFS_LOG_FILE: {
@@ -1794,21 +2937,6 @@ __famfs_logplay(
 			if (skip_file)
 				continue;
 
-			if (shadow) {
-				/* For shadow logplay, file path is based on
-				 * shadow_root, which may not match mpt
-				 */
-				snprintf(fullpath, PATH_MAX - 1, "%s/%s",
-					 shadow_root,
-					 fm->fm_relpath);
-				realpath(fullpath, rpath);
-
-				famfs_shadow_file_create(rpath, fm, &ls,
-							 dry_run,
-							 shadowtest, verbose);
-				continue;
-			}
-
 			/* Get the rationalized full path */
 			snprintf(fullpath, PATH_MAX - 1, "%s/%s", mpt,
 				 fm->fm_relpath);
@@ -1932,8 +3060,7 @@ bad_log_fmap:
 			if (dry_run)
 				continue;
 
-			snprintf(fullpath, PATH_MAX - 1, "%s/%s",
-				 shadow ? shadow_root : mpt,
+			snprintf(fullpath, PATH_MAX - 1, "%s/%s", mpt,
 				 md->md_relpath);
 			realpath(fullpath, rpath);
 
@@ -1972,8 +3099,7 @@ bad_log_fmap:
 				printf("%s: creating directory %s\n",
 				       __func__, md->md_relpath);
 
-			rc = famfs_dir_create(shadow ? shadow_root : mpt,
-					      (char *)md->md_relpath,
+			rc = famfs_dir_create(mpt, (char *)md->md_relpath,
 					      md->md_mode,
 					      md->md_uid, md->md_gid);
 			if (rc) {
@@ -2199,7 +3325,7 @@ out_umount:
 	if (fd > 0)
 		close(fd);
 	if (logp)
-		munmap(logp, log_size);
+		famfs_unmap_log(logp);
 	if (mpt_out) {
 		int umountrc = famfs_umount(mpt_out);
 
@@ -2305,20 +3431,22 @@ famfs_logplay(
 			close(sfd);
 			return -1;
 		}
-		
-		logp = mmap(0, log_size, PROT_READ, MAP_PRIVATE, lfd, 0);
-		if (logp == MAP_FAILED) {
+
+		/* Segments the log has grown by since this node mounted
+		 * don't have meta files yet */
+		famfs_mkmeta_log_segs(mpt_out, (client_mode) ? FAMFS_CLIENT
+				      : famfs_get_role(sb), verbose);
+
+		/* Map the log and any segments it has grown by */
+		logp = famfs_log_map(lfd, 0, log_size, PROT_READ,
+				     0 /* not raw */, mpt_out);
+		if (!logp) {
 			fprintf(stderr,
 				"%s: failed to mmap log file for %s\n",
 				__func__, mpt_out);
 			close(lfd);
 			return -1;
 		}
-		
-		/* Note that this dereferences logp to get the length, and then
-		 * invalidates the cache. I think this is ok...
-		 */
-		invalidate_processor_cache(logp, logp->famfs_log_len);
 	} else {
 		/* XXX: Hmm, not sure how to invalidate the processor cache
 		 * before a posix read. Default is mmap; posix read may not work
@@ -2341,19 +3469,18 @@ famfs_logplay(
 		if (rc)
 			goto err_out;
 
-		/* Get log via posix read */
-		logp = calloc(1, log_size);
-		if (!logp) {
-			close(lfd);
-			fprintf(stderr, "%s: malloc %ld failed for log\n",
-				__func__, log_size);
-			return -ENOMEM;
-		}
+		/* As above: the segments need meta files to be read */
+		famfs_mkmeta_log_segs(mpt_out, (client_mode) ? FAMFS_CLIENT
+				      : famfs_get_role(sb), verbose);
 
-		rc = famfs_file_read(lfd, (char *)logp, log_size, __func__,
-				     "log file", verbose);
-		if (rc)
+		/* Get log, and any segments it has grown by, via posix read */
+		logp = famfs_log_read(lfd, log_size, mpt_out, verbose);
+		if (!logp) {
+			fprintf(stderr, "%s: failed to read log file for %s\n",
+				__func__, mpt_out);
+			rc = -1;
 			goto err_out;
+		}
 	}
 
 	role = (client_mode) ? FAMFS_CLIENT : famfs_get_role(sb);
@@ -2370,60 +3497,908 @@ famfs_logplay(
 				     role, verbose);
 err_out:
 	if (use_mmap) {
-		munmap(logp, log_size);
+		famfs_unmap_log(logp);
 		munmap(sb, FAMFS_SUPERBLOCK_SIZE);
 	} else {
 		if (logp)
-			free(logp);
+			famfs_unmap_log(logp);
 		if (sb)
 			free(sb);
 	}
-	close(lfd);
-	return rc;
+	close(lfd);
+	return rc;
+}
+
+/********************************************************************************
+ *
+ * Log maintenance / append
+ */
+
+/*
+ * Append to a packed log: the entry is flushed before the header that makes
+ * it visible, so only the new bytes and the header are written back.
+ */
+static int
+famfs_append_log_packed(struct famfs_log       *logp,
+			struct famfs_log_entry *e)
+{
+	struct famfs_log_packed *pl = famfs_log_packed(logp);
+	u64 buf[FAMFS_LOG_PREC_MAX / sizeof(u64)] = { 0 };
+	size_t len = famfs_log_prec_size(e);
+	u8 *dest;
+
+	if (pl->pl_next_offset + len > famfs_log_entry_limit(logp)) {
+		fprintf(stderr, "%s: log full\n", __func__);
+		return -ENOSPC;
+	}
+
+	/* The limit covers every linked segment; make sure this one is
+	 * mapped here */
+	dest = pl->pl_entries + pl->pl_next_offset;
+	if (dest + len > (u8 *)logp + famfs_log_mapped_len(logp))
+		famfs_log_follow_chain(logp);
+	if (dest + len > (u8 *)logp + famfs_log_mapped_len(logp)) {
+		fprintf(stderr, "%s: log segment is not mapped\n", __func__);
+		return -EIO;
+	}
+
+	e->famfs_log_entry_seqnum = logp->famfs_log_next_seqnum;
+	famfs_log_prec_encode(e, (u8 *)buf);
+
+	memcpy(dest, buf, len);
+	flush_processor_cache(dest, len);
+
+	pl->pl_next_offset += len;
+	logp->famfs_log_next_seqnum++;
+	logp->famfs_log_next_index++;
+	flush_processor_cache(logp, sizeof(*logp) + sizeof(*pl));
+
+	return 0;
+}
+
+/**
+ * famfs_append_log()
+ *
+ * @logp: pointer to struct famfs_log in memory media
+ * @e:    pointer to log entry in memory
+ *
+ * NOTE: this function is not re-entrant. Must hold a lock or mutexj
+ * when calling this function if there is any chance of re-entrancy.
+ */
+static int
+famfs_append_log(struct famfs_log       *logp,
+		 struct famfs_log_entry *e)
+{
+	assert(logp);
+	assert(e);
+
+	/* XXX This function is not re-entrant */
+
+	if (famfs_log_is_packed(logp))
+		return famfs_append_log_packed(logp, e);
+
+	e->famfs_log_entry_seqnum = logp->famfs_log_next_seqnum;
+	e->famfs_log_entry_crc = famfs_gen_log_entry_crc(e);
+
+	memcpy(&logp->entries[logp->famfs_log_next_index], e, sizeof(*e));
+
+	logp->famfs_log_next_seqnum++;
+	logp->famfs_log_next_index++;
+
+	/* Could flush: 1) the log entry, 2) the log header
+	 * That would be less flushing, but would not guarantee that the entry
+	 * is visible before the log header. If the log header becomes visible
+	 * first (leading to reading a cache-incoherent log entry), the checksum
+	 * on the log entry will save us - and the logplay can be retried.
+	 *
+	 * But now we're just flushing the whole log every time...
+	 */
+	flush_processor_cache(logp, logp->famfs_log_len);
+
+	return 0;
+}
+
+/*
+ * Set of relpaths, for dropping entries that logplay would skip because the
+ * path already exists. Open addressing; grows at half full.
+ */
+struct famfs_pathset {
+	const char **slots;
+	size_t size;          /* power of 2 */
+	size_t count;
+};
+
+static u64
+famfs_pathset_hash(const char *path)
+{
+	u64 h = 0xcbf29ce484222325ULL; /* FNV-1a */
+
+	while (*path) {
+		h ^= (unsigned char)*path++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/* Returns 1 if @path was added, 0 if it was already present, -1 on ENOMEM.
+ * @path must stay valid while it is in the set. */
+static int
+famfs_pathset_add(struct famfs_pathset *ps, const char *path)
+{
+	size_t i;
+
+	if (2 * (ps->count + 1) > ps->size) {
+		size_t newsize = ps->size ? ps->size * 2 : 1024;
+		const char **slots = calloc(newsize, sizeof(*slots));
+
+		if (!slots)
+			return -1;
+		for (i = 0; i < ps->size; i++) {
+			size_t j;
+
+			if (!ps->slots[i])
+				continue;
+			j = famfs_pathset_hash(ps->slots[i]) & (newsize - 1);
+			while (slots[j])
+				j = (j + 1) & (newsize - 1);
+			slots[j] = ps->slots[i];
+		}
+		free(ps->slots);
+		ps->slots = slots;
+		ps->size = newsize;
+	}
+
+	i = famfs_pathset_hash(path) & (ps->size - 1);
+	for (; ps->slots[i]; i = (i + 1) & (ps->size - 1))
+		if (strcmp(ps->slots[i], path) == 0)
+			return 0;
+	ps->slots[i] = path;
+	ps->count++;
+	return 1;
+}
+
+/* Returns 1 if @path is in the set */
+static int
+famfs_pathset_find(const struct famfs_pathset *ps, const char *path)
+{
+	size_t i;
+
+	if (!ps->size)
+		return 0;
+	i = famfs_pathset_hash(path) & (ps->size - 1);
+	for (; ps->slots[i]; i = (i + 1) & (ps->size - 1))
+		if (strcmp(ps->slots[i], path) == 0)
+			return 1;
+	return 0;
+}
+
+/* For a set that owns its paths (they were strdup'd when added) */
+static void
+famfs_pathset_free(struct famfs_pathset *ps)
+{
+	size_t i;
+
+	for (i = 0; i < ps->size; i++)
+		free((char *)ps->slots[i]);
+	free(ps->slots);
+	memset(ps, 0, sizeof(*ps));
+}
+
+/*
+ * Path index
+ *
+ * The files and directories that the log creates, so that the create paths
+ * in a locked-log session (__famfs_mkfile(), __famfs_mkdir(), famfs_cp() and
+ * friends) can check for duplicates and find parents without a stat() or
+ * realpath() per path - each of which is a round trip through the daemon
+ * under fuse. It is built from the log when the session starts
+ * (famfs_init_locked_log()) and kept current as the session logs creations;
+ * the log lock keeps anyone else from adding to the namespace meanwhile.
+ */
+struct famfs_path_index {
+	struct famfs_pathset files;
+	struct famfs_pathset dirs;
+	int valid;         /* Clear if the log could not be indexed */
+};
+
+static void
+famfs_path_index_free(struct famfs_path_index *pi)
+{
+	if (!pi)
+		return;
+	famfs_pathset_free(&pi->files);
+	famfs_pathset_free(&pi->dirs);
+	free(pi);
+}
+
+static int
+famfs_path_index_add(
+	struct famfs_path_index *pi,
+	const char              *relpath,
+	enum famfs_path_type     type)
+{
+	char *path = strdup(relpath);
+	int rc;
+
+	if (!path)
+		return -ENOMEM;
+	rc = famfs_pathset_add((type == FAMFS_PATH_DIR) ?
+			       &pi->dirs : &pi->files, path);
+	if (rc <= 0)
+		free(path);
+	return (rc < 0) ? -ENOMEM : 0;
+}
+
+static struct famfs_path_index *
+famfs_path_index_build(const struct famfs_log *logp)
+{
+	struct famfs_path_index *pi = calloc(1, sizeof(*pi));
+	struct famfs_log_entry le;
+	struct famfs_log_iter it;
+	int rc;
+
+	if (!pi)
+		return NULL;
+
+	famfs_log_iter_init(&it, logp);
+	while ((rc = famfs_log_iter_next(&it, &le)) > 0) {
+		if (le.famfs_log_entry_type == FAMFS_LOG_FILE)
+			rc = famfs_path_index_add(pi, le.famfs_fm.fm_relpath,
+						  FAMFS_PATH_FILE);
+		else if (le.famfs_log_entry_type == FAMFS_LOG_MKDIR)
+			rc = famfs_path_index_add(pi,
+					(const char *)le.famfs_md.md_relpath,
+					FAMFS_PATH_DIR);
+		else
+			rc = 0;
+		if (rc)
+			break;
+	}
+	if (rc) {
+		fprintf(stderr, "%s: unable to index the log (%d)\n",
+			__func__, rc);
+		famfs_pathset_free(&pi->files);
+		famfs_pathset_free(&pi->dirs);
+		return pi; /* Not valid; lookups go to the filesystem */
+	}
+
+	pi->valid = 1;
+	return pi;
+}
+
+/* Note a creation that this session just logged */
+static void
+famfs_path_index_note(
+	struct famfs_locked_log *lp,
+	const char              *relpath,
+	enum famfs_path_type     type)
+{
+	if (!lp->pidx || !lp->pidx->valid)
+		return;
+	if (famfs_path_index_add(lp->pidx, relpath, type))
+		lp->pidx->valid = 0;
+}
+
+/* True if @relpath has no empty, "." or ".." components - i.e. it is in the
+ * form that the log records */
+static int
+famfs_relpath_is_canonical(const char *relpath)
+{
+	const char *p = relpath;
+
+	if (!*p)
+		return 0;
+	while (1) {
+		const char *end = strchrnul(p, '/');
+		size_t n = end - p;
+
+		if (n == 0 || (n == 1 && p[0] == '.') ||
+		    (n == 2 && p[0] == '.' && p[1] == '.'))
+			return 0;
+		if (!*end)
+			return 1;
+		p = end + 1;
+	}
+}
+
+/**
+ * famfs_path_index_lookup()
+ *
+ * Look @path up in the path index of @lp.
+ *
+ * @lp:       Locked log
+ * @path:     Absolute, or relative to getcwd()
+ * @fullpath: If non-NULL, the absolute path is returned here (PATH_MAX)
+ *
+ * Returns FAMFS_PATH_NONE, FAMFS_PATH_FILE or FAMFS_PATH_DIR; or -1 if the
+ * index can't answer for @path (it is outside the mount, under .meta, or not
+ * in canonical form, or the session has no index), in which case the caller
+ * must ask the filesystem.
+ * When the index answers, @fullpath is canonical.
+ */
+int
+famfs_path_index_lookup(
+	struct famfs_locked_log *lp,
+	const char              *path,
+	char                    *fullpath)
+{
+	char abspath[PATH_MAX];
+	const char *relpath;
+	size_t mlen;
+	int len;
+
+	assert(lp);
+	assert(lp->mpt);
+
+	if (path[0] == '/') {
+		len = snprintf(abspath, PATH_MAX, "%s", path);
+	} else {
+		char cwd[PATH_MAX];
+
+		if (!getcwd(cwd, sizeof(cwd)))
+			return -1;
+		len = snprintf(abspath, PATH_MAX, "%s/%s", cwd, path);
+	}
+	if (len >= PATH_MAX)
+		return -1;
+	if (fullpath)
+		memcpy(fullpath, abspath, len + 1);
+
+	mlen = strlen(lp->mpt);
+	if (strncmp(abspath, lp->mpt, mlen) != 0)
+		return -1;
+	if (abspath[mlen] == '\0')
+		return FAMFS_PATH_DIR; /* The mount point */
+	if (abspath[mlen] != '/')
+		return -1;
+
+	relpath = &abspath[mlen + 1];
+	if (!lp->logp || /* (A master service session; see famfs_master.c) */
+	    !famfs_relpath_is_canonical(relpath) ||
+	    strcmp(relpath, ".meta") == 0 || strncmp(relpath, ".meta/", 6) == 0)
+		return -1;
+
+	if (!lp->pidx || !lp->pidx->valid)
+		return -1;
+
+	if (famfs_pathset_find(&lp->pidx->dirs, relpath))
+		return FAMFS_PATH_DIR;
+	if (famfs_pathset_find(&lp->pidx->files, relpath))
+		return FAMFS_PATH_FILE;
+	return FAMFS_PATH_NONE;
+}
+
+/* What is at @path: from the path index if it can say, else from stat() */
+static int
+famfs_path_type(struct famfs_locked_log *lp, const char *path)
+{
+	struct stat st;
+	int type;
+
+	type = famfs_path_index_lookup(lp, path, NULL);
+	if (type >= 0)
+		return type;
+	if (stat(path, &st))
+		return FAMFS_PATH_NONE;
+	return S_ISDIR(st.st_mode) ? FAMFS_PATH_DIR : FAMFS_PATH_FILE;
+}
+
+/* famfs_path_type() of the directory that would contain @path */
+static int
+famfs_path_parent_type(struct famfs_locked_log *lp, const char *path)
+{
+	char parent[PATH_MAX];
+
+	strncpy(parent, path, PATH_MAX - 1);
+	parent[PATH_MAX - 1] = '\0';
+	return famfs_path_type(lp, dirname(parent));
+}
+
+/* Bytes of a checkpoint entry in @logp */
+static size_t
+famfs_log_ckpt_entry_size(const struct famfs_log *logp)
+{
+	struct famfs_log_entry le;
+
+	if (!famfs_log_is_packed(logp))
+		return sizeof(le);
+	memset(&le, 0, sizeof(le));
+	le.famfs_log_entry_type = FAMFS_LOG_CHECKPOINT;
+	return famfs_log_prec_size(&le);
+}
+
+/* The part of the log, past the entries in use and any checkpoint, where a
+ * new snapshot region of @len bytes can go; 0 if there is no room. The new
+ * region must not overlap anything live until the new checkpoint commits. */
+static u64
+famfs_log_ckpt_place(const struct famfs_log *logp, u64 len)
+{
+	const struct famfs_log_checkpoint *ck = famfs_log_get_checkpoint(logp);
+	u64 ebase = offsetof(struct famfs_log, entries);
+	u64 top = famfs_log_mapped_len(logp);
+	u64 cklen = famfs_log_ckpt_entry_size(logp);
+	u64 used, reserve;
+	u64 start;
+
+	/* The new checkpoint is appended to the entries in use before it
+	 * moves to the front (see __famfs_log_compact()); after that, leave
+	 * room for it and at least one new entry */
+	if (famfs_log_is_packed(logp)) {
+		ebase += offsetof(struct famfs_log_packed, pl_entries);
+		used = famfs_log_packed(logp)->pl_next_offset + cklen;
+		reserve = cklen + FAMFS_LOG_PREC_MAX;
+	} else {
+		used = (logp->famfs_log_next_index + 1) * cklen;
+		reserve = 2 * cklen;
+	}
+
+	/* The appended checkpoint must not land on the current snapshot */
+	if (ck && ebase + used > ck->ck_offset)
+		return 0;
+
+	/* Highest first: the top of the log, or else just below the
+	 * current snapshot region */
+	if (len > top)
+		return 0;
+	start = (top - len) & ~(u64)(FAMFS_LOG_REC_ALIGN - 1);
+	if (ck && start < ck->ck_offset + ck->ck_len) {
+		top = ck->ck_offset;
+		if (len > top)
+			return 0;
+		start = (top - len) & ~(u64)(FAMFS_LOG_REC_ALIGN - 1);
+	}
+	return (start >= ebase + MAX(used, reserve)) ? start : 0;
+}
+
+/**
+ * famfs_log_compact()
+ *
+ * Replace the log's entries with a checkpoint: one compact record per file,
+ * directory and daxdev, in log order. Entries for a path that already exists
+ * (which logplay skips) are dropped. Afterwards the log holds just the
+ * checkpoint entry, so replay costs O(live files) and the freed slots can
+ * be used for new files. See struct famfs_log_checkpoint.
+ *
+ * The new snapshot region is written to free space at the top of the log
+ * first. The checkpoint entry that points at it is then appended like any
+ * other entry, so the commit is the single aligned store that counts it
+ * (famfs_log_next_index); readers skip a checkpoint that is not at the
+ * front, since what it stands for comes before it. Only then is the
+ * checkpoint copied over entries[0] and the count reset to 1. Until the
+ * reset, the appended copy is still there to recover a torn entries[0]
+ * from (famfs_log_compact_recover()). Clients following the log notice the
+ * new checkpoint (famfs_log_iter_stale()) and replay from the start;
+ * everything they have is already in place.
+ *
+ * With @force, a checkpoint is rewritten even if nothing was logged after
+ * it; that moves its snapshot region to the top of the log, which is how
+ * famfs_log_grow() frees the space below it.
+ *
+ * Caller must hold the log lock (famfs_init_locked_log()).
+ *
+ * Returns 0 on success (including when there is nothing to compact), or a
+ * negative errno
+ */
+static int
+__famfs_log_compact(struct famfs_log *logp, int force, int verbose)
+{
+	struct famfs_pathset ps = { 0 };
+	struct famfs_log_entry *entries = NULL;
+	struct famfs_log_entry le;
+	struct famfs_log_iter it;
+	u64 pbuf[FAMFS_LOG_PREC_MAX / sizeof(u64)] = { 0 };
+	u64 nrecs = 0, ndups = 0, nentries, nentries_in_log;
+	size_t cklen = famfs_log_ckpt_entry_size(logp);
+	size_t len = 0, ofs = 0;
+	u8 *buf = NULL;
+	u64 start, i;
+	int rc;
+
+	if (famfs_validate_log_header(logp))
+		return -EINVAL;
+
+	/* (A checkpoint by itself is rewritten only if @force. A packed entry
+	 * shorter than a checkpoint would be overwritten by the move to the
+	 * front while the appended copy still overlaps it; compacting that
+	 * one entry would gain nothing anyway.) */
+	nentries = nentries_in_log = logp->famfs_log_next_index;
+	if (nentries == 0 ||
+	    (!force && nentries == 1 && famfs_log_get_checkpoint(logp)) ||
+	    (famfs_log_is_packed(logp) &&
+	     famfs_log_packed(logp)->pl_next_offset < cklen)) {
+		if (verbose)
+			printf("%s: nothing to compact\n", __func__);
+		return 0;
+	}
+
+	/* Everything is copied out first, since the records refer to the
+	 * paths; the log is at most a few MiB */
+	entries = calloc(nentries, sizeof(*entries));
+	if (!entries)
+		return -ENOMEM;
+
+	famfs_log_iter_init(&it, logp);
+	for (i = 0; ; i++) {
+		rc = famfs_log_iter_next(&it, &le);
+		if (rc == 0)
+			break;
+		if (rc < 0) {
+			fprintf(stderr, "%s: invalid log; not compacting\n",
+				__func__);
+			rc = -EINVAL;
+			goto out;
+		}
+		if (i == nentries) {
+			struct famfs_log_entry *n;
+
+			n = realloc(entries, 2 * nentries * sizeof(*n));
+			if (!n) {
+				rc = -ENOMEM;
+				goto out;
+			}
+			entries = n;
+			nentries *= 2;
+		}
+		entries[i] = le;
+	}
+	nentries = i;
+
+	for (i = 0; i < nentries; i++) {
+		const struct famfs_log_entry *e = &entries[i];
+		const char *path = NULL;
+
+		if (e->famfs_log_entry_type == FAMFS_LOG_FILE)
+			path = e->famfs_fm.fm_relpath;
+		else if (e->famfs_log_entry_type == FAMFS_LOG_MKDIR)
+			path = (const char *)e->famfs_md.md_relpath;
+		if (path) {
+			rc = famfs_pathset_add(&ps, path);
+			if (rc < 0) {
+				rc = -ENOMEM;
+				goto out;
+			}
+			if (rc == 0) {
+				ndups++;
+				continue;
+			}
+		}
+		len += famfs_log_rec_size(e);
+	}
+
+	start = famfs_log_ckpt_place(logp, len);
+	if (!start) {
+		fprintf(stderr,
+			"%s: not enough free log space to compact "
+			"(%ld bytes needed)\n", __func__, len);
+		rc = -ENOSPC;
+		goto out;
+	}
+
+	buf = calloc(1, len ? len : 1);
+	if (!buf) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	ps.count = 0;
+	if (ps.slots)
+		memset(ps.slots, 0, ps.size * sizeof(*ps.slots));
+	for (i = 0; i < nentries; i++) {
+		const struct famfs_log_entry *e = &entries[i];
+		size_t reclen = famfs_log_rec_size(e);
+
+		if (!reclen)
+			continue;
+		if (e->famfs_log_entry_type == FAMFS_LOG_FILE &&
+		    famfs_pathset_add(&ps, e->famfs_fm.fm_relpath) == 0)
+			continue;
+		if (e->famfs_log_entry_type == FAMFS_LOG_MKDIR &&
+		    famfs_pathset_add(&ps,
+				(const char *)e->famfs_md.md_relpath) == 0)
+			continue;
+		famfs_log_rec_encode(e, buf + ofs);
+		ofs += reclen;
+		nrecs++;
+	}
+	assert(ofs == len);
+
+	/* The snapshot region is not live yet... */
+	memcpy((u8 *)logp + start, buf, len);
+	flush_processor_cache((u8 *)logp + start, len);
+
+	/* ...until a checkpoint entry that points at it is appended; counting
+	 * that entry (one aligned 8-byte store) is the commit */
+	memset(&le, 0, sizeof(le));
+	le.famfs_log_entry_type = FAMFS_LOG_CHECKPOINT;
+	le.famfs_log_entry_seqnum = logp->famfs_log_next_seqnum;
+	le.famfs_ck.ck_offset = start;
+	le.famfs_ck.ck_len = len;
+	le.famfs_ck.ck_nrecs = nrecs;
+	le.famfs_ck.ck_crc = famfs_ckpt_crc(buf, len);
+	if (famfs_log_is_packed(logp)) {
+		struct famfs_log_packed *pl = famfs_log_packed(logp);
+		u8 *dest = pl->pl_entries + pl->pl_next_offset;
+
+		/* famfs_log_ckpt_place() left room for it */
+		famfs_log_prec_encode(&le, (u8 *)pbuf);
+		memcpy(dest, pbuf, cklen);
+		flush_processor_cache(dest, cklen);
+		pl->pl_next_offset += cklen;
+		flush_processor_cache(&pl->pl_next_offset,
+				      sizeof(pl->pl_next_offset));
+	} else {
+		le.famfs_log_entry_crc = famfs_gen_log_entry_crc(&le);
+		memcpy(&logp->entries[nentries_in_log], &le, sizeof(le));
+		flush_processor_cache(&logp->entries[nentries_in_log],
+				      sizeof(le));
+	}
+	logp->famfs_log_next_index = nentries_in_log + 1;
+	flush_processor_cache(&logp->famfs_log_next_index,
+			      sizeof(logp->famfs_log_next_index));
+	logp->famfs_log_next_seqnum = le.famfs_log_entry_seqnum + 1;
+	flush_processor_cache(&logp->famfs_log_next_seqnum,
+			      sizeof(logp->famfs_log_next_seqnum));
+
+	/* Then it moves to the front. Should that be interrupted, the copy
+	 * at the end is still counted, to finish the job from */
+	if (famfs_log_is_packed(logp)) {
+		struct famfs_log_packed *pl = famfs_log_packed(logp);
+
+		memcpy(pl->pl_entries, pbuf, cklen);
+		flush_processor_cache(pl->pl_entries, cklen);
+		pl->pl_next_offset = cklen;
+		flush_processor_cache(&pl->pl_next_offset,
+				      sizeof(pl->pl_next_offset));
+	} else {
+		memcpy(&logp->entries[0], &le, sizeof(le));
+		flush_processor_cache(&logp->entries[0], sizeof(le));
+	}
+	logp->famfs_log_next_index = 1;
+	flush_processor_cache(&logp->famfs_log_next_index,
+			      sizeof(logp->famfs_log_next_index));
+
+	if (verbose)
+		printf("%s: %lld entries compacted to %lld records "
+		       "(%ld bytes at offset %lld); %lld duplicates dropped\n",
+		       __func__, nentries, nrecs, len, start, ndups);
+	rc = 0;
+out:
+	free(ps.slots);
+	free(entries);
+	free(buf);
+	return rc;
+}
+
+int
+famfs_log_compact(struct famfs_log *logp, int verbose)
+{
+	return __famfs_log_compact(logp, 0, verbose);
+}
+
+/**
+ * famfs_sb_require_minor()
+ *
+ * Raise the superblock's OMF minor version to @minor, if it is lower, before
+ * the log takes on a feature that older famfs versions can't read; they then
+ * refuse the file system rather than misparse its log (see
+ * FAMFS_OMF_MINOR_BASE).
+ *
+ * Caller must hold the log lock (famfs_init_locked_log()).
+ *
+ * Returns 0 on success, or a negative errno
+ */
+int
+famfs_sb_require_minor(struct famfs_locked_log *lp, u32 minor, int verbose)
+{
+	struct famfs_superblock *sb;
+
+	sb = famfs_map_superblock_by_path(lp->mpt, true, 0 /* writable */);
+	if (!sb)
+		return -EIO;
+	invalidate_processor_cache(sb, sizeof(*sb));
+
+	if (sb->ts_omf_ver_minor < minor) {
+		if (verbose)
+			printf("%s: superblock OMF minor version %d -> %d\n",
+			       __func__, sb->ts_omf_ver_minor, minor);
+		sb->ts_omf_ver_minor = minor;
+		sb->ts_crc = famfs_gen_superblock_crc(sb);
+		flush_processor_cache(sb, sizeof(*sb));
+	}
+	munmap(sb, FAMFS_SUPERBLOCK_SIZE);
+	return 0;
 }
 
-/********************************************************************************
- *
- * Log maintenance / append
- */
-
 /**
- * famfs_append_log()
+ * famfs_log_grow()
  *
- * @logp: pointer to struct famfs_log in memory media
- * @e:    pointer to log entry in memory
+ * Double the space in a packed log by linking another segment to it (see
+ * struct famfs_log_packed). The segment is allocated from the data area and
+ * gets a meta file (.meta/.log.<n>), through which it is zeroed before the
+ * log header links it; readers that come across the link map it then.
  *
- * NOTE: this function is not re-entrant. Must hold a lock or mutexj
- * when calling this function if there is any chance of re-entrancy.
+ * A checkpoint's snapshot region sits at the top of the log, where it would
+ * keep new entries out of the segment, so a log with a checkpoint is then
+ * compacted again to move the snapshot to the new top.
+ *
+ * Caller must hold the log lock (famfs_init_locked_log()).
+ *
+ * Returns 0 on success, or a negative errno
  */
-static int
-famfs_append_log(struct famfs_log       *logp,
-		 struct famfs_log_entry *e)
+int
+famfs_log_grow(struct famfs_locked_log *lp, int verbose)
 {
-	assert(logp);
-	assert(e);
+	struct famfs_log *logp = lp->logp;
+	struct famfs_log_packed *pl;
+	struct famfs_log_seg *seg;
+	char metafile[PATH_MAX];
+	char path[PATH_MAX];
+	char name[NAME_MAX];
+	size_t size;
+	s64 offset;
+	void *addr;
+	u32 nsegs;
+	u32 segno;
+	u64 len;
+	int rc;
 
-	/* XXX This function is not re-entrant */
+	if (famfs_validate_log_header(logp))
+		return -EINVAL;
+	if (!famfs_log_is_packed(logp)) {
+		fprintf(stderr, "%s: only a packed log can grow\n", __func__);
+		return -EOPNOTSUPP;
+	}
+	pl = famfs_log_packed(logp);
+	nsegs = famfs_log_nsegs(logp);
+	if (nsegs >= FAMFS_LOG_MAX_SEGS) {
+		fprintf(stderr, "%s: log is at its maximum size (%lld)\n",
+			__func__, famfs_log_seg_end(logp, nsegs));
+		return -ENOSPC;
+	}
+	if (famfs_log_follow_chain(logp) != nsegs) {
+		fprintf(stderr, "%s: log segments are not mapped\n", __func__);
+		return -EIO;
+	}
+
+	/* Segments are numbered as their meta files: .log.<segno> */
+	segno = nsegs + 1;
+	len = famfs_log_seg_end(logp, nsegs);
+	offset = famfs_log_seg_alloc(lp, len, verbose);
+	if (offset < 0)
+		return offset;
+
+	snprintf(name, sizeof(name), ".log.%u", segno);
+	rc = snprintf(metafile, sizeof(metafile), "%s/.meta/%s",
+		      (lp->famfs_type == FAMFS_FUSE) ? lp->shadow_root : lp->mpt,
+		      name);
+	if (rc < 0 || (size_t)rc >= sizeof(metafile)) {
+		fprintf(stderr, "%s: path too long for log segment %u\n",
+			__func__, segno);
+		return -ENAMETOOLONG;
+	}
+	rc = snprintf(path, sizeof(path), "%s/%s.%u", lp->mpt,
+		      LOG_FILE_RELPATH, segno);
+	if (rc < 0 || (size_t)rc >= sizeof(path)) {
+		fprintf(stderr, "%s: path too long for log segment %u\n",
+			__func__, segno);
+		return -ENAMETOOLONG;
+	}
+
+	if (lp->famfs_type == FAMFS_FUSE)
+		rc = famfs_mkmeta_logfile(lp->shadow_root, name, offset, len,
+					  FAMFS_MASTER, 1 /* shadow */,
+					  verbose);
+	else
+		rc = famfs_mkmeta_logfile(lp->mpt, name, offset, len,
+					  FAMFS_MASTER, 0, verbose);
+	if (rc) {
+		fprintf(stderr, "%s: failed to create meta file for log "
+			"segment %u\n", __func__, segno);
+		rc = -EIO;
+		goto err_unlink;
+	}
 
-	e->famfs_log_entry_seqnum = logp->famfs_log_next_seqnum;
-	e->famfs_log_entry_crc = famfs_gen_log_entry_crc(e);
+	/* Whatever was in that space before must not look like entries */
+	addr = famfs_mmap_whole_file(path, 0 /* writable */, &size);
+	if (!addr || size != len) {
+		fprintf(stderr, "%s: failed to map %s\n", __func__, path);
+		if (addr)
+			munmap(addr, size);
+		rc = -EIO;
+		goto err_unlink;
+	}
+	memset(addr, 0, len);
+	flush_processor_cache(addr, len);
+	munmap(addr, size);
 
-	memcpy(&logp->entries[logp->famfs_log_next_index], e, sizeof(*e));
+	rc = famfs_sb_require_minor(lp, FAMFS_OMF_MINOR_LOG_SEGS, verbose);
+	if (rc)
+		goto err_unlink;
 
-	logp->famfs_log_next_seqnum++;
-	logp->famfs_log_next_index++;
+	/* The segment first; counting it is the commit */
+	seg = &pl->pl_segs[nsegs];
+	seg->ls_offset = offset;
+	seg->ls_len = len;
+	flush_processor_cache(seg, sizeof(*seg));
+	pl->pl_nsegs = segno;
+	flush_processor_cache(&pl->pl_nsegs, sizeof(pl->pl_nsegs));
 
-	/* Could flush: 1) the log entry, 2) the log header
-	 * That would be less flushing, but would not guarantee that the entry
-	 * is visible before the log header. If the log header becomes visible
-	 * first (leading to reading a cache-incoherent log entry), the checksum
-	 * on the log entry will save us - and the logplay can be retried.
-	 *
-	 * But now we're just flushing the whole log every time...
-	 */
-	flush_processor_cache(logp, logp->famfs_log_len);
+	if (famfs_log_follow_chain(logp) != segno) {
+		fprintf(stderr, "%s: failed to map log segment %u\n",
+			__func__, segno);
+		return -EIO;
+	}
+	if (verbose)
+		printf("%s: log is now %lld bytes (segment %u: %lld bytes "
+		       "at offset %lld)\n", __func__,
+		       famfs_log_seg_end(logp, segno), segno, len, offset);
 
+	if (famfs_log_get_checkpoint(logp))
+		return __famfs_log_compact(logp, 1 /* force */, verbose);
 	return 0;
+
+err_unlink:
+	/* The segment is not linked; don't leave a meta file that maps it */
+	if (unlink(metafile) && errno != ENOENT)
+		fprintf(stderr, "%s: failed to remove %s\n", __func__,
+			metafile);
+	return rc;
+}
+
+/*
+ * If a compaction was interrupted after it committed (appended) its
+ * checkpoint, but before it reset the entry count, the last entry counted
+ * is the checkpoint; entries[0] may be the old one, torn, or the new one.
+ * Finish the job: move the checkpoint to the front and reset the count.
+ */
+static void
+famfs_log_compact_recover(struct famfs_log *logp)
+{
+	struct famfs_log_packed *pl = famfs_log_packed(logp);
+	size_t cklen = famfs_log_ckpt_entry_size(logp);
+	const struct famfs_log_entry *le;
+	const struct famfs_log_prec *pr;
+	u64 n = logp->famfs_log_next_index;
+	u64 seq;
+
+	if (famfs_log_is_packed(logp)) {
+		/* pl_next_offset takes in the appended checkpoint before it
+		 * is counted, and moves back to the front before the count
+		 * is reset, so it finds the checkpoint either way */
+		if (!n || pl->pl_next_offset < cklen)
+			return;
+		pr = (const struct famfs_log_prec *)
+			(pl->pl_entries + pl->pl_next_offset - cklen);
+		if ((const u8 *)pr == pl->pl_entries && n == 1)
+			return; /* A compacted log */
+		if (famfs_log_prec_check(pr, famfs_log_packed_end(logp)) !=
+		    (int)cklen ||
+		    pr->pr_rec.lr_type != FAMFS_LOG_CHECKPOINT)
+			return;
+		seq = pr->pr_seqnum;
+		if ((const u8 *)pr != pl->pl_entries) {
+			memmove(pl->pl_entries, pr, cklen);
+			flush_processor_cache(pl->pl_entries, cklen);
+		}
+		pl->pl_next_offset = cklen;
+		flush_processor_cache(&pl->pl_next_offset,
+				      sizeof(pl->pl_next_offset));
+	} else {
+		if (n <= 1)
+			return;
+		le = &logp->entries[n - 1];
+		seq = le->famfs_log_entry_seqnum;
+		if (le->famfs_log_entry_type != FAMFS_LOG_CHECKPOINT ||
+		    famfs_validate_log_entry(le, seq))
+			return;
+		memcpy(&logp->entries[0], le, sizeof(*le));
+		flush_processor_cache(&logp->entries[0], sizeof(*le));
+	}
+
+	fprintf(stderr, "%s: finishing interrupted log compaction\n",
+		__func__);
+	logp->famfs_log_next_seqnum = seq + 1;
+	logp->famfs_log_next_index = 1;
+	flush_processor_cache(logp, sizeof(*logp));
 }
 
 
@@ -2934,7 +4909,13 @@ famfs_map_superblock_by_path(
 	return sb;
 }
 
-static struct famfs_log *
+/**
+ * famfs_map_log_by_path()
+ *
+ * Map the log of the famfs instance that contains @path via its meta file,
+ * along with any segments it has grown by. Unmap it with famfs_unmap_log().
+ */
+struct famfs_log *
 famfs_map_log_by_path(
 	const char *path,
 	int         read_only,
@@ -2943,14 +4924,14 @@ famfs_map_log_by_path(
 {
 	struct famfs_log *logp;
 	int prot = (read_only) ? PROT_READ : PROT_READ | PROT_WRITE;
+	char mpt[PATH_MAX];
 	size_t log_size;
-	void *addr;
 	int fd;
 
 	if (read_only)
-		fd = open_log_file_read_only(path, &log_size, -1, NULL, lockopt);
+		fd = open_log_file_read_only(path, &log_size, -1, mpt, lockopt);
 	else
-		fd = open_log_file_writable(path, &log_size, -1, NULL, lockopt);
+		fd = open_log_file_writable(path, &log_size, -1, mpt, lockopt);
 
 	if (fd < 0) {
 		fprintf(stderr,
@@ -2958,27 +4939,24 @@ famfs_map_log_by_path(
 			__func__, path);
 		return NULL;
 	}
-	addr = mmap(0, log_size, prot, MAP_SHARED, fd, 0);
+	logp = famfs_log_map(fd, 0, log_size, prot, 0 /* not raw */, mpt);
 	close(fd);
-	if (addr == MAP_FAILED) {
+	if (!logp) {
 		fprintf(stderr, "%s: Failed to mmap log file %s\n",
 			__func__, path);
 		return NULL;
 	}
 
-	logp = (struct famfs_log *)addr;
-
-	invalidate_processor_cache(logp, log_size);
 	if (check_log && log_size != logp->famfs_log_len) {
 		fprintf(stderr,
 			"%s: log file length is invalid (%lld / %lld)\n",
 			__func__, (s64)log_size, logp->famfs_log_len);
-		munmap(addr, log_size);
+		famfs_unmap_log(logp);
 		return NULL;
 	}
 
 	if (check_log && famfs_validate_log_header(logp)) {
-		munmap(addr, log_size);
+		famfs_unmap_log(logp);
 		return NULL;
 	}
 
@@ -3056,6 +5034,7 @@ famfs_fsck_mounted(
 		 * may have soon outlived their utility. Probably should drop
 		 * this at some point.
 		 */
+		char lmpt[PATH_MAX];
 		int sfd;
 		int lfd;
 
@@ -3085,7 +5064,7 @@ famfs_fsck_mounted(
 		close(sfd);
 
 		lfd = open_log_file_read_only(path, NULL, -1,
-					      NULL, NO_LOCK);
+					      lmpt, NO_LOCK);
 		if (lfd < 0 || mock_failure == MOCK_FAIL_OPEN_LOG) {
 			free(sb);
 			fprintf(stderr,
@@ -3094,13 +5073,10 @@ famfs_fsck_mounted(
 			return -1;
 		}
 
-		logp = calloc(1, sb->ts_log_len);
-		assert(logp);
-
-		/* Read a copy of the log */
-		rc = famfs_file_read(lfd, (char *)logp, sb->ts_log_len,
-				     __func__, "log file", verbose);
-		if (rc != 0
+		/* Read a copy of the log, and of any segments it has grown
+		 * by */
+		logp = famfs_log_read(lfd, sb->ts_log_len, lmpt, verbose);
+		if (!logp
 		    || mock_failure == MOCK_FAIL_READ_FULL_LOG
 		    || mock_failure == MOCK_FAIL_READ_LOG) {
 			close(lfd);
@@ -3108,7 +5084,8 @@ famfs_fsck_mounted(
 				"%s: error %d reading log file\n",
 				__func__, errno);
 			free(sb);
-			free(logp);
+			if (logp)
+				famfs_unmap_log(logp);
 			return -1;
 		}
 		close(lfd);
@@ -3126,12 +5103,12 @@ famfs_fsck_mounted(
 out:
 	if (use_mmap) {
 		if (logp)
-			munmap(logp, sb->ts_log_len);
+			famfs_unmap_log(logp);
 		if (sb)
 			munmap(sb, FAMFS_SUPERBLOCK_SIZE);
 	} else {
 		if (logp)
-			free(logp);
+			famfs_unmap_log(logp);
 		if (sb)
 			free(sb);
 	}
@@ -3253,7 +5230,7 @@ famfs_fsck(
 
 out_unmap:
 		if (logp)
-			munmap(logp, sb->ts_log_len);
+			famfs_unmap_log(logp);
 		if (sb)
 			munmap(sb, FAMFS_SUPERBLOCK_SIZE);
 		return rc;
@@ -3384,7 +5361,6 @@ __famfs_init_locked_log(
 {
 	char shadow[PATH_MAX];
 	char mpt[PATH_MAX];
-	void *addr = NULL;
 	size_t log_size;
 	int role;
 	int rc;
@@ -3447,14 +5423,14 @@ __famfs_init_locked_log(
 		}
 	}
 
-	addr = mmap(0, log_size, PROT_READ | PROT_WRITE, MAP_SHARED,
-		    lp->lfd, 0);
-	if (addr == MAP_FAILED) {
+	lp->logp = famfs_log_map(lp->lfd, 0, log_size,
+				 PROT_READ | PROT_WRITE, 0 /* not raw */,
+				 lp->mpt);
+	if (!lp->logp) {
 		fprintf(stderr, "%s: Failed to mmap log file\n", __func__);
 		rc = -1;
 		goto err_out;
 	}
-	lp->logp = (struct famfs_log *)addr;
 
 	if (thread_ct > 0)
 		lp->thp = thpool_init(thread_ct);
@@ -3471,9 +5447,10 @@ __famfs_init_locked_log(
 	}
 #endif
 	assert(lp->logp->famfs_log_len == log_size);
-	 /* Invalidate the processor cache for the log */
-	invalidate_processor_cache(lp->logp, log_size);
+	famfs_log_compact_recover(lp->logp);
 
+	/* If this fails, lookups go to the filesystem */
+	lp->pidx = famfs_path_index_build(lp->logp);
 
 #if (FAMFS_KABI_VERSION > 42)
 	if (FAMFS_KABI_VERSION > 42) {
@@ -3521,8 +5498,8 @@ err_out:
 		close(lp->lfd);
 	if (lp->thp)
 		famfs_thpool_destroy(lp->thp, 100000 /* 100ms */);
-	if (addr)
-		munmap(addr, log_size);
+	if (lp->logp)
+		famfs_unmap_log(lp->logp);
 	if (lp->shadow_root)
 		free(lp->shadow_root);
 	return rc;
@@ -3563,13 +5540,22 @@ famfs_release_locked_log(struct famfs_locked_log *lp, int abort, int verbose)
 
 	if (lp->bitmap)
 		free(lp->bitmap);
+	famfs_path_index_free(lp->pidx);
+	lp->pidx = NULL;
 
-	assert(lp->lfd > 0);
-	rc = flock(lp->lfd, LOCK_UN);
-	if (rc)
-		fprintf(stderr, "%s: unlock returned an error\n", __func__);
+	if (lp->master_fd > 0) {
+		/* The master service holds the lock */
+		close(lp->master_fd);
+		rc = 0;
+	} else {
+		assert(lp->lfd > 0);
+		rc = flock(lp->lfd, LOCK_UN);
+		if (rc)
+			fprintf(stderr, "%s: unlock returned an error\n",
+				__func__);
 
-	close(lp->lfd);
+		close(lp->lfd);
+	}
 	if (lp->mpt)
 		free(lp->mpt);
 	if (lp->shadow_root)
@@ -3590,6 +5576,8 @@ famfs_release_locked_log(struct famfs_locked_log *lp, int abort, int verbose)
 			printf("%s: threadpool work complete\n",
 			       __func__);	
 	}
+	if (lp->logp)
+		famfs_unmap_log(lp->logp);
 	return rc;
 }
 
@@ -3826,6 +5814,164 @@ famfs_shadow_file_create(
 	return rc;
 }
 
+/**
+ * famfs_shadow_logplay_entry() - play one log entry into a shadow tree
+ *
+ * This is the shadow-mode body of __famfs_logplay(), one entry at a time, so
+ * callers that follow the log incrementally (e.g. the famfs_fused log tailer)
+ * share it with full logplay.
+ *
+ * @shadow_root: root of the shadow file system
+ * @le:          log entry (already checksum-validated by the iterator)
+ * @ls:          stats to update (may be NULL)
+ * @dry_run:     validate and count, but create nothing
+ * @shadowtest:  re-read and check shadow yaml files
+ * @verbose:     verbose flag
+ *
+ * Returns 1 if a shadow file or directory was created, 0 if it already
+ * existed (or the entry type has no shadow representation, or dry_run),
+ * -1 on error
+ */
+int
+famfs_shadow_logplay_entry(
+	const char                    *shadow_root,
+	const struct famfs_log_entry  *le,
+	struct famfs_log_stats        *ls,
+	int                            dry_run,
+	int                            shadowtest,
+	int                            verbose)
+{
+	struct famfs_log_stats local = { 0 };
+	char fullpath[PATH_MAX];
+	char rpath[PATH_MAX];
+	struct stat st;
+	u64 created;
+	u64 j;
+	int rc;
+
+	if (!ls)
+		ls = &local;
+
+	switch (le->famfs_log_entry_type) {
+	case FAMFS_LOG_FILE: {
+		const struct famfs_log_file_meta *fm = &le->famfs_fm;
+		int skip_file = 0;
+
+		ls->f_logged++;
+
+		if (!famfs_log_entry_fc_path_is_relative(fm) || mock_path) {
+			fprintf(stderr,
+				"%s: ignoring log entry; path is not relative\n",
+				__func__);
+			ls->f_errs++;
+			skip_file++;
+		}
+
+		/* The only file that should have an extent with offset 0
+		 * is the superblock, which is not in the log.
+		 * Check for files with null offset...
+		 */
+		for (j = 0; j < fm->fm_fmap.fmap_nextents; j++) {
+			const struct famfs_simple_extent *se;
+
+			se = &fm->fm_fmap.se[j];
+
+			if (se->se_offset == 0 || mock_path) {
+				fprintf(stderr,
+					"%s: ERROR file %s "
+					"has extent with 0 offset\n",
+					__func__, fm->fm_relpath);
+				ls->f_errs++;
+				skip_file++;
+			}
+		}
+
+		if (skip_file)
+			return -1;
+
+		/* File path is based on shadow_root, which may not match
+		 * the mount point
+		 */
+		rc = snprintf(fullpath, sizeof(fullpath), "%s/%s",
+			      shadow_root, fm->fm_relpath);
+		if (rc < 0 || (size_t)rc >= sizeof(fullpath)) {
+			fprintf(stderr, "%s: path too long: %s/%s\n",
+				__func__, shadow_root, fm->fm_relpath);
+			ls->f_errs++;
+			return -1;
+		}
+		realpath(fullpath, rpath);
+
+		created = ls->f_created;
+		rc = famfs_shadow_file_create(rpath, fm, ls, dry_run,
+					      shadowtest, verbose);
+		if (rc)
+			return -1;
+		return (ls->f_created > created) ? 1 : 0;
+	}
+	case FAMFS_LOG_MKDIR: {
+		const struct famfs_log_mkdir *md = &le->famfs_md;
+
+		ls->d_logged++;
+
+		if (!famfs_log_entry_md_path_is_relative(md) || mock_path) {
+			fprintf(stderr,
+				"%s: ignoring log mkdir entry; "
+				"path is not relative\n", __func__);
+			ls->d_errs++;
+			return -1;
+		}
+
+		if (dry_run)
+			return 0;
+
+		rc = snprintf(fullpath, sizeof(fullpath), "%s/%s",
+			      shadow_root, md->md_relpath);
+		if (rc < 0 || (size_t)rc >= sizeof(fullpath)) {
+			fprintf(stderr, "%s: path too long: %s/%s\n",
+				__func__, shadow_root, md->md_relpath);
+			ls->d_errs++;
+			return -1;
+		}
+		realpath(fullpath, rpath);
+
+		if (stat(rpath, &st) == 0) {
+			if (S_ISDIR(st.st_mode)) {
+				/* This is normal for log replay */
+				if (verbose > 1)
+					fprintf(stderr, "%s: dir %s exists\n",
+						__func__, rpath);
+				ls->d_existed++;
+				return 0;
+			}
+			fprintf(stderr,
+				"%s: something (%s) exists where dir should be\n",
+				__func__, rpath);
+			ls->d_errs++;
+			return -1;
+		}
+
+		if (verbose)
+			printf("%s: creating directory %s\n",
+			       __func__, md->md_relpath);
+
+		rc = famfs_dir_create(shadow_root, (char *)md->md_relpath,
+				      md->md_mode, md->md_uid, md->md_gid);
+		if (rc) {
+			fprintf(stderr,
+				"%s: error: unable to create directory (%s)\n",
+				__func__, md->md_relpath);
+			ls->d_errs++;
+			return -1;
+		}
+		ls->d_created++;
+		return 1;
+	}
+	default:
+		return 0;
+	}
+}
+
 /**
  * __famfs_mkfile()
  *
@@ -3870,6 +6016,7 @@ __famfs_mkfile(
 	char *cwd = get_current_dir_name();
 	struct stat st;
 	int fd = -1;
+	int type;
 	int rc;
 
 	assert(lp);
@@ -3898,14 +6045,24 @@ __famfs_mkfile(
 
 	/* From here on, use target_fullpath and not filename */
 
+	if (lp->master_fd > 0) {
+		fd = famfs_master_mkfile(lp, target_fullpath, mode, uid, gid,
+					 size, open_existing, verbose);
+		goto out;
+	}
+
 	/* Don't create the destination file yet, but...
 	 * 1. File must not exist, or must be the right size
 	 * 2. Parent path must exist
 	 * 3. Parent path must be in a famfs file system
 	 * Otherwise fail
+	 * (The path index answers these without going to the filesystem,
+	 * except for reopening an existing file)
 	 */
-	if (stat(target_fullpath, &st) == 0) {
-		if (open_existing &&
+	type = famfs_path_type(lp, target_fullpath);
+	if (type != FAMFS_PATH_NONE) {
+		if (open_existing && type == FAMFS_PATH_FILE &&
+		    stat(target_fullpath, &st) == 0 &&
 		    S_ISREG(st.st_mode) && st.st_size == (long int)size) {
 			fd = open(target_fullpath, O_RDWR, mode);
 			if (fd < 0) {
@@ -3926,34 +6083,28 @@ __famfs_mkfile(
 			target_fullpath);
 		fd = -1;
 		goto out;
-	} else {
-		char *tmp_path = strdup(target_fullpath);
-		char *parent_path = dirname(tmp_path);
-
-		rc = stat(parent_path, &st);
-		free(tmp_path);
-		if (rc != 0) {
-			fprintf(stderr,
-				"%s: Error %s parent dir does not exist\n",
-				__func__, target_fullpath);
-			fd = -1;
-			goto out;
-		}
-		switch (st.st_mode & S_IFMT) {
-		case S_IFDIR:
-			break; /* all good - parent is a directory */
-		default:
-			fprintf(stderr,
-				"%s: Error %s parent exists "
-				"but is not a directory\n",
-				__func__, target_fullpath);
-			fd = -1;
-			goto out;
-		}
+	}
 
-		/* TODO: verify parent_path is in a famfs mount */
+	switch (famfs_path_parent_type(lp, target_fullpath)) {
+	case FAMFS_PATH_DIR:
+		break; /* all good - parent is a directory */
+	case FAMFS_PATH_NONE:
+		fprintf(stderr,
+			"%s: Error %s parent dir does not exist\n",
+			__func__, target_fullpath);
+		fd = -1;
+		goto out;
+	default:
+		fprintf(stderr,
+			"%s: Error %s parent exists "
+			"but is not a directory\n",
+			__func__, target_fullpath);
+		fd = -1;
+		goto out;
 	}
 
+	/* TODO: verify parent_path is in a famfs mount */
+
 	logp = lp->logp;
 	strncpy(mpt, lp->mpt, PATH_MAX - 1);
 
@@ -4061,6 +6212,7 @@ __famfs_mkfile(
 				     (verbose > 1) ? 1:0 /* dump metadata */);
 	if (rc)
 		return rc;
+	famfs_path_index_note(lp, relpath, FAMFS_PATH_FILE);
 
 
 out:
@@ -4099,7 +6251,10 @@ famfs_mkfile(
 		return -EINVAL;
 	}
 
-	rc = famfs_init_locked_log(&ll, filename, 0, verbose);
+	/* Use the master service if there is one */
+	rc = famfs_master_connect(&ll, filename, 0, verbose);
+	if (rc)
+		rc = famfs_init_locked_log(&ll, filename, 0, verbose);
 	if (rc)
 		return rc;
 
@@ -4208,6 +6363,30 @@ __famfs_mkdir(
 
 	assert(lp);
 
+	if (lp->master_fd > 0)
+		return famfs_master_mkdir(lp, dirpath, mode, uid, gid, 0,
+					  verbose);
+
+	/* If the path index knows dirpath, fullpath is already rational */
+	rc = famfs_path_index_lookup(lp, dirpath, fullpath);
+	if (rc >= 0) {
+		if (rc != FAMFS_PATH_NONE)
+			return -1; /* Already exists */
+		switch (famfs_path_parent_type(lp, fullpath)) {
+		case FAMFS_PATH_DIR:
+			goto have_fullpath;
+		case FAMFS_PATH_NONE:
+			fprintf(stderr, "%s: parent of path %s does not exist\n",
+				__func__, dirpath);
+			return -1;
+		default:
+			fprintf(stderr,
+				"%s: parent of path %s is not a directory\n",
+				__func__, dirpath);
+			return -1;
+		}
+	}
+
 	/* Rationalize dirpath; if it exists, get role based on that */
 	if (realpath(dirpath, realdirpath)) {
 		/* Error if dirpath already exists in "non -p" mkdir */
@@ -4253,6 +6432,7 @@ __famfs_mkdir(
 		goto err_out;
 	}
 
+have_fullpath:
 	strncpy(mpt_out, lp->mpt, PATH_MAX - 1);
 
 	if (verbose)
@@ -4281,6 +6461,8 @@ __famfs_mkdir(
 
 	/* Should it be logged before it's locally created? */
 	rc = famfs_log_dir_creation(lp->logp, relpath, mode, uid, gid);
+	if (rc == 0)
+		famfs_path_index_note(lp, relpath, FAMFS_PATH_DIR);
 
 err_out:
 	if (dirdupe)
@@ -4308,7 +6490,10 @@ famfs_mkdir(
 	else
 		snprintf(abspath, PATH_MAX - 1, "%s/%s", cwd, dirpath);
 
-	rc = famfs_init_locked_log(&ll, abspath, 0, verbose);
+	/* Use the master service if there is one */
+	rc = famfs_master_connect(&ll, abspath, 0, verbose);
+	if (rc)
+		rc = famfs_init_locked_log(&ll, abspath, 0, verbose);
 	if (rc) {
 		free(cwd);
 		return rc;
@@ -4321,6 +6506,56 @@ famfs_mkdir(
 	return rc;
 }
 
+/**
+ * famfs_compact()
+ *
+ * Compact the log of the famfs instance that contains @path
+ * (see famfs_log_compact()). Must be run on the master.
+ */
+int
+famfs_compact(
+	const char *path,
+	int         verbose)
+{
+	struct famfs_locked_log ll;
+	int rc;
+
+	rc = famfs_init_locked_log(&ll, path, 0, verbose);
+	if (rc)
+		return rc;
+
+	rc = famfs_sb_require_minor(&ll, FAMFS_OMF_MINOR_CHECKPOINT, verbose);
+	if (!rc)
+		rc = famfs_log_compact(ll.logp, verbose);
+
+	famfs_release_locked_log(&ll, 0, verbose);
+	return rc;
+}
+
+/**
+ * famfs_grow_log()
+ *
+ * Grow the log of the famfs instance that contains @path by another
+ * segment (see famfs_log_grow()). Must be run on the master.
+ */
+int
+famfs_grow_log(
+	const char *path,
+	int         verbose)
+{
+	struct famfs_locked_log ll;
+	int rc;
+
+	rc = famfs_init_locked_log(&ll, path, 0, verbose);
+	if (rc)
+		return rc;
+
+	rc = famfs_log_grow(&ll, verbose);
+
+	famfs_release_locked_log(&ll, 0, verbose);
+	return rc;
+}
+
 /**
  * famfs_make_parent_dir()
  *
@@ -4335,7 +6570,7 @@ famfs_mkdir(
  * @gid
  * @depth
  */
-static int
+int
 famfs_make_parent_dir(
 	struct famfs_locked_log *lp,
 	const char *path,
@@ -4347,22 +6582,22 @@ famfs_make_parent_dir(
 {
 	char *dirdupe = strdup(path);
 	char *parentdir;
-	struct stat st;
 	int rc;
 
 	assert(lp);
 
 	/* Does path already exist? */
-	if (stat(path, &st) == 0) {
+	switch (famfs_path_type(lp, path)) {
+	case FAMFS_PATH_NONE:
+		break;
+	case FAMFS_PATH_DIR:
 		free(dirdupe);
-		switch (st.st_mode & S_IFMT) {
-		case S_IFDIR:
-			return 0;
-		default:
-			fprintf(stderr, "%s: path %s is not a directory\n",
-				__func__, path);
-			return -1;
-		}
+		return 0;
+	default:
+		free(dirdupe);
+		fprintf(stderr, "%s: path %s is not a directory\n",
+			__func__, path);
+		return -1;
 	}
 
 	/* get parent path */
@@ -4422,8 +6657,11 @@ famfs_mkdir_parents(
 		return -1;
 	}
 
-	/* OK, we know were in a FAMFS instance. get a locked log struct */
-	rc = famfs_init_locked_log(&ll, rpath, 0, verbose);
+	/* OK, we know were in a FAMFS instance. get a locked log struct
+	 * (or use the master service if there is one) */
+	rc = famfs_master_connect(&ll, rpath, 0, verbose);
+	if (rc)
+		rc = famfs_init_locked_log(&ll, rpath, 0, verbose);
 	if (rc) {
 		free(rpath);
 		return rc;
@@ -4431,7 +6669,12 @@ famfs_mkdir_parents(
 
 	/* Now recurse up fromm abspath till we find an existing parent,
 	 * and mkdir back down */
-	rc = famfs_make_parent_dir(&ll, abspath, mode, uid, gid, 0, verbose);
+	if (ll.master_fd > 0)
+		rc = famfs_master_mkdir(&ll, abspath, mode, uid, gid,
+					1 /* parents */, verbose);
+	else
+		rc = famfs_make_parent_dir(&ll, abspath, mode, uid, gid, 0,
+					   verbose);
 
 	/* Separate function should release ll and lock */
 	famfs_release_locked_log(&ll, 0, verbose);
@@ -4854,8 +7097,9 @@ famfs_cp(struct famfs_locked_log *lp,
 	 int                      verbose)
 {
 	char actual_destfile[PATH_MAX] = { 0 };
-	struct stat deststat;
-	int rc;
+	char realdest[PATH_MAX];
+	int indexed;
+	int type;
 
 	assert(lp);
 
@@ -4864,12 +7108,14 @@ famfs_cp(struct famfs_locked_log *lp,
 	 * * A non-existing path whose parent directory is in famfs
 	 * * An existing path to a directory in famfs
 	 */
-	rc = stat(destfile, &deststat);
-	if (!rc) {
-		switch (deststat.st_mode & S_IFMT) {
-		case S_IFDIR: {
+	type = famfs_path_index_lookup(lp, destfile, realdest);
+	indexed = (type >= 0);
+	if (!indexed)
+		type = famfs_path_type(lp, destfile);
+	if (type != FAMFS_PATH_NONE) {
+		switch (type) {
+		case FAMFS_PATH_DIR: {
 			char destpath[PATH_MAX];
-			char realdest[PATH_MAX];
 			char src[PATH_MAX];
 
 			if (verbose > 1)
@@ -4881,8 +7127,10 @@ famfs_cp(struct famfs_locked_log *lp,
 			 * Use realdest (not destfile) in the snprintf so that
 			 * a trailing slash on destfile doesn't produce a
 			 * double-slash path that breaks relpath extraction.
+			 * (If the path index knew destfile, realdest already
+			 * holds its rational path.)
 			 */
-			if (realpath(destfile, realdest) == 0 ||
+			if ((!indexed && realpath(destfile, realdest) == 0) ||
 					mock_failure == MOCK_FAIL_GENERIC) {
 				fprintf(stderr,
 					"%s: failed to rationalize dest path "
@@ -4944,7 +7192,6 @@ int famfs_cp_dir(
 {
 	struct dirent *entry;
 	DIR *directory;
-	struct stat st;
 	int rc;
 	int err = 0;
 
@@ -4953,8 +7200,7 @@ int famfs_cp_dir(
 		printf("%s: (%s) -> (%s)\n", __func__, src, dest);
 
 	/* Does the dest dir exist? */
-	rc = stat(dest, &st);
-	if (rc) {
+	if (famfs_path_type(lp, dest) == FAMFS_PATH_NONE) {
 		/* The directory doesn't exist yet */
 		rc = __famfs_mkdir(lp, dest, mode, uid, gid, verbose);
 		if (rc) {
@@ -5176,7 +7422,11 @@ famfs_cp_multi(
 		}
 	}
 
-	rc = famfs_init_locked_log(&ll, dest_parent_path, thread_ct, verbose);
+	/* Use the master service if there is one */
+	rc = famfs_master_connect(&ll, dest_parent_path, thread_ct, verbose);
+	if (rc)
+		rc = famfs_init_locked_log(&ll, dest_parent_path, thread_ct,
+					   verbose);
 	if (rc) {
 		free(dest_parent_path);
 		free(dirdupe);
@@ -5497,6 +7747,9 @@ err_out:
  * This handller can be called by unit tests; the actual device open/mmap is
  * done by the caller, so an alternate caller can arrange for a superblock
  * and log to be written to alternate files/locations.
+ *
+ * @packed_log: make a packed log (variable-length entries; see
+ *              struct famfs_log_packed) rather than an array of entries
  */
 int
 __famfs_mkfs(const char              *daxdev,
@@ -5505,7 +7758,8 @@ __famfs_mkfs(const char              *daxdev,
 	     u64                      log_len,
 	     u64                      device_size,
 	     int                      force,
-	     int                      kill)
+	     int                      kill,
+	     bool                     packed_log)
 
 {
 	int rc;
@@ -5547,7 +7801,9 @@ __famfs_mkfs(const char              *daxdev,
 	sb->ts_log_len    = log_len;
 	sb->ts_alloc_unit = FAMFS_ALLOC_UNIT; /* Future: make configurable */
 	sb->ts_omf_ver_major = FAMFS_OMF_VER_MAJOR;
-	sb->ts_omf_ver_minor = FAMFS_OMF_VER_MINOR;
+	/* The oldest minor that can read the log we are about to make */
+	sb->ts_omf_ver_minor = packed_log ? FAMFS_OMF_MINOR_PACKED
+					  : FAMFS_OMF_MINOR_BASE;
 	famfs_uuidgen(&sb->ts_uuid);
 
 	/* Check for bad / non-writable daxdev */
@@ -5579,6 +7835,13 @@ __famfs_mkfs(const char              *daxdev,
 	logp->famfs_log_last_index = (((log_len - offsetof(struct famfs_log,
 							   entries))
 				      / sizeof(struct famfs_log_entry)) - 1);
+	if (packed_log) {
+		/* Here the last index is the last byte of pl_entries */
+		logp->famfs_log_magic = FAMFS_LOG_MAGIC_PACKED;
+		logp->famfs_log_last_index = log_len -
+			offsetof(struct famfs_log, entries) -
+			offsetof(struct famfs_log_packed, pl_entries) - 1;
+	}
 
 	logp->famfs_log_crc = famfs_gen_log_header_crc(logp);
 
@@ -5648,6 +7911,7 @@ famfs_mkfs_via_dummy_mount(
 	int         kill,
 	int         force,
 	bool        set_daxmode,
+	bool        packed_log,
 	int         verbose)
 {
 	struct famfs_superblock *sb = NULL;
@@ -5745,14 +8009,12 @@ famfs_mkfs_via_dummy_mount(
 		goto out_umount;
 	}
 
-	rc = __famfs_mkfs(daxdev, sb, logp, log_len, devsize_out, force, kill);
+	rc = __famfs_mkfs(daxdev, sb, logp, log_len, devsize_out, force, kill,
+			  packed_log);
 
 out_umount:
-	if (logp) {
-		int rc2 = munmap(logp, log_len);
-		if (rc2)
-			fprintf(stderr, "%s: failed to unmap log\n", __func__);
-	}
+	if (logp)
+		famfs_unmap_log(logp);
 	if (sb) {
 		int rc2 = munmap(sb, FAMFS_SUPERBLOCK_SIZE);
 		if (rc2)
@@ -5775,7 +8037,8 @@ famfs_mkfs_rawdev(
 	const char *daxdev,
 	u64         log_len, /* already validated */
 	int         kill,
-	int         force)
+	int         force,
+	bool        packed_log)
 {
 	struct famfs_superblock *sb;
 	enum famfs_system_role role;
@@ -5815,19 +8078,16 @@ famfs_mkfs_rawdev(
 	if (rc)
 		return -1;
 
-	rc = __famfs_mkfs(daxdev, sb, logp, log_len, devsize_out, force, kill);
+	rc = __famfs_mkfs(daxdev, sb, logp, log_len, devsize_out, force, kill,
+			  packed_log);
 	if (sb) {
 		int rc2 = munmap(sb, FAMFS_SUPERBLOCK_SIZE);
 		if (rc2)
 			fprintf(stderr, "%s: failed to unmap superblock\n",
 				__func__);
 	}		
-	if (logp) {
-		int rc2 = munmap(logp, log_len);
-		if (rc2)
-			fprintf(stderr, "%s: failed to unmap log\n",
-				__func__);
-	}
+	if (logp)
+		famfs_unmap_log(logp);
 	return rc;
 }
 
@@ -5839,6 +8099,7 @@ famfs_mkfs(
 	bool        nodax_in,
 	int         force,
 	bool        set_daxmode,
+	bool        packed_log,
 	int         verbose)
 {
 	bool no_raw_dax = nodax_in || famfs_daxmode_required();
@@ -5853,9 +8114,11 @@ famfs_mkfs(
 
 	if (no_raw_dax)
 		rc = famfs_mkfs_via_dummy_mount(daxdev, log_len, kill, force,
-						set_daxmode, verbose);
+						set_daxmode, packed_log,
+						verbose);
 	else
-		rc = famfs_mkfs_rawdev(daxdev, log_len, kill, force);
+		rc = famfs_mkfs_rawdev(daxdev, log_len, kill, force,
+				       packed_log);
 
 	return rc;
 }
@@ -99,6 +99,11 @@ int famfs_mkmeta_standalone(const char *devname, int verbose);
 int __famfs_mkmeta_superblock(const char *mpt, int shadow, int verbose);
 int __famfs_mkmeta_log(const char *mpt, u64 log_offset, u64 log_size,
 		   enum famfs_system_role role, int shadow, int verbose);
+int __famfs_mkmeta_log_segs(const char *mpt, const struct famfs_log *logp,
+			    enum famfs_system_role role, int shadow,
+			    int verbose);
+int famfs_mkmeta_log_segs(const char *mpt, enum famfs_system_role role,
+			  int verbose);
 
 int famfs_logplay(
 	const char *mpt, int use_mmap, int dry_run, int client_mode,
@@ -106,6 +111,9 @@ int famfs_logplay(
 int famfs_dax_shadow_logplay(
 	const char *shadowpath, int dry_run, int client_mode, const char *daxdev,
 	int testmode, bool set_daxmode, int verbose);
+int famfs_mmap_log_raw_ro(const char *devname, struct famfs_superblock **sbp,
+			  struct famfs_log **logp);
+void famfs_unmap_log(struct famfs_log *logp);
 
 int famfs_mkfile(const char *filename, mode_t mode,
 		 uid_t uid, gid_t gid, size_t size,
@@ -119,13 +127,20 @@ int famfs_clone(const char *srcfile, const char *destfile);
 int famfs_mkdir(const char *dirpath, mode_t mode, uid_t uid, gid_t gid, int verbose);
 int famfs_mkdir_parents(const char *dirpath, mode_t mode, uid_t uid, gid_t gid, int verbose);
 int famfs_mkfs(const char *daxdev, u64 log_len, int kill, bool nodax,
-	int force, bool set_daxmode, int verbose);
+	int force, bool set_daxmode, bool packed_log, int verbose);
 int famfs_check(const char *path, int verbose);
+int famfs_compact(const char *path, int verbose);
+int famfs_grow_log(const char *path, int verbose);
 
 int famfs_flush_file(const char *filename, int verbose);
 
 int file_not_famfs(const char *fname);
 
+/* famfs_master.c */
+#define FAMFS_MASTER_DIR "/run/famfs" /* Overridden by $FAMFS_MASTER_DIR */
+int famfs_master_serve(const char *path, int verbose);
+void famfs_master_stop(void);
+
 /* famfs_misc.c */
 void famfs_uuidgen(uuid_le *uuid);
 s64 get_multiplier(const char *endptr);
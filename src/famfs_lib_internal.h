@@ -30,6 +30,8 @@ enum mock_failure {
 	MOCK_FAIL_MMAP,
 };
 
+struct famfs_path_index;
+
 struct famfs_locked_log {
 	s64               devsize;
 	struct famfs_log *logp;
@@ -53,6 +55,51 @@ struct famfs_locked_log {
 	struct thpool_ *thp;
 	char *mpt;
 	char *shadow_root;
+	/* The namespace per the log; built when the session starts (see
+	 * famfs_path_index_lookup()) */
+	struct famfs_path_index *pidx;
+	/* If set, this session forwards creations to the master service
+	 * (famfs_master.c), which holds the log; logp etc. are not set up */
+	int master_fd;
+};
+
+enum famfs_path_type {
+	FAMFS_PATH_NONE = 0,
+	FAMFS_PATH_FILE,
+	FAMFS_PATH_DIR,
+};
+
+/*
+ * Master service protocol (famfs_master.c): the client sends a request and
+ * waits for the reply. A successful FAMFS_MASTER_MKFILE reply has rc 1 and
+ * carries the new file's descriptor (SCM_RIGHTS); otherwise rc is what
+ * __famfs_mkfile(), __famfs_mkdir() or famfs_make_parent_dir() returned.
+ */
+#define FAMFS_MASTER_MAGIC 0x5253544d /* "MTSR" */
+
+enum famfs_master_op {
+	FAMFS_MASTER_MKFILE = 1,
+	FAMFS_MASTER_MKDIR,
+	FAMFS_MASTER_MKDIR_P,
+};
+
+#define FAMFS_MASTER_OPEN_EXISTING (1 << 0)
+
+struct famfs_master_req {
+	u32 magic;
+	u32 op;             /* enum famfs_master_op */
+	u32 mode;
+	u32 uid;
+	u32 gid;
+	u32 flags;
+	u64 size;           /* FAMFS_MASTER_MKFILE */
+	struct famfs_interleave_param interleave_param; /* All 0: default */
+	char path[PATH_MAX]; /* Absolute */
+};
+
+struct famfs_master_rsp {
+	u32 magic;
+	int32_t rc;
 };
 
 struct famfs_log_stats {
@@ -70,17 +117,78 @@ struct famfs_log_stats {
 	u64 yaml_checked;
 };
 
+/*
+ * Log reader: walks the log entries in order, including the records of a
+ * checkpoint (see struct famfs_log_checkpoint), which come out as the
+ * entries they replaced. Readers that follow a live log keep one of these
+ * across polls; famfs_log_iter_stale() says when a compaction means they
+ * must start over.
+ */
+struct famfs_log_iter {
+	const struct famfs_log *logp;
+	u64 index;          /* Next log entry slot */
+	u64 seq_base;       /* Seqnum of the checkpoint, if any */
+	u64 nread;          /* Entries returned so far */
+	u64 len;            /* Bytes of the log that are mapped */
+	const u8 *pos;      /* Next entry, in a packed log */
+	const u8 *ck_pos;   /* Next checkpoint record */
+	const u8 *ck_end;
+	int ck_pending;     /* Checkpoint found but records not yet loaded */
+	int have_ck;
+	struct famfs_log_checkpoint ck;
+};
+
 /*
  * Exported for internal use
  */
+/* famfs_lib.c */
+void famfs_log_iter_init(struct famfs_log_iter *it,
+			 const struct famfs_log *logp);
+int famfs_log_iter_next(struct famfs_log_iter *it, struct famfs_log_entry *le);
+void famfs_log_iter_skip(struct famfs_log_iter *it);
+void famfs_log_iter_invalidate(const struct famfs_log_iter *it);
+int famfs_log_iter_stale(const struct famfs_log_iter *it);
+int famfs_log_compact(struct famfs_log *logp, int verbose);
+int famfs_shadow_logplay_entry(const char *shadow_root,
+			       const struct famfs_log_entry *le,
+			       struct famfs_log_stats *ls, int dry_run,
+			       int shadowtest, int verbose);
+struct famfs_log *famfs_map_log_by_path(const char *path, int read_only,
+					bool check_log,
+					enum lock_opt lockopt);
+u32 famfs_log_follow_chain(const struct famfs_log *logp);
+u64 famfs_log_mapped_len(const struct famfs_log *logp);
+int famfs_sb_require_minor(struct famfs_locked_log *lp, u32 minor,
+			   int verbose);
+int famfs_log_grow(struct famfs_locked_log *lp, int verbose);
+int famfs_path_index_lookup(struct famfs_locked_log *lp, const char *path,
+			    char *fullpath);
+int famfs_make_parent_dir(struct famfs_locked_log *lp, const char *path,
+			  mode_t mode, uid_t uid, gid_t gid, int depth,
+			  int verbose);
+
+/* famfs_master.c */
+int famfs_master_sock_path(const char *mpt, char *path, size_t len);
+int famfs_master_connect(struct famfs_locked_log *lp, const char *fspath,
+			 int thread_ct, int verbose);
+int famfs_master_mkfile(struct famfs_locked_log *lp, const char *filename,
+			mode_t mode, uid_t uid, gid_t gid, size_t size,
+			int open_existing, int verbose);
+int famfs_master_mkdir(struct famfs_locked_log *lp, const char *dirpath,
+		       mode_t mode, uid_t uid, gid_t gid, int parents,
+		       int verbose);
+
 /* famfs_alloc.c */
 u8 *famfs_build_bitmap(
 	const struct famfs_log *logp, const u64 alloc_unit, u64 dev_size_in,
 	u64 *bitmap_nbits_out, u64 *alloc_errors_out, u64 *size_total_out,
 	u64 *alloc_total_out, struct famfs_log_stats *log_stats_out,
 	int verbose);
+u64 famfs_bitmap_add_file(u8 *bitmap, const u64 alloc_unit,
+			  const struct famfs_log_file_meta *fm, u64 *alloc_sum);
 int famfs_file_alloc(struct famfs_locked_log *lp, u64 size,
 		     struct famfs_log_fmap **fmap_out, int verbose);
+s64 famfs_log_seg_alloc(struct famfs_locked_log *lp, u64 len, int verbose);
 void mu_print_bitmap(u8 *bitmap, int num_bits);
 int famfs_validate_interleave_param(
 		struct famfs_interleave_param *interleave_param,
@@ -112,6 +220,8 @@ struct famfs_bitmap_stats {
 };
 void mu_bitmap_range_stats(u8 *bitmap, u64 start, u64 end, /* exclusive */
 			   struct famfs_bitmap_stats *bs);
+void put_sb_log_into_bitmap(u8 *bitmap, const u64 alloc_unit,
+			    const struct famfs_log *logp, u64 *alloc_sum);
 
 /*
  * Only exported for unit tests
@@ -121,7 +231,8 @@ int __file_is_famfs_v1(int fd);
 unsigned long famfs_gen_superblock_crc(const struct famfs_superblock *sb);
 unsigned long famfs_gen_log_header_crc(const struct famfs_log *logp);
 int __famfs_mkfs(const char *daxdev, struct famfs_superblock *sb, struct famfs_log *logp,
-		 u64 log_len, u64 device_size, int force, int kill);
+		 u64 log_len, u64 device_size, int force, int kill,
+		 bool packed_log);
 int __open_relpath(const char *path, const char *relpath, int read_only, size_t *size_out, ssize_t size_in,
 		   char *mpt_out, enum lock_opt lockopt, int no_fscheck);
 int __famfs_cp(struct famfs_locked_log  *lp, const char *srcfile, const char *destfile,
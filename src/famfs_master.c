@@ -0,0 +1,633 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2026 Micron Technology, Inc.  All rights reserved.
+ */
+
+/*
+ * famfs master service
+ *
+ * Each famfs creat, mkdir or cp on the master sets up a locked-log session
+ * of its own (famfs_init_locked_log()): it validates the superblock, takes
+ * the log lock, maps the log, parses .alloc.cfg, and then rebuilds the
+ * allocation bitmap and the path index - only to create a few files.
+ * 'famfs master' holds one session open and serves create and mkdir requests
+ * from those commands over a unix socket, so that cost is paid once rather
+ * than per command.
+ *
+ * The service is optional. A command that finds no service for its mount
+ * sets up its own session, as before. While the service runs it holds the
+ * log lock, so commands that need the log itself (compact, growlog, ...)
+ * wait for it to exit.
+ *
+ * A new file goes back to the client as an open file descriptor
+ * (SCM_RIGHTS), so famfs cp still copies the data itself.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+
+#include "famfs_meta.h"
+#include "famfs_lib.h"
+#include "famfs_lib_internal.h"
+#include "thpool.h"
+
+#define FAMFS_MASTER_MAX_CLIENTS 64
+/* A client gets this long to deliver a whole request once it has started
+ * sending, or to take its reply; the service holds the log lock meanwhile */
+#define FAMFS_MASTER_CLIENT_TIMEOUT_MS 1000
+
+static volatile sig_atomic_t famfs_master_stopping;
+
+/**
+ * famfs_master_sock_path()
+ *
+ * The service socket for the famfs instance mounted at @mpt is
+ * <dir>/master.<hash of @mpt>.sock, where <dir> is $FAMFS_MASTER_DIR if that
+ * is set, else FAMFS_MASTER_DIR.
+ *
+ * Returns 0, or -ENAMETOOLONG if the path won't fit in @len or in a
+ * sockaddr_un
+ */
+int
+famfs_master_sock_path(const char *mpt, char *path, size_t len)
+{
+	struct sockaddr_un sa;
+	const char *dir = getenv("FAMFS_MASTER_DIR");
+	u64 h = 0xcbf29ce484222325ULL; /* FNV-1a */
+	const char *p;
+	int n;
+
+	if (!dir || !*dir)
+		dir = FAMFS_MASTER_DIR;
+	for (p = mpt; *p; p++) {
+		h ^= (unsigned char)*p;
+		h *= 0x100000001b3ULL;
+	}
+	n = snprintf(path, len, "%s/master.%016llx.sock", dir,
+		     (unsigned long long)h);
+	if (n < 0 || (size_t)n >= len || (size_t)n >= sizeof(sa.sun_path))
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+static int
+famfs_master_sock_connect(const char *sock_path)
+{
+	struct sockaddr_un sa = { 0 };
+	size_t len = strlen(sock_path);
+	int fd;
+
+	if (len >= sizeof(sa.sun_path))
+		return -ENAMETOOLONG;
+	sa.sun_family = AF_UNIX;
+	memcpy(sa.sun_path, sock_path, len + 1);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Client side
+ */
+
+/**
+ * famfs_master_connect()
+ *
+ * If a master service is running for the famfs instance that contains
+ * @fspath, set up @lp as a session that forwards its creations to the
+ * service: __famfs_mkfile(), __famfs_mkdir() and famfs_mkdir_parents() send
+ * requests instead of touching the log. Such a session has no log mapping;
+ * it is released with famfs_release_locked_log() as usual.
+ *
+ * @lp:        locked_log structure (mandatory)
+ * @fspath:    Any path within the famfs mount (need not exist yet)
+ * @thread_ct: Threadpool count; 0=none
+ * @verbose:
+ *
+ * Returns 0 if connected; otherwise -1, and the caller should set up its own
+ * session with famfs_init_locked_log()
+ */
+int
+famfs_master_connect(
+	struct famfs_locked_log *lp,
+	const char              *fspath,
+	int                      thread_ct,
+	int                      verbose)
+{
+	char sock_path[PATH_MAX];
+	char mpt[PATH_MAX] = { 0 };
+	const char *dir;
+	struct stat st;
+	int sfd;
+	int fd;
+
+	memset(lp, 0, sizeof(*lp));
+
+	/* Cheap check first: no service has ever run here */
+	dir = getenv("FAMFS_MASTER_DIR");
+	if (stat((dir && *dir) ? dir : FAMFS_MASTER_DIR, &st))
+		return -1;
+
+	sfd = __open_relpath(fspath, SB_FILE_RELPATH, 1, NULL, -1, mpt,
+			     NO_LOCK, 1);
+	if (sfd < 0)
+		return -1;
+	close(sfd);
+
+	if (famfs_master_sock_path(mpt, sock_path, sizeof(sock_path)))
+		return -1;
+	fd = famfs_master_sock_connect(sock_path);
+	if (fd < 0)
+		return -1;
+
+	lp->master_fd = fd;
+	lp->mpt = strdup(mpt);
+	lp->famfs_type = file_is_famfs(fspath);
+	if (thread_ct > 0)
+		lp->thp = thpool_init(thread_ct);
+	if (verbose)
+		printf("%s: using master service at %s\n", __func__, sock_path);
+	return 0;
+}
+
+/* Send @req and wait for the reply; a file descriptor that comes with the
+ * reply is returned in @fd_out */
+static int
+famfs_master_call(
+	struct famfs_locked_log *lp,
+	struct famfs_master_req *req,
+	int                     *fd_out)
+{
+	char cbuf[CMSG_SPACE(sizeof(int))] = { 0 };
+	struct famfs_master_rsp rsp = { 0 };
+	struct iovec iov = { &rsp, sizeof(rsp) };
+	struct msghdr msg = { 0 };
+	struct cmsghdr *cmsg;
+	ssize_t n;
+
+	req->magic = FAMFS_MASTER_MAGIC;
+	n = send(lp->master_fd, req, sizeof(*req), MSG_NOSIGNAL);
+	if (n != sizeof(*req)) {
+		fprintf(stderr, "%s: failed to send request (errno=%d)\n",
+			__func__, errno);
+		return -EIO;
+	}
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	n = recvmsg(lp->master_fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+	if (n != sizeof(rsp) || rsp.magic != FAMFS_MASTER_MAGIC) {
+		fprintf(stderr, "%s: no reply from master service\n", __func__);
+		return -EIO;
+	}
+
+	if (fd_out)
+		*fd_out = -1;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		if (fd_out)
+			memcpy(fd_out, CMSG_DATA(cmsg), sizeof(int));
+		else
+			close(*(int *)CMSG_DATA(cmsg));
+	}
+	return rsp.rc;
+}
+
+/* Requests carry absolute paths, since the service has its own cwd */
+static int
+famfs_master_req_path(struct famfs_master_req *req, const char *path)
+{
+	char cwd[PATH_MAX];
+	int n;
+
+	if (path[0] == '/') {
+		n = snprintf(req->path, sizeof(req->path), "%s", path);
+	} else {
+		if (!getcwd(cwd, sizeof(cwd)))
+			return -errno;
+		n = snprintf(req->path, sizeof(req->path), "%s/%s", cwd, path);
+	}
+	return (n < 0 || (size_t)n >= sizeof(req->path)) ? -ENAMETOOLONG : 0;
+}
+
+/**
+ * famfs_master_mkfile()
+ *
+ * __famfs_mkfile() through the master service; the return value is the same.
+ */
+int
+famfs_master_mkfile(
+	struct famfs_locked_log *lp,
+	const char              *filename,
+	mode_t                   mode,
+	uid_t                    uid,
+	gid_t                    gid,
+	size_t                   size,
+	int                      open_existing,
+	int                      verbose)
+{
+	struct famfs_master_req req = { 0 };
+	int fd = -1;
+	int rc;
+
+	assert(lp->master_fd > 0);
+
+	rc = famfs_master_req_path(&req, filename);
+	if (rc)
+		return rc;
+	req.op = FAMFS_MASTER_MKFILE;
+	req.mode = mode;
+	req.uid = uid;
+	req.gid = gid;
+	req.size = size;
+	if (open_existing)
+		req.flags |= FAMFS_MASTER_OPEN_EXISTING;
+	req.interleave_param = lp->interleave_param;
+
+	rc = famfs_master_call(lp, &req, &fd);
+	if (rc <= 0) {
+		fprintf(stderr, "%s: master service failed to create %s "
+			"(rc=%d)\n", __func__, req.path, rc);
+		if (fd >= 0)
+			close(fd);
+		return rc;
+	}
+	if (fd < 0) {
+		fprintf(stderr, "%s: no file descriptor for %s\n",
+			__func__, req.path);
+		return -EIO;
+	}
+	if (verbose)
+		printf("%s: created %s\n", __func__, req.path);
+	return fd;
+}
+
+/**
+ * famfs_master_mkdir()
+ *
+ * __famfs_mkdir() (or, with @parents, famfs_mkdir_parents()) through the
+ * master service; the return value is the same.
+ */
+int
+famfs_master_mkdir(
+	struct famfs_locked_log *lp,
+	const char              *dirpath,
+	mode_t                   mode,
+	uid_t                    uid,
+	gid_t                    gid,
+	int                      parents,
+	int                      verbose)
+{
+	struct famfs_master_req req = { 0 };
+	int rc;
+
+	assert(lp->master_fd > 0);
+
+	rc = famfs_master_req_path(&req, dirpath);
+	if (rc)
+		return rc;
+	req.op = (parents) ? FAMFS_MASTER_MKDIR_P : FAMFS_MASTER_MKDIR;
+	req.mode = mode;
+	req.uid = uid;
+	req.gid = gid;
+
+	rc = famfs_master_call(lp, &req, NULL);
+	if (rc)
+		fprintf(stderr, "%s: master service failed to create %s "
+			"(rc=%d)\n", __func__, req.path, rc);
+	else if (verbose)
+		printf("%s: created %s\n", __func__, req.path);
+	return rc;
+}
+
+/*
+ * Service side
+ */
+
+static void
+famfs_master_sighandler(int sig)
+{
+	(void)sig;
+	famfs_master_stopping = 1;
+}
+
+/**
+ * famfs_master_stop()
+ *
+ * Ask famfs_master_serve() to return; it notices within 100ms.
+ */
+void
+famfs_master_stop(void)
+{
+	famfs_master_stopping = 1;
+}
+
+static int
+famfs_master_reply(int cfd, int rc, int fd)
+{
+	struct famfs_master_rsp rsp = { .magic = FAMFS_MASTER_MAGIC, .rc = rc };
+	char cbuf[CMSG_SPACE(sizeof(int))] = { 0 };
+	struct iovec iov = { &rsp, sizeof(rsp) };
+	struct msghdr msg = { 0 };
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (fd > 0) {
+		struct cmsghdr *cmsg;
+
+		msg.msg_control = cbuf;
+		msg.msg_controllen = sizeof(cbuf);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+	if (sendmsg(cfd, &msg, MSG_NOSIGNAL) != sizeof(rsp))
+		return -1;
+	return 0;
+}
+
+/* Serve one request from @cfd. Returns 0, or -1 if the client has gone
+ * away (or broke the protocol) and should be dropped */
+static int
+famfs_master_serve_one(struct famfs_locked_log *lp, int cfd, int verbose)
+{
+	struct famfs_interleave_param saved = lp->interleave_param;
+	struct famfs_master_req req;
+	int fd = -1;
+	ssize_t n;
+	int rc;
+
+	/* Bounded by SO_RCVTIMEO (famfs_master_client_setup()) */
+	n = recv(cfd, &req, sizeof(req), MSG_WAITALL);
+	if (n != sizeof(req)) {
+		if (n > 0 || (n < 0 && (errno == EAGAIN ||
+					errno == EWOULDBLOCK)))
+			fprintf(stderr, "%s: dropping client: incomplete "
+				"request (%zd of %zu bytes)\n", __func__,
+				(n > 0) ? n : 0, sizeof(req));
+		return -1;
+	}
+	if (req.magic != FAMFS_MASTER_MAGIC) {
+		fprintf(stderr, "%s: bad request magic\n", __func__);
+		return -1;
+	}
+	req.path[sizeof(req.path) - 1] = '\0';
+	if (req.path[0] != '/') {
+		fprintf(stderr, "%s: relative path %s\n", __func__, req.path);
+		return famfs_master_reply(cfd, -EINVAL, -1);
+	}
+
+	switch (req.op) {
+	case FAMFS_MASTER_MKFILE:
+		if (req.size == 0) {
+			rc = -EINVAL;
+			break;
+		}
+		/* Per-request allocation parameters override the config */
+		if (req.interleave_param.nbuckets ||
+		    req.interleave_param.nstrips ||
+		    req.interleave_param.chunk_size)
+			lp->interleave_param = req.interleave_param;
+		fd = __famfs_mkfile(lp, req.path, req.mode, req.uid, req.gid,
+				    req.size,
+				    !!(req.flags & FAMFS_MASTER_OPEN_EXISTING),
+				    verbose);
+		lp->interleave_param = saved;
+		rc = (fd > 0) ? 1 : fd;
+		break;
+	case FAMFS_MASTER_MKDIR:
+		rc = __famfs_mkdir(lp, req.path, req.mode, req.uid, req.gid,
+				   verbose);
+		break;
+	case FAMFS_MASTER_MKDIR_P:
+		rc = famfs_make_parent_dir(lp, req.path, req.mode, req.uid,
+					   req.gid, 0, verbose);
+		break;
+	default:
+		fprintf(stderr, "%s: bad request op %u\n", __func__, req.op);
+		rc = -EINVAL;
+		break;
+	}
+	if (verbose)
+		printf("%s: op %u %s: rc %d\n", __func__, req.op, req.path, rc);
+
+	rc = famfs_master_reply(cfd, rc, fd);
+	if (fd > 0)
+		close(fd);
+	return rc;
+}
+
+/* Only root and the service's own user may create files through it */
+static int
+famfs_master_peer_ok(int cfd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(cfd, SOL_SOCKET, SO_PEERCRED, &cred, &len))
+		return 0;
+	return cred.uid == 0 || cred.uid == geteuid();
+}
+
+/* Only serve a client that may create files, and bound the time it can keep
+ * the service (and the log lock) waiting on it */
+static int
+famfs_master_client_setup(int cfd)
+{
+	struct timeval tv = {
+		.tv_sec = FAMFS_MASTER_CLIENT_TIMEOUT_MS / 1000,
+		.tv_usec = (FAMFS_MASTER_CLIENT_TIMEOUT_MS % 1000) * 1000,
+	};
+
+	if (!famfs_master_peer_ok(cfd))
+		return -1;
+	if (setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) ||
+	    setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv))) {
+		fprintf(stderr, "%s: unable to set client timeouts "
+			"(errno=%d)\n", __func__, errno);
+		return -1;
+	}
+	return 0;
+}
+
+/* Bind under a temporary name and rename into place once listening, so a
+ * client never finds a socket that refuses connections */
+static int
+famfs_master_listen(const char *sock_path)
+{
+	struct sockaddr_un sa = { 0 };
+	char tmp_path[sizeof(sa.sun_path)];
+	int lfd;
+	int n;
+
+	n = snprintf(tmp_path, sizeof(tmp_path), "%s.%d", sock_path, getpid());
+	if (n < 0 || (size_t)n >= sizeof(tmp_path)) {
+		fprintf(stderr, "%s: socket path %s.%d too long\n",
+			__func__, sock_path, getpid());
+		return -ENAMETOOLONG;
+	}
+	sa.sun_family = AF_UNIX;
+	memcpy(sa.sun_path, tmp_path, n + 1);
+
+	lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (lfd < 0) {
+		fprintf(stderr, "%s: socket failed (errno=%d)\n",
+			__func__, errno);
+		return -1;
+	}
+	unlink(tmp_path);
+	if (bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) ||
+	    chmod(tmp_path, 0660) ||
+	    listen(lfd, FAMFS_MASTER_MAX_CLIENTS) ||
+	    rename(tmp_path, sock_path)) {
+		fprintf(stderr, "%s: unable to listen on %s (errno=%d)\n",
+			__func__, sock_path, errno);
+		unlink(tmp_path);
+		close(lfd);
+		return -1;
+	}
+	return lfd;
+}
+
+/**
+ * famfs_master_serve()
+ *
+ * Run the master service for the famfs instance that contains @path, until
+ * SIGINT or SIGTERM (or famfs_master_stop()). Must be run on the master.
+ *
+ * The locked-log session is set up once, and the allocator state and path
+ * index it builds stay warm across requests. Clients are served in turn,
+ * one request each per pass, so a burst of commands shares the log lock
+ * without any one of them waiting on the others' setup. A client that
+ * stalls mid-request is dropped after FAMFS_MASTER_CLIENT_TIMEOUT_MS.
+ *
+ * Returns 0 when stopped, or a negative errno if the service could not
+ * start
+ */
+int
+famfs_master_serve(const char *path, int verbose)
+{
+	struct pollfd pfd[FAMFS_MASTER_MAX_CLIENTS + 1];
+	struct sigaction sa = { 0 }, old_int, old_term;
+	struct famfs_locked_log ll;
+	char sock_path[PATH_MAX];
+	const char *dir;
+	int nclients = 0;
+	int lfd;
+	int rc;
+	int i;
+
+	famfs_master_stopping = 0;
+
+	rc = famfs_init_locked_log(&ll, path, 0, verbose);
+	if (rc)
+		return (rc < 0) ? rc : -rc;
+
+	rc = famfs_master_sock_path(ll.mpt, sock_path, sizeof(sock_path));
+	if (rc) {
+		fprintf(stderr, "%s: socket path too long\n", __func__);
+		goto out;
+	}
+
+	/* Holding the log lock means no other service is running for this
+	 * mount; anything at sock_path is stale */
+	dir = getenv("FAMFS_MASTER_DIR");
+	if (!dir || !*dir)
+		dir = FAMFS_MASTER_DIR;
+	if (mkdir(dir, 0755) && errno != EEXIST) {
+		rc = -errno;
+		fprintf(stderr, "%s: unable to create %s (errno=%d)\n",
+			__func__, dir, -rc);
+		goto out;
+	}
+	unlink(sock_path);
+	lfd = famfs_master_listen(sock_path);
+	if (lfd < 0) {
+		rc = (lfd == -ENAMETOOLONG) ? lfd : -EIO;
+		goto out;
+	}
+
+	sa.sa_handler = famfs_master_sighandler;
+	sigaction(SIGINT, &sa, &old_int);
+	sigaction(SIGTERM, &sa, &old_term);
+
+	printf("famfs master service for %s listening on %s\n",
+	       ll.mpt, sock_path);
+	fflush(stdout);
+
+	pfd[0].fd = lfd;
+	pfd[0].events = POLLIN;
+	while (!famfs_master_stopping) {
+		rc = poll(pfd, nclients + 1, 100);
+		if (rc <= 0)
+			continue;
+
+		for (i = 1; i <= nclients; i++) {
+			if (!pfd[i].revents)
+				continue;
+			if ((pfd[i].revents & POLLIN) &&
+			    famfs_master_serve_one(&ll, pfd[i].fd,
+						   verbose) == 0)
+				continue;
+
+			/* Client is gone */
+			close(pfd[i].fd);
+			pfd[i--] = pfd[nclients--];
+		}
+
+		if (pfd[0].revents & POLLIN) {
+			int cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+
+			if (cfd < 0)
+				continue;
+			if (nclients == FAMFS_MASTER_MAX_CLIENTS ||
+			    famfs_master_client_setup(cfd)) {
+				close(cfd);
+				continue;
+			}
+			nclients++;
+			pfd[nclients].fd = cfd;
+			pfd[nclients].events = POLLIN;
+			pfd[nclients].revents = 0;
+		}
+	}
+	rc = 0;
+	sigaction(SIGINT, &old_int, NULL);
+	sigaction(SIGTERM, &old_term, NULL);
+
+	for (i = 1; i <= nclients; i++)
+		close(pfd[i].fd);
+	unlink(sock_path);
+	close(lfd);
+	if (verbose)
+		printf("%s: stopped\n", __func__);
+out:
+	famfs_release_locked_log(&ll, 0, verbose);
+	return rc;
+}
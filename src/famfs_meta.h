@@ -17,6 +17,7 @@
 #include <linux/uuid.h>
 #include <linux/famfs_ioctl.h>
 #include <sys/types.h>
+#include <stddef.h>
 #include <assert.h>
 
 #include "famfs.h"
@@ -59,7 +60,19 @@ static inline size_t round_size_to_alloc_unit(u64 size)
 #define FAMFS_DEVNAME_LEN 64
 
 #define FAMFS_OMF_VER_MAJOR 2
-#define FAMFS_OMF_VER_MINOR 2 /* +FAMFS_LOG_ADD_DAXDEV (additive, backward-compatible) */
+#define FAMFS_OMF_VER_MINOR 5 /* The newest minor this famfs can read */
+
+/*
+ * The superblock records the lowest minor version that can read its log:
+ * mkfs writes the one its log format needs, and an operation that puts a
+ * newer log feature to use raises it first (famfs_sb_require_minor()). A
+ * superblock with a minor newer than FAMFS_OMF_VER_MINOR is refused rather
+ * than have its log misparsed.
+ */
+#define FAMFS_OMF_MINOR_BASE       2 /* +FAMFS_LOG_ADD_DAXDEV */
+#define FAMFS_OMF_MINOR_CHECKPOINT 3 /* +FAMFS_LOG_CHECKPOINT (compacted) */
+#define FAMFS_OMF_MINOR_PACKED     4 /* +FAMFS_LOG_MAGIC_PACKED */
+#define FAMFS_OMF_MINOR_LOG_SEGS   5 /* +log segments (grown) */
 
 struct famfs_daxdev {
 	size_t              dd_size;
@@ -165,6 +178,7 @@ enum famfs_log_entry_type {
 	FAMFS_LOG_DELETE,
 	FAMFS_LOG_ADD_DAXDEV, /* Adds a (secondary) daxdev to the filesystem */
 	FAMFS_LOG_INVALID,
+	FAMFS_LOG_CHECKPOINT, /* entries[0] of a compacted log */
 };
 
 #define FAMFS_MAX_PATHLEN 80
@@ -215,6 +229,73 @@ struct famfs_log_add_daxdev {
 	u32     dd_index;  /* intended daxdev index (dense, in log order) */
 };
 
+/*
+ * Log checkpoint (compaction)
+ *
+ * A compacted log starts with a single FAMFS_LOG_CHECKPOINT entry that stands
+ * for everything logged before it: the namespace as of the compaction, as a
+ * packed run of variable-length records (struct famfs_log_rec) in a snapshot
+ * region near the top of the log. Entries appended after the compaction
+ * follow the checkpoint from entries[1] on, and can't grow into the snapshot
+ * region (see famfs_log_entry_limit()).
+ *
+ * Sequence numbers carry on across a compaction: the checkpoint takes the
+ * next seqnum, and entries[i] of a compacted log has seqnum
+ * entries[0].seqnum + i. Stale entries left past entries[0] by an
+ * interrupted compaction therefore fail validation rather than replaying
+ * twice.
+ *
+ * A compaction first appends its checkpoint after the entries it replaces
+ * (the commit), then copies it to entries[0]. Readers skip a checkpoint
+ * anywhere but entries[0].
+ */
+struct famfs_log_checkpoint {
+	u64     ck_offset;  /* snapshot records: bytes from the start of the log */
+	u64     ck_len;     /* bytes of records */
+	u64     ck_nrecs;
+	u32     ck_crc;     /* crc32 of the records */
+};
+
+#define FAMFS_LOG_REC_ALIGN 8  /* records are padded to this */
+
+/*
+ * A log entry in compact form, as stored in a checkpoint or a packed log.
+ * The header is followed by (for an interleaved file) a u64 chunk size,
+ * then lr_nextents struct famfs_simple_extent (the strips, for an
+ * interleaved file), then lr_pathlen bytes of relpath - or the dd_uuid, for
+ * a daxdev, or a struct famfs_log_checkpoint.
+ */
+struct famfs_log_rec {
+	u16     lr_len;      /* bytes in this record, including padding */
+	u8      lr_type;     /* enum famfs_log_entry_type */
+	u8      lr_ext_type; /* enum famfs_log_ext_type */
+	u16     lr_nextents;
+	u16     lr_pathlen;  /* not NUL-terminated */
+	u32     lr_flags;    /* fm_flags; dd_index for a daxdev */
+	u32     lr_uid;
+	u32     lr_gid;
+	u32     lr_mode;
+	u64     lr_size;     /* fm_size; dd_size for a daxdev */
+};
+
+/*
+ * An entry in a packed log: a struct famfs_log_rec (with its payload) behind
+ * its own seqnum and crc
+ */
+struct famfs_log_prec {
+	u64     pr_seqnum;
+	u32     pr_crc;      /* crc32 of pr_seqnum and pr_rec (lr_len bytes) */
+	u32     pr_reserved;
+	struct famfs_log_rec pr_rec;
+};
+
+/* The largest packed entry: an interleaved file with all extents in use */
+#define FAMFS_LOG_PREC_MAX						\
+	((sizeof(struct famfs_log_prec) + sizeof(u64) +			\
+	  FAMFS_MAX_SIMPLE_EXTENTS * sizeof(struct famfs_simple_extent) +	\
+	  FAMFS_MAX_PATHLEN + FAMFS_LOG_REC_ALIGN - 1) &			\
+	 ~(size_t)(FAMFS_LOG_REC_ALIGN - 1))
+
 struct famfs_log_entry {
 	u64     famfs_log_entry_seqnum;
 	u32     famfs_log_entry_type;
@@ -222,11 +303,13 @@ struct famfs_log_entry {
 		struct famfs_log_file_meta     famfs_fm;
 		struct famfs_log_mkdir         famfs_md;
 		struct famfs_log_add_daxdev    famfs_dd;
+		struct famfs_log_checkpoint    famfs_ck;
 	};
 	unsigned long famfs_log_entry_crc;
 };
 
-#define FAMFS_LOG_MAGIC 0xbadcafef00d
+#define FAMFS_LOG_MAGIC        0xbadcafef00d
+#define FAMFS_LOG_MAGIC_PACKED 0xbadcafef00dd
 
 /**
  * @famfs_log - the structure of the famfs log
@@ -250,10 +333,134 @@ struct famfs_log {
 	struct famfs_log_entry entries[];
 };
 
+/*
+ * Packed log
+ *
+ * A log made with 'mkfs.famfs --packed-log' has FAMFS_LOG_MAGIC_PACKED and
+ * the same header, but in place of the array of fixed-size entries it holds
+ * a struct famfs_log_packed: a run of variable-length entries
+ * (struct famfs_log_prec) that readers walk by length. A one-extent file
+ * takes about a fifth of a struct famfs_log_entry.
+ *
+ * In a packed log famfs_log_next_index still counts the entries, and
+ * famfs_log_last_index is the last byte of pl_entries in the primary log. A
+ * checkpoint is the first packed entry, and seqnums work as in a fixed log.
+ *
+ * A packed log can grow (famfs growlog): the master allocates an extension
+ * segment from the data area and links it from pl_segs. Segment i is as big
+ * as the primary log and all segments before it put together
+ * (famfs_log_len << i), so each one doubles the log. Readers map the
+ * segments right after the primary log (see famfs_log_follow_chain()), so
+ * pl_entries simply runs on into them; famfs_log_len and
+ * famfs_log_last_index still describe the primary log alone.
+ */
+#define FAMFS_LOG_MAX_SEGS 3
+
+struct famfs_log_seg {
+	u64     ls_offset;       /* on the primary daxdev */
+	u64     ls_len;
+};
+
+struct famfs_log_packed {
+	u64     pl_next_offset;  /* bytes of pl_entries in use */
+	u32     pl_nsegs;        /* extension segments linked */
+	u32     pl_reserved;
+	struct famfs_log_seg pl_segs[FAMFS_LOG_MAX_SEGS];
+	u8      pl_entries[];
+};
+
+STATIC_ASSERT(sizeof(struct famfs_log_packed) == 64, famfs_log_packed_size);
+
+static inline int
+famfs_log_is_packed(const struct famfs_log *logp)
+{
+	return (logp->famfs_log_magic == FAMFS_LOG_MAGIC_PACKED);
+}
+
+static inline struct famfs_log_packed *
+famfs_log_packed(const struct famfs_log *logp)
+{
+	return (struct famfs_log_packed *)logp->entries;
+}
+
+/* Extension segments linked from the header (none for a fixed log) */
+static inline u32
+famfs_log_nsegs(const struct famfs_log *logp)
+{
+	u32 nsegs;
+
+	if (!famfs_log_is_packed(logp))
+		return 0;
+	nsegs = famfs_log_packed(logp)->pl_nsegs;
+	return (nsegs < FAMFS_LOG_MAX_SEGS) ? nsegs : FAMFS_LOG_MAX_SEGS;
+}
+
+/* Bytes of log with the first @nsegs segments: each segment doubles it */
+static inline u64
+famfs_log_seg_end(const struct famfs_log *logp, u32 nsegs)
+{
+	return logp->famfs_log_len << nsegs;
+}
+
+/* The checkpoint at the start of the log, if any (not validated) */
+static inline const struct famfs_log_checkpoint *
+famfs_log_get_checkpoint(const struct famfs_log *logp)
+{
+	const struct famfs_log_prec *pr;
+
+	if (!logp->famfs_log_next_index)
+		return NULL;
+	if (famfs_log_is_packed(logp)) {
+		pr = (const struct famfs_log_prec *)
+			famfs_log_packed(logp)->pl_entries;
+		return (pr->pr_rec.lr_type == FAMFS_LOG_CHECKPOINT)
+			? (const struct famfs_log_checkpoint *)(pr + 1) : NULL;
+	}
+	return (logp->entries[0].famfs_log_entry_type == FAMFS_LOG_CHECKPOINT)
+		? &logp->entries[0].famfs_ck : NULL;
+}
+
+/*
+ * Where the log entries must end: the end of the log (with any linked
+ * segments), or where a checkpoint's snapshot region begins. In entry slots
+ * for a fixed log, and in bytes of pl_entries for a packed one.
+ */
+static inline u64
+famfs_log_entry_limit(const struct famfs_log *logp)
+{
+	const struct famfs_log_checkpoint *ck = famfs_log_get_checkpoint(logp);
+	u64 limit = logp->famfs_log_last_index + 1;
+	u64 base = offsetof(struct famfs_log, entries);
+	u64 ck_first;
+
+	if (famfs_log_is_packed(logp)) {
+		base += offsetof(struct famfs_log_packed, pl_entries);
+		limit += famfs_log_seg_end(logp, famfs_log_nsegs(logp)) -
+			logp->famfs_log_len;
+	}
+	if (ck && ck->ck_offset >= base) {
+		ck_first = ck->ck_offset - base;
+		if (!famfs_log_is_packed(logp))
+			ck_first /= sizeof(struct famfs_log_entry);
+		if (ck_first < limit)
+			limit = ck_first;
+	}
+	return limit;
+}
+
+/* For a packed log, the number of the largest entries that still fit */
 static inline s64
-log_slots_available(struct famfs_log *logp)
+log_slots_available(const struct famfs_log *logp)
 {
-	s64 navail = logp->famfs_log_last_index - logp->famfs_log_next_index + 1;
+	u64 limit = famfs_log_entry_limit(logp);
+	u64 used;
+	s64 navail;
+
+	if (famfs_log_is_packed(logp)) {
+		used = famfs_log_packed(logp)->pl_next_offset;
+		return (used < limit) ? (limit - used) / FAMFS_LOG_PREC_MAX : 0;
+	}
+	navail = limit - logp->famfs_log_next_index;
 	assert(navail >= 0);
 	return navail;
 }
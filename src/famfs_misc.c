@@ -160,6 +160,16 @@ famfs_dump_logentry(
 		break;
 	}
 
+	case FAMFS_LOG_CHECKPOINT: {
+		const struct famfs_log_checkpoint *ck = &le->famfs_ck;
+
+		printf("%s: %d checkpoint: seqnum=%lld nrecs=%lld len=%lld "
+		       "offset=%lld\n", prefix, index,
+		       le->famfs_log_entry_seqnum, ck->ck_nrecs, ck->ck_len,
+		       ck->ck_offset);
+		break;
+	}
+
 	case FAMFS_LOG_DELETE:
 	default:
 		printf("\tError unrecognized log entry type\n");
@@ -196,6 +206,16 @@ void famfs_dump_log(struct famfs_log *logp)
 	printf("\tlen:        %lld\n", logp->famfs_log_len);
 	printf("\tlast index: %lld\n", logp->famfs_log_last_index);
 	printf("\tnext index: %lld\n", logp->famfs_log_next_index);
+	if (famfs_log_is_packed(logp)) {
+		struct famfs_log_packed *pl = famfs_log_packed(logp);
+		u32 i;
+
+		printf("\tnext offset: %lld (packed)\n", pl->pl_next_offset);
+		printf("\tsegments:   %d\n", pl->pl_nsegs);
+		for (i = 0; i < famfs_log_nsegs(logp); i++)
+			printf("\t  %d: %lld bytes at offset %lld\n", i,
+			       pl->pl_segs[i].ls_len, pl->pl_segs[i].ls_offset);
+	}
 }
 
 #define SYS_UUID_DIR "/opt/famfs"
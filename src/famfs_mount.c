@@ -985,6 +985,17 @@ famfs_mount_fuse(
 		}
 
 		assert(log_size == log_size_out);
+
+		/* A dummy mount for mkfs maps a log that isn't there yet;
+		 * otherwise map any segments the log has grown by */
+		if (!dummy_log_size &&
+		    famfs_mkmeta_log_segs(realmpt, role, verbose) < 0) {
+			fprintf(stderr,
+				"%s: failed to create log segment meta files\n",
+				__func__);
+			rc = -1;
+			goto out;
+		}
 	}
 
 	/* Unmap the superblock, though logplay will re-map it */
@@ -1201,6 +1212,17 @@ famfs_dummy_mount_v1(
 		}
 	}
 
+	/* Segments the log has grown by (not for mkfs) */
+	if (log_len == 0) {
+		rc = famfs_mkmeta_log_segs(mpt, role, verbose);
+		if (rc < 0) {
+			fprintf(stderr,
+				"%s: failed to create log segment meta files\n",
+				__func__);
+			goto out_umount;
+		}
+	}
+
 	if (verbose)
 		printf("%s: dummy v1 mount of %s at %s\n",
 		       __func__, realdaxdev, mpt);
@@ -44,6 +44,9 @@ print_usage(int   argc,
 	       "    -f|--force        - Will create the file system even if there is already a valid superblock\n"
 	       "    -k|--kill         - Will 'kill' existing superblock (also requires -f)\n"
 	       "    -l|--loglen <len> - Default loglen: 8 MiB; valid range: >= 8 MiB\n"
+	       "    -p|--packed-log   - Use the packed log format (variable-length log entries):\n"
+	       "                        several times the files per log size, but the file\n"
+	       "                        system can't be mounted by famfs older than OMF 2.4\n"
 	       "    -M|--set-daxmode  - Switch daxdev to famfs mode if needed (kernel >= 7.0 only).\n"
 	       "                        Without this flag, mkfs fails with a clear message if the\n"
 	       "                        device is not already in famfs mode. The device is left in\n"
@@ -72,6 +75,7 @@ struct option global_options[] = {
 	{"loglen",      required_argument, 0,              'l'},
 	{"nodax",       no_argument,       0,              'D'},
 	{"set-daxmode", no_argument,       0,              'M'},
+	{"packed-log",  no_argument,       0,              'p'},
 	{"nofuse",      no_argument,       0,              'F'},
 	{"fuse",        no_argument,       0,  MKFS_OPT_FUSE},
 	{"verbose",     no_argument,       0,              'v'},
@@ -87,6 +91,7 @@ main(int argc, char *argv[])
 	int nodax = 0;
 	int verbose = 0;
 	bool set_daxmode = false;
+	bool packed_log = false;
 	char *daxdev = NULL;
 	u64 loglen = 0x800000;
 
@@ -95,7 +100,7 @@ main(int argc, char *argv[])
 	 * to return -1 when it sees something that is not recognized option
 	 * (e.g. the command that will mux us off to the command handlers
 	 */
-	while ((c = getopt_long(argc, argv, "+fFkl:DMh?",
+	while ((c = getopt_long(argc, argv, "+fFkl:DMph?",
 				global_options, &optind)) != EOF) {
 		char *endptr;
 		s64 mult;
@@ -122,6 +127,9 @@ main(int argc, char *argv[])
 		case 'M':
 			set_daxmode = true;
 			break;
+		case 'p':
+			packed_log = true;
+			break;
 		case 'F':
 			/* Pin the internal dummy mount to standalone v1.
 			 * famfs_select_mode() reads FAMFS_MODE; overwrite it so
@@ -157,7 +165,8 @@ main(int argc, char *argv[])
 	famfs_log_enable_syslog("famfs", LOG_PID | LOG_CONS, LOG_DAEMON);
 	famfs_log(FAMFS_LOG_NOTICE, "Starting famfs mkfs on device %s", daxdev);
 
-	rc = famfs_mkfs(daxdev, loglen, kill_super, nodax, force, set_daxmode, verbose);
+	rc = famfs_mkfs(daxdev, loglen, kill_super, nodax, force, set_daxmode,
+			packed_log, verbose);
 	if (rc == 0)
 		famfs_log(FAMFS_LOG_NOTICE,
 			  "mkfs %s command successful on device %s",
@@ -11,6 +11,8 @@ extern "C" {
 #include <linux/limits.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -19,6 +21,7 @@ extern "C" {
 #include <linux/famfs_ioctl.h>
 #include "famfs_lib.h"
 #include "famfs_lib_internal.h"
+#include "bitmap.h"
 #include "famfs_meta.h"
 #include "famfs_fmap.h"
 #include "xrand.h"
@@ -118,30 +121,30 @@ TEST(famfs, famfs_mkfs)
 	ASSERT_EQ(rc, 0);
 
 	/* Try a bad mkfs - invalid log length */
-	rc = __famfs_mkfs("/dev/dax0.0", sb, logp, 1, device_size, 0, 0);
+	rc = __famfs_mkfs("/dev/dax0.0", sb, logp, 1, device_size, 0, 0, false);
 	ASSERT_NE(rc, 0);
 
 	rc = famfs_check_super(sb, NULL, NULL);
 	ASSERT_EQ(rc, 0);
 
 	/* Repeat should fail because there is a valid superblock */
-	rc = __famfs_mkfs("/dev/dax0.0", sb, logp, FAMFS_LOG_LEN, device_size, 0, 0);
+	rc = __famfs_mkfs("/dev/dax0.0", sb, logp, FAMFS_LOG_LEN, device_size, 0, 0, false);
 	ASSERT_NE(rc, 0);
 
 	/* Repeat with kill and force should succeed */
-	rc = __famfs_mkfs("/dev/dax0.0", sb, logp, FAMFS_LOG_LEN, device_size, 1, 1);
+	rc = __famfs_mkfs("/dev/dax0.0", sb, logp, FAMFS_LOG_LEN, device_size, 1, 1, false);
 	ASSERT_EQ(rc, 0);
 
 	/* Repeat without force should succeed because we wiped out the old superblock */
-	rc = __famfs_mkfs("/dev/dax0.0", sb, logp, FAMFS_LOG_LEN, device_size, 0, 0);
+	rc = __famfs_mkfs("/dev/dax0.0", sb, logp, FAMFS_LOG_LEN, device_size, 0, 0, false);
 	ASSERT_EQ(rc, 0);
 
 	/* Repeat without force should fail because there is a valid sb again */
-	rc = __famfs_mkfs("/dev/dax0.0", sb, logp, FAMFS_LOG_LEN, device_size, 0, 0);
+	rc = __famfs_mkfs("/dev/dax0.0", sb, logp, FAMFS_LOG_LEN, device_size, 0, 0, false);
 	ASSERT_NE(rc, 0);
 
 	/* Repeat with force should succeed because of force */
-	rc = __famfs_mkfs("/dev/dax0.0", sb, logp, FAMFS_LOG_LEN, device_size, 1, 0);
+	rc = __famfs_mkfs("/dev/dax0.0", sb, logp, FAMFS_LOG_LEN, device_size, 1, 0, false);
 	ASSERT_EQ(rc, 0);
 
 	/* This leaves a valid superblock and log at /tmp/famfs/.meta ... */
@@ -167,7 +170,7 @@ TEST(famfs, famfs_super_test)
 	logp = (struct famfs_log *)calloc(1, FAMFS_LOG_LEN);
 
 	/* Make a fake file system with our fake sb and log */
-	rc = __famfs_mkfs("/dev/dax0.0", sb, logp, FAMFS_LOG_LEN, device_size, 0, 0);
+	rc = __famfs_mkfs("/dev/dax0.0", sb, logp, FAMFS_LOG_LEN, device_size, 0, 0, false);
 	ASSERT_EQ(rc, 0);
 
 	rc = famfs_check_super(sb, NULL, NULL);
@@ -197,6 +200,20 @@ TEST(famfs, famfs_super_test)
 	rc = famfs_check_super(sb, NULL, NULL);
 	ASSERT_EQ(rc, 0); /* good crc */
 
+	/* mkfs records the oldest minor that can read the log */
+	ASSERT_EQ(sb->ts_omf_ver_major, (u32)FAMFS_OMF_VER_MAJOR);
+	ASSERT_EQ(sb->ts_omf_ver_minor, (u32)FAMFS_OMF_MINOR_BASE);
+
+	sb->ts_omf_ver_minor = FAMFS_OMF_VER_MINOR + 1; /* log too new */
+	sb->ts_crc = famfs_gen_superblock_crc(sb);
+	rc = famfs_check_super(sb, NULL, NULL);
+	ASSERT_EQ(rc, 1);
+
+	sb->ts_omf_ver_minor = FAMFS_OMF_VER_MINOR;
+	sb->ts_crc = famfs_gen_superblock_crc(sb);
+	rc = famfs_check_super(sb, NULL, NULL);
+	ASSERT_EQ(rc, 0);
+
 	logp->famfs_log_magic++;
 	rc = famfs_validate_log_header(logp);
 	ASSERT_LT(rc, 0);
@@ -322,6 +339,52 @@ TEST(famfs, famfs_random_buffer)
 #endif
 }
 
+TEST(famfs, famfs_random_buffer_range)
+{
+	size_t len = 3 * RB_BLOCK_SIZE + 1234;
+	size_t sublen = RB_BLOCK_SIZE + 99;
+	size_t subofs = RB_BLOCK_SIZE - 13;
+	u8 *buf = (u8 *)malloc(len);
+	u8 *sub = (u8 *)malloc(sublen);
+	int64_t ofs;
+
+	ASSERT_NE(buf, nullptr);
+	ASSERT_NE(sub, nullptr);
+
+	randomize_buffer(buf, len, 42);
+	ASSERT_EQ(validate_random_buffer(buf, len, 42), -1);
+	ASSERT_NE(validate_random_buffer(buf, len, 43), -1);
+
+	/* A subrange generated on its own matches the whole-buffer stream */
+	randomize_buffer_range(sub, sublen, subofs, 42);
+	ASSERT_EQ(memcmp(sub, buf + subofs, sublen), 0);
+	ASSERT_EQ(validate_random_buffer_range(buf + subofs, sublen,
+					       subofs, 42), -1);
+	ASSERT_EQ(validate_random_buffer_range(buf + 7, 5, 7, 42), -1);
+
+	/* Miscompares are reported at their stream offset */
+	buf[2 * RB_BLOCK_SIZE + 77] ^= 0x10;
+	ofs = validate_random_buffer(buf, len, 42);
+	ASSERT_EQ(ofs, 2 * RB_BLOCK_SIZE + 77);
+	ofs = validate_random_buffer_range(buf + RB_BLOCK_SIZE,
+					   len - RB_BLOCK_SIZE,
+					   RB_BLOCK_SIZE, 42);
+	ASSERT_EQ(ofs, 2 * RB_BLOCK_SIZE + 77);
+
+	/* randomize_buffer() takes an unsigned int seed; range validation of
+	 * its output must use the same truncated seed (famfs verify -t) */
+	randomize_buffer(buf, len, (unsigned int)0x100000007ULL);
+	ASSERT_EQ(validate_random_buffer(buf, len,
+					 (unsigned int)0x100000007ULL), -1);
+	ASSERT_EQ(validate_random_buffer_range(buf, len, 0,
+			(unsigned int)0x100000007ULL), -1);
+	ASSERT_NE(validate_random_buffer_range(buf, len, 0, 0x100000007ULL),
+		  -1);
+
+	free(buf);
+	free(sub);
+}
+
 #define booboofile "/tmp/booboo"
 TEST(famfs, famfs_file_is_famfs_v1)
 {
@@ -1224,6 +1287,553 @@ TEST(famfs, famfs_log_overflow_files)
 	ASSERT_EQ(rc, 0);
 }
 
+TEST(famfs, famfs_log_compact)
+{
+	u64 device_size = 64ULL * 1024ULL * 1024ULL * 1024ULL;
+	struct famfs_log_stats ls_before, ls_after;
+	u64 alloc_before, alloc_after;
+	struct famfs_superblock *sb;
+	struct famfs_log_entry le, ck;
+	struct famfs_log_iter it;
+	char filename[PATH_MAX];
+	struct famfs_log *logp;
+	u64 avail_before;
+	extern int mock_kmod;
+	u64 nbits, errs, fsize;
+	size_t oldlen;
+	u8 *bitmap;
+	u64 nold;
+	u8 *old;
+	int fd;
+	int rc;
+	int i;
+
+	mock_kmod = 1;
+
+	/* Prepare a fake famfs (move changes to this block everywhere it is) */
+	rc = create_mock_famfs_instance("/tmp/famfs", device_size, &sb, &logp);
+	ASSERT_EQ(rc, 0);
+
+	rc = famfs_mkdir_parents("/tmp/famfs/a/b/c", 0755, 0, 0, 0);
+	ASSERT_EQ(rc, 0);
+	for (i = 0; i < 50; i++) {
+		sprintf(filename, "/tmp/famfs/a/b/c/%04d", i);
+		fd = famfs_mkfile(filename, 0644, 0, 0, 1048576, NULL, 0);
+		ASSERT_GT(fd, 0);
+		close(fd);
+	}
+	avail_before = log_slots_available(logp);
+	bitmap = famfs_build_bitmap(logp, sb->ts_alloc_unit, device_size,
+				    &nbits, &errs, &fsize, &alloc_before,
+				    &ls_before, 0);
+	ASSERT_NE(bitmap, nullptr);
+	free(bitmap);
+
+	/* A reader that is part way through the log */
+	famfs_log_iter_init(&it, logp);
+	ASSERT_EQ(famfs_log_iter_next(&it, &le), 1);
+	ASSERT_EQ(famfs_log_iter_stale(&it), 0);
+
+	/* Compaction raises the OMF minor version first, so older famfs
+	 * versions refuse the compacted log */
+	ASSERT_EQ(sb->ts_omf_ver_minor, (u32)FAMFS_OMF_MINOR_BASE);
+	rc = famfs_compact("/tmp/famfs", 1);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(sb->ts_omf_ver_minor, (u32)FAMFS_OMF_MINOR_CHECKPOINT);
+	ASSERT_EQ(famfs_check_super(sb, NULL, NULL), 0);
+	ASSERT_EQ(logp->famfs_log_next_index, 1);
+	ASSERT_EQ(logp->entries[0].famfs_log_entry_type,
+		  (u32)FAMFS_LOG_CHECKPOINT);
+	ASSERT_NE(famfs_log_iter_stale(&it), 0);
+	ASSERT_GT(log_slots_available(logp), avail_before);
+
+	/* The checkpoint reads back as the same files and directories */
+	bitmap = famfs_build_bitmap(logp, sb->ts_alloc_unit, device_size,
+				    &nbits, &errs, &fsize, &alloc_after,
+				    &ls_after, 0);
+	ASSERT_NE(bitmap, nullptr);
+	free(bitmap);
+	ASSERT_EQ(errs, 0);
+	ASSERT_EQ(ls_after.bad_entries, 0);
+	ASSERT_EQ(ls_after.f_logged, ls_before.f_logged);
+	ASSERT_EQ(ls_after.d_logged, ls_before.d_logged);
+	ASSERT_EQ(alloc_after, alloc_before);
+
+	/* Nothing new to compact */
+	rc = famfs_compact("/tmp/famfs", 1);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(logp->famfs_log_next_index, 1);
+
+	/* New entries follow the checkpoint, and compact again */
+	for (i = 50; i < 60; i++) {
+		sprintf(filename, "/tmp/famfs/a/b/c/%04d", i);
+		fd = famfs_mkfile(filename, 0644, 0, 0, 1048576, NULL, 0);
+		ASSERT_GT(fd, 0);
+		close(fd);
+	}
+	ASSERT_EQ(logp->famfs_log_next_index, 11);
+	rc = __famfs_logplay("/tmp/famfs", logp, 0, 0, 0, FAMFS_MASTER, 0);
+	ASSERT_EQ(rc, 0);
+
+	rc = famfs_compact("/tmp/famfs", 1);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(logp->famfs_log_next_index, 1);
+	bitmap = famfs_build_bitmap(logp, sb->ts_alloc_unit, device_size,
+				    &nbits, &errs, &fsize, &alloc_after,
+				    &ls_after, 0);
+	ASSERT_NE(bitmap, nullptr);
+	free(bitmap);
+	ASSERT_EQ(ls_after.f_logged, ls_before.f_logged + 10);
+
+	/* A compaction interrupted after it appended (committed) its
+	 * checkpoint, but before it moved it to the front: first save the
+	 * log as it was, then compact */
+	for (i = 60; i < 70; i++) {
+		sprintf(filename, "/tmp/famfs/a/b/c/%04d", i);
+		fd = famfs_mkfile(filename, 0644, 0, 0, 1048576, NULL, 0);
+		ASSERT_GT(fd, 0);
+		close(fd);
+	}
+	nold = logp->famfs_log_next_index;
+	ASSERT_EQ(nold, 11);
+	oldlen = offsetof(struct famfs_log, entries) +
+		nold * sizeof(struct famfs_log_entry);
+	old = (u8 *)malloc(oldlen);
+	ASSERT_NE(old, nullptr);
+	memcpy(old, logp, oldlen);
+	rc = famfs_compact("/tmp/famfs", 1);
+	ASSERT_EQ(rc, 0);
+	ck = logp->entries[0];
+
+	/* The old entries, still counted, and the checkpoint after them;
+	 * its snapshot region is in place. Readers skip the checkpoint. */
+	memcpy(logp, old, oldlen);
+	logp->entries[nold] = ck;
+	logp->famfs_log_next_index = nold + 1;
+	bitmap = famfs_build_bitmap(logp, sb->ts_alloc_unit, device_size,
+				    &nbits, &errs, &fsize, &alloc_after,
+				    &ls_after, 0);
+	ASSERT_NE(bitmap, nullptr);
+	free(bitmap);
+	ASSERT_EQ(ls_after.bad_entries, 0);
+	ASSERT_EQ(ls_after.f_logged, ls_before.f_logged + 20);
+
+	/* entries[0] torn by the move to the front: the next locked log
+	 * session finishes the compaction from the appended copy */
+	logp->entries[0].famfs_ck.ck_len ^= 1;
+	rc = famfs_compact("/tmp/famfs", 1);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(logp->famfs_log_next_index, 1);
+	ASSERT_EQ(memcmp(&logp->entries[0], &ck, sizeof(ck)), 0);
+	bitmap = famfs_build_bitmap(logp, sb->ts_alloc_unit, device_size,
+				    &nbits, &errs, &fsize, &alloc_after,
+				    &ls_after, 0);
+	ASSERT_NE(bitmap, nullptr);
+	free(bitmap);
+	ASSERT_EQ(ls_after.bad_entries, 0);
+	ASSERT_EQ(ls_after.f_logged, ls_before.f_logged + 20);
+	free(old);
+
+	rc = __famfs_logplay("/tmp/famfs", logp, 0, 0, 0, FAMFS_MASTER, 0);
+	ASSERT_EQ(rc, 0);
+	rc = famfs_fsck_scan(sb, logp, 1, 0, 1);
+	ASSERT_EQ(rc, 0);
+}
+
+TEST(famfs, famfs_log_packed)
+{
+	u64 device_size = 64ULL * 1024ULL * 1024ULL * 1024ULL;
+	struct famfs_log_stats ls_before, ls_after;
+	u64 alloc_before, alloc_after;
+	struct famfs_superblock *sb;
+	char filename[PATH_MAX];
+	struct famfs_log *logp;
+	u64 avail_before;
+	extern int mock_kmod;
+	u64 nbits, errs, fsize;
+	u8 *bitmap, *last;
+	int fd;
+	int rc;
+	int i;
+
+	mock_kmod = 1;
+
+	/* Prepare a fake famfs, then re-mkfs it with a packed log */
+	rc = create_mock_famfs_instance("/tmp/famfs", device_size, &sb, &logp);
+	ASSERT_EQ(rc, 0);
+	rc = __famfs_mkfs("/dev/dax0.0", sb, logp, FAMFS_LOG_LEN, device_size,
+			  1, 0, true);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(logp->famfs_log_magic, FAMFS_LOG_MAGIC_PACKED);
+	ASSERT_EQ(famfs_validate_log_header(logp), 0);
+	avail_before = log_slots_available(logp);
+	ASSERT_GT(avail_before, (u64)(FAMFS_LOG_LEN /
+				      sizeof(struct famfs_log_entry)));
+
+	rc = famfs_mkdir_parents("/tmp/famfs/a/b/c", 0755, 0, 0, 0);
+	ASSERT_EQ(rc, 0);
+	for (i = 0; i < 50; i++) {
+		sprintf(filename, "/tmp/famfs/a/b/c/%04d", i);
+		fd = famfs_mkfile(filename, 0644, 0, 0, 1048576, NULL, 0);
+		ASSERT_GT(fd, 0);
+		close(fd);
+	}
+	ASSERT_EQ(logp->famfs_log_next_index, 53);
+	ASSERT_LT(famfs_log_packed(logp)->pl_next_offset,
+		  53 * sizeof(struct famfs_log_entry));
+	ASSERT_LT(log_slots_available(logp), avail_before);
+
+	bitmap = famfs_build_bitmap(logp, sb->ts_alloc_unit, device_size,
+				    &nbits, &errs, &fsize, &alloc_before,
+				    &ls_before, 0);
+	ASSERT_NE(bitmap, nullptr);
+	free(bitmap);
+	ASSERT_EQ(errs, 0);
+	ASSERT_EQ(ls_before.bad_entries, 0);
+	ASSERT_EQ(ls_before.f_logged, 50);
+	ASSERT_EQ(ls_before.d_logged, 3);
+
+	rc = __famfs_logplay("/tmp/famfs", logp, 0, 0, 0, FAMFS_MASTER, 0);
+	ASSERT_EQ(rc, 0);
+
+	/* Compaction writes a packed checkpoint */
+	rc = famfs_compact("/tmp/famfs", 1);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(logp->famfs_log_next_index, 1);
+	ASSERT_NE(famfs_log_get_checkpoint(logp), nullptr);
+	bitmap = famfs_build_bitmap(logp, sb->ts_alloc_unit, device_size,
+				    &nbits, &errs, &fsize, &alloc_after,
+				    &ls_after, 0);
+	ASSERT_NE(bitmap, nullptr);
+	free(bitmap);
+	ASSERT_EQ(ls_after.f_logged, ls_before.f_logged);
+	ASSERT_EQ(ls_after.d_logged, ls_before.d_logged);
+	ASSERT_EQ(alloc_after, alloc_before);
+
+	/* A corrupt entry is caught by its crc */
+	sprintf(filename, "/tmp/famfs/a/b/c/%04d", 50);
+	fd = famfs_mkfile(filename, 0644, 0, 0, 1048576, NULL, 0);
+	ASSERT_GT(fd, 0);
+	close(fd);
+	last = &famfs_log_packed(logp)->pl_entries[
+		famfs_log_packed(logp)->pl_next_offset - 1];
+	*last ^= 0xff;
+	bitmap = famfs_build_bitmap(logp, sb->ts_alloc_unit, device_size,
+				    &nbits, &errs, &fsize, &alloc_after,
+				    &ls_after, 0);
+	ASSERT_NE(bitmap, nullptr);
+	free(bitmap);
+	ASSERT_EQ(ls_after.bad_entries, 1);
+	ASSERT_EQ(ls_after.f_logged, ls_before.f_logged);
+	*last ^= 0xff;
+
+	rc = __famfs_logplay("/tmp/famfs", logp, 0, 0, 0, FAMFS_MASTER, 0);
+	ASSERT_EQ(rc, 0);
+	rc = famfs_fsck_scan(sb, logp, 1, 0, 1);
+	ASSERT_EQ(rc, 0);
+}
+
+TEST(famfs, famfs_log_grow)
+{
+	u64 device_size = 1024ULL * 1024ULL * 1024ULL;
+	struct famfs_log_stats ls_before, ls_after;
+	struct famfs_log *logp, *mlogp;
+	u64 alloc_before, alloc_after;
+	struct famfs_superblock *sb;
+	char filename[PATH_MAX];
+	extern int mock_fstype;
+	extern int mock_kmod;
+	u64 nbits, errs, fsize;
+	s64 avail_before;
+	struct stat st;
+	u8 *bitmap;
+	int fd;
+	int rc;
+	int i;
+
+	mock_kmod = 1;
+	mock_fstype = FAMFS_V1;
+
+	/* Only a packed log can grow */
+	rc = create_mock_famfs_instance("/tmp/famfs", device_size, &sb, &logp);
+	ASSERT_EQ(rc, 0);
+	rc = famfs_grow_log("/tmp/famfs", 0);
+	ASSERT_EQ(rc, -EOPNOTSUPP);
+	ASSERT_EQ(famfs_log_nsegs(logp), 0);
+
+	rc = __famfs_mkfs("/dev/dax0.0", sb, logp, FAMFS_LOG_LEN, device_size,
+			  1, 0, true);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(sb->ts_omf_ver_minor, (u32)FAMFS_OMF_MINOR_PACKED);
+	rc = famfs_mkdir_parents("/tmp/famfs/a/b", 0755, 0, 0, 0);
+	ASSERT_EQ(rc, 0);
+	for (i = 0; i < 20; i++) {
+		sprintf(filename, "/tmp/famfs/a/b/%04d", i);
+		fd = famfs_mkfile(filename, 0644, 0, 0, 1048576, NULL, 0);
+		ASSERT_GT(fd, 0);
+		close(fd);
+	}
+	rc = famfs_compact("/tmp/famfs", 0);
+	ASSERT_EQ(rc, 0);
+	bitmap = famfs_build_bitmap(logp, sb->ts_alloc_unit, device_size,
+				    &nbits, &errs, &fsize, &alloc_before,
+				    &ls_before, 0);
+	ASSERT_NE(bitmap, nullptr);
+	free(bitmap);
+	avail_before = log_slots_available(logp);
+
+	/* The segment is linked, and the checkpoint moves to its top */
+	rc = famfs_grow_log("/tmp/famfs", 1);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(famfs_log_nsegs(logp), 1);
+	ASSERT_EQ(sb->ts_omf_ver_minor, (u32)FAMFS_OMF_MINOR_LOG_SEGS);
+	ASSERT_EQ(famfs_log_packed(logp)->pl_segs[0].ls_len, FAMFS_LOG_LEN);
+	ASSERT_NE(famfs_log_get_checkpoint(logp), nullptr);
+	ASSERT_GT(famfs_log_get_checkpoint(logp)->ck_offset, FAMFS_LOG_LEN);
+	ASSERT_GT(log_slots_available(logp), avail_before);
+	rc = stat("/tmp/famfs/.meta/.log.1", &st);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(st.st_size, FAMFS_LOG_LEN);
+
+	/* A log mapped by path follows the chain; the segment's space is
+	 * allocated */
+	mlogp = famfs_map_log_by_path("/tmp/famfs", 1, true, NO_LOCK);
+	ASSERT_NE(mlogp, nullptr);
+	ASSERT_EQ(famfs_log_mapped_len(mlogp), 2 * FAMFS_LOG_LEN);
+	bitmap = famfs_build_bitmap(mlogp, sb->ts_alloc_unit, device_size,
+				    &nbits, &errs, &fsize, &alloc_after,
+				    &ls_after, 0);
+	ASSERT_NE(bitmap, nullptr);
+	free(bitmap);
+	ASSERT_EQ(errs, 0);
+	ASSERT_EQ(ls_after.bad_entries, 0);
+	ASSERT_EQ(ls_after.f_logged, ls_before.f_logged);
+	ASSERT_EQ(ls_after.d_logged, ls_before.d_logged);
+	ASSERT_EQ(alloc_after, alloc_before + FAMFS_LOG_LEN);
+
+	/* ...and picks up segments that are linked later */
+	sprintf(filename, "/tmp/famfs/a/b/%04d", i);
+	fd = famfs_mkfile(filename, 0644, 0, 0, 1048576, NULL, 0);
+	ASSERT_GT(fd, 0);
+	close(fd);
+	rc = famfs_grow_log("/tmp/famfs", 0);
+	ASSERT_EQ(rc, 0);
+	rc = famfs_grow_log("/tmp/famfs", 0);
+	ASSERT_EQ(rc, 0);
+	rc = famfs_grow_log("/tmp/famfs", 0);
+	ASSERT_EQ(rc, -ENOSPC);
+	ASSERT_EQ(famfs_log_nsegs(logp), FAMFS_LOG_MAX_SEGS);
+
+	bitmap = famfs_build_bitmap(mlogp, sb->ts_alloc_unit, device_size,
+				    &nbits, &errs, &fsize, &alloc_after,
+				    &ls_after, 0);
+	ASSERT_NE(bitmap, nullptr);
+	free(bitmap);
+	ASSERT_EQ(famfs_log_mapped_len(mlogp), 8 * FAMFS_LOG_LEN);
+	ASSERT_EQ(errs, 0);
+	ASSERT_EQ(ls_after.bad_entries, 0);
+	ASSERT_EQ(ls_after.f_logged, ls_before.f_logged + 1);
+	ASSERT_EQ(alloc_after,
+		  alloc_before + 7 * FAMFS_LOG_LEN + sb->ts_alloc_unit);
+
+	rc = __famfs_logplay("/tmp/famfs", mlogp, 0, 0, 0, FAMFS_MASTER, 0);
+	ASSERT_EQ(rc, 0);
+	rc = famfs_fsck_scan(sb, mlogp, 1, 0, 0);
+	ASSERT_EQ(rc, 0);
+	famfs_unmap_log(mlogp);
+
+	/* Readers that don't mmap the log read the segments too */
+	rc = famfs_fsck("/tmp/famfs", false /* !nodax */, 0 /* read */, 1, 0,
+			false /* !set_daxmode */, 0);
+	ASSERT_EQ(rc, 0);
+	rc = famfs_logplay("/tmp/famfs", 0 /* read */, 1 /* dry run */, 0,
+			   NULL, 0, 0);
+	ASSERT_EQ(rc, 0);
+	mock_kmod = 0;
+}
+
+TEST(famfs, famfs_path_index)
+{
+	u64 device_size = 1024ULL * 1024ULL * 256ULL;
+	struct famfs_superblock *sb;
+	struct famfs_locked_log ll;
+	char fullpath[PATH_MAX];
+	char cwd[PATH_MAX];
+	struct famfs_log *logp;
+	extern int mock_fstype;
+	extern int mock_kmod;
+	int fd;
+	int rc;
+
+	mock_kmod = 1;
+	mock_fstype = FAMFS_V1;
+	rc = create_mock_famfs_instance("/tmp/famfs", device_size, &sb, &logp);
+	ASSERT_EQ(rc, 0);
+	rc = famfs_mkdir_parents("/tmp/famfs/a/b", 0755, 0, 0, 0);
+	ASSERT_EQ(rc, 0);
+	fd = famfs_mkfile("/tmp/famfs/a/f", 0644, 0, 0, 1048576, NULL, 0);
+	ASSERT_GT(fd, 0);
+	close(fd);
+
+	/* The session indexes the log when it starts */
+	rc = famfs_init_locked_log(&ll, "/tmp/famfs", 0, 0);
+	ASSERT_EQ(rc, 0);
+	ASSERT_NE(ll.pidx, nullptr);
+	ASSERT_EQ(famfs_path_index_lookup(&ll, "/tmp/famfs", NULL),
+		  FAMFS_PATH_DIR);
+	ASSERT_EQ(famfs_path_index_lookup(&ll, "/tmp/famfs/a", NULL),
+		  FAMFS_PATH_DIR);
+	ASSERT_EQ(famfs_path_index_lookup(&ll, "/tmp/famfs/a/b", NULL),
+		  FAMFS_PATH_DIR);
+	ASSERT_EQ(famfs_path_index_lookup(&ll, "/tmp/famfs/a/f", NULL),
+		  FAMFS_PATH_FILE);
+	ASSERT_EQ(famfs_path_index_lookup(&ll, "/tmp/famfs/a/x", NULL),
+		  FAMFS_PATH_NONE);
+
+	/* Paths the index can't answer for */
+	ASSERT_EQ(famfs_path_index_lookup(&ll, "/tmp/famfs/a/./b", NULL), -1);
+	ASSERT_EQ(famfs_path_index_lookup(&ll, "/tmp/famfs/a/b/", NULL), -1);
+	ASSERT_EQ(famfs_path_index_lookup(&ll, "/tmp/famfs/.meta/.log", NULL),
+		  -1);
+	ASSERT_EQ(famfs_path_index_lookup(&ll, "/tmp/famfsx", NULL), -1);
+
+	/* Relative paths resolve against the cwd */
+	ASSERT_NE(getcwd(cwd, sizeof(cwd)), nullptr);
+	rc = chdir("/tmp/famfs/a");
+	ASSERT_EQ(rc, 0);
+	rc = famfs_path_index_lookup(&ll, "b", fullpath);
+	ASSERT_EQ(chdir(cwd), 0);
+	ASSERT_EQ(rc, FAMFS_PATH_DIR);
+	ASSERT_STREQ(fullpath, "/tmp/famfs/a/b");
+
+	/* The index, not the filesystem, decides what exists */
+	unlink("/tmp/famfs/a/f");
+	fd = __famfs_mkfile(&ll, "/tmp/famfs/a/f", 0644, 0, 0, 1048576, 0, 0);
+	ASSERT_LT(fd, 0);
+	fd = __famfs_mkfile(&ll, "/tmp/famfs/a/f/g", 0644, 0, 0, 1048576, 0, 0);
+	ASSERT_LT(fd, 0);
+	fd = __famfs_mkfile(&ll, "/tmp/famfs/z/g", 0644, 0, 0, 1048576, 0, 0);
+	ASSERT_LT(fd, 0);
+
+	/* Creations in the session are indexed as they are logged */
+	fd = __famfs_mkfile(&ll, "/tmp/famfs/a/b/new", 0644, 0, 0, 1048576,
+			    0, 0);
+	ASSERT_GT(fd, 0);
+	close(fd);
+	ASSERT_EQ(famfs_path_index_lookup(&ll, "/tmp/famfs/a/b/new", NULL),
+		  FAMFS_PATH_FILE);
+	rc = __famfs_mkdir(&ll, "/tmp/famfs/a/c", 0755, 0, 0, 0);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(famfs_path_index_lookup(&ll, "/tmp/famfs/a/c", NULL),
+		  FAMFS_PATH_DIR);
+	rc = __famfs_mkdir(&ll, "/tmp/famfs/a/c", 0755, 0, 0, 0);
+	ASSERT_NE(rc, 0);
+	fd = __famfs_mkfile(&ll, "/tmp/famfs/a/c/g", 0644, 0, 0, 1048576, 0, 0);
+	ASSERT_GT(fd, 0);
+	close(fd);
+
+	famfs_release_locked_log(&ll, 0, 0);
+	ASSERT_EQ(ll.pidx, nullptr);
+	mock_kmod = 0;
+}
+
+static void *
+master_thread(void *arg)
+{
+	*(int *)arg = famfs_master_serve("/tmp/famfs", 0);
+	return NULL;
+}
+
+TEST(famfs, famfs_master)
+{
+	u64 device_size = 1024ULL * 1024ULL * 256ULL;
+	u64 nbits, errs, fsize, alloc;
+	struct famfs_superblock *sb;
+	struct famfs_log_stats ls;
+	char sock_path[PATH_MAX];
+	struct famfs_log *logp;
+	extern int mock_fstype;
+	extern int mock_kmod;
+	struct sockaddr_un sa = { 0 };
+	int serve_rc = -1;
+	struct stat st;
+	int stalled;
+	pthread_t tid;
+	u8 *bitmap;
+	int fd;
+	int rc;
+	int i;
+
+	mock_kmod = 1;
+	mock_fstype = FAMFS_V1;
+	rc = create_mock_famfs_instance("/tmp/famfs", device_size, &sb, &logp);
+	ASSERT_EQ(rc, 0);
+	system("rm -rf /tmp/famfs_master");
+	setenv("FAMFS_MASTER_DIR", "/tmp/famfs_master", 1);
+	rc = famfs_master_sock_path("/tmp/famfs", sock_path, sizeof(sock_path));
+	ASSERT_EQ(rc, 0);
+
+	/* The socket only appears once the service is listening */
+	rc = pthread_create(&tid, NULL, master_thread, &serve_rc);
+	ASSERT_EQ(rc, 0);
+	for (i = 0; i < 500 && stat(sock_path, &st); i++)
+		usleep(10000);
+	ASSERT_EQ(stat(sock_path, &st), 0);
+
+	/* Creations go through the service */
+	fd = famfs_mkfile("/tmp/famfs/m0", 0644, 0, 0, 1048576, NULL, 0);
+	ASSERT_GT(fd, 0);
+	close(fd);
+	fd = famfs_mkfile("/tmp/famfs/m0", 0644, 0, 0, 1048576, NULL, 0);
+	ASSERT_LE(fd, 0);
+	rc = famfs_mkdir_parents("/tmp/famfs/d/e", 0755, 0, 0, 0);
+	ASSERT_EQ(rc, 0);
+	rc = famfs_mkdir("/tmp/famfs/d/f", 0755, 0, 0, 0);
+	ASSERT_EQ(rc, 0);
+	rc = famfs_mkdir("/tmp/famfs/d/f", 0755, 0, 0, 0);
+	ASSERT_NE(rc, 0);
+	rc = famfs_mkdir("/tmp/famfs/x/y", 0755, 0, 0, 0);
+	ASSERT_NE(rc, 0);
+	fd = famfs_mkfile("/tmp/famfs/d/e/m1", 0644, 0, 0, 1048576, NULL, 0);
+	ASSERT_GT(fd, 0);
+	close(fd);
+
+	/* A client that stalls mid-request is dropped, not waited on */
+	stalled = socket(AF_UNIX, SOCK_STREAM, 0);
+	ASSERT_GE(stalled, 0);
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, sock_path, sizeof(sa.sun_path) - 1);
+	rc = connect(stalled, (struct sockaddr *)&sa, sizeof(sa));
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(send(stalled, "fam", 3, 0), 3);
+	fd = famfs_mkfile("/tmp/famfs/d/e/m2", 0644, 0, 0, 1048576, NULL, 0);
+	ASSERT_GT(fd, 0);
+	close(fd);
+	close(stalled);
+
+	famfs_master_stop();
+	pthread_join(tid, NULL);
+	ASSERT_EQ(serve_rc, 0);
+	ASSERT_NE(stat(sock_path, &st), 0);
+
+	/* ...and are in the log */
+	bitmap = famfs_build_bitmap(logp, sb->ts_alloc_unit, device_size,
+				    &nbits, &errs, &fsize, &alloc, &ls, 0);
+	ASSERT_NE(bitmap, nullptr);
+	free(bitmap);
+	ASSERT_EQ(errs, 0);
+	ASSERT_EQ(ls.f_logged, 3);
+	ASSERT_EQ(ls.d_logged, 3);
+
+	/* With no service, commands set up their own sessions */
+	fd = famfs_mkfile("/tmp/famfs/d/m2", 0644, 0, 0, 1048576, NULL, 0);
+	ASSERT_GT(fd, 0);
+	close(fd);
+	unsetenv("FAMFS_MASTER_DIR");
+	system("rm -rf /tmp/famfs_master");
+	mock_kmod = 0;
+}
+
 TEST(famfs, famfs_cp) {
 	u64 device_size = 1024 * 1024 * 256;
 	struct famfs_locked_log ll;
@@ -1813,6 +2423,631 @@ TEST(famfs, famfs_icache_test) {
 	famfs_icache_destroy(&icache);
 }
 
+TEST(famfs, famfs_dir_index_test) {
+	struct famfs_inode *inode, *dir;
+	famfs_icache icache;
+	struct stat st;
+	char name[64];
+	int i;
+#define NCHILDREN 1000
+
+	memset(&st, 0, sizeof(st));
+	famfs_icache_init(NULL, &icache, NULL);
+
+	/* A directory with an index, under root */
+	dir = famfs_inode_alloc(&icache, -1, "dir", 2, 0, NULL, &st,
+				FAMFS_FDIR, &icache.root);
+	ASSERT_NE(dir, (struct famfs_inode *)NULL);
+	dir->dindex = famfs_dir_index_alloc();
+	ASSERT_NE(dir->dindex, (struct famfs_dir_index *)NULL);
+	famfs_icache_insert_locked(&icache, dir);
+	famfs_inode_putref_locked(dir, 1);
+
+	/* Enough children to force several rehashes */
+	for (i = 0; i < NCHILDREN; i++) {
+		snprintf(name, sizeof(name), "file%d", i);
+		ASSERT_EQ(famfs_dir_index_find_locked(dir, name),
+			  (struct famfs_inode *)NULL);
+		inode = famfs_inode_alloc(&icache, -1, name, 3 + i, 0, NULL,
+					  &st, FAMFS_FREG, dir);
+		ASSERT_NE(inode, (struct famfs_inode *)NULL);
+		ASSERT_EQ(famfs_dir_index_add_locked(dir, inode), 0);
+		famfs_icache_insert_locked(&icache, inode);
+		famfs_inode_putref_locked(inode, 1);
+	}
+	ASSERT_EQ(dir->dindex->nchildren, NCHILDREN);
+	ASSERT_GE(dir->dindex->nbuckets, NCHILDREN);
+
+	/* Every child is found by name, and children[] is creation order */
+	for (i = 0; i < NCHILDREN; i++) {
+		snprintf(name, sizeof(name), "file%d", i);
+		inode = famfs_dir_index_find_locked(dir, name);
+		ASSERT_NE(inode, (struct famfs_inode *)NULL);
+		ASSERT_EQ(inode->ino, (ino_t)(3 + i));
+		ASSERT_EQ(dir->dindex->children[i], inode);
+	}
+	ASSERT_EQ(famfs_dir_index_find_locked(dir, "nope"),
+		  (struct famfs_inode *)NULL);
+	ASSERT_EQ(famfs_dir_index_find_locked(&icache.root, "dir"),
+		  (struct famfs_inode *)NULL); /* root has no index */
+
+	famfs_icache_destroy(&icache);
+}
+
+TEST(famfs, famfs_flock_test) {
+	struct famfs_flock_waiter *granted = NULL;
+	struct famfs_inode *inode;
+	famfs_icache icache;
+	struct stat st;
+	/* Cookies only need to be distinct */
+	int c3, c4, c6, c7;
+
+	memset(&st, 0, sizeof(st));
+	famfs_icache_init(NULL, &icache, NULL);
+	inode = famfs_inode_alloc(&icache, -1, "file", 2, 0, NULL, &st,
+				  FAMFS_FREG, &icache.root);
+	ASSERT_NE(inode, (struct famfs_inode *)NULL);
+	famfs_icache_insert_locked(&icache, inode);
+
+	/* Shared locks coexist; exclusive waits for them (or fails NB) */
+	ASSERT_EQ(famfs_flock_acquire_locked(inode, 1, 0, 0, NULL, &granted), 0);
+	ASSERT_EQ(famfs_flock_acquire_locked(inode, 2, 0, 0, NULL, &granted), 0);
+	ASSERT_EQ(famfs_flock_acquire_locked(inode, 3, 1, 1, NULL, &granted),
+		  EWOULDBLOCK);
+	ASSERT_EQ(famfs_flock_acquire_locked(inode, 3, 1, 0, &c3, &granted),
+		  EINPROGRESS);
+
+	/* A shared request queues behind the exclusive waiter */
+	ASSERT_EQ(famfs_flock_acquire_locked(inode, 4, 0, 0, &c4, &granted),
+		  EINPROGRESS);
+	ASSERT_EQ(famfs_flock_acquire_locked(inode, 5, 0, 1, NULL, &granted),
+		  EWOULDBLOCK);
+	ASSERT_EQ(granted, (struct famfs_flock_waiter *)NULL);
+	ASSERT_EQ(icache.flock_stats.waiting, 2);
+
+	/* The exclusive waiter is granted when the last reader leaves */
+	ASSERT_EQ(famfs_flock_release_locked(inode, 1, &granted), 1);
+	ASSERT_EQ(granted, (struct famfs_flock_waiter *)NULL);
+	ASSERT_EQ(famfs_flock_release_locked(inode, 9, &granted), 0);
+	ASSERT_EQ(famfs_flock_release_locked(inode, 2, &granted), 1);
+	ASSERT_NE(granted, (struct famfs_flock_waiter *)NULL);
+	ASSERT_EQ(granted->cookie, &c3);
+	ASSERT_EQ(granted->next, (struct famfs_flock_waiter *)NULL);
+	free(granted);
+	granted = NULL;
+
+	ASSERT_EQ(famfs_flock_release_locked(inode, 3, &granted), 1);
+	ASSERT_NE(granted, (struct famfs_flock_waiter *)NULL);
+	ASSERT_EQ(granted->cookie, &c4);
+	free(granted);
+	granted = NULL;
+
+	/* Re-taking a lock in the same mode is a no-op */
+	ASSERT_EQ(famfs_flock_acquire_locked(inode, 4, 0, 1, NULL, &granted), 0);
+
+	/* Cancelling a waiter lets the ones behind it through */
+	ASSERT_EQ(famfs_flock_acquire_locked(inode, 6, 1, 0, &c6, &granted),
+		  EINPROGRESS);
+	ASSERT_EQ(famfs_flock_acquire_locked(inode, 7, 0, 0, &c7, &granted),
+		  EINPROGRESS);
+	ASSERT_EQ(famfs_flock_cancel_locked(inode, &c6, &granted), 1);
+	ASSERT_EQ(famfs_flock_cancel_locked(inode, &c6, &granted), 0);
+	ASSERT_NE(granted, (struct famfs_flock_waiter *)NULL);
+	ASSERT_EQ(granted->cookie, &c7);
+	free(granted);
+	granted = NULL;
+
+	/* The lock state goes away with the last holder */
+	ASSERT_EQ(famfs_flock_release_locked(inode, 4, &granted), 1);
+	ASSERT_NE(inode->flock, (struct famfs_flock *)NULL);
+	ASSERT_EQ(famfs_flock_release_locked(inode, 7, &granted), 1);
+	ASSERT_EQ(inode->flock, (struct famfs_flock *)NULL);
+
+	ASSERT_EQ(icache.flock_stats.acquired, 5);
+	ASSERT_EQ(icache.flock_stats.contended, 4);
+	ASSERT_EQ(icache.flock_stats.wouldblock, 2);
+	ASSERT_EQ(icache.flock_stats.interrupted, 1);
+	ASSERT_EQ(icache.flock_stats.waiting, 0);
+
+	famfs_icache_destroy(&icache);
+}
+
+/*
+ * famfs_bitmap_add_file() is what famfs_fused uses to keep statfs current as
+ * log entries are appended; check the bits and byte counts it produces.
+ */
+TEST(famfs, famfs_icache_pool_test) {
+	struct famfs_inode *inodes[2000];
+	struct famfs_pool_stats ps;
+	struct stat st, st2;
+	famfs_icache icache;
+	u64 inode_bytes;
+	char name[NAME_MAX + 1];
+	void *p;
+	int i, pass;
+
+	famfs_icache_init(NULL, &icache, NULL);
+
+	/* Attributes survive the round trip through the compact form */
+	memset(&st, 0, sizeof(st));
+	st.st_mode = S_IFREG | 0640;
+	st.st_nlink = 1;
+	st.st_uid = 1001;
+	st.st_gid = 1002;
+	st.st_size = 0x123456789ULL;
+	st.st_blksize = 4096;
+	st.st_blocks = 42;
+	st.st_mtim.tv_sec = 1700000000;
+	st.st_mtim.tv_nsec = 123456789;
+	st.st_ctim.tv_sec = 1700000001;
+	inodes[0] = famfs_inode_alloc(&icache, -1, "file", 2, 7, NULL, &st,
+				      FAMFS_FREG, &icache.root);
+	ASSERT_NE(inodes[0], (struct famfs_inode *)NULL);
+	famfs_inode_get_attr(inodes[0], &st2);
+	ASSERT_EQ(st2.st_ino, (ino_t)2);
+	ASSERT_EQ(st2.st_dev, (dev_t)7);
+	ASSERT_EQ(st2.st_mode, st.st_mode);
+	ASSERT_EQ(st2.st_uid, st.st_uid);
+	ASSERT_EQ(st2.st_gid, st.st_gid);
+	ASSERT_EQ(st2.st_size, st.st_size);
+	ASSERT_EQ(st2.st_blocks, st.st_blocks);
+	ASSERT_EQ(st2.st_mtim.tv_sec, st.st_mtim.tv_sec);
+	ASSERT_EQ(st2.st_mtim.tv_nsec, st.st_mtim.tv_nsec);
+	ASSERT_EQ(st2.st_ctim.tv_sec, st.st_ctim.tv_sec);
+	famfs_inode_free(inodes[0]);
+
+	/* Inodes and names come back to the pools, and are reused */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < 2000; i++) {
+			/* Names from 1 to NAME_MAX bytes */
+			memset(name, 'a' + (i % 26), sizeof(name));
+			name[1 + (i % NAME_MAX)] = '\0';
+			inodes[i] = famfs_inode_alloc(&icache, -1, name, 3 + i,
+						      0, NULL, &st, FAMFS_FREG,
+						      &icache.root);
+			ASSERT_NE(inodes[i], (struct famfs_inode *)NULL);
+			ASSERT_STREQ(inodes[i]->name, name);
+			famfs_icache_insert_locked(&icache, inodes[i]);
+		}
+		famfs_icache_pool_stats(&icache, &ps);
+		ASSERT_EQ(ps.inodes, 2000);
+		ASSERT_EQ(ps.mem_allocs, 2001); /* Plus the root's name */
+		if (pass == 0)
+			inode_bytes = ps.inode_bytes;
+		else
+			ASSERT_EQ(ps.inode_bytes, inode_bytes);
+
+		for (i = 0; i < 2000; i++)
+			famfs_inode_putref_locked(inodes[i], 2);
+		famfs_icache_pool_stats(&icache, &ps);
+		ASSERT_EQ(ps.inodes, 0);
+		ASSERT_EQ(ps.mem_allocs, 1);
+		ASSERT_EQ(famfs_icache_count(&icache), 0);
+	}
+
+	/* Too big for a size class */
+	p = famfs_icache_mem_alloc(&icache, 8192);
+	ASSERT_NE(p, (void *)NULL);
+	famfs_icache_pool_stats(&icache, &ps);
+	ASSERT_EQ(ps.mem_large, 1);
+	famfs_icache_mem_free(&icache, p, 8192);
+	famfs_icache_pool_stats(&icache, &ps);
+	ASSERT_EQ(ps.mem_large, 0);
+
+	famfs_icache_destroy(&icache);
+}
+
+TEST(famfs, famfs_icache_lru_test) {
+	struct famfs_inode *inode, *dir;
+	struct famfs_pool_stats ps;
+	famfs_icache icache;
+	char tmpdir[] = "/tmp/famfs_lru_XXXXXX";
+	char name[64];
+	struct stat st;
+	int i, fd;
+
+	memset(&st, 0, sizeof(st));
+
+	/* Without a budget, an unreferenced inode is freed */
+	famfs_icache_init(NULL, &icache, NULL);
+	inode = famfs_inode_alloc(&icache, -1, "file", 2, 0, NULL, &st,
+				  FAMFS_FREG, &icache.root);
+	famfs_icache_insert_locked(&icache, inode);
+	famfs_inode_putref_locked(inode, 2);
+	ASSERT_EQ(famfs_icache_count(&icache), 0);
+	ASSERT_EQ(icache.lru_count, 0);
+
+	/* With a budget, unreferenced inodes are retained up to it */
+	famfs_icache_set_limits(&icache, 64 * 1024, 0);
+	dir = famfs_inode_alloc(&icache, -1, "dir", 2, 0, NULL, &st,
+				FAMFS_FDIR, &icache.root);
+	famfs_icache_insert_locked(&icache, dir);
+	famfs_inode_putref_locked(dir, 1);
+	for (i = 0; i < 1000; i++) {
+		snprintf(name, sizeof(name), "file%d", i);
+		inode = famfs_inode_alloc(&icache, -1, name, 3 + i, 0, NULL,
+					  &st, FAMFS_FREG, dir);
+		famfs_icache_insert_locked(&icache, inode);
+		famfs_inode_putref_locked(inode, 2);
+	}
+	famfs_icache_pool_stats(&icache, &ps);
+	ASSERT_LE(ps.bytes, 64 * 1024);
+	ASSERT_GT(icache.evictions, 0);
+	ASSERT_EQ(icache.lru_count + icache.evictions, 1000);
+	ASSERT_EQ(famfs_icache_count(&icache), icache.lru_count + 1);
+
+	/* The coldest were evicted; a retained inode is found again */
+	ASSERT_EQ(famfs_icache_find_get_from_ino_locked(&icache, 3),
+		  (struct famfs_inode *)NULL);
+	inode = famfs_icache_find_get_from_ino_locked(&icache, 3 + 999);
+	ASSERT_NE(inode, (struct famfs_inode *)NULL);
+	ASSERT_EQ(inode->refcount, 1);
+	ASSERT_EQ(icache.lru_hits, 1);
+	famfs_inode_putref_locked(inode, 1);
+
+	/* The dir is held by its children; once they are evicted, it is
+	 * retained and evicted in turn */
+	famfs_inode_putref_locked(dir, 1);
+	famfs_icache_set_limits(&icache, 1, 0);
+	inode = famfs_inode_alloc(&icache, -1, "last", 5000, 0, NULL, &st,
+				  FAMFS_FREG, &icache.root);
+	famfs_icache_insert_locked(&icache, inode);
+	famfs_inode_putref_locked(inode, 2);
+	ASSERT_EQ(famfs_icache_count(&icache), 0);
+	ASSERT_EQ(icache.lru_count, 0);
+	famfs_icache_destroy(&icache);
+
+	/* Directory fds beyond the budget are closed and reopened lazily */
+	ASSERT_NE(mkdtemp(tmpdir), (char *)NULL);
+	famfs_icache_init(NULL, &icache, tmpdir);
+	famfs_icache_set_limits(&icache, 0, 2);
+	for (i = 0; i < 5; i++) {
+		snprintf(name, sizeof(name), "%s/d%d", tmpdir, i);
+		ASSERT_EQ(mkdir(name, 0755), 0);
+		snprintf(name, sizeof(name), "d%d", i);
+		fd = openat(icache.root.fd, name, O_PATH | O_NOFOLLOW);
+		ASSERT_GE(fd, 0);
+		ASSERT_EQ(fstat(fd, &st), 0);
+		inode = famfs_inode_alloc(&icache, fd, name, st.st_ino, 0,
+					  NULL, &st, FAMFS_FDIR, &icache.root);
+		famfs_icache_insert_locked(&icache, inode);
+		famfs_inode_putref_locked(inode, 1);
+	}
+	ASSERT_EQ(icache.nfds, 2);
+	ASSERT_EQ(icache.fd_closes, 3);
+
+	/* d0 was the coldest */
+	snprintf(name, sizeof(name), "%s/d0", tmpdir);
+	ASSERT_EQ(stat(name, &st), 0);
+	inode = famfs_icache_find_get_from_ino_locked(&icache, st.st_ino);
+	ASSERT_NE(inode, (struct famfs_inode *)NULL);
+	ASSERT_EQ(inode->fd, -1);
+	fd = famfs_inode_fd_get(inode);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(icache.fd_reopens, 1);
+	ASSERT_EQ(fstat(fd, &st), 0);
+	ASSERT_EQ(st.st_ino, inode->ino);
+	ASSERT_EQ(icache.nfds, 2);
+
+	/* Fds in use are not closed, even over budget */
+	famfs_icache_set_limits(&icache, 0, 1);
+	snprintf(name, sizeof(name), "%s/d4", tmpdir);
+	ASSERT_EQ(stat(name, &st), 0);
+	dir = famfs_icache_find_get_from_ino_locked(&icache, st.st_ino);
+	ASSERT_NE(dir, (struct famfs_inode *)NULL);
+	ASSERT_GE(famfs_inode_fd_get(dir), 0);
+	ASSERT_EQ(icache.nfds, 2);
+	famfs_inode_fd_put(dir);
+	famfs_inode_fd_put(inode);
+	famfs_inode_putref_locked(inode, 1);
+	famfs_inode_putref_locked(dir, 1);
+
+	famfs_icache_destroy(&icache);
+	for (i = 0; i < 5; i++) {
+		snprintf(name, sizeof(name), "%s/d%d", tmpdir, i);
+		rmdir(name);
+	}
+	rmdir(tmpdir);
+}
+
+/* Build ndirs directories of nfiles files, each holding one kernel ref */
+static void
+famfs_forget_test_tree(
+	struct famfs_icache *icache,
+	int ndirs,
+	int nfiles,
+	struct fuse_forget_data *forgets)
+{
+	struct famfs_inode *dir, *inode;
+	struct stat st;
+	char name[64];
+	int d, f, n = 0;
+
+	memset(&st, 0, sizeof(st));
+	for (d = 0; d < ndirs; d++) {
+		snprintf(name, sizeof(name), "dir%d", d);
+		dir = famfs_inode_alloc(icache, -1, name, 2 + d, 0, NULL, &st,
+					FAMFS_FDIR, &icache->root);
+		famfs_icache_insert_locked(icache, dir);
+		famfs_inode_putref_locked(dir, 1);
+
+		/* Dirs first: their children's refs keep them around until
+		 * the children are forgotten */
+		forgets[n].ino = (uintptr_t)dir;
+		forgets[n++].nlookup = 1;
+		for (f = 0; f < nfiles; f++) {
+			snprintf(name, sizeof(name), "file%d", f);
+			inode = famfs_inode_alloc(icache, -1, name,
+						  1000000 + d * nfiles + f, 0,
+						  NULL, &st, FAMFS_FREG, dir);
+			famfs_icache_insert_locked(icache, inode);
+			famfs_inode_putref_locked(inode, 1);
+			forgets[n].ino = (uintptr_t)inode;
+			forgets[n++].nlookup = 1;
+		}
+	}
+}
+
+TEST(famfs, famfs_icache_forget_batch_test) {
+	const int ndirs = 10, nfiles = 10000;
+	const size_t n = ndirs * (nfiles + 1);
+	struct fuse_forget_data *forgets;
+	struct famfs_pool_stats ps;
+	struct famfs_inode bogus;
+	famfs_icache icache;
+	struct timespec t0, t1;
+	double one_ns, batch_ns;
+	size_t i;
+
+	forgets = (struct fuse_forget_data *)calloc(n + 1, sizeof(*forgets));
+	ASSERT_NE(forgets, nullptr);
+
+	/* One lock round trip per entry, as forget_multi used to do */
+	famfs_icache_init(NULL, &icache, NULL);
+	famfs_forget_test_tree(&icache, ndirs, nfiles, forgets);
+	ASSERT_EQ(famfs_icache_count(&icache), n);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++)
+		famfs_icache_unref_inode(&icache,
+			(struct famfs_inode *)(uintptr_t)forgets[i].ino, 1);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	one_ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+	ASSERT_EQ(famfs_icache_count(&icache), 0);
+	famfs_icache_destroy(&icache);
+
+	/* Batched: a chunk per lock hold, with the parent cascades; an
+	 * entry that is not an inode of this icache is skipped */
+	memset(&bogus, 0, sizeof(bogus));
+	famfs_icache_init(NULL, &icache, NULL);
+	famfs_forget_test_tree(&icache, ndirs, nfiles, forgets);
+	forgets[n].ino = (uintptr_t)&bogus;
+	forgets[n].nlookup = 1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	ASSERT_EQ(famfs_icache_forget_batch(&icache, forgets, n + 1), n);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	batch_ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+	ASSERT_EQ(famfs_icache_count(&icache), 0);
+	ASSERT_EQ(icache.forget_batches, 1);
+	ASSERT_EQ(icache.forgets, n);
+	famfs_icache_destroy(&icache);
+
+	/* With a budget, forgotten inodes are retained and the LRU is
+	 * trimmed once per chunk */
+	famfs_icache_init(NULL, &icache, NULL);
+	famfs_icache_set_limits(&icache, 256 * 1024, 0);
+	famfs_forget_test_tree(&icache, ndirs, nfiles, forgets);
+	ASSERT_EQ(famfs_icache_forget_batch(&icache, forgets, n), n);
+	famfs_icache_pool_stats(&icache, &ps);
+	ASSERT_LE(ps.bytes, 256 * 1024);
+	ASSERT_GT(icache.lru_count, 0);
+	ASSERT_EQ(famfs_icache_count(&icache) + icache.evictions, n);
+	famfs_icache_destroy(&icache);
+
+	printf("forget %zu inodes: %.1f ns/entry one at a time, "
+	       "%.1f ns/entry batched\n", n, one_ns / n, batch_ns / n);
+	free(forgets);
+}
+
+TEST(famfs, famfs_negcache_test) {
+	struct famfs_inode *dir, *file;
+	famfs_icache icache;
+	struct stat st;
+	char name[32];
+	uint64_t gen;
+	int i;
+
+	famfs_icache_init(NULL, &icache, NULL);
+	memset(&st, 0, sizeof(st));
+	st.st_mode = S_IFDIR | 0755;
+	st.st_ino = 100;
+	pthread_mutex_lock(&icache.mutex);
+	dir = famfs_inode_alloc(&icache, -1, "dir", 100, 0, NULL, &st,
+				FAMFS_FDIR, &icache.root);
+	ASSERT_NE(dir, nullptr);
+	famfs_icache_insert_locked(&icache, dir);
+	st.st_mode = S_IFREG | 0644;
+	st.st_ino = 101;
+	file = famfs_inode_alloc(&icache, -1, "file", 101, 0, NULL, &st,
+				 FAMFS_FREG, dir);
+	ASSERT_NE(file, nullptr);
+	famfs_icache_insert_locked(&icache, file);
+
+	/* Misses are remembered per directory */
+	gen = famfs_icache_neg_gen(&icache);
+	ASSERT_EQ(famfs_negcache_find_locked(dir, "missing", gen), 0);
+	famfs_negcache_add_locked(dir, "missing", gen);
+	ASSERT_EQ(famfs_negcache_find_locked(dir, "missing", gen), 1);
+	ASSERT_EQ(famfs_negcache_find_locked(dir, "missing2", gen), 0);
+	ASSERT_EQ(famfs_negcache_find_locked(&icache.root, "missing", gen), 0);
+	ASSERT_EQ(icache.neg_hits, 1);
+
+	/* Only directories have a negcache */
+	famfs_negcache_add_locked(file, "missing", gen);
+	ASSERT_EQ(file->negcache, nullptr);
+
+	/* A new generation hides every entry, and an add sampled before it
+	 * is dropped */
+	famfs_icache_neg_invalidate(&icache);
+	ASSERT_EQ(famfs_negcache_find_locked(dir, "missing",
+					     famfs_icache_neg_gen(&icache)), 0);
+	famfs_negcache_add_locked(dir, "stale", gen);
+	ASSERT_EQ(famfs_negcache_find_locked(dir, "stale", gen), 0);
+
+	/* More names than slots: collisions replace, the cache stays
+	 * bounded */
+	gen = famfs_icache_neg_gen(&icache);
+	for (i = 0; i < 4 * FAMFS_NEGCACHE_SLOTS; i++) {
+		snprintf(name, sizeof(name), "name%d", i);
+		famfs_negcache_add_locked(dir, name, gen);
+		ASSERT_EQ(famfs_negcache_find_locked(dir, name, gen), 1);
+	}
+	ASSERT_LE(dir->negcache->count, FAMFS_NEGCACHE_SLOTS);
+	ASSERT_EQ(icache.neg_adds, 1 + 4 * FAMFS_NEGCACHE_SLOTS);
+	pthread_mutex_unlock(&icache.mutex);
+
+	/* The negcache goes with the directory */
+	famfs_icache_destroy(&icache);
+}
+
+TEST(famfs, famfs_logtail_negcache_test) {
+	u64 device_size = 1024 * 1024 * 256;
+	const char *shadow = "/tmp/famfs_negshadow";
+	struct famfs_superblock *sb;
+	struct famfs_locked_log ll;
+	struct famfs_log_entry le;
+	struct famfs_log_iter it;
+	struct famfs_log *logp;
+	extern int mock_kmod;
+	extern int mock_fstype;
+	struct famfs_ctx ctx;
+	famfs_icache icache;
+	struct stat st;
+	uint64_t gen;
+	int rc;
+	int fd;
+
+	mock_kmod = 1;
+	mock_fstype = FAMFS_V1;
+	rc = create_mock_famfs_instance("/tmp/famfs", device_size, &sb, &logp);
+	ASSERT_EQ(rc, 0);
+	rc = famfs_init_locked_log(&ll, "/tmp/famfs", 0, 1);
+	ASSERT_EQ(rc, 0);
+	fd = __famfs_mkfile(&ll, "/tmp/famfs/newfile", 0644, 0, 0, 1048576,
+			    0, 0);
+	ASSERT_GT(fd, 0);
+	close(fd);
+	famfs_log_iter_init(&it, logp);
+	ASSERT_EQ(famfs_log_iter_next(&it, &le), 1);
+	ASSERT_EQ(le.famfs_log_entry_type, FAMFS_LOG_FILE);
+
+	system("rm -rf /tmp/famfs_negshadow");
+	ASSERT_EQ(mkdir(shadow, 0755), 0);
+	famfs_icache_init(NULL, &icache, NULL);
+
+	/* By default nothing caches misses, even with the tailer running */
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.timeout = 86400.0;
+	ctx.logtail_active = 1;
+	ASSERT_EQ(famfs_neg_timeout(&ctx), 0.0);
+	ASSERT_EQ(famfs_negcache_enabled(&ctx), 0);
+
+	/* So a lookup of a missing name, a local create and an open of the
+	 * new name succeed without the tailer */
+	ASSERT_NE(stat("/tmp/famfs_negshadow/newfile", &st), 0);
+	rc = famfs_shadow_logplay_entry(shadow, &le, NULL, 0, 0, 0);
+	ASSERT_EQ(rc, 1);
+	fd = open("/tmp/famfs_negshadow/newfile", O_RDONLY);
+	ASSERT_GE(fd, 0);
+	close(fd);
+
+	/* Opted in, a cached miss hides a local create until the tailer
+	 * plays an entry that creates something */
+	ctx.neg_timeout = 1.0;
+	ctx.neg_timeout_set = 1;
+	ASSERT_EQ(famfs_neg_timeout(&ctx), 1.0);
+	ASSERT_EQ(famfs_negcache_enabled(&ctx), 1);
+	ctx.logtail_active = 0;
+	ASSERT_EQ(famfs_negcache_enabled(&ctx), 0);
+	gen = famfs_icache_neg_gen(&icache);
+	pthread_mutex_lock(&icache.mutex);
+	ASSERT_EQ(famfs_negcache_find_locked(&icache.root, "newfile", gen), 0);
+	famfs_negcache_add_locked(&icache.root, "newfile", gen);
+	ASSERT_EQ(famfs_negcache_find_locked(&icache.root, "newfile", gen), 1);
+	pthread_mutex_unlock(&icache.mutex);
+
+	/* An entry whose shadow file is already in place (as at mount, or
+	 * after a compaction) creates nothing and notifies nobody */
+	rc = famfs_icache_shadow_logplay_entry(&icache, shadow, &le);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(famfs_icache_neg_gen(&icache), gen);
+
+	/* An entry the tailer creates moves the generation */
+	system("rm -rf /tmp/famfs_negshadow/newfile");
+	rc = famfs_icache_shadow_logplay_entry(&icache, shadow, &le);
+	ASSERT_EQ(rc, 1);
+	gen = famfs_icache_neg_gen(&icache);
+	pthread_mutex_lock(&icache.mutex);
+	ASSERT_EQ(famfs_negcache_find_locked(&icache.root, "newfile", gen), 0);
+	pthread_mutex_unlock(&icache.mutex);
+	ASSERT_EQ(stat("/tmp/famfs_negshadow/newfile", &st), 0);
+
+	famfs_icache_destroy(&icache);
+	famfs_release_locked_log(&ll, 0, 0);
+	system("rm -rf /tmp/famfs_negshadow");
+	mock_kmod = 0;
+}
+
+TEST(famfs, famfs_bitmap_add_file) {
+	const u64 au = 0x200000;
+	struct famfs_log_file_meta fm;
+	u64 alloc_sum = 0;
+	u64 errs;
+	u8 *bitmap;
+
+	bitmap = (u8 *)calloc(1, mu_bitmap_size(64) + 1);
+	ASSERT_NE(bitmap, nullptr);
+
+	/* Two simple extents; the second is not a multiple of alloc_unit */
+	memset(&fm, 0, sizeof(fm));
+	fm.fm_fmap.fmap_ext_type = FAMFS_EXT_SIMPLE;
+	fm.fm_fmap.fmap_nextents = 2;
+	fm.fm_fmap.se[0].se_offset = 4 * au;
+	fm.fm_fmap.se[0].se_len = 2 * au;
+	fm.fm_fmap.se[1].se_offset = 10 * au;
+	fm.fm_fmap.se[1].se_len = au + 1;
+	errs = famfs_bitmap_add_file(bitmap, au, &fm, &alloc_sum);
+	ASSERT_EQ(errs, 0);
+	ASSERT_EQ(alloc_sum, 4 * au);
+	ASSERT_EQ(mu_bitmap_test(bitmap, 3), 0);
+	ASSERT_NE(mu_bitmap_test(bitmap, 4), 0);
+	ASSERT_NE(mu_bitmap_test(bitmap, 5), 0);
+	ASSERT_EQ(mu_bitmap_test(bitmap, 6), 0);
+	ASSERT_NE(mu_bitmap_test(bitmap, 11), 0);
+
+	/* Adding it again collides everywhere and allocates nothing new */
+	errs = famfs_bitmap_add_file(bitmap, au, &fm, &alloc_sum);
+	ASSERT_EQ(errs, 4);
+	ASSERT_EQ(alloc_sum, 4 * au);
+
+	/* Interleaved: one strip overlaps the simple extent above */
+	memset(&fm, 0, sizeof(fm));
+	fm.fm_fmap.fmap_ext_type = FAMFS_EXT_INTERLEAVE;
+	fm.fm_fmap.fmap_niext = 1;
+	fm.fm_fmap.ie[0].ie_nstrips = 2;
+	fm.fm_fmap.ie[0].ie_chunk_size = au;
+	fm.fm_fmap.ie[0].ie_strips[0].se_offset = 20 * au;
+	fm.fm_fmap.ie[0].ie_strips[0].se_len = au;
+	fm.fm_fmap.ie[0].ie_strips[1].se_offset = 5 * au;
+	fm.fm_fmap.ie[0].ie_strips[1].se_len = 2 * au;
+	errs = famfs_bitmap_add_file(bitmap, au, &fm, &alloc_sum);
+	ASSERT_EQ(errs, 1);
+	ASSERT_EQ(alloc_sum, 6 * au);
+	ASSERT_NE(mu_bitmap_test(bitmap, 20), 0);
+	ASSERT_NE(mu_bitmap_test(bitmap, 6), 0);
+
+	free(bitmap);
+}
+
 TEST(famfs, famfs_log_test) {
 	famfs_log(FAMFS_LOG_NOTICE, "%s:\n", __func__);
 	famfs_log(FAMFS_INVALID, "bad log level\n");
@@ -1854,7 +3089,7 @@ TEST(famfs, famfs_log_add_daxdev_entry)
 
 	/* OMF version constants bumped for the additive log entry type */
 	ASSERT_EQ(FAMFS_OMF_VER_MAJOR, 2);
-	ASSERT_EQ(FAMFS_OMF_VER_MINOR, 2);
+	ASSERT_EQ(FAMFS_OMF_VER_MINOR, 5);
 	ASSERT_EQ(FAMFS_CURRENT_VERSION, 48);
 
 	/* A minimal in-memory log - no device, fs, or root required */
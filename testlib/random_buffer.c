@@ -1,67 +1,179 @@
 /* SPDX-License-Identifier: Apache-2.0 */
 /*
- * Copyright (C) 2015-2025 Micron Technology, Inc.  All rights reserved.
+ * Copyright (C) 2015-2026 Micron Technology, Inc.  All rights reserved.
  */
 
 #include <string.h>
 #include <assert.h>
+#include <stdbool.h>
 
 #include "xrand.h"
+#include "random_buffer.h"
 
-void
-randomize_buffer(void *buf, size_t len, unsigned int seed)
+/*
+ * Random buffer layout
+ *
+ * The logical stream for a seed is divided into RB_BLOCK_SIZE blocks. Each
+ * block is seeded independently from (seed, block number), so any block can
+ * be generated or validated without generating the blocks before it. Within
+ * a block, RB_LANES independent xoroshiro128+ generators are stepped in
+ * lock-step; each round yields one 64-bit word per lane, and the lane words
+ * are laid out consecutively (RB_ROUND_BYTES per round). The lane state is
+ * kept as two plain arrays so the compiler can vectorize the round.
+ */
+#define RB_LANES       8
+#define RB_ROUND_BYTES (RB_LANES * sizeof(uint64_t))
+
+struct rb_lanes {
+	uint64_t s0[RB_LANES];
+	uint64_t s1[RB_LANES];
+};
+
+static inline uint64_t
+rb_splitmix64(uint64_t *x)
 {
-	uint8_t *p = buf;
-	uint64_t remain = len;
-	uint32_t val;
-	struct xrand xr;
+	uint64_t z = (*x += UINT64_C(0x9E3779B97F4A7C15));
 
-	if (len == 0)
-		return;
+	z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+	return z ^ (z >> 31);
+}
 
-	xrand_init(&xr, seed);
+static void
+rb_lanes_init(struct rb_lanes *rl, uint64_t seed, uint64_t blkno)
+{
+	uint64_t x = seed ^ (blkno * UINT64_C(0xD1B54A32D192ED03));
+	int i;
 
-	while (remain >= sizeof(val)) {
-		val = xrand64(&xr);
-		memcpy(p, &val, sizeof(val));
-		p += sizeof(val);
-		remain -= sizeof(val);
+	for (i = 0; i < RB_LANES; i++) {
+		rl->s0[i] = rb_splitmix64(&x);
+		rl->s1[i] = rb_splitmix64(&x);
 	}
+}
+
+static inline void
+rb_lanes_next(struct rb_lanes *rl, uint64_t out[RB_LANES])
+{
+	int i;
+
+	for (i = 0; i < RB_LANES; i++) {
+		uint64_t s0 = rl->s0[i];
+		uint64_t s1 = rl->s1[i];
 
-	if (remain > 0) {
-		val = xrand64(&xr);
-		memcpy(p, &val, remain);
+		out[i] = s0 + s1;
+		s1 ^= s0;
+		rl->s0[i] = xoroshiro_rotl(s0, 55) ^ s1 ^ (s1 << 14);
+		rl->s1[i] = xoroshiro_rotl(s1, 36);
 	}
 }
 
-int64_t
-validate_random_buffer(void *buf, size_t len, unsigned int seed)
+/*
+ * rb_process_range()
+ *
+ * Generate (validate == false) or check (validate == true) the bytes of the
+ * stream for @seed in [offset, offset + len), which live at @buf.
+ *
+ * Returns -1 on success, or the stream offset of the first miscompare.
+ */
+static int64_t
+rb_process_range(
+	uint8_t *buf,
+	size_t len,
+	uint64_t offset,
+	uint64_t seed,
+	bool validate)
 {
-	uint8_t *p = buf;
-	uint64_t remain = len;
-	uint32_t val;
-	struct xrand xr;
-	int64_t offset = 0;
-
-	if (len == 0)
-		return -1;
-
-	xrand_init(&xr, seed);
-
-	while (remain >= sizeof(val)) {
-		val = xrand64(&xr);
-		if (memcmp(p, &val, sizeof(val)) != 0)
-			return offset;
-		p += sizeof(val);
-		remain -= sizeof(val);
-		offset += sizeof(val);
-	}
+	uint64_t out[RB_LANES];
+	struct rb_lanes rl;
+	size_t done = 0;
+
+	while (done < len) {
+		uint64_t pos = offset + done;
+		uint64_t blkno = pos / RB_BLOCK_SIZE;
+		size_t in_blk = pos % RB_BLOCK_SIZE;
+		size_t blk_remain = RB_BLOCK_SIZE - in_blk;
+		size_t skip;
+
+		if (blk_remain > len - done)
+			blk_remain = len - done;
+
+		rb_lanes_init(&rl, seed, blkno);
+
+		/* Fast-forward to the round containing pos */
+		for (skip = in_blk / RB_ROUND_BYTES; skip > 0; skip--)
+			rb_lanes_next(&rl, out);
+
+		while (blk_remain > 0) {
+			size_t start = in_blk % RB_ROUND_BYTES;
+			size_t n = RB_ROUND_BYTES - start;
+			uint8_t *p = buf + done;
+
+			if (n > blk_remain)
+				n = blk_remain;
 
-	if (remain > 0) {
-		val = xrand64(&xr);
-		if (memcmp(p, &val, remain) != 0)
-			return offset;
+			rb_lanes_next(&rl, out);
+
+			if (!validate) {
+				memcpy(p, (uint8_t *)out + start, n);
+			} else if (n == RB_ROUND_BYTES) {
+				uint64_t w[RB_LANES];
+				uint64_t diff = 0;
+				int i;
+
+				memcpy(w, p, sizeof(w));
+				for (i = 0; i < RB_LANES; i++)
+					diff |= w[i] ^ out[i];
+				if (diff)
+					goto miscompare;
+			} else if (memcmp(p, (uint8_t *)out + start, n)) {
+				goto miscompare;
+			}
+
+			done += n;
+			in_blk += n;
+			blk_remain -= n;
+			continue;
+
+miscompare:
+			{
+				const uint8_t *exp = (uint8_t *)out + start;
+				size_t i;
+
+				for (i = 0; i < n; i++)
+					if (p[i] != exp[i])
+						break;
+				return (int64_t)(offset + done + i);
+			}
+		}
 	}
 
 	return -1;
 }
+
+void
+randomize_buffer_range(void *buf, size_t len, uint64_t offset, uint64_t seed)
+{
+	rb_process_range(buf, len, offset, seed, false);
+}
+
+int64_t
+validate_random_buffer_range(
+	void *buf,
+	size_t len,
+	uint64_t offset,
+	uint64_t seed)
+{
+	return rb_process_range(buf, len, offset, seed, true);
+}
+
+void
+randomize_buffer(void *buf, size_t len, unsigned int seed)
+{
+	randomize_buffer_range(buf, len, 0, seed);
+}
+
+int64_t
+validate_random_buffer(void *buf, size_t len, unsigned int seed)
+{
+	return validate_random_buffer_range(buf, len, 0, seed);
+}
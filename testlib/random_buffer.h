@@ -6,6 +6,16 @@
 #ifndef HSE_CORE_HSE_TEST_RANDOM_BUFFER_H
 #define HSE_CORE_HSE_TEST_RANDOM_BUFFER_H
 
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* The random stream for a seed is generated in independently seeded blocks
+ * of this size, so any subrange can be generated or validated on its own
+ * (e.g. by parallel threads working on different parts of one file).
+ */
+#define RB_BLOCK_SIZE (64 * 1024)
+
 /* randomize_buffer
  *
  * Write pseudo-random data to a buffer, based on a specified seed
@@ -19,9 +29,28 @@ randomize_buffer(void *buf, size_t len, unsigned int seed);
  * Take advantage of the fact that starting with the same seed will generate
  * the same pseudo-random data, for an easy way to validate a buffer
  */
-int
+int64_t
 validate_random_buffer(void *buf, size_t len, unsigned int seed);
 
+/* randomize_buffer_range
+ *
+ * Write bytes [offset, offset + len) of the pseudo-random stream for seed
+ * to buf. randomize_buffer(buf, len, seed) is equivalent to
+ * randomize_buffer_range(buf, len, 0, seed).
+ */
+void
+randomize_buffer_range(void *buf, size_t len, uint64_t offset, uint64_t seed);
+
+/* validate_random_buffer_range
+ *
+ * Validate that buf holds bytes [offset, offset + len) of the pseudo-random
+ * stream for seed. Returns -1 if the buffer matches, or the stream offset
+ * (not the offset within buf) of the first miscompare.
+ */
+int64_t
+validate_random_buffer_range(void *buf, size_t len, uint64_t offset,
+			     uint64_t seed);
+
 /* generate_random_u_int32_t
  *
  * Create and return a random u_int32_t between min and max inclusive with